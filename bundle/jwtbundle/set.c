@@ -185,6 +185,19 @@ jwtbundle_Bundle *jwtbundle_Set_GetJWTBundleForTrustDomain(
     return bundle;
 }
 
+jwtbundle_Bundle *jwtbundle_Set_LookupJWTBundleForTrustDomain(
+    jwtbundle_Set *s, const spiffeid_TrustDomain td, err_t *err)
+{
+    const ptrdiff_t idx = util_shgeti_ts(s->bundles, td.name);
+    if(idx < 0) {
+        // trust domain not available
+        *err = ERR_TRUSTDOMAIN_NOTAVAILABLE;
+        return NULL;
+    }
+    *err = NO_ERROR;
+    return s->bundles[idx].value;
+}
+
 jwtbundle_Set *jwtbundle_Set_Clone(jwtbundle_Set *set)
 {
     jwtbundle_Set *ret = jwtbundle_NewSet(0);
@@ -198,6 +211,18 @@ jwtbundle_Set *jwtbundle_Set_Clone(jwtbundle_Set *set)
     return ret;
 }
 
+jwtbundle_Set *jwtbundle_Set_Take(jwtbundle_Set *set)
+{
+    jwtbundle_Set *ret = malloc(sizeof *ret);
+    mtx_init(&(ret->mtx), mtx_plain);
+    mtx_lock(&(set->mtx));
+    ret->bundles = set->bundles;
+    set->bundles = NULL;
+    sh_new_strdup(set->bundles);
+    mtx_unlock(&(set->mtx));
+    return ret;
+}
+
 void jwtbundle_Set_Free(jwtbundle_Set *s)
 {
     if(s) {
@@ -36,11 +36,33 @@ jwtbundle_Bundle *jwtbundle_Source_GetJWTBundleForTrustDomain(
     } else if(s->type == JWTBUNDLE_WORKLOADAPI_JWTSOURCE) {
         return workloadapi_JWTSource_GetJWTBundleForTrustDomain(
             s->source.source, td, err);
+    } else if(s->type == JWTBUNDLE_FROZEN_SET) {
+        return jwtbundle_Set_LookupJWTBundleForTrustDomain(s->source.set, td,
+                                                           err);
     }
 
     return NULL;
 }
 
+jwtbundle_Source *jwtbundle_Source_Pin(jwtbundle_Source *s,
+                                       jwtbundle_Source *pinned,
+                                       workloadapi_JWTSnapshot **snapshot)
+{
+    *snapshot = NULL;
+    if(s && s->type == JWTBUNDLE_WORKLOADAPI_JWTSOURCE) {
+        err_t err;
+        *snapshot
+            = workloadapi_JWTSource_AcquireSnapshot(s->source.source, &err);
+        if(*snapshot) {
+            pinned->type = JWTBUNDLE_FROZEN_SET;
+            pinned->source.set = (*snapshot)->bundles;
+            return pinned;
+        }
+    }
+
+    return s;
+}
+
 jwtbundle_Source *jwtbundle_SourceFromBundle(jwtbundle_Bundle *b)
 {
     if(b) {
@@ -88,7 +110,8 @@ void jwtbundle_Source_Free(jwtbundle_Source *s)
     if(s) {
         if(s->type == JWTBUNDLE_BUNDLE) {
             jwtbundle_Bundle_Free(s->source.bundle);
-        } else if(s->type == JWTBUNDLE_SET) {
+        } else if(s->type == JWTBUNDLE_SET
+                  || s->type == JWTBUNDLE_FROZEN_SET) {
             jwtbundle_Set_Free(s->source.set);
         } else if(s->type == JWTBUNDLE_WORKLOADAPI_JWTSOURCE) {
             workloadapi_JWTSource_Free(s->source.source);
@@ -66,6 +66,32 @@ START_TEST(test_jwtbundle_NewSet)
 }
 END_TEST
 
+START_TEST(test_jwtbundle_Set_Take)
+{
+    spiffeid_TrustDomain td = { "example1.com" };
+
+    err_t err;
+    jwtbundle_Bundle *bundle
+        = jwtbundle_Load(td, "./resources/jwk_keys.json", &err);
+    ck_assert_uint_eq(err, NO_ERROR);
+
+    jwtbundle_Set *set = jwtbundle_NewSet(1, bundle);
+    jwtbundle_Set *taken = jwtbundle_Set_Take(set);
+
+    // same bundle object, no copy
+    bool suc;
+    ck_assert_ptr_eq(jwtbundle_Set_Get(taken, td, &suc), bundle);
+    ck_assert(suc);
+    ck_assert_uint_eq(jwtbundle_Set_Len(set), 0);
+
+    // the emptied set is still usable
+    ck_assert(!jwtbundle_Set_Has(set, td));
+
+    jwtbundle_Set_Free(set);
+    jwtbundle_Set_Free(taken);
+}
+END_TEST
+
 // precondition: valid empty jwt set object
 // postcondition: valid jwt bundle set with after
 // each function call
@@ -319,6 +345,38 @@ START_TEST(test_jwtbundle_Set_GetJWTBundleForTrustDomain)
 }
 END_TEST
 
+// precondition: valid jwt set object, no longer modified
+// postcondition: same bundles as the locking lookup, errors included
+START_TEST(test_jwtbundle_Set_LookupJWTBundleForTrustDomain)
+{
+    spiffeid_TrustDomain td[] = { { "example1.com" }, { "example2.com" } };
+
+    err_t err;
+    jwtbundle_Bundle *bundle_ptr[2];
+    for(int i = 0; i < 2; ++i) {
+        bundle_ptr[i]
+            = jwtbundle_Load(td[i], "./resources/jwk_keys.json", &err);
+        ck_assert_uint_eq(err, NO_ERROR);
+    }
+    jwtbundle_Set *set = jwtbundle_NewSet(2, bundle_ptr[0], bundle_ptr[1]);
+
+    for(int i = 0; i < 2; ++i) {
+        jwtbundle_Bundle *b
+            = jwtbundle_Set_LookupJWTBundleForTrustDomain(set, td[i], &err);
+        ck_assert_uint_eq(err, NO_ERROR);
+        ck_assert_ptr_eq(b, bundle_ptr[i]);
+    }
+
+    spiffeid_TrustDomain newtd = { "example4.com" };
+    jwtbundle_Bundle *b
+        = jwtbundle_Set_LookupJWTBundleForTrustDomain(set, newtd, &err);
+    ck_assert_uint_eq(err, ERR_TRUSTDOMAIN_NOTAVAILABLE);
+    ck_assert_ptr_eq(b, NULL);
+
+    jwtbundle_Set_Free(set);
+}
+END_TEST
+
 START_TEST(test_jwtbundle_Set_Print)
 {
     const int ITERS = 4;
@@ -400,6 +458,7 @@ Suite *set_suite(void)
     TCase *tc_core = tcase_create("core");
 
     tcase_add_test(tc_core, test_jwtbundle_NewSet);
+    tcase_add_test(tc_core, test_jwtbundle_Set_Take);
     tcase_add_test(tc_core, test_jwtbundle_Set_Add);
     tcase_add_test(tc_core, test_jwtbundle_Set_Remove);
     tcase_add_test(tc_core, test_jwtbundle_Set_Has);
@@ -407,6 +466,8 @@ Suite *set_suite(void)
     tcase_add_test(tc_core, test_jwtbundle_Set_Bundles);
     tcase_add_test(tc_core, test_jwtbundle_Set_Len);
     tcase_add_test(tc_core, test_jwtbundle_Set_GetJWTBundleForTrustDomain);
+    tcase_add_test(tc_core,
+                   test_jwtbundle_Set_LookupJWTBundleForTrustDomain);
     tcase_add_test(tc_core, test_jwtbundle_Set_Print);
     tcase_add_test(tc_core, test_jwtbundle_Set_Print_Errors);
 
@@ -57,6 +57,16 @@ void jwtbundle_Set_Remove(jwtbundle_Set *s, const spiffeid_TrustDomain td);
  */
 jwtbundle_Set *jwtbundle_Set_Clone(jwtbundle_Set *set);
 
+/**
+ * Moves the bundles of a set into a new set, without copying them. The
+ * given set is left empty.
+ *
+ * \param set [in] JWT Bundle Set object pointer.
+ * \returns a set with the bundles of the given one. Must be freed using
+ * jwtbundle_Set_Free function.
+ */
+jwtbundle_Set *jwtbundle_Set_Take(jwtbundle_Set *set);
+
 /**
  * Checks if a bundle belongs to the set.
  *
@@ -142,6 +152,20 @@ err_t jwtbundle_Set_Print(jwtbundle_Set *set);
 jwtbundle_Bundle *jwtbundle_Set_GetJWTBundleForTrustDomain(
     jwtbundle_Set *s, const spiffeid_TrustDomain td, err_t *err);
 
+/**
+ * Gets bundle for a given Trust Domain object, without locking. Only for
+ * sets no longer modified, such as the published snapshot of a source,
+ * where any number of threads may look up at once.
+ *
+ * \param set [in] Set of JWT bundles object pointer, not modified.
+ * \param td [in] Trust Domain object.
+ * \param err [out] Variable to get information in the event of error.
+ * \returns The bundle for the given Trust Domain if it exists,
+ * <tt>NULL</tt> otherwise.
+ */
+jwtbundle_Bundle *jwtbundle_Set_LookupJWTBundleForTrustDomain(
+    jwtbundle_Set *s, const spiffeid_TrustDomain td, err_t *err);
+
 /**
  * Frees a set of JWT bundles object.
  *
@@ -14,7 +14,9 @@ typedef struct {
     enum jwtbundle_Source_Cardinality {
         JWTBUNDLE_BUNDLE,
         JWTBUNDLE_SET,
-        JWTBUNDLE_WORKLOADAPI_JWTSOURCE
+        JWTBUNDLE_WORKLOADAPI_JWTSOURCE,
+        /** set no longer modified, looked up without locking */
+        JWTBUNDLE_FROZEN_SET
     } type;
     union {
         jwtbundle_Bundle *bundle;
@@ -35,6 +37,22 @@ typedef struct {
 jwtbundle_Bundle *jwtbundle_Source_GetJWTBundleForTrustDomain(
     jwtbundle_Source *s, const spiffeid_TrustDomain td, err_t *err);
 
+/**
+ * Pins the bundles of a source for the length of a verification. A
+ * workload API JWT source may free the bundles it lends on its second
+ * update after the lookup, so its current snapshot is held instead and
+ * looked up as a frozen set. Other sources are used as they are.
+ *
+ * \param s [in] Source of JWT bundles object pointer.
+ * \param pinned [out] Storage for the pinned source, if one is needed.
+ * \param snapshot [out] Snapshot to release with
+ * workloadapi_JWTSnapshot_Release once done, NULL if none was taken.
+ * \returns The source to look bundles up in, pinned or s.
+ */
+jwtbundle_Source *jwtbundle_Source_Pin(jwtbundle_Source *s,
+                                       jwtbundle_Source *pinned,
+                                       workloadapi_JWTSnapshot **snapshot);
+
 /**
  * Creates a source of JWT bundles from a JWT bundle. Takes ownership of
  * the object, so it will be freed when the source is freed.
@@ -5,6 +5,7 @@
 #include "c-spiffe/internal/x509util/certpool.h"
 #include "c-spiffe/spiffetls/tlsconfig/authorizer.h"
 #include "c-spiffe/svid/x509svid/source.h"
+#include "c-spiffe/workload/sourceregistry.h"
 #include "c-spiffe/workload/x509source.h"
 
 #ifdef __cplusplus
@@ -31,6 +32,9 @@ typedef struct {
     tlsconfig_Authorizer *authorizer;
 
     workloadapi_X509Source *source;
+    /** source taken from workloadapi_AcquireX509Source, released instead of
+     * freed */
+    bool shared_source;
 
     x509bundle_Source *bundle;
     x509svid_Source *svid;
@@ -46,6 +50,9 @@ typedef struct {
     tlsconfig_Authorizer *authorizer;
 
     workloadapi_X509Source *source;
+    /** source taken from workloadapi_AcquireX509Source, released instead of
+     * freed */
+    bool shared_source;
 
     x509bundle_Source *bundle;
     x509svid_Source *svid;
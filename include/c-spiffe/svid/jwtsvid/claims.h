@@ -0,0 +1,43 @@
+#ifndef INCLUDE_SVID_JWTSVID_CLAIMS_H
+#define INCLUDE_SVID_JWTSVID_CLAIMS_H
+
+#include "c-spiffe/svid/jwtsvid/svid.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** deepest nesting of values scanned, as jansson */
+#define JWTSVID_SCAN_MAX_DEPTH 2048
+
+/**
+ * Scans a decoded JOSE header for its alg, kid and typ fields, without
+ * building a JSON tree. Strings are unescaped and null terminated in place,
+ * so the text is altered and the fields point into it.
+ *
+ * \param json [in, out] Header JSON text.
+ * \param len [in] Length of the text.
+ * \param header [out] Header fields.
+ * \returns ERR_PARSING if the text is not a JSON object, NO_ERROR
+ * otherwise.
+ */
+err_t jwtsvid_ScanHeader(char *json, size_t len, jwtsvid_Header *header);
+
+/**
+ * Scans a decoded token payload for the registered claims, in place as
+ * jwtsvid_ScanHeader. Other claims are checked to be valid JSON and skipped.
+ *
+ * \param json [in, out] Payload JSON text.
+ * \param len [in] Length of the text.
+ * \param claims [out] Registered claims. Its audience array must be freed
+ * using arrfree, also on error.
+ * \returns ERR_PARSING if the text is not a JSON object, NO_ERROR
+ * otherwise.
+ */
+err_t jwtsvid_ScanClaims(char *json, size_t len, jwtsvid_Claims *claims);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // INCLUDE_SVID_JWTSVID_CLAIMS_H
@@ -3,19 +3,26 @@
 
 #include "c-spiffe/bundle/jwtbundle/source.h"
 #include "c-spiffe/svid/jwtsvid/svid.h"
+#include "c-spiffe/svid/jwtsvid/tokencache.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-/** Validates the token and returns the claims. */
+/** longest signature verified, in bytes, that of an 8192 bit RSA key */
+#define JWTSVID_MAX_SIGNATURE 1024
+
+/** Validates the token. Returns the claims map, which the JWT-SVID takes,
+ * or NULL to leave it to jwtsvid_SVID_GetClaims. */
 typedef map_string_claim *(*token_validator_t)(jwtsvid_JWT *,
                                                spiffeid_TrustDomain, void *,
                                                err_t *);
 
 /**
  * Parses and validates a JWT-SVID token and returns the JWT-SVID. The
- * JWT-SVID signature is verified using the JWT bundle source.
+ * JWT-SVID signature is verified using the JWT bundle source. If the source
+ * has no bundle for the trust domain of the token, err is ERR_NOT_FOUND; if
+ * the bundle has no key with the token key ID, err is ERR_NOAUTHORITY.
  *
  * \param token [in] string JWT token.
  * \param bundles [in] Source of bundles.
@@ -24,9 +31,46 @@ typedef map_string_claim *(*token_validator_t)(jwtsvid_JWT *,
  * \returns Parsed JWT-SVID object pointer. Must be freed using
  * jwtsvid_SVID_Free function.
  */
-jwtsvid_SVID *jwtsvid_ParseAndValidate(char *token, jwtbundle_Source *bundles,
+jwtsvid_SVID *jwtsvid_ParseAndValidate(const char *token,
+                                       jwtbundle_Source *bundles,
                                        string_arr_t audience, err_t *err);
 
+/**
+ * Same as jwtsvid_ParseAndValidate, for a token that is not null
+ * terminated, such as a slice of a request buffer. The token is only read.
+ *
+ * \param token [in] JWT token bytes.
+ * \param len [in] Length of the token.
+ * \param bundles [in] Source of bundles.
+ * \param audience [in] stb array of audiences.
+ * \param err [out] Variable to get information in the event of error.
+ * \returns Parsed JWT-SVID object pointer. Must be freed using
+ * jwtsvid_SVID_Free function.
+ */
+jwtsvid_SVID *jwtsvid_ParseAndValidateView(const char *token, size_t len,
+                                           jwtbundle_Source *bundles,
+                                           string_arr_t audience, err_t *err);
+
+/**
+ * Same as jwtsvid_ParseAndValidate, but serves tokens validated before for
+ * the same audience set from the cache. The time claims of a cached token
+ * are checked on every call, and it is verified again once the bundle no
+ * longer has the key that signed it.
+ *
+ * \param cache [in] Token cache. NULL to always verify.
+ * \param token [in] string JWT token.
+ * \param bundles [in] Source of bundles.
+ * \param audience [in] stb array of audiences.
+ * \param err [out] Variable to get information in the event of error.
+ * \returns Parsed JWT-SVID object pointer. Must be freed using
+ * jwtsvid_SVID_Free function.
+ */
+jwtsvid_SVID *jwtsvid_ParseAndValidateCached(jwtsvid_TokenCache *cache,
+                                             const char *token,
+                                             jwtbundle_Source *bundles,
+                                             string_arr_t audience,
+                                             err_t *err);
+
 /**
  * Parses and validates a JWT-SVID token and returns the JWT-SVID. The
  * JWT-SVID signature is not verified.
@@ -37,7 +81,7 @@ jwtsvid_SVID *jwtsvid_ParseAndValidate(char *token, jwtbundle_Source *bundles,
  * \returns Parsed JWT-SVID object pointer. Must be freed using
  * jwtsvid_SVID_Free function.
  */
-jwtsvid_SVID *jwtsvid_ParseInsecure(char *token, string_arr_t audience,
+jwtsvid_SVID *jwtsvid_ParseInsecure(const char *token, string_arr_t audience,
                                     err_t *err);
 
 /**
@@ -52,10 +96,47 @@ jwtsvid_SVID *jwtsvid_ParseInsecure(char *token, string_arr_t audience,
  * \returns Parsed JWT-SVID object pointer. Must be freed using
  * jwtsvid_SVID_Free function.
  */
-jwtsvid_SVID *jwtsvid_parse(char *token, string_arr_t audience,
+jwtsvid_SVID *jwtsvid_parse(const char *token, string_arr_t audience,
                             token_validator_t validator, void *arg,
                             err_t *err);
 
+/**
+ * Same as jwtsvid_parse, for a token that is not null terminated. The
+ * token is split in a single scan and never written, so it may be shared
+ * between threads.
+ *
+ * \param token [in] JWT token bytes.
+ * \param len [in] Length of the token.
+ * \param audience [in] stb array of audiences.
+ * \param validator [in] Validator function.
+ * \param arg [in] argument to pass to the validator.
+ * \param err [out] Variable to get information in the event of error.
+ * \returns Parsed JWT-SVID object pointer. Must be freed using
+ * jwtsvid_SVID_Free function.
+ */
+jwtsvid_SVID *jwtsvid_parseView(const char *token, size_t len,
+                                string_arr_t audience,
+                                token_validator_t validator, void *arg,
+                                err_t *err);
+
+/**
+ * Converts a JSON object, such as a token payload, to a claims map.
+ *
+ * \param obj [in] JSON object.
+ * \returns Claims map with the members of the object, borrowed, or NULL if
+ * it is not an object. Must be freed using shfree.
+ */
+map_string_claim *jwtsvid_ClaimsFromJSON(json_t *obj);
+
+/**
+ * Gets the key ID of a token from its header.
+ *
+ * \param jwt [in] JWT object.
+ * \returns Key ID, borrowed from the header, or NULL if it is empty or the
+ * token type is neither JWT nor JOSE.
+ */
+const char *jwtsvid_JWT_KeyID(jwtsvid_JWT *jwt);
+
 #ifdef __cplusplus
 }
 #endif
@@ -15,18 +15,45 @@ typedef struct map_string_claim {
     json_t *value;
 } map_string_claim;
 
-/** JWT object */
+/** JOSE header fields of a token. NULL if absent or not a string */
 typedef struct {
-    /** header in json internal format */
-    json_t *header;
-    /** payload in json internal format */
-    json_t *payload;
-    /** header in stb string Base64URL encoding */
-    string_t header_str;
-    /** payload in stb string Base64URL encoding */
-    string_t payload_str;
-    /** signature in stb string Base64URL encoding */
-    string_t signature;
+    const char *alg;
+    const char *kid;
+    const char *typ;
+} jwtsvid_Header;
+
+/** registered claims of a token. Strings are NULL if absent or not a
+ * string, times are 0 if absent and -1 if not an integer */
+typedef struct {
+    const char *issuer;
+    const char *subject;
+    /** stb array of the 'aud' claim, a single string or an array */
+    const char **audience;
+    time_t expiry;
+    time_t not_before;
+    time_t issued_at;
+    const char *id;
+} jwtsvid_Claims;
+
+/** JWT object. The encoded parts are views of the token it was parsed
+ * from, not null terminated, and valid as long as the token is. The
+ * header fields and claims point into decoded. */
+typedef struct {
+    jwtsvid_Header header;
+    jwtsvid_Claims claims;
+    /** decoded header and payload, each null terminated */
+    char *decoded;
+    /** header in Base64URL encoding. The dot and the payload follow it, so
+     * the signed message is the header_len + 1 + payload_len bytes from
+     * here */
+    const char *header_str;
+    size_t header_len;
+    /** payload in Base64URL encoding */
+    const char *payload_str;
+    size_t payload_len;
+    /** signature in Base64URL encoding */
+    const char *signature;
+    size_t signature_len;
 } jwtsvid_JWT;
 
 /** JWT parameters */
@@ -36,6 +63,16 @@ typedef struct jwtsvid_Params {
     spiffeid_ID subject;
 } jwtsvid_Params;
 
+/** states of the claims map of a JWT-SVID */
+enum {
+    /** not built yet */
+    JWTSVID_CLAIMS_PENDING,
+    /** being built by a caller of jwtsvid_SVID_GetClaims */
+    JWTSVID_CLAIMS_BUILDING,
+    /** final, NULL if the payload is not a JSON object */
+    JWTSVID_CLAIMS_BUILT
+};
+
 /** JWT-SVID object */
 typedef struct jwtsvid_SVID {
     /** The SPIFFE ID of the JWT-SVID as present in the 'sub' claim */
@@ -45,8 +82,11 @@ typedef struct jwtsvid_SVID {
     string_arr_t audience;
     /** The expiration time of JWT-SVID as present in 'exp' claim */
     time_t expiry;
-    /** The parsed claims from token */
+    /** The parsed claims from token. NULL until requested with
+     * jwtsvid_SVID_GetClaims, unless the validator provided them */
     map_string_claim *claims;
+    /** one of the JWTSVID_CLAIMS_ states, claims is only read once built */
+    UTIL_ATOMIC(int) claims_state;
     /** Serialized JWT token */
     string_t token;
 } jwtsvid_SVID;
@@ -60,6 +100,18 @@ typedef struct jwtsvid_SVID {
  */
 const char *jwtsvid_SVID_Marshal(jwtsvid_SVID *svid);
 
+/**
+ * Gets the claims of a JWT-SVID, parsing them from the token payload on the
+ * first call. Parsing only looks at the registered claims, so the map is
+ * built when a caller needs the private ones. Safe to call concurrently
+ * for the same object: one caller builds the map, the others wait for it.
+ *
+ * \param svid [in] JWT-SVID object pointer.
+ * \returns Claims map, owned by the JWT-SVID, or NULL if the payload is
+ * not a JSON object.
+ */
+map_string_claim *jwtsvid_SVID_GetClaims(jwtsvid_SVID *svid);
+
 /**
  * Frees a JWT-SVID object.
  *
@@ -67,6 +119,27 @@ const char *jwtsvid_SVID_Marshal(jwtsvid_SVID *svid);
  */
 void jwtsvid_SVID_Free(jwtsvid_SVID *svid);
 
+/**
+ * Creates a copy of a JWT-SVID object. Claims are shared with the original
+ * by reference counting.
+ *
+ * \param svid [in] JWT-SVID object pointer.
+ * \returns Copy of the JWT-SVID object. Must be freed using
+ * jwtsvid_SVID_Free function.
+ */
+jwtsvid_SVID *jwtsvid_SVID_Clone(const jwtsvid_SVID *svid);
+
+/**
+ * Builds a key identifying the JWT-SVID requested by params: the subject
+ * followed by the sorted, deduplicated audiences. Extra audiences are only
+ * considered along with the audience, as the Workload API client does.
+ *
+ * \param params [in] JWT parameters.
+ * \returns stb string key. Must be freed using util_string_t_Free or
+ * arrfree functions.
+ */
+string_t jwtsvid_Params_Key(const jwtsvid_Params *params);
+
 #ifdef __cplusplus
 }
 #endif
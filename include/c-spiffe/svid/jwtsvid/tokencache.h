@@ -0,0 +1,126 @@
+#ifndef INCLUDE_SVID_JWTSVID_TOKENCACHE_H
+#define INCLUDE_SVID_JWTSVID_TOKENCACHE_H
+
+#include "c-spiffe/svid/jwtsvid/svid.h"
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+#include <threads.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** number of independently locked parts of a token cache */
+#define JWTSVID_TOKENCACHE_SHARDS 16
+
+/** entries kept by a token cache created with no limit */
+#define JWTSVID_TOKENCACHE_DEFAULT_ENTRIES 4096
+
+/** longest token cached, longer ones are verified every time */
+#define JWTSVID_TOKENCACHE_MAX_TOKEN 8192
+
+/** SHA-256 of a token and the audience set it was validated for */
+typedef struct {
+    unsigned char bytes[SHA256_DIGEST_LENGTH];
+} jwtsvid_TokenDigest;
+
+/** validated token, linked in the recency list of its shard */
+typedef struct jwtsvid_TokenCacheEntry {
+    jwtsvid_TokenDigest digest;
+    jwtsvid_SVID *svid;
+    /** key that verified the signature, referenced, and its ID. A hit is
+     * only served while the bundle still has that key for the ID */
+    EVP_PKEY *pkey;
+    string_t kid;
+    /** time claims, checked again on every hit. 0 if absent */
+    time_t not_before;
+    time_t issued_at;
+    struct jwtsvid_TokenCacheEntry *prev;
+    struct jwtsvid_TokenCacheEntry *next;
+} jwtsvid_TokenCacheEntry;
+
+typedef struct {
+    jwtsvid_TokenDigest key;
+    jwtsvid_TokenCacheEntry *value;
+} map_TokenDigest_TokenCacheEntry;
+
+/** token cache counters */
+typedef struct {
+    /** tokens served from the cache */
+    unsigned long hits;
+    /** tokens that had to be verified */
+    unsigned long misses;
+    /** entries dropped for room */
+    unsigned long evictions;
+    /** entries dropped because their key left the bundle */
+    unsigned long invalidations;
+} jwtsvid_TokenCacheStats;
+
+typedef struct {
+    map_TokenDigest_TokenCacheEntry *entries;
+    /** most recently used first */
+    jwtsvid_TokenCacheEntry *head;
+    jwtsvid_TokenCacheEntry *tail;
+    size_t capacity;
+    jwtsvid_TokenCacheStats stats;
+    mtx_t mtx;
+} jwtsvid_TokenCacheShard;
+
+/** jwtsvid_TokenCache keeps the JWT-SVIDs of recently validated tokens, so
+ * validating a token again costs a hash lookup instead of a signature
+ * check. It is split in shards picked by digest, each with its own lock
+ * and least recently used list, so concurrent validations rarely contend.
+ * */
+typedef struct {
+    jwtsvid_TokenCacheShard shards[JWTSVID_TOKENCACHE_SHARDS];
+} jwtsvid_TokenCache;
+
+/**
+ * Creates a token cache.
+ *
+ * \param max_entries [in] Most tokens kept, spread across the shards. 0 for
+ * JWTSVID_TOKENCACHE_DEFAULT_ENTRIES.
+ * \returns Token cache. Must be freed using jwtsvid_TokenCache_Free.
+ */
+jwtsvid_TokenCache *jwtsvid_NewTokenCache(size_t max_entries);
+
+/** frees the cache and its entries. NULL safe. */
+void jwtsvid_TokenCache_Free(jwtsvid_TokenCache *cache);
+
+/** returns the counters of the cache, summed over its shards. */
+jwtsvid_TokenCacheStats jwtsvid_TokenCache_GetStats(jwtsvid_TokenCache *cache);
+
+/** digest keying a token validated for an audience set. The order and
+ * repetitions of the audiences do not matter. */
+jwtsvid_TokenDigest jwtsvid_TokenCache_Digest(const char *token,
+                                              string_arr_t audience);
+
+/** shard holding a digest. Lock its mtx around the shard functions. */
+jwtsvid_TokenCacheShard *
+jwtsvid_TokenCache_GetShard(jwtsvid_TokenCache *cache,
+                            const jwtsvid_TokenDigest *digest);
+
+/** looks up a digest, marking its entry as the most recently used. NULL if
+ * absent. */
+jwtsvid_TokenCacheEntry *
+jwtsvid_TokenCacheShard_Get(jwtsvid_TokenCacheShard *shard,
+                            const jwtsvid_TokenDigest *digest);
+
+/** adds an entry, which the shard then owns, evicting the least recently
+ * used one if full. Frees the entry instead if the digest is there
+ * already. */
+void jwtsvid_TokenCacheShard_Put(jwtsvid_TokenCacheShard *shard,
+                                 jwtsvid_TokenCacheEntry *entry);
+
+/** removes and frees an entry. */
+void jwtsvid_TokenCacheShard_Remove(jwtsvid_TokenCacheShard *shard,
+                                    jwtsvid_TokenCacheEntry *entry);
+
+/** frees an entry that is not in a shard. NULL safe. */
+void jwtsvid_TokenCacheEntry_Free(jwtsvid_TokenCacheEntry *entry);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // INCLUDE_SVID_JWTSVID_TOKENCACHE_H
@@ -0,0 +1,102 @@
+#ifndef INCLUDE_SVID_JWTSVID_VERIFIER_H
+#define INCLUDE_SVID_JWTSVID_VERIFIER_H
+
+#include "c-spiffe/bundle/jwtbundle/source.h"
+#include "c-spiffe/svid/jwtsvid/svid.h"
+#include <openssl/evp.h>
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** algorithms a token may be signed with: RS, PS and ES, each with
+ * SHA-256, SHA-384 and SHA-512 */
+#define JWTSVID_VERIFIER_ALGORITHMS 9
+
+/** verification state prepared for a bundle key */
+typedef struct {
+    /** key the state was prepared for, referenced. The state is prepared
+     * again once the bundle has another key under the same ID */
+    EVP_PKEY *pkey;
+    /** trust domain of the bundle the key came from, the state is dropped
+     * once that bundle no longer has the key */
+    string_t td;
+    int key_type;
+    /** bytes of each of r and s in an EC signature, from the curve degree
+     */
+    size_t ec_len;
+    /** contexts initialized for verifying with the key, one per
+     * algorithm, NULL for the algorithms of other key types or curves.
+     * Never modified once the key is in the verifier, each token gets a
+     * copy of one of them */
+    EVP_MD_CTX *templates[JWTSVID_VERIFIER_ALGORITHMS];
+} jwtsvid_VerifierKey;
+
+typedef struct {
+    string_t key;
+    jwtsvid_VerifierKey *value;
+} map_string_VerifierKey;
+
+/** jwtsvid_Verifier validates JWT-SVID tokens against a bundle source and
+ * an audience set. It keeps the verification state of every key ID it
+ * has seen, so validating a token copies a prepared context instead of
+ * looking up the algorithm and initializing one.
+ * */
+typedef struct {
+    jwtbundle_Source *bundles;
+    /** owned stb array of audiences */
+    string_arr_t audience;
+    /** prepared keys by key ID */
+    map_string_VerifierKey *keys;
+    /** held for reading to copy a prepared context, for writing to add,
+     * replace or drop keys */
+    pthread_rwlock_t lock;
+} jwtsvid_Verifier;
+
+/**
+ * Creates a verifier.
+ *
+ * \param bundles [in] Source of bundles, borrowed. Must outlive the
+ * verifier.
+ * \param audience [in] stb array of audiences tokens must have, copied.
+ * \param err [out] Variable to get information in the event of error.
+ * \returns Verifier. Must be freed using jwtsvid_Verifier_Free.
+ */
+jwtsvid_Verifier *jwtsvid_NewVerifier(jwtbundle_Source *bundles,
+                                      string_arr_t audience, err_t *err);
+
+/** frees the verifier and its prepared state. NULL safe. */
+void jwtsvid_Verifier_Free(jwtsvid_Verifier *verifier);
+
+/**
+ * Parses and validates a JWT-SVID token, as jwtsvid_ParseAndValidate with
+ * the bundles and audiences of the verifier. Safe to call from several
+ * threads.
+ *
+ * \param verifier [in] Verifier.
+ * \param token [in] string JWT token.
+ * \param err [out] Variable to get information in the event of error.
+ * \returns Parsed JWT-SVID object pointer. Must be freed using
+ * jwtsvid_SVID_Free function.
+ */
+jwtsvid_SVID *jwtsvid_Verifier_Validate(jwtsvid_Verifier *verifier,
+                                        const char *token, err_t *err);
+
+/** same as jwtsvid_Verifier_Validate, for a token of len bytes that is not
+ * null terminated. */
+jwtsvid_SVID *jwtsvid_Verifier_ValidateView(jwtsvid_Verifier *verifier,
+                                            const char *token, size_t len,
+                                            err_t *err);
+
+/** verifies the signature of a parsed token with pkey, preparing the
+ * context from scratch. For validation that keeps no verifier around.
+ * ERR_INVALID_ALGORITHM if the algorithm is unknown or pkey is not of its
+ * key type, ERR_INITIALIZING or ERR_UNMATCH if it is not valid. */
+err_t jwtsvid_VerifyJWT(jwtsvid_JWT *jwt, EVP_PKEY *pkey);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // INCLUDE_SVID_JWTSVID_VERIFIER_H
@@ -102,6 +102,16 @@ bool x509svid_keyMatches(EVP_PKEY *priv_key, EVP_PKEY *pub_key, err_t *err);
  */
 void x509svid_SVID_Free(x509svid_SVID *svid);
 
+/**
+ * Creates a copy of a X509-SVID object. Certificates and private key are
+ * shared with the original by reference counting.
+ *
+ * \param svid [in] SVID object pointer.
+ * \returns Copy of the SVID object. Must be freed using x509svid_SVID_Free
+ * function.
+ */
+x509svid_SVID *x509svid_SVID_Clone(const x509svid_SVID *svid);
+
 /**
  * Returns the default SVID from a list of SVIDS.
  *
@@ -0,0 +1,93 @@
+#ifndef INCLUDE_UTILS_BASE64_H
+#define INCLUDE_UTILS_BASE64_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** alphabets, RFC 4648 sections 4 and 5. The URL one is written without
+ * padding, as in JWS. */
+typedef enum {
+    UTIL_BASE64_STD,
+    UTIL_BASE64_URL,
+} util_Base64Alphabet;
+
+/** implementations. On x86 the SIMD ones are picked at run time when the
+ * CPU supports them, unless built with UTIL_BASE64_NO_SIMD defined. */
+typedef enum {
+    /** best one the CPU supports */
+    UTIL_BASE64_AUTO,
+    UTIL_BASE64_SCALAR,
+    UTIL_BASE64_SSE41,
+    UTIL_BASE64_AVX2,
+} util_Base64Impl;
+
+/**
+ * Most bytes decoded from len characters.
+ *
+ * \param len [in] Length of the encoded string.
+ * \returns Size of an output buffer large enough for util_Base64_Decode.
+ */
+size_t util_Base64_DecodedLen(size_t len);
+
+/**
+ * Characters encoding len bytes, without the null character.
+ *
+ * \param len [in] Number of bytes to encode.
+ * \param alphabet [in] Alphabet, which decides on padding.
+ * \returns Length of the encoded string.
+ */
+size_t util_Base64_EncodedLen(size_t len, util_Base64Alphabet alphabet);
+
+/**
+ * Decodes a base64 string into a caller provided buffer. Up to two trailing
+ * padding characters are accepted in either alphabet.
+ *
+ * \param in [in] Encoded characters, not necessarily null terminated.
+ * \param len [in] Number of characters.
+ * \param out [out] Buffer of at least util_Base64_DecodedLen(len) bytes.
+ * \param out_len [out] Number of bytes decoded.
+ * \param alphabet [in] Alphabet of the input.
+ * \returns <tt>true</tt> on success, <tt>false</tt> if the input has a
+ * character outside the alphabet or a truncated group.
+ */
+bool util_Base64_Decode(const char *in, size_t len, uint8_t *out,
+                        size_t *out_len, util_Base64Alphabet alphabet);
+
+/**
+ * Encodes bytes into a caller provided buffer.
+ *
+ * \param in [in] Bytes to encode.
+ * \param len [in] Number of bytes.
+ * \param out [out] Buffer of at least util_Base64_EncodedLen(len) + 1
+ * characters. A null character is placed at the end.
+ * \param alphabet [in] Alphabet of the output.
+ * \returns Length of the encoded string.
+ */
+size_t util_Base64_Encode(const uint8_t *in, size_t len, char *out,
+                          util_Base64Alphabet alphabet);
+
+/** whether the CPU supports an implementation. */
+bool util_Base64_Supported(util_Base64Impl impl);
+
+/** same as util_Base64_Decode, with the given implementation. Fails if it is
+ * not supported. For tests and benchmarks. */
+bool util_Base64_DecodeWith(util_Base64Impl impl, const char *in, size_t len,
+                            uint8_t *out, size_t *out_len,
+                            util_Base64Alphabet alphabet);
+
+/** same as util_Base64_Encode, with the given implementation, or the
+ * scalar one if it is not supported. For tests and benchmarks. */
+size_t util_Base64_EncodeWith(util_Base64Impl impl, const uint8_t *in,
+                              size_t len, char *out,
+                              util_Base64Alphabet alphabet);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // INCLUDE_UTILS_BASE64_H
@@ -75,7 +75,8 @@ enum enum_err_t {
     ERR_WAITING,
     ERR_EXISTS,
     ERR_TOO_LONG,
-    ERR_BAD_PORT
+    ERR_BAD_PORT,
+    ERR_TOO_MANY_CALLS
 };
 
 typedef enum enum_err_t err_t;
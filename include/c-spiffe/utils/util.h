@@ -6,6 +6,16 @@
 #include <openssl/evp.h>
 #include <stdbool.h>
 
+/** UTIL_ATOMIC declares an atomic struct member in headers shared with C++
+ * code, which only passes such structs around by pointer. */
+#ifdef __cplusplus
+#include <atomic>
+#define UTIL_ATOMIC(T) std::atomic<T>
+#else
+#include <stdatomic.h>
+#define UTIL_ATOMIC(T) _Atomic(T)
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -28,6 +38,25 @@ typedef struct map_string_string {
     string_t value;
 } map_string_string;
 
+/** util_shgeti_ts is shgeti for string keyed maps read by several threads
+ * at once. shgeti leaves the index it found in the map header, which
+ * concurrent readers would race on, so this returns it instead. Evaluates
+ * to the index of k in map, -1 if it is absent or map is NULL. */
+#define util_shgeti_ts(map, k)                                                \
+    util_shgeti_ts_func((map), sizeof *(map), (k), sizeof (map)->key)
+
+static inline ptrdiff_t util_shgeti_ts_func(void *map, size_t elemsize,
+                                            const char *key, size_t keysize)
+{
+    ptrdiff_t index = -1;
+    // stb would allocate a NULL map to return the index in
+    if(map) {
+        stbds_hmget_key_ts(map, elemsize, (void *) key, keysize, &index,
+                           STBDS_HM_STRING);
+    }
+    return index;
+}
+
 
 /**
  * Frees stb string.
@@ -0,0 +1,93 @@
+#ifndef INCLUDE_WORKLOAD_ASYNCCLIENT_H
+#define INCLUDE_WORKLOAD_ASYNCCLIENT_H
+
+#include "c-spiffe/svid/jwtsvid/svid.h"
+#include "c-spiffe/workload/client.h"
+#include "c-spiffe/workload/jwtwatcher.h"
+#include "c-spiffe/workload/watcher.h"
+#include <threads.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** pointer to grpc::CompletionQueue, can't use C++ types in the header */
+typedef void *workloadapi_CompletionQueue;
+
+/** Callback called from the event thread when an asynchronous JWT-SVID
+ * fetch completes. On success, err is NO_ERROR and the callee owns svid. */
+typedef struct {
+    void *args;
+    void (*func)(jwtsvid_SVID *svid, err_t err, void *args);
+} workloadapi_JWTSVIDCallback;
+
+/** AsyncClient is a Workload API client that drives every watch stream and
+ * unary call over a single completion queue, drained by one event thread.
+ * Watcher callbacks are called from that thread.
+ * */
+typedef struct workloadapi_AsyncClient {
+    /** Workload API client providing stub, address and headers */
+    workloadapi_Client *client;
+
+    /** did this create its client? */
+    bool owns_client;
+
+    /** completion queue shared by all calls */
+    workloadapi_CompletionQueue cq;
+
+    /** thread spun to drain the completion queue */
+    thrd_t event_thread;
+    bool running;
+    bool closing;
+
+    /** calls in flight, protected by calls_mutex */
+    void **calls;
+    mtx_t calls_mutex;
+    cnd_t calls_cond;
+
+} workloadapi_AsyncClient;
+
+/** creates a new async client on top of client. If client is NULL, a
+ * client with default options is created and owned. */
+workloadapi_AsyncClient *
+workloadapi_NewAsyncClient(workloadapi_Client *client, err_t *err);
+
+/** dials the client if needed and spins the event thread. */
+err_t workloadapi_AsyncClient_Start(workloadapi_AsyncClient *async_client);
+
+/** cancels every call in flight, waits for them to finish and joins the
+ * event thread. Must not be called from a callback, which runs on the event
+ * thread: it returns ERR_THREAD there. */
+err_t workloadapi_AsyncClient_Close(workloadapi_AsyncClient *async_client);
+
+/** frees the async client. should be closed first. also frees client, if
+ * owned. */
+err_t workloadapi_AsyncClient_Free(workloadapi_AsyncClient *async_client);
+
+/** registers a X.509 context stream for watcher. The stream is restarted
+ * with backoff on errors until it is cancelled or the client closes. */
+err_t workloadapi_AsyncClient_WatchX509Context(
+    workloadapi_AsyncClient *async_client, workloadapi_Watcher *watcher);
+
+/** registers a JWT bundles stream for watcher. The stream is restarted
+ * with backoff on errors until it is cancelled or the client closes. */
+err_t workloadapi_AsyncClient_WatchJWTBundles(
+    workloadapi_AsyncClient *async_client, workloadapi_JWTWatcher *watcher);
+
+/** cancels every stream registered for owner (a watcher) and blocks until
+ * they are finished, so no callback runs for owner afterwards. Must not be
+ * called from a callback: it returns ERR_THREAD there. */
+err_t workloadapi_AsyncClient_CancelWatch(
+    workloadapi_AsyncClient *async_client, void *owner);
+
+/** starts a unary JWT-SVID fetch. params are copied, callback is called
+ * from the event thread with the result. */
+err_t workloadapi_AsyncClient_FetchJWTSVID(
+    workloadapi_AsyncClient *async_client, jwtsvid_Params *params,
+    workloadapi_JWTSVIDCallback callback);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // INCLUDE_WORKLOAD_ASYNCCLIENT_H
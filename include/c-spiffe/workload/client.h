@@ -19,10 +19,42 @@ typedef void *workloadapi_Context; // gRPC context with cancel utils
 typedef struct workloadapi_Watcher workloadapi_Watcher;
 typedef struct workloadapi_JWTWatcher workloadapi_JWTWatcher;
 
+/** size in bytes of the arena block watch streams decode responses into.
+ * The block is reused for every message, so only larger updates allocate.
+ * */
+#define WORKLOADAPI_RESPONSE_ARENA_SIZE (64 * 1024)
+
+/** maximum number of calls a client keeps in flight at once. Calls started
+ * past it fail with ERR_TOO_MANY_CALLS. */
+#define WORKLOADAPI_MAX_CALLS 1024
+
+/** FetchJWTSVID call in flight, shared by concurrent identical requests.
+ * */
+typedef struct workloadapi_JWTSVIDCall {
+    /** result of the call, valid once done */
+    jwtsvid_SVID *svid;
+    err_t err;
+    bool done;
+    /** callers still waiting on the result, including the one fetching */
+    int waiters;
+    cnd_t done_cond;
+} workloadapi_JWTSVIDCall;
+
+typedef struct {
+    string_t key;
+    workloadapi_JWTSVIDCall *value;
+} map_string_JWTSVIDCall;
+
 /** Client is a Workload API client.
  * */
 typedef struct workloadapi_Client {
-    workloadapi_Context *context_list;
+    /** contexts of the calls in flight, cancelled by Close. Finished calls
+     * leave a NULL slot that is reused, so the array only grows up to the
+     * most calls ever in flight at once. */
+    workloadapi_Context *calls;
+    /** stb array of the indexes of the NULL slots in calls */
+    int *free_calls;
+    mtx_t calls_mutex;
     workloadapi_Stub stub;
     bool owns_stub;
     string_arr_t headers;
@@ -31,6 +63,10 @@ typedef struct workloadapi_Client {
     mtx_t closed_mutex;
     cnd_t closed_cond;
 
+    /** FetchJWTSVID calls in flight, keyed by jwtsvid_Params_Key */
+    map_string_JWTSVIDCall *jwtsvid_calls;
+    mtx_t jwtsvid_calls_mutex;
+
 } workloadapi_Client;
 
 /** workloadapi_NewClient the Workload API and returns a client.
@@ -85,6 +121,9 @@ err_t workloadapi_Client_watchX509Context(
     workloadapi_Client *client, workloadapi_Watcher *Watcher,
     workloadapi_Backoff *backoff); // used internally
 
+/** cancels the gRPC call of a context, such as a watcher stream. */
+void workloadapi_Client_CancelContext(workloadapi_Context ctx);
+
 err_t workloadapi_Client_HandleWatchError(workloadapi_Client *client,
                                           err_t error,
                                           workloadapi_Backoff *backoff);
@@ -120,12 +159,33 @@ x509svid_SVID *workloadapi_Client_FetchX509SVID(workloadapi_Client *client,
 x509svid_SVID **workloadapi_Client_FetchX509SVIDs(workloadapi_Client *client,
                                                   err_t *error);
 
-/** workloadapi_Client_FetchJWTSVID fetches a JWT-SVID.
+/** workloadapi_Client_FetchJWTSVID fetches a JWT-SVID. Concurrent calls with
+ * equal params share a single request to the Workload API, and each gets its
+ * own copy of the result.
  */
 jwtsvid_SVID *workloadapi_Client_FetchJWTSVID(workloadapi_Client *client,
                                               jwtsvid_Params *params,
                                               err_t *err);
 
+/** Result of one entry of a batch JWT-SVID fetch. */
+typedef struct {
+    /** stb array of every JWT-SVID in the response, NULL on error */
+    jwtsvid_SVID **svids;
+    err_t err;
+} workloadapi_JWTSVIDResult;
+
+/** workloadapi_Client_FetchJWTSVIDs fetches JWT-SVIDs for each entry of the
+ * stb array params. Requests are pipelined over the channel concurrently.
+ * Returns an stb array with one result per entry, in the same order, which
+ * must be freed with workloadapi_JWTSVIDResults_Free.
+ */
+workloadapi_JWTSVIDResult *
+workloadapi_Client_FetchJWTSVIDs(workloadapi_Client *client,
+                                 jwtsvid_Params *params, err_t *err);
+
+/** frees every JWT-SVID in results and the array itself. */
+void workloadapi_JWTSVIDResults_Free(workloadapi_JWTSVIDResult *results);
+
 /** workloadapi_Client_FetchJWTBundles fetches the JWT bundles for JWT-SVID validation, keyed
  * by a SPIFFE ID of the trust domain to which they belong.
  * */
@@ -133,11 +193,22 @@ jwtbundle_Set *workloadapi_Client_FetchJWTBundles(workloadapi_Client *client,
                                                   err_t *err);
                                          
 /** workloadapi_Client_ValidateJWTSVID validates the JWT-SVID token. The parsed and validated
- * JWT-SVID is returned.
+ * JWT-SVID is returned, built from the claims sent by the Workload API.
  */
 jwtsvid_SVID *workloadapi_Client_ValidateJWTSVID(workloadapi_Client *client,
                                                  char *token, char *audience,
                                                  err_t *err);
+
+/** workloadapi_Client_ValidateJWTSVIDWithBundles validates the JWT-SVID
+ * token locally against bundles, e.g. those received by a JWTWatcher, with
+ * no RPC. The Workload API is asked only when bundles is NULL or the bundle
+ * of the token trust domain has no key with its key ID, as after a key
+ * rotation the bundles have not seen yet. A token of a trust domain with no
+ * bundle fails with ERR_NOT_FOUND.
+ */
+jwtsvid_SVID *workloadapi_Client_ValidateJWTSVIDWithBundles(
+    workloadapi_Client *client, jwtbundle_Set *bundles, char *token,
+    char *audience, err_t *err);
 /// Implemented in client.cc, not part of public API (Needs grpc Response
 /// class, from C++)
 // x509bundle_Set* workloadapi_parseX509Bundles(
@@ -148,6 +219,8 @@ jwtsvid_SVID *workloadapi_Client_ValidateJWTSVID(workloadapi_Client *client,
 //                                             err_t *err);
 // jwtsvid_SVID* workloadapi_parseJWTSVID(
 //     const JWTSVIDResponse *resp, jwtsvid_Params *params, err_t *err);
+// jwtsvid_SVID** workloadapi_parseJWTSVIDs(
+//     const JWTSVIDResponse *resp, jwtsvid_Params *params, err_t *err);
 // jwtbundle_Set* workloadapi_parseJWTBundles(
 //     const JWTBundlesResponse *resp, err_t *err);
 
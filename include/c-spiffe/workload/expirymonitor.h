@@ -0,0 +1,140 @@
+#ifndef INCLUDE_WORKLOAD_EXPIRYMONITOR_H
+#define INCLUDE_WORKLOAD_EXPIRYMONITOR_H
+
+#include "c-spiffe/utils/util.h"
+#include <threads.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** number of slots of the timer wheel. Deadlines further than a turn of
+ * the wheel wait for the extra turns in their slot. */
+#define WORKLOADAPI_EXPIRY_WHEEL_SLOTS 512
+
+/** default fraction of an SVID lifetime after which the monitor reports it,
+ * if it has not been replaced. */
+#define WORKLOADAPI_EXPIRY_ALERT_FRACTION 0.8
+
+/** type for expiry callback function, called with the key of an SVID that
+ * passed the alert fraction of its lifetime and its expiry. */
+typedef void (*workloadapi_expiryFunc_t)(const char *, time_t, void *);
+
+typedef struct {
+    void *args;
+    workloadapi_expiryFunc_t func;
+} workloadapi_ExpiryCallback;
+
+/** expiry monitor counters */
+typedef struct {
+    /** SVIDs tracked now */
+    unsigned long tracked;
+    /** alerts reported, SVIDs that passed the alert fraction without being
+     * replaced */
+    unsigned long alerts;
+} workloadapi_ExpiryMonitorStats;
+
+/** tracked SVID, linked in the slot of the wheel its alert falls in */
+typedef struct workloadapi_ExpiryEntry {
+    string_t key;
+    time_t expiry;
+    /** turns of the wheel left before the alert */
+    unsigned long rounds;
+    /** slot the entry is linked in, -1 once reported */
+    int slot;
+    struct workloadapi_ExpiryEntry *prev;
+    struct workloadapi_ExpiryEntry *next;
+} workloadapi_ExpiryEntry;
+
+typedef struct {
+    string_t key;
+    workloadapi_ExpiryEntry *value;
+} map_string_ExpiryEntry;
+
+/** workloadapi_ExpiryMonitor reports SVIDs that get close to their expiry
+ * without being rotated. Alerts are kept in a hashed timer wheel that
+ * advances one slot per tick, so tracking, replacing and reporting an SVID
+ * are constant time however many SVIDs are tracked.
+ * */
+typedef struct {
+    /** lists of the entries whose alert falls in each slot */
+    workloadapi_ExpiryEntry *wheel[WORKLOADAPI_EXPIRY_WHEEL_SLOTS];
+    /** entries by key */
+    map_string_ExpiryEntry *entries;
+    /** slot the wheel is at, and the time it stands for */
+    int current;
+    time_t current_time;
+    /** seconds per slot */
+    time_t tick;
+    double fraction;
+    workloadapi_ExpiryCallback callback;
+    workloadapi_ExpiryMonitorStats stats;
+
+    mtx_t mtx;
+    cnd_t cond;
+    /** thread advancing the wheel */
+    thrd_t thread;
+    bool running;
+} workloadapi_ExpiryMonitor;
+
+/**
+ * Creates an expiry monitor. It does not report anything until started.
+ *
+ * \param fraction [in] Fraction of the lifetime after which an SVID that
+ * was not replaced is reported, 0 for WORKLOADAPI_EXPIRY_ALERT_FRACTION.
+ * \param tick [in] Seconds per slot of the wheel, the precision of the
+ * alerts. 0 for 1 second.
+ * \param callback [in] Function called for every alert, from the monitor
+ * thread.
+ * \param err [out] Variable to get information in the event of error,
+ * ERR_BAD_ARGUMENT for a fraction outside [0, 1] or a negative tick.
+ * \returns Expiry monitor. Must be freed using
+ * workloadapi_ExpiryMonitor_Free.
+ */
+workloadapi_ExpiryMonitor *
+workloadapi_NewExpiryMonitor(double fraction, time_t tick,
+                             workloadapi_ExpiryCallback callback, err_t *err);
+
+/** stops the monitor if running and frees it. */
+void workloadapi_ExpiryMonitor_Free(workloadapi_ExpiryMonitor *monitor);
+
+/** spins the thread advancing the wheel. */
+err_t workloadapi_ExpiryMonitor_Start(workloadapi_ExpiryMonitor *monitor);
+
+/** stops the thread advancing the wheel. Once it returns, the callback is
+ * not running and will not be called until started again. */
+err_t workloadapi_ExpiryMonitor_Stop(workloadapi_ExpiryMonitor *monitor);
+
+/**
+ * Tracks an SVID, or updates it. An SVID tracked again with the same expiry
+ * keeps its alert, so it is reported once however many updates resend it.
+ * A new expiry means it was rotated, and schedules a new alert.
+ *
+ * \param monitor [in] Expiry monitor.
+ * \param key [in] Key identifying the SVID, such as its SPIFFE ID.
+ * \param issued [in] Start of the SVID lifetime.
+ * \param expiry [in] End of the SVID lifetime.
+ */
+void workloadapi_ExpiryMonitor_Track(workloadapi_ExpiryMonitor *monitor,
+                                     const char *key, time_t issued,
+                                     time_t expiry);
+
+/** stops tracking an SVID, if tracked. */
+void workloadapi_ExpiryMonitor_Untrack(workloadapi_ExpiryMonitor *monitor,
+                                       const char *key);
+
+/** reports the alerts due by now, and moves the wheel to now. The monitor
+ * thread calls it on every tick. */
+void workloadapi_ExpiryMonitor_Advance(workloadapi_ExpiryMonitor *monitor,
+                                       time_t now);
+
+/** returns the monitor counters. */
+workloadapi_ExpiryMonitorStats
+workloadapi_ExpiryMonitor_GetStats(workloadapi_ExpiryMonitor *monitor);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // INCLUDE_WORKLOAD_EXPIRYMONITOR_H
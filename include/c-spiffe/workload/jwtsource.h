@@ -3,6 +3,8 @@
 
 #include "c-spiffe/bundle/jwtbundle/set.h"
 #include "c-spiffe/svid/jwtsvid/svid.h"
+#include "c-spiffe/svid/jwtsvid/tokencache.h"
+#include "c-spiffe/workload/expirymonitor.h"
 #include "c-spiffe/workload/jwtwatcher.h"
 #include <threads.h>
 
@@ -12,19 +14,130 @@ extern "C" {
 
 typedef struct {
     workloadapi_JWTWatcherConfig watcher_config;
+    /** fraction of a cached JWT-SVID lifetime after which it is fetched
+     * again in the background. 0 uses the default, a negative value disables
+     * the JWT-SVID cache. */
+    double svid_refresh_fraction;
+    /** fraction of a cached JWT-SVID lifetime after which, if the refresh
+     * did not replace it, the source reports it. 0 for
+     * WORKLOADAPI_EXPIRY_ALERT_FRACTION, negative to disable */
+    double expiry_alert_fraction;
+    /** called for each JWT-SVID reported, with its cache key */
+    workloadapi_ExpiryCallback expiry_callback;
+    /** most tokens kept validated by ValidateJWTSVID. 0 for
+     * JWTSVID_TOKENCACHE_DEFAULT_ENTRIES, negative to verify every token */
+    long token_cache_entries;
+    /** most JWT-SVIDs cached, the least recently used one is dropped for
+     * room. 0 for WORKLOADAPI_JWTSVID_CACHE_ENTRIES */
+    long svid_cache_entries;
 } workloadapi_JWTSourceConfig;
 
+/** default refresh fraction for cached JWT-SVIDs */
+#define WORKLOADAPI_JWTSVID_REFRESH_FRACTION 0.5
+
+/** JWT-SVIDs kept by a source configured with no limit */
+#define WORKLOADAPI_JWTSVID_CACHE_ENTRIES 256
+
+/** JWT-SVID cache counters */
+typedef struct {
+    /** GetJWTSVID calls served from the cache */
+    unsigned long hits;
+    /** GetJWTSVID calls that had to fetch from the Workload API */
+    unsigned long misses;
+    /** background fetches of cached JWT-SVIDs */
+    unsigned long refreshes;
+    /** entries dropped because they expired, or for room */
+    unsigned long evictions;
+} workloadapi_JWTSVIDCacheStats;
+
+typedef struct {
+    /** owned copy of the parameters, used for refreshing */
+    jwtsvid_Params params;
+    jwtsvid_SVID *svid;
+    /** when the entry must be fetched again */
+    time_t refresh_at;
+    /** cache clock when the SVID was fetched, and when GetJWTSVID last
+     * returned it. Entries not used since fetched are not refreshed, they
+     * expire instead */
+    unsigned long fetched;
+    unsigned long last_used;
+} workloadapi_JWTSVIDCacheEntry;
+
+typedef struct {
+    string_t key;
+    workloadapi_JWTSVIDCacheEntry *value;
+} map_string_JWTSVIDCacheEntry;
+
+/** workloadapi_JWTSnapshot is the immutable JWT bundle set of a source after
+ * an update. Readers take it with workloadapi_JWTSource_AcquireSnapshot and
+ * give it back with workloadapi_JWTSnapshot_Release. It is freed once the
+ * source replaced it and its last reader released it.
+ * */
+typedef struct {
+    jwtbundle_Set *bundles;
+    /** number of the update that built it, starting at 1. Matches the
+     * watcher generation for updates received from the Workload API */
+    uint64_t generation;
+    UTIL_ATOMIC(int) refs;
+} workloadapi_JWTSnapshot;
+
+/** type for snapshot listener function. The snapshot is borrowed for the
+ * duration of the call. */
+typedef void (*workloadapi_JWTSnapshotFunc_t)(workloadapi_JWTSnapshot *,
+                                              void *);
+
+typedef struct {
+    void *args;
+    workloadapi_JWTSnapshotFunc_t func;
+} workloadapi_JWTSnapshotCallback;
+
+typedef struct {
+    int id;
+    workloadapi_JWTSnapshotCallback callback;
+} workloadapi_JWTSubscriber;
+
 /** workloadapi_JWTSource is a source of JWT-SVID and JWT bundles maintained
  * via the Workload API
  * */
 typedef struct {
     workloadapi_JWTWatcher *watcher;
     workloadapi_JWTSourceConfig *config;
+    /** serializes updates, readers never take it */
     mtx_t mtx;
     mtx_t closed_mutex;
-    bool closed;
+    UTIL_ATOMIC(bool) closed;
 
-    jwtbundle_Set *bundles;
+    /** snapshot of the last update, NULL before the first one */
+    UTIL_ATOMIC(workloadapi_JWTSnapshot *) snapshot;
+    /** snapshot replaced by the last update, kept until the next one so
+     * bundles borrowed from GetJWTBundleForTrustDomain outlive one update */
+    workloadapi_JWTSnapshot *retired;
+    /** reader counts per epoch, as in workloadapi_X509Source */
+    UTIL_ATOMIC(unsigned) epoch;
+    UTIL_ATOMIC(unsigned) readers[2];
+
+    /** listeners called after each update, stb array */
+    workloadapi_JWTSubscriber *subscribers;
+    int last_subscriber_id;
+    mtx_t subscribers_mutex;
+
+    /** JWT-SVIDs keyed by subject and sorted audiences */
+    map_string_JWTSVIDCacheEntry *svid_cache;
+    mtx_t svid_cache_mutex;
+    cnd_t svid_cache_cond;
+    workloadapi_JWTSVIDCacheStats svid_cache_stats;
+    /** ticks on every fetch and use of a cached JWT-SVID */
+    unsigned long svid_cache_clock;
+
+    /** thread spun to refresh and evict cached JWT-SVIDs */
+    thrd_t svid_refresh_thread;
+    bool svid_refresh_running;
+
+    /** tracks the expiry of the cached JWT-SVIDs, NULL if disabled */
+    workloadapi_ExpiryMonitor *expiry_monitor;
+
+    /** tokens validated by ValidateJWTSVID, NULL if disabled */
+    jwtsvid_TokenCache *token_cache;
 } workloadapi_JWTSource;
 
 /** workloadapi_NewJWTSource creates a new JWTSource. It blocks until the
@@ -34,8 +147,20 @@ workloadapi_JWTSource *
 workloadapi_NewJWTSource(workloadapi_JWTSourceConfig *config, err_t *err);
 void workloadapi_JWTSource_Free(workloadapi_JWTSource *source);
 
+/** workloadapi_JWTSource_Start starts watching the Workload API and blocks
+ * until the first update. Starting a source that is already started only
+ * waits for its first update.
+ * */
 err_t workloadapi_JWTSource_Start(workloadapi_JWTSource *source);
 
+/** workloadapi_JWTSource_StartAsync starts watching the Workload API and
+ * returns without waiting for the first update, so several sources connect
+ * at once. Wait for them with workloadapi_JWTSource_TimedWaitUntilUpdated or
+ * workloadapi_WaitUntilReady. Starting a source already started does
+ * nothing.
+ * */
+err_t workloadapi_JWTSource_StartAsync(workloadapi_JWTSource *source);
+
 /** workloadapi_JWTSource_Close closes the source, dropping the connection to
  * the Workload API. Other source methods will return an error after Close has
  * been called. The underlying Workload API client will also be closed if it is
@@ -49,22 +174,126 @@ err_t workloadapi_JWTSource_checkClosed(workloadapi_JWTSource *source);
  * the context is done, in which case ctx.Err() is returned.
  * */
 err_t workloadapi_JWTSource_WaitUntilUpdated(workloadapi_JWTSource *source);
+
+/** workloadapi_JWTSource_TimedWaitUntilUpdated waits until the source is
+ * updated or the deadline, an absolute TIME_UTC time, passes, in which case
+ * ERR_TIMEOUT is returned. ERR_CLOSED if the source is not started.
+ * */
+err_t workloadapi_JWTSource_TimedWaitUntilUpdated(
+    workloadapi_JWTSource *source, const struct timespec *deadline);
+
+/**
+ * Registers a listener called with the new snapshot after every update of
+ * the source. Listeners run in the thread receiving updates, in the order
+ * they subscribed, and share the watcher stream of the source. They must not
+ * subscribe or unsubscribe from within the call.
+ *
+ * \param source [in] JWT source.
+ * \param callback [in] Listener and its argument.
+ * \param err [out] Variable to get information in the event of error.
+ * \returns Subscription ID to pass to workloadapi_JWTSource_Unsubscribe.
+ */
+int workloadapi_JWTSource_Subscribe(
+    workloadapi_JWTSource *source,
+    workloadapi_JWTSnapshotCallback callback, err_t *err);
+
+/** removes a listener. Once it returns, the listener is not running and will
+ * not be called again. Returns ERR_NOT_FOUND for an unknown ID. */
+err_t workloadapi_JWTSource_Unsubscribe(workloadapi_JWTSource *source,
+                                        int id);
+
+/** workloadapi_JWTSource_GetUpdateFd returns a file descriptor that polls
+ * readable after every update of the source, see
+ * workloadapi_JWTWatcher_GetUpdateFd. The source owns it.
+ * */
+int workloadapi_JWTSource_GetUpdateFd(workloadapi_JWTSource *source);
+
+/** workloadapi_JWTSource_ClearUpdateFd clears the readiness of the update
+ * descriptor and returns the latest generation, which the snapshot acquired
+ * next has at least.
+ * */
+uint64_t workloadapi_JWTSource_ClearUpdateFd(workloadapi_JWTSource *source);
+
+/** publishes the bundles of set as the new snapshot of the source. The
+ * bundles are moved out of set, not copied, leaving it empty. */
 void workloadapi_JWTSource_applyJWTBundle_Set(workloadapi_JWTSource *source,
                                               jwtbundle_Set *set);
 
+/**
+ * Takes a reference to the current snapshot of the source, without
+ * locking.
+ *
+ * \param source [in] JWT source.
+ * \param err [out] Variable to get information in the event of error.
+ * \returns Snapshot of the last update. Must be released using
+ * workloadapi_JWTSnapshot_Release.
+ */
+workloadapi_JWTSnapshot *
+workloadapi_JWTSource_AcquireSnapshot(workloadapi_JWTSource *source,
+                                      err_t *err);
+
+/** drops a reference to a snapshot, freeing it with its bundles after the
+ * last one. NULL safe. */
+void workloadapi_JWTSnapshot_Release(workloadapi_JWTSnapshot *snapshot);
+
 /** workloadapi_JWTSource_GetJWTSVID gettes a JWT-SVID from the source with the
- * given parameters. It implements the jwtsvid.Source interface.
+ * given parameters. It implements the jwtsvid.Source interface. JWT-SVIDs are
+ * served from the cache while valid, the returned copy must be freed with
+ * jwtsvid_SVID_Free.
  * */
 jwtsvid_SVID *workloadapi_JWTSource_GetJWTSVID(workloadapi_JWTSource *source,
                                                jwtsvid_Params *params,
                                                err_t *err);
 
+/** stores a copy of params and takes ownership of svid in the JWT-SVID
+ * cache. */
+void workloadapi_JWTSource_cacheJWTSVID(workloadapi_JWTSource *source,
+                                        jwtsvid_Params *params,
+                                        jwtsvid_SVID *svid);
+
+/** drops the expired JWT-SVIDs from the cache and returns copies of the
+ * parameters of the ones due for refresh, an stb array. Only entries used
+ * since their last fetch are refreshed. next gets the time of the next
+ * deadline. Called with svid_cache_mutex held. */
+jwtsvid_Params *workloadapi_JWTSource_dueJWTSVIDs(workloadapi_JWTSource *source,
+                                                  time_t now, time_t *next);
+
+/** returns the JWT-SVID cache counters. */
+workloadapi_JWTSVIDCacheStats
+workloadapi_JWTSource_GetJWTSVIDCacheStats(workloadapi_JWTSource *source);
+
+/** workloadapi_JWTSource_GetExpiryStats returns the counters of the expiry
+ * monitor of the JWT-SVID cache, zero if it has none.
+ * */
+workloadapi_ExpiryMonitorStats
+workloadapi_JWTSource_GetExpiryStats(workloadapi_JWTSource *source);
+
+/** workloadapi_JWTSource_GetTokenCacheStats returns the counters of the
+ * cache of validated tokens, zero if it has none.
+ * */
+jwtsvid_TokenCacheStats
+workloadapi_JWTSource_GetTokenCacheStats(workloadapi_JWTSource *source);
+
 /** workloadapi_JWTSource_GetJWTBundleForTrustDomain returns the JWT bundle for
  * the given trust domain. It implements the jwtbundle.Source interface.
+ * The bundle belongs to the source and stays valid until the second update
+ * after the call, use workloadapi_JWTSource_AcquireSnapshot to hold it
+ * longer. Verifying through a jwtbundle_Source of the source holds a
+ * snapshot, see jwtbundle_Source_Pin.
  * */
 jwtbundle_Bundle *workloadapi_JWTSource_GetJWTBundleForTrustDomain(
     workloadapi_JWTSource *source, const spiffeid_TrustDomain td, err_t *err);
 
+/** workloadapi_JWTSource_ValidateJWTSVID validates the JWT-SVID token
+ * against the bundles of the source, with no RPC. The Workload API is asked
+ * only before the first update, or when the bundle of the token trust
+ * domain has no key with its key ID. A token of a trust domain with no
+ * bundle fails with ERR_NOT_FOUND. The returned JWT-SVID must be freed with
+ * jwtsvid_SVID_Free.
+ * */
+jwtsvid_SVID *workloadapi_JWTSource_ValidateJWTSVID(
+    workloadapi_JWTSource *source, char *token, char *audience, err_t *err);
+
 #ifdef __cplusplus
 }
 #endif
@@ -3,13 +3,16 @@
 
 #include "c-spiffe/bundle/jwtbundle/set.h"
 #include "c-spiffe/workload/client.h"
+#include "c-spiffe/workload/updatecache.h"
 #include "c-spiffe/workload/jwtcallback.h"
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 typedef struct workloadapi_Client workloadapi_Client;
+typedef struct workloadapi_AsyncClient workloadapi_AsyncClient;
 typedef void (*workloadapi_ClientOption)(workloadapi_Client *, void *);
 typedef struct {
     workloadapi_Client *client;
@@ -27,6 +30,12 @@ typedef struct workloadapi_JWTWatcher {
     mtx_t update_mutex;
     cnd_t update_cond;
     bool updated;
+    /** number of updates received so far */
+    uint64_t generation;
+    /** eventfd readable after each update, -1 if it could not be created */
+    int update_fd;
+    /** watch stream pipeline counters, guarded by update_mutex */
+    workloadapi_PipelineStats pipeline_stats;
 
     err_t update_error;
 
@@ -39,9 +48,19 @@ typedef struct workloadapi_JWTWatcher {
     thrd_t watcher_thread;
     int thread_error;
 
+    /** if set, updates are received on the async client event thread
+     * instead of watcher_thread */
+    workloadapi_AsyncClient *async_client;
+
     // function called with updated JWTBundleSet
     workloadapi_JWTCallback jwt_callback;
 
+    /** objects parsed from the last update, reused while unchanged */
+    workloadapi_UpdateCache *update_cache;
+
+    /** function called with the trust domains changed by an update */
+    workloadapi_DeltaCallback delta_callback;
+
 } workloadapi_JWTWatcher;
 
 /** creates and sets up a new watcher, doesn't dial client yet. */
@@ -53,6 +72,21 @@ workloadapi_newJWTWatcher(workloadapi_JWTWatcherConfig config,
  */
 err_t workloadapi_JWTWatcher_Start(workloadapi_JWTWatcher *watcher);
 
+/** starts watcher thread without waiting for the first update, see
+ * workloadapi_JWTWatcher_TimedWaitUntilUpdated. dials client if needed. */
+err_t workloadapi_JWTWatcher_StartAsync(workloadapi_JWTWatcher *watcher);
+
+/** makes the watcher receive updates through async_client, instead of
+ * spinning its own thread. The watcher then uses the async client's client.
+ * Must be called before Start. */
+err_t workloadapi_JWTWatcher_SetAsyncClient(
+    workloadapi_JWTWatcher *watcher, workloadapi_AsyncClient *async_client);
+
+/** sets a callback called after each update that changed the trust
+ * domains received, with what changed. Must be called before Start. */
+err_t workloadapi_JWTWatcher_SetDeltaCallback(
+    workloadapi_JWTWatcher *watcher, workloadapi_DeltaCallback callback);
+
 /** drops connection to WorkloadAPI, and kills client (if watcher owns
  * client) */
 err_t workloadapi_JWTWatcher_Close(workloadapi_JWTWatcher *watcher);
@@ -73,6 +107,24 @@ void workloadapi_JWTWatcher_OnJWTBundlesWatchError(
 err_t workloadapi_JWTWatcher_WaitUntilUpdated(workloadapi_JWTWatcher *watcher);
 err_t workloadapi_JWTWatcher_TimedWaitUntilUpdated(
     workloadapi_JWTWatcher *watcher, const struct timespec *timer);
+/** Returns the number of updates received so far. */
+uint64_t workloadapi_JWTWatcher_GetGeneration(workloadapi_JWTWatcher *watcher);
+
+/** Returns the counters of the watch stream pipeline. */
+workloadapi_PipelineStats
+workloadapi_JWTWatcher_GetPipelineStats(workloadapi_JWTWatcher *watcher);
+
+/** Returns a file descriptor that polls readable after every update, to
+ * handle updates from an event loop instead of a blocked thread. The watcher
+ * owns it, do not close it. Returns -1 if the descriptor could not be
+ * created. */
+int workloadapi_JWTWatcher_GetUpdateFd(workloadapi_JWTWatcher *watcher);
+
+/** Clears the readiness of the update descriptor, until the next update.
+ * Returns the generation current after clearing it, so every update up to it
+ * has been seen. */
+uint64_t workloadapi_JWTWatcher_ClearUpdateFd(workloadapi_JWTWatcher *watcher);
+
 /** Broadcasts an update to all waiting. */
 err_t workloadapi_JWTWatcher_TriggerUpdated(workloadapi_JWTWatcher *watcher);
 
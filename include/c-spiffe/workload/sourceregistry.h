@@ -0,0 +1,72 @@
+#ifndef INCLUDE_WORKLOAD_SOURCEREGISTRY_H
+#define INCLUDE_WORKLOAD_SOURCEREGISTRY_H
+
+#include "c-spiffe/workload/jwtsource.h"
+#include "c-spiffe/workload/x509source.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** address of the Workload API used when none is given, the same one
+ * workloadapi_Client_setDefaultAddressOption sets. */
+#define WORKLOADAPI_DEFAULT_ADDRESS "unix:///tmp/agent.sock"
+
+/**
+ * Gets the process-wide X509Source for a Workload API address, creating it
+ * on first use. Every caller asking for the same address shares one
+ * source, and so one watcher, one stream and one parsed copy of the SVIDs
+ * and bundles. The source is created but not started, starting it again
+ * once it is running only waits for its first update.
+ *
+ * \param address [in] Workload API address, or NULL for the default one.
+ * \param err [out] Variable to get information in the event of error.
+ * \returns Shared X509Source. Must be released using
+ * workloadapi_ReleaseX509Source, never closed or freed directly.
+ */
+workloadapi_X509Source *workloadapi_AcquireX509Source(const char *address,
+                                                      err_t *err);
+
+/** drops a reference taken by workloadapi_AcquireX509Source. The last one
+ * closes and frees the source. NULL safe. */
+void workloadapi_ReleaseX509Source(workloadapi_X509Source *source);
+
+/**
+ * Gets the process-wide JWTSource for a Workload API address, creating it
+ * on first use. Works like workloadapi_AcquireX509Source.
+ *
+ * \param address [in] Workload API address, or NULL for the default one.
+ * \param err [out] Variable to get information in the event of error.
+ * \returns Shared JWTSource. Must be released using
+ * workloadapi_ReleaseJWTSource, never closed or freed directly.
+ */
+workloadapi_JWTSource *workloadapi_AcquireJWTSource(const char *address,
+                                                    err_t *err);
+
+/** drops a reference taken by workloadapi_AcquireJWTSource. The last one
+ * closes and frees the source. NULL safe. */
+void workloadapi_ReleaseJWTSource(workloadapi_JWTSource *source);
+
+/**
+ * Waits until every source of a set received its first update, with one
+ * deadline for the whole set. Start the sources with
+ * workloadapi_X509Source_StartAsync and workloadapi_JWTSource_StartAsync
+ * first, so they connect to the Workload API at the same time and the wait
+ * lasts as long as the slowest one instead of the sum.
+ *
+ * \param x509_sources [in] stb array of X.509 sources, may be NULL.
+ * \param jwt_sources [in] stb array of JWT sources, may be NULL.
+ * \param deadline [in] Absolute TIME_UTC time to give up at, NULL to wait
+ * without limit.
+ * \returns NO_ERROR once all are updated, ERR_TIMEOUT if the deadline
+ * passed first, ERR_CLOSED if one of them is not started.
+ */
+err_t workloadapi_WaitUntilReady(workloadapi_X509Source **x509_sources,
+                                 workloadapi_JWTSource **jwt_sources,
+                                 const struct timespec *deadline);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // INCLUDE_WORKLOAD_SOURCEREGISTRY_H
@@ -0,0 +1,206 @@
+#ifndef INCLUDE_WORKLOAD_UPDATECACHE_H
+#define INCLUDE_WORKLOAD_UPDATECACHE_H
+
+#include "c-spiffe/bundle/jwtbundle/bundle.h"
+#include "c-spiffe/bundle/x509bundle/bundle.h"
+#include "c-spiffe/svid/x509svid/svid.h"
+#include "c-spiffe/utils/util.h"
+#include <openssl/sha.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** workloadapi_UpdateDelta reports what changed between two consecutive
+ * updates of a watch stream. Every array is a stb array of stb strings.
+ * */
+typedef struct {
+    /** SPIFFE IDs of SVIDs added or changed */
+    string_arr_t changed_svids;
+    /** SPIFFE IDs of SVIDs no longer present */
+    string_arr_t removed_svids;
+    /** trust domains whose bundle was added or changed */
+    string_arr_t changed_bundles;
+    /** trust domains whose bundle is no longer present */
+    string_arr_t removed_bundles;
+} workloadapi_UpdateDelta;
+
+/** type for delta callback function. */
+typedef void (*workloadapi_deltaFunc_t)(const workloadapi_UpdateDelta *,
+                                        void *);
+
+typedef struct {
+    void *args;
+    workloadapi_deltaFunc_t func;
+} workloadapi_DeltaCallback;
+
+/** counters of the pipeline handing watch stream responses from the thread
+ * reading them to the thread parsing and dispatching them */
+typedef struct {
+    /** responses read from the stream */
+    unsigned long received;
+    /** responses parsed and dispatched to the watcher */
+    unsigned long dispatched;
+    /** responses dropped because a newer one arrived before dispatch */
+    unsigned long coalesced;
+    /** responses read and not dispatched yet, at most 1 */
+    unsigned long depth;
+    /** time from reading a response to the end of its dispatch, in
+     * nanoseconds */
+    uint64_t last_latency_ns;
+    uint64_t max_latency_ns;
+    uint64_t total_latency_ns;
+} workloadapi_PipelineStats;
+
+/** parsed X.509-SVID, keyed by the digest of its raw bytes */
+typedef struct {
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+    x509svid_SVID *svid;
+    /** present in the update being parsed */
+    bool seen;
+} workloadapi_X509SVIDCacheEntry;
+
+typedef struct {
+    string_t key;
+    workloadapi_X509SVIDCacheEntry *value;
+} map_string_X509SVIDCacheEntry;
+
+/** parsed X.509 bundle, keyed by the digest of its raw bytes */
+typedef struct {
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+    x509bundle_Bundle *bundle;
+    bool seen;
+} workloadapi_X509BundleCacheEntry;
+
+typedef struct {
+    string_t key;
+    workloadapi_X509BundleCacheEntry *value;
+} map_string_X509BundleCacheEntry;
+
+/** SHA-256 digest, as a map key */
+typedef struct {
+    unsigned char bytes[SHA256_DIGEST_LENGTH];
+} workloadapi_Digest;
+
+/** X.509 authorities decoded from bundle bytes */
+typedef struct {
+    /** stb array of certificates */
+    X509 **certs;
+    bool seen;
+} workloadapi_X509AuthoritiesCacheEntry;
+
+typedef struct {
+    workloadapi_Digest key;
+    workloadapi_X509AuthoritiesCacheEntry *value;
+} map_digest_X509AuthoritiesCacheEntry;
+
+/** parsed JWT bundle, keyed by the digest of its raw bytes */
+typedef struct {
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+    jwtbundle_Bundle *bundle;
+    bool seen;
+} workloadapi_JWTBundleCacheEntry;
+
+typedef struct {
+    string_t key;
+    workloadapi_JWTBundleCacheEntry *value;
+} map_string_JWTBundleCacheEntry;
+
+/** workloadapi_UpdateCache keeps the objects parsed from the last update of
+ * a watch stream, so entries whose raw bytes did not change are not decoded
+ * again. Objects handed out share certificates and keys with the cached
+ * ones by reference counting. Not thread safe: each stream owns its cache.
+ * */
+typedef struct {
+    /** X.509-SVIDs by SPIFFE ID */
+    map_string_X509SVIDCacheEntry *x509svids;
+    /** X.509 bundles by trust domain */
+    map_string_X509BundleCacheEntry *x509bundles;
+    /** authorities of the X.509 bundles by the digest of their bytes, so
+     * bytes several trust domains share, or that move from one to
+     * another, are decoded once */
+    map_digest_X509AuthoritiesCacheEntry *x509authorities;
+    /** JWT bundles by trust domain */
+    map_string_JWTBundleCacheEntry *jwtbundles;
+
+    /** changes found by the last update */
+    workloadapi_UpdateDelta delta;
+} workloadapi_UpdateCache;
+
+/** creates a new, empty update cache. */
+workloadapi_UpdateCache *workloadapi_NewUpdateCache(void);
+
+/** frees the cache and every object it holds. */
+void workloadapi_UpdateCache_Free(workloadapi_UpdateCache *cache);
+
+/** starts parsing a new update: clears the delta and marks every entry as
+ * not seen. */
+void workloadapi_UpdateCache_Begin(workloadapi_UpdateCache *cache);
+
+/** finishes parsing an update: evicts the entries it did not contain and
+ * records them as removed. */
+void workloadapi_UpdateCache_End(workloadapi_UpdateCache *cache);
+
+/** drops an update that failed to parse half-way: the entries it replaced
+ * are invalidated, so the next update decodes them again and reports them
+ * as changed, and the delta is cleared. Entries it did not contain are kept
+ * until the End of an update that succeeds. */
+void workloadapi_UpdateCache_Abort(workloadapi_UpdateCache *cache);
+
+/** returns true if the last update changed anything. */
+bool workloadapi_UpdateCache_Changed(const workloadapi_UpdateCache *cache);
+
+/**
+ * Parses an X.509-SVID, reusing the cached one if its bytes did not change.
+ *
+ * \param cache [in] Update cache.
+ * \param id [in] SPIFFE ID the Workload API sent along with the SVID.
+ * \param certbytes [in] Concatenated DER certificates.
+ * \param certlen [in] Length of certbytes.
+ * \param keybytes [in] PKCS#8 DER private key.
+ * \param keylen [in] Length of keybytes.
+ * \param err [out] Variable to get information in the event of error.
+ * \returns X.509-SVID object pointer. Must be freed using
+ * x509svid_SVID_Free.
+ */
+x509svid_SVID *workloadapi_UpdateCache_ParseX509SVID(
+    workloadapi_UpdateCache *cache, const char *id, const byte *certbytes,
+    size_t certlen, const byte *keybytes, size_t keylen, err_t *err);
+
+/**
+ * Parses an X.509 bundle, reusing the cached one if its bytes did not
+ * change.
+ *
+ * \param cache [in] Update cache.
+ * \param td [in] Trust domain of the bundle.
+ * \param bytes [in] Concatenated DER certificates.
+ * \param len [in] Length of bytes.
+ * \param err [out] Variable to get information in the event of error.
+ * \returns X.509 bundle object pointer. Must be freed using
+ * x509bundle_Bundle_Free.
+ */
+x509bundle_Bundle *workloadapi_UpdateCache_ParseX509Bundle(
+    workloadapi_UpdateCache *cache, const spiffeid_TrustDomain td,
+    const byte *bytes, size_t len, err_t *err);
+
+/**
+ * Parses a JWT bundle, reusing the cached one if its bytes did not change.
+ *
+ * \param cache [in] Update cache.
+ * \param td [in] Trust domain of the bundle.
+ * \param bytes [in] JWKS document.
+ * \param len [in] Length of bytes.
+ * \param err [out] Variable to get information in the event of error.
+ * \returns JWT bundle object pointer. Must be freed using
+ * jwtbundle_Bundle_Free.
+ */
+jwtbundle_Bundle *workloadapi_UpdateCache_ParseJWTBundle(
+    workloadapi_UpdateCache *cache, const spiffeid_TrustDomain td,
+    const char *bytes, size_t len, err_t *err);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // INCLUDE_WORKLOAD_UPDATECACHE_H
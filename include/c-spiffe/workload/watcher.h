@@ -2,7 +2,9 @@
 #define INCLUDE_WORKLOAD_WATCHER_H
 
 #include "c-spiffe/workload/client.h"
+#include "c-spiffe/workload/updatecache.h"
 #include "c-spiffe/workload/x509context.h"
+#include <stdint.h>
 #include <threads.h>
 #include <time.h>
 
@@ -11,6 +13,7 @@ extern "C" {
 #endif
 
 typedef struct workloadapi_Client workloadapi_Client;
+typedef struct workloadapi_AsyncClient workloadapi_AsyncClient;
 typedef void (*workloadapi_ClientOption)(workloadapi_Client *, void *);
 typedef struct {
     workloadapi_Client *client;
@@ -28,6 +31,17 @@ typedef struct workloadapi_Watcher {
     mtx_t update_mutex;
     cnd_t update_cond;
     bool updated;
+    /** number of updates received so far */
+    uint64_t generation;
+    /** eventfd readable after each update, -1 if it could not be created */
+    int update_fd;
+    /** watch stream pipeline counters, guarded by update_mutex */
+    workloadapi_PipelineStats pipeline_stats;
+    /** context of the open watch stream, NULL between streams. Guarded by
+     * update_mutex */
+    void *stream;
+    /** set when the stream was cancelled to be opened again */
+    bool restart;
 
     err_t update_error;
 
@@ -40,9 +54,19 @@ typedef struct workloadapi_Watcher {
     thrd_t watcher_thread;
     int thread_error;
 
+    /** if set, updates are received on the async client event thread
+     * instead of watcher_thread */
+    workloadapi_AsyncClient *async_client;
+
     /** function called with updated x509Context */
     workloadapi_X509Callback x509callback;
 
+    /** objects parsed from the last update, reused while unchanged */
+    workloadapi_UpdateCache *update_cache;
+
+    /** function called with the SVIDs and trust domains changed by an update */
+    workloadapi_DeltaCallback delta_callback;
+
 } workloadapi_Watcher;
 
 /** creates and sets up a new watcher, doesn't dial client yet. */
@@ -53,6 +77,22 @@ workloadapi_newWatcher(workloadapi_WatcherConfig config,
 /** starts watcher thread and blocks until updated. dials client if needed. */
 err_t workloadapi_Watcher_Start(workloadapi_Watcher *watcher);
 
+/** starts watcher thread without waiting for the first update, see
+ * workloadapi_Watcher_TimedWaitUntilUpdated. dials client if needed. */
+err_t workloadapi_Watcher_StartAsync(workloadapi_Watcher *watcher);
+
+/** makes the watcher receive updates through async_client, instead of
+ * spinning its own thread. The watcher then uses the async client's client.
+ * Must be called before Start. */
+err_t workloadapi_Watcher_SetAsyncClient(
+    workloadapi_Watcher *watcher, workloadapi_AsyncClient *async_client);
+
+/** sets a callback called after each update that changed the SVIDs or
+ * trust domains received, with what changed. Must be called before Start.
+ * */
+err_t workloadapi_Watcher_SetDeltaCallback(workloadapi_Watcher *watcher,
+                                           workloadapi_DeltaCallback callback);
+
 /** drops connection to WorkloadAPI, and kills client (if watcher owns client)
  */
 err_t workloadapi_Watcher_Close(workloadapi_Watcher *watcher);
@@ -74,6 +114,30 @@ void workloadapi_Watcher_OnX509ContextWatchError(workloadapi_Watcher *watcher,
 err_t workloadapi_Watcher_WaitUntilUpdated(workloadapi_Watcher *watcher);
 err_t workloadapi_Watcher_TimedWaitUntilUpdated(workloadapi_Watcher *watcher,
                                                 const struct timespec *timer);
+/** Returns the number of updates received so far. */
+uint64_t workloadapi_Watcher_GetGeneration(workloadapi_Watcher *watcher);
+
+/** Returns the counters of the watch stream pipeline. */
+workloadapi_PipelineStats
+workloadapi_Watcher_GetPipelineStats(workloadapi_Watcher *watcher);
+
+/** Returns a file descriptor that polls readable after every update, to
+ * handle updates from an event loop instead of a blocked thread. The watcher
+ * owns it, do not close it. Returns -1 if the descriptor could not be
+ * created. */
+int workloadapi_Watcher_GetUpdateFd(workloadapi_Watcher *watcher);
+
+/** Clears the readiness of the update descriptor, until the next update.
+ * Returns the generation current after clearing it, so every update up to it
+ * has been seen. */
+uint64_t workloadapi_Watcher_ClearUpdateFd(workloadapi_Watcher *watcher);
+
+/** Cancels the watch stream, which is opened again right away instead of
+ * ending the watch, to recover from a stream the agent stopped updating.
+ * NO_ERROR if no stream is open, as the next one is new. Not supported with
+ * an async client. */
+err_t workloadapi_Watcher_Restart(workloadapi_Watcher *watcher);
+
 /** Broadcasts an update to all waiting. */
 err_t workloadapi_Watcher_TriggerUpdated(workloadapi_Watcher *watcher);
 
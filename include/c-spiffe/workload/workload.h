@@ -1,11 +1,14 @@
 #ifndef INCLUDE_WORKLOAD_H
 #define INCLUDE_WORKLOAD_H
 
+#include "c-spiffe/workload/asyncclient.h"
 #include "c-spiffe/workload/backoff.h"
 #include "c-spiffe/workload/client.h"
 #include "c-spiffe/workload/jwtcallback.h"
 #include "c-spiffe/workload/jwtsource.h"
 #include "c-spiffe/workload/jwtwatcher.h"
+#include "c-spiffe/workload/sourceregistry.h"
+#include "c-spiffe/workload/updatecache.h"
 #include "c-spiffe/workload/watcher.h"
 #include "c-spiffe/workload/x509context.h"
 #include "c-spiffe/workload/x509source.h"
@@ -3,6 +3,7 @@
 
 #include "c-spiffe/bundle/x509bundle/set.h"
 #include "c-spiffe/svid/x509svid/svid.h"
+#include "c-spiffe/workload/expirymonitor.h"
 #include "c-spiffe/workload/watcher.h"
 #include <threads.h>
 
@@ -13,20 +14,83 @@ extern "C" {
 typedef struct {
     workloadapi_WatcherConfig watcher_config;
     x509svid_SVID *(*picker)(x509svid_SVID **);
+    /** fraction of the lifetime of an SVID after which, if it was not
+     * rotated, the source reports it and reopens its watch stream. 0 for
+     * WORKLOADAPI_EXPIRY_ALERT_FRACTION, negative to disable */
+    double expiry_alert_fraction;
+    /** called for each SVID reported, optional */
+    workloadapi_ExpiryCallback expiry_callback;
 } workloadapi_X509SourceConfig;
 
+typedef struct {
+    string_t key;
+    x509svid_SVID *value;
+} map_string_x509svid_SVID;
+
+/** workloadapi_X509Snapshot is the immutable X.509 state of a source after
+ * an update. Readers take it with workloadapi_X509Source_AcquireSnapshot
+ * and give it back with workloadapi_X509Snapshot_Release. It is freed once
+ * the source replaced it and its last reader released it.
+ * */
+typedef struct {
+    x509svid_SVID **svids;
+    x509bundle_Set *bundles;
+    /** SVID chosen by the source picker, NULL if there is none */
+    x509svid_SVID *svid;
+    /** svids keyed by trust domain name followed by path, the first one
+     * wins if an ID repeats. Look it up with
+     * workloadapi_X509Snapshot_GetX509SVIDForID. */
+    map_string_x509svid_SVID *svids_by_id;
+    /** number of the update that built it, starting at 1. Matches the
+     * watcher generation for updates received from the Workload API */
+    uint64_t generation;
+    UTIL_ATOMIC(int) refs;
+} workloadapi_X509Snapshot;
+
+/** type for snapshot listener function. The snapshot is borrowed for the
+ * duration of the call. */
+typedef void (*workloadapi_X509SnapshotFunc_t)(workloadapi_X509Snapshot *,
+                                               void *);
+
+typedef struct {
+    void *args;
+    workloadapi_X509SnapshotFunc_t func;
+} workloadapi_X509SnapshotCallback;
+
+typedef struct {
+    int id;
+    workloadapi_X509SnapshotCallback callback;
+} workloadapi_X509Subscriber;
+
 /** workloadapi_X509Source is a source of X509-SVIDs and X.509 bundles
  * maintained via the Workload API.
  * */
 typedef struct {
     workloadapi_Watcher *watcher;
     workloadapi_X509SourceConfig *config;
+    /** serializes updates, readers never take it */
     mtx_t mtx;
     mtx_t closed_mutex;
-    bool closed;
+    UTIL_ATOMIC(bool) closed;
 
-    x509svid_SVID **svids;
-    x509bundle_Set *bundles;
+    /** snapshot of the last update, NULL before the first one */
+    UTIL_ATOMIC(workloadapi_X509Snapshot *) snapshot;
+    /** snapshot replaced by the last update. The source keeps it until the
+     * next one, so pointers borrowed from the getters outlive an update. */
+    workloadapi_X509Snapshot *retired;
+    /** readers taking a reference count themselves in the slot of the
+     * current epoch. An update moves to the next epoch and waits for the
+     * slot of the previous one to drain before dropping a snapshot. */
+    UTIL_ATOMIC(unsigned) epoch;
+    UTIL_ATOMIC(unsigned) readers[2];
+
+    /** listeners called after each update, stb array */
+    workloadapi_X509Subscriber *subscribers;
+    int last_subscriber_id;
+    mtx_t subscribers_mutex;
+
+    /** tracks the expiry of the SVIDs while started, NULL if disabled */
+    workloadapi_ExpiryMonitor *expiry_monitor;
 } workloadapi_X509Source;
 
 /** workloadapi_NewX509Source creates a new X509Source. It blocks until the
@@ -36,8 +100,20 @@ workloadapi_X509Source *
 workloadapi_NewX509Source(workloadapi_X509SourceConfig *config, err_t *err);
 void workloadapi_X509Source_Free(workloadapi_X509Source *source);
 
+/** workloadapi_X509Source_Start starts watching the Workload API and blocks
+ * until the first update. Starting a source that is already started only
+ * waits for its first update.
+ * */
 err_t workloadapi_X509Source_Start(workloadapi_X509Source *source);
 
+/** workloadapi_X509Source_StartAsync starts watching the Workload API and
+ * returns without waiting for the first update, so several sources connect
+ * at once. Wait for them with workloadapi_X509Source_TimedWaitUntilUpdated or
+ * workloadapi_WaitUntilReady. Starting a source already started does
+ * nothing.
+ * */
+err_t workloadapi_X509Source_StartAsync(workloadapi_X509Source *source);
+
 /** workloadapi_X509Source_Close closes the source, dropping the connection to
  * the Workload API. Other source methods will return an error after Close has
  * been called. The underlying Workload API client will also be closed if it is
@@ -51,17 +127,106 @@ err_t workloadapi_X509Source_checkClosed(workloadapi_X509Source *source);
  * or the context is done, in which case ctx.Err() is returned.
  * */
 err_t workloadapi_X509Source_WaitUntilUpdated(workloadapi_X509Source *source);
+
+/** workloadapi_X509Source_TimedWaitUntilUpdated waits until the source is
+ * updated or the deadline, an absolute TIME_UTC time, passes, in which case
+ * ERR_TIMEOUT is returned. ERR_CLOSED if the source is not started.
+ * */
+err_t workloadapi_X509Source_TimedWaitUntilUpdated(
+    workloadapi_X509Source *source, const struct timespec *deadline);
+
+/**
+ * Registers a listener called with the new snapshot after every update of
+ * the source. Listeners run in the thread receiving updates, in the order
+ * they subscribed, and share the watcher stream of the source. They must not
+ * subscribe or unsubscribe from within the call.
+ *
+ * \param source [in] X.509 source.
+ * \param callback [in] Listener and its argument.
+ * \param err [out] Variable to get information in the event of error.
+ * \returns Subscription ID to pass to workloadapi_X509Source_Unsubscribe.
+ */
+int workloadapi_X509Source_Subscribe(
+    workloadapi_X509Source *source,
+    workloadapi_X509SnapshotCallback callback, err_t *err);
+
+/** removes a listener. Once it returns, the listener is not running and will
+ * not be called again. Returns ERR_NOT_FOUND for an unknown ID. */
+err_t workloadapi_X509Source_Unsubscribe(workloadapi_X509Source *source,
+                                         int id);
+
+/** workloadapi_X509Source_GetExpiryStats returns the counters of the
+ * expiry monitor of the source, zero if it has none.
+ * */
+workloadapi_ExpiryMonitorStats
+workloadapi_X509Source_GetExpiryStats(workloadapi_X509Source *source);
+
+/** workloadapi_X509Source_GetUpdateFd returns a file descriptor that polls
+ * readable after every update of the source, see
+ * workloadapi_Watcher_GetUpdateFd. The source owns it.
+ * */
+int workloadapi_X509Source_GetUpdateFd(workloadapi_X509Source *source);
+
+/** workloadapi_X509Source_ClearUpdateFd clears the readiness of the update
+ * descriptor and returns the latest generation, which the snapshot acquired
+ * next has at least.
+ * */
+uint64_t workloadapi_X509Source_ClearUpdateFd(workloadapi_X509Source *source);
 void workloadapi_X509Source_applyX509Context(workloadapi_X509Source *source,
                                              workloadapi_X509Context *ctx);
 
+/**
+ * Takes a reference to the current snapshot of the source, without
+ * locking.
+ *
+ * \param source [in] X.509 source.
+ * \param err [out] Variable to get information in the event of error.
+ * \returns Snapshot of the last update. Must be released using
+ * workloadapi_X509Snapshot_Release.
+ */
+workloadapi_X509Snapshot *
+workloadapi_X509Source_AcquireSnapshot(workloadapi_X509Source *source,
+                                       err_t *err);
+
+/** drops a reference to a snapshot, freeing it with its SVIDs and bundles
+ * after the last one. NULL safe. */
+void workloadapi_X509Snapshot_Release(workloadapi_X509Snapshot *snapshot);
+
 /** workloadapi_X509Source_GetX509SVID returns an X509-SVID from the source. It
- * implements the x509svid.Source interface.
+ * implements the x509svid.Source interface. The SVID belongs to the source
+ * and stays valid until the second update after the call, use
+ * workloadapi_X509Source_AcquireSnapshot to hold it longer.
  * */
 x509svid_SVID *
 workloadapi_X509Source_GetX509SVID(workloadapi_X509Source *source, err_t *err);
 
+/**
+ * Looks up the SVID of a SPIFFE ID in a snapshot, in constant time. Safe to
+ * call from several threads at once.
+ *
+ * \param snapshot [in] X.509 snapshot.
+ * \param id [in] SPIFFE ID of the SVID.
+ * \param err [out] Variable to get information in the event of error.
+ * \returns The SVID, owned by the snapshot, or <tt>NULL</tt> with
+ * ERR_NOT_FOUND if the snapshot has none for the ID.
+ */
+x509svid_SVID *
+workloadapi_X509Snapshot_GetX509SVIDForID(workloadapi_X509Snapshot *snapshot,
+                                          const spiffeid_ID id, err_t *err);
+
+/** workloadapi_X509Source_GetX509SVIDForID returns the X509-SVID of the
+ * given SPIFFE ID, without scanning the SVIDs of the source. It has the same
+ * lifetime as workloadapi_X509Source_GetX509SVID results, hold a snapshot
+ * to keep it across rotations.
+ * */
+x509svid_SVID *
+workloadapi_X509Source_GetX509SVIDForID(workloadapi_X509Source *source,
+                                        const spiffeid_ID id, err_t *err);
+
 /** workloadapi_X509Source_GetX509BundleForTrustDomain returns the X.509 bundle
  * for the given trust domain. It implements the x509bundle.Source interface.
+ * The bundle belongs to the source, with the same lifetime as
+ * workloadapi_X509Source_GetX509SVID results.
  * */
 x509bundle_Bundle *workloadapi_X509Source_GetX509BundleForTrustDomain(
     workloadapi_X509Source *source, const spiffeid_TrustDomain td, err_t *err);
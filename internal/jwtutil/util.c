@@ -24,6 +24,7 @@
 
 #include "c-spiffe/internal/jwtutil/util.h"
 #include "c-spiffe/internal/cryptoutil/keys.h"
+#include "c-spiffe/utils/base64.h"
 #include <cjose/cjose.h>
 #include <jansson.h>
 #include <openssl/x509.h>
@@ -189,14 +190,16 @@ jwtutil_JWKS jwtutil_ParseJWKS(const char *bytes, err_t *err)
                                    ? json_string_value(leaf_json)
                                    : NULL;
                 }
-                uint8_t *buffer;
+                const size_t leaf_len = leaf_str ? strlen(leaf_str) : 0;
+                uint8_t *buffer = malloc(util_Base64_DecodedLen(leaf_len));
                 size_t buffer_len;
-                cjose_base64_decode(leaf_str, strlen(leaf_str), &buffer,
-                                    &buffer_len, NULL);
-                const uint8_t *buffer_out = buffer;
-                X509 *cert = d2i_X509(NULL, &buffer_out, buffer_len);
-                if(cert) {
-                    arrput(jwks.x509_auths, cert);
+                if(util_Base64_Decode(leaf_str, leaf_len, buffer, &buffer_len,
+                                      UTIL_BASE64_STD)) {
+                    const uint8_t *buffer_out = buffer;
+                    X509 *cert = d2i_X509(NULL, &buffer_out, buffer_len);
+                    if(cert) {
+                        arrput(jwks.x509_auths, cert);
+                    }
                 }
 
                 free(buffer);
@@ -233,12 +236,9 @@ static char *BN_to_str(const BIGNUM *bn)
         BN_bn2bin(bn, out_bn);
 
         // raw array of bytes to base64
-        char *out_bn_base64 = NULL;
-        size_t out_bn_base64_len;
-        cjose_err j_err;
-        cjose_base64url_encode(out_bn, arrlenu(out_bn), &out_bn_base64,
-                               &out_bn_base64_len, &j_err);
-        out_bn_base64[out_bn_base64_len] = 0;
+        char *out_bn_base64 = malloc(
+            util_Base64_EncodedLen(num_bytes, UTIL_BASE64_URL) + 1);
+        util_Base64_Encode(out_bn, num_bytes, out_bn_base64, UTIL_BASE64_URL);
         arrfree(out_bn);
 
         return out_bn_base64;
@@ -336,12 +336,10 @@ static json_t *X509_to_json(X509 *cert)
         unsigned char *out_cert = NULL;
         int out_cert_len = i2d_X509(cert, &out_cert);
         if(out_cert_len > 0) {
-            char *out_cert_base64 = NULL;
-            size_t out_cert_base64_len;
-            cjose_err j_err;
-            cjose_base64_encode(out_cert, out_cert_len, &out_cert_base64,
-                                &out_cert_base64_len, &j_err);
-            out_cert_base64[out_cert_base64_len] = 0;
+            char *out_cert_base64 = malloc(
+                util_Base64_EncodedLen(out_cert_len, UTIL_BASE64_STD) + 1);
+            util_Base64_Encode(out_cert, out_cert_len, out_cert_base64,
+                               UTIL_BASE64_STD);
             OPENSSL_free(out_cert);
             json_t *x5c_json = json_pack("[s]", out_cert_base64);
             free(out_cert_base64);
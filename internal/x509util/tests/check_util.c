@@ -107,6 +107,73 @@ START_TEST(test_x509util_ParseCertificates)
 }
 END_TEST
 
+START_TEST(test_x509util_ParseCertificates_concatenated)
+{
+    const int COPIES = 64;
+
+    FILE *f = fopen("./resources/certs.pem", "r");
+    string_t buffer = FILE_to_string(f);
+    fclose(f);
+
+    BIO *bio_mem = BIO_new(BIO_s_mem());
+    BIO_puts(bio_mem, buffer);
+    arrfree(buffer);
+
+    X509 *cert = PEM_read_bio_X509(bio_mem, NULL, NULL, NULL);
+    ck_assert_ptr_ne(cert, NULL);
+
+    const int der_len = i2d_X509(cert, NULL);
+    ck_assert_int_gt(der_len, 0);
+
+    // a large bundle of concatenated DER certificates
+    byte *der_bytes = malloc((size_t) der_len * COPIES + 4);
+    byte *pout = der_bytes;
+    for(int i = 0; i < COPIES; ++i) {
+        i2d_X509(cert, &pout);
+    }
+
+    err_t err;
+    X509 **parsed_certs
+        = x509util_ParseCertificates(der_bytes, pout - der_bytes, &err);
+    ck_assert_uint_eq(err, NO_ERROR);
+    ck_assert_uint_eq(arrlenu(parsed_certs), COPIES);
+    for(size_t i = 0, size = arrlenu(parsed_certs); i < size; ++i) {
+        ck_assert_int_eq(X509_cmp(cert, parsed_certs[i]), 0);
+        X509_free(parsed_certs[i]);
+    }
+    arrfree(parsed_certs);
+
+    // trailing bytes that are not a certificate stop the parsing
+    memset(pout, 0xff, 4);
+    parsed_certs
+        = x509util_ParseCertificates(der_bytes, pout - der_bytes + 4, &err);
+    ck_assert_uint_eq(err, NO_ERROR);
+    ck_assert_uint_eq(arrlenu(parsed_certs), COPIES);
+    for(size_t i = 0, size = arrlenu(parsed_certs); i < size; ++i) {
+        X509_free(parsed_certs[i]);
+    }
+    arrfree(parsed_certs);
+
+    // truncated certificate
+    parsed_certs = x509util_ParseCertificates(der_bytes, der_len - 1, &err);
+    ck_assert_uint_ne(err, NO_ERROR);
+    ck_assert_uint_eq(arrlenu(parsed_certs), 0);
+    arrfree(parsed_certs);
+
+    parsed_certs = x509util_ParseCertificates(der_bytes, 0, &err);
+    ck_assert_ptr_eq(parsed_certs, NULL);
+    ck_assert_uint_ne(err, NO_ERROR);
+
+    parsed_certs = x509util_ParseCertificates(NULL, der_len, &err);
+    ck_assert_ptr_eq(parsed_certs, NULL);
+    ck_assert_uint_ne(err, NO_ERROR);
+
+    free(der_bytes);
+    X509_free(cert);
+    BIO_free(bio_mem);
+}
+END_TEST
+
 START_TEST(test_x509util_ParsePrivateKey)
 {
     FILE *f = fopen("./resources/key-pkcs8-rsa.pem", "r");
@@ -236,6 +303,7 @@ Suite *util_suite(void)
 
     tcase_add_test(tc_core, test_x509util_CopyX509Authorities);
     tcase_add_test(tc_core, test_x509util_ParseCertificates);
+    tcase_add_test(tc_core, test_x509util_ParseCertificates_concatenated);
     tcase_add_test(tc_core, test_x509util_ParsePrivateKey);
     tcase_add_test(tc_core, test_x509util_CertsEqual);
     tcase_add_test(tc_core, test_x509util_NewCertPool);
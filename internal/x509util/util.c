@@ -23,18 +23,22 @@
  */
 
 #include "c-spiffe/internal/x509util/util.h"
+#include <limits.h>
 #include <openssl/x509.h>
 
 X509 **x509util_ParseCertificates(const byte *bytes, const size_t len,
                                   err_t *err)
 {
     *err = ERR_DEFAULT;
-    BIO *bio_mem = BIO_new(BIO_s_mem());
 
-    if(BIO_write(bio_mem, bytes, len) > 0) {
+    if(bytes && len > 0 && len <= LONG_MAX) {
         X509 **certs = NULL;
-        while(true) {
-            X509 *cert = d2i_X509_bio(bio_mem, NULL);
+        // d2i_X509 decodes straight from the caller's buffer and advances
+        // ptr past each certificate, so no intermediate copy is made
+        const byte *ptr = bytes;
+        const byte *const end = bytes + len;
+        while(ptr < end) {
+            X509 *cert = d2i_X509(NULL, &ptr, (long) (end - ptr));
             if(cert) {
                 arrput(certs, cert);
             } else {
@@ -55,10 +59,10 @@ EVP_PKEY *x509util_ParsePrivateKey(const byte *bytes, const size_t len,
                                    err_t *err)
 {
     *err = ERR_DEFAULT;
-    BIO *bio_mem = BIO_new(BIO_s_mem());
 
-    if(BIO_write(bio_mem, bytes, len) > 0) {
-        EVP_PKEY *pkey = d2i_PrivateKey_bio(bio_mem, NULL);
+    if(bytes && len > 0 && len <= LONG_MAX) {
+        const byte *ptr = bytes;
+        EVP_PKEY *pkey = d2i_AutoPrivateKey(NULL, &ptr, (long) len);
 
         if(pkey)
             *err = NO_ERROR;
@@ -66,12 +66,14 @@ SSL *spiffetls_DialWithMode(in_port_t port, in_addr_t addr,
     if(!mode->unneeded_source) {
         workloadapi_X509Source *source = mode->source;
         if(!source) {
-            source = workloadapi_NewX509Source(NULL, err);
+            // share the process-wide source for the default address
+            source = workloadapi_AcquireX509Source(NULL, err);
             if(*err) {
                 // could not create source
                 *err = ERR_CREATE;
                 goto error;
             }
+            mode->shared_source = true;
 
             /**err = workloadapi_X509Source_Start(source);
             if(*err) {
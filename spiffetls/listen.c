@@ -81,11 +81,13 @@ SSL *spiffetls_ListenWithMode(in_port_t port, spiffetls_ListenMode *mode,
     if(!mode->unneeded_source) {
         workloadapi_X509Source *source = mode->source;
         if(!source) {
-            source = workloadapi_NewX509Source(NULL, err);
+            // share the process-wide source for the default address
+            source = workloadapi_AcquireX509Source(NULL, err);
             if(*err) {
                 *err = ERR_CREATE;
                 goto error;
             }
+            mode->shared_source = true;
 
             /**err = workloadapi_X509Source_Start(source);
             if(*err) {
@@ -176,11 +178,13 @@ SSL *spiffetls_PollWithMode(in_port_t port, spiffetls_ListenMode *mode,
     if(!mode->unneeded_source) {
         workloadapi_X509Source *source = mode->source;
         if(!source) {
-            source = workloadapi_NewX509Source(NULL, err);
+            // share the process-wide source for the default address
+            source = workloadapi_AcquireX509Source(NULL, err);
             if(*err) {
                 *err = ERR_CREATE;
                 goto error;
             }
+            mode->shared_source = true;
         }
         mode->source = source;
         mode->bundle = x509bundle_SourceFromSource(source);
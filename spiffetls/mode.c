@@ -162,6 +162,14 @@ void spiffetls_DialMode_Free(spiffetls_DialMode *mode)
     if(mode) {
         tlsconfig_Authorizer_Free(mode->authorizer);
         x509util_CertPool_Free(mode->roots);
+        if(mode->shared_source) {
+            // the wrappers only point to the shared source
+            free(mode->bundle);
+            free(mode->svid);
+            workloadapi_ReleaseX509Source(mode->source);
+            free(mode);
+            return;
+        }
         workloadapi_X509Source *source
             = mode->bundle ? mode->bundle->source.source : NULL;
         x509bundle_Source_Free(mode->bundle);
@@ -260,6 +268,14 @@ void spiffetls_ListenMode_Free(spiffetls_ListenMode *mode)
 {
     if(mode) {
         tlsconfig_Authorizer_Free(mode->authorizer);
+        if(mode->shared_source) {
+            // the wrappers only point to the shared source
+            free(mode->bundle);
+            free(mode->svid);
+            workloadapi_ReleaseX509Source(mode->source);
+            free(mode);
+            return;
+        }
         workloadapi_X509Source *source
             = mode->bundle ? mode->bundle->source.source : NULL;
         x509bundle_Source_Free(mode->bundle);
@@ -0,0 +1,493 @@
+/**
+ *
+ * (C) Copyright 2020-2021 Hewlett Packard Enterprise Development LP
+ *
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include "c-spiffe/svid/jwtsvid/claims.h"
+#include <limits.h>
+
+typedef struct {
+    char *pos;
+    char *end;
+} jwtsvid_Scanner;
+
+// called with the scanner on the value of a member, which it must consume
+typedef bool (*member_func_t)(jwtsvid_Scanner *, const char *, int, void *);
+
+static bool skip_value(jwtsvid_Scanner *s, int depth);
+
+static void skip_ws(jwtsvid_Scanner *s)
+{
+    while(s->pos < s->end
+          && (*s->pos == ' ' || *s->pos == '\t' || *s->pos == '\n'
+              || *s->pos == '\r')) {
+        ++(s->pos);
+    }
+}
+
+static bool expect(jwtsvid_Scanner *s, char c)
+{
+    if(s->pos < s->end && *s->pos == c) {
+        ++(s->pos);
+        return true;
+    }
+    return false;
+}
+
+static int hex_value(char c)
+{
+    if(c >= '0' && c <= '9')
+        return c - '0';
+    else if(c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    else if(c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+// reads the four hex digits of a \u escape
+static long scan_hex4(jwtsvid_Scanner *s)
+{
+    if(s->end - s->pos < 4) {
+        return -1;
+    }
+    long value = 0;
+    for(int i = 0; i < 4; ++i) {
+        const int digit = hex_value(*s->pos++);
+        if(digit < 0) {
+            return -1;
+        }
+        value = value << 4 | digit;
+    }
+    return value;
+}
+
+// checks the UTF-8 sequence starting at pos, returning its length, or 0
+static size_t utf8_length(const unsigned char *pos, const unsigned char *end)
+{
+    size_t len;
+    unsigned char min = 0x80, max = 0xBF;
+    if(*pos < 0x80) {
+        return 1;
+    } else if(*pos >= 0xC2 && *pos <= 0xDF) {
+        len = 2;
+    } else if(*pos >= 0xE0 && *pos <= 0xEF) {
+        len = 3;
+        // no overlong forms nor surrogates
+        if(*pos == 0xE0)
+            min = 0xA0;
+        else if(*pos == 0xED)
+            max = 0x9F;
+    } else if(*pos >= 0xF0 && *pos <= 0xF4) {
+        len = 4;
+        if(*pos == 0xF0)
+            min = 0x90;
+        else if(*pos == 0xF4)
+            max = 0x8F;
+    } else {
+        return 0;
+    }
+    if((size_t) (end - pos) < len || pos[1] < min || pos[1] > max) {
+        return 0;
+    }
+    for(size_t i = 2; i < len; ++i) {
+        if(pos[i] < 0x80 || pos[i] > 0xBF) {
+            return 0;
+        }
+    }
+    return len;
+}
+
+static char *put_utf8(char *out, long cp)
+{
+    if(cp < 0x80) {
+        *out++ = (char) cp;
+    } else if(cp < 0x800) {
+        *out++ = (char) (0xC0 | cp >> 6);
+        *out++ = (char) (0x80 | (cp & 0x3F));
+    } else if(cp < 0x10000) {
+        *out++ = (char) (0xE0 | cp >> 12);
+        *out++ = (char) (0x80 | (cp >> 6 & 0x3F));
+        *out++ = (char) (0x80 | (cp & 0x3F));
+    } else {
+        *out++ = (char) (0xF0 | cp >> 18);
+        *out++ = (char) (0x80 | (cp >> 12 & 0x3F));
+        *out++ = (char) (0x80 | (cp >> 6 & 0x3F));
+        *out++ = (char) (0x80 | (cp & 0x3F));
+    }
+    return out;
+}
+
+// scans the string at pos, unescaping it over itself. An escape is never
+// shorter than the bytes it stands for, so the text is only written behind
+// the scanner, and the closing quote leaves room for the terminator
+static bool scan_string(jwtsvid_Scanner *s, const char **str)
+{
+    if(!expect(s, '"')) {
+        return false;
+    }
+    char *out = s->pos;
+    *str = out;
+    while(s->pos < s->end) {
+        const char c = *s->pos;
+        if(c == '"') {
+            ++(s->pos);
+            *out = '\0';
+            return true;
+        } else if((unsigned char) c < 0x20) {
+            // control characters must be escaped
+            return false;
+        } else if(c != '\\') {
+            const size_t len = utf8_length((const unsigned char *) s->pos,
+                                           (const unsigned char *) s->end);
+            if(len == 0) {
+                return false;
+            }
+            // nothing to move until the first escape
+            if(out != s->pos) {
+                memmove(out, s->pos, len);
+            }
+            out += len;
+            s->pos += len;
+            continue;
+        }
+
+        if(++(s->pos) == s->end) {
+            return false;
+        }
+        switch(*s->pos++) {
+        case '"':
+            *out++ = '"';
+            break;
+        case '\\':
+            *out++ = '\\';
+            break;
+        case '/':
+            *out++ = '/';
+            break;
+        case 'b':
+            *out++ = '\b';
+            break;
+        case 'f':
+            *out++ = '\f';
+            break;
+        case 'n':
+            *out++ = '\n';
+            break;
+        case 'r':
+            *out++ = '\r';
+            break;
+        case 't':
+            *out++ = '\t';
+            break;
+        case 'u': {
+            long cp = scan_hex4(s);
+            if(cp >= 0xD800 && cp <= 0xDBFF) {
+                // high surrogate, the low one must follow
+                if(!expect(s, '\\') || !expect(s, 'u')) {
+                    return false;
+                }
+                const long low = scan_hex4(s);
+                if(low < 0xDC00 || low > 0xDFFF) {
+                    return false;
+                }
+                cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+            } else if(cp <= 0 || (cp >= 0xDC00 && cp <= 0xDFFF)) {
+                // invalid, a lone low surrogate or a null character
+                return false;
+            }
+            out = put_utf8(out, cp);
+            break;
+        }
+        default:
+            return false;
+        }
+    }
+    // no closing quote
+    return false;
+}
+
+static bool is_digit(jwtsvid_Scanner *s)
+{
+    return s->pos < s->end && *s->pos >= '0' && *s->pos <= '9';
+}
+
+// scans a number. value is set to it if it is an integer that fits, -1
+// otherwise
+static bool scan_number(jwtsvid_Scanner *s, time_t *value)
+{
+    const bool negative = expect(s, '-');
+    if(!is_digit(s)) {
+        return false;
+    }
+    bool integer = true;
+    long long n = 0;
+    if(*s->pos == '0') {
+        ++(s->pos);
+    } else {
+        while(is_digit(s)) {
+            const int digit = *s->pos++ - '0';
+            if(n > (LLONG_MAX - digit) / 10) {
+                integer = false;
+            } else {
+                n = n * 10 + digit;
+            }
+        }
+    }
+    if(expect(s, '.')) {
+        integer = false;
+        if(!is_digit(s)) {
+            return false;
+        }
+        while(is_digit(s)) {
+            ++(s->pos);
+        }
+    }
+    if(expect(s, 'e') || expect(s, 'E')) {
+        integer = false;
+        if(!expect(s, '+')) {
+            expect(s, '-');
+        }
+        if(!is_digit(s)) {
+            return false;
+        }
+        while(is_digit(s)) {
+            ++(s->pos);
+        }
+    }
+    *value = integer ? (time_t) (negative ? -n : n) : -1;
+    return true;
+}
+
+static bool scan_literal(jwtsvid_Scanner *s, const char *literal)
+{
+    const size_t len = strlen(literal);
+    if((size_t) (s->end - s->pos) < len || memcmp(s->pos, literal, len)) {
+        return false;
+    }
+    s->pos += len;
+    return true;
+}
+
+static bool skip_member(jwtsvid_Scanner *s, const char *key, int depth,
+                        void *arg)
+{
+    return skip_value(s, depth);
+}
+
+// scans the members of the object at pos, calling member on each value
+static bool scan_object(jwtsvid_Scanner *s, int depth, member_func_t member,
+                        void *arg)
+{
+    if(depth > JWTSVID_SCAN_MAX_DEPTH || !expect(s, '{')) {
+        return false;
+    }
+    skip_ws(s);
+    if(expect(s, '}')) {
+        return true;
+    }
+    do {
+        skip_ws(s);
+        const char *key;
+        if(!scan_string(s, &key)) {
+            return false;
+        }
+        skip_ws(s);
+        if(!expect(s, ':')) {
+            return false;
+        }
+        skip_ws(s);
+        if(!member(s, key, depth + 1, arg)) {
+            return false;
+        }
+        skip_ws(s);
+    } while(expect(s, ','));
+
+    return expect(s, '}');
+}
+
+static bool skip_array(jwtsvid_Scanner *s, int depth)
+{
+    if(depth > JWTSVID_SCAN_MAX_DEPTH || !expect(s, '[')) {
+        return false;
+    }
+    skip_ws(s);
+    if(expect(s, ']')) {
+        return true;
+    }
+    do {
+        skip_ws(s);
+        if(!skip_value(s, depth + 1)) {
+            return false;
+        }
+        skip_ws(s);
+    } while(expect(s, ','));
+
+    return expect(s, ']');
+}
+
+static bool skip_value(jwtsvid_Scanner *s, int depth)
+{
+    if(s->pos == s->end) {
+        return false;
+    }
+    const char *str;
+    time_t number;
+    switch(*s->pos) {
+    case '{':
+        return scan_object(s, depth, skip_member, NULL);
+    case '[':
+        return skip_array(s, depth);
+    case '"':
+        return scan_string(s, &str);
+    case 't':
+        return scan_literal(s, "true");
+    case 'f':
+        return scan_literal(s, "false");
+    case 'n':
+        return scan_literal(s, "null");
+    default:
+        return scan_number(s, &number);
+    }
+}
+
+// sets str to the string at pos, or NULL if the value is something else
+static bool scan_string_member(jwtsvid_Scanner *s, int depth,
+                               const char **str)
+{
+    if(s->pos < s->end && *s->pos == '"') {
+        return scan_string(s, str);
+    }
+    *str = NULL;
+    return skip_value(s, depth);
+}
+
+// sets value to the integer at pos, or -1 if the value is something else
+static bool scan_time_member(jwtsvid_Scanner *s, int depth, time_t *value)
+{
+    if(s->pos < s->end && (*s->pos == '-' || is_digit(s))) {
+        return scan_number(s, value);
+    }
+    *value = -1;
+    return skip_value(s, depth);
+}
+
+// the audience is a string or an array, whose strings are kept
+static bool scan_audience(jwtsvid_Scanner *s, int depth,
+                          const char ***audience)
+{
+    arrsetlen(*audience, 0);
+    const char *str;
+    if(s->pos < s->end && *s->pos == '"') {
+        if(!scan_string(s, &str)) {
+            return false;
+        }
+        arrput(*audience, str);
+        return true;
+    } else if(s->pos == s->end || *s->pos != '[') {
+        return skip_value(s, depth);
+    } else if(depth > JWTSVID_SCAN_MAX_DEPTH) {
+        return false;
+    }
+
+    ++(s->pos);
+    skip_ws(s);
+    if(expect(s, ']')) {
+        return true;
+    }
+    do {
+        skip_ws(s);
+        if(s->pos < s->end && *s->pos == '"') {
+            if(!scan_string(s, &str)) {
+                return false;
+            }
+            arrput(*audience, str);
+        } else if(!skip_value(s, depth + 1)) {
+            return false;
+        }
+        skip_ws(s);
+    } while(expect(s, ','));
+
+    return expect(s, ']');
+}
+
+static bool header_member(jwtsvid_Scanner *s, const char *key, int depth,
+                          void *arg)
+{
+    jwtsvid_Header *header = arg;
+    if(!strcmp(key, "alg"))
+        return scan_string_member(s, depth, &(header->alg));
+    else if(!strcmp(key, "kid"))
+        return scan_string_member(s, depth, &(header->kid));
+    else if(!strcmp(key, "typ"))
+        return scan_string_member(s, depth, &(header->typ));
+    return skip_value(s, depth);
+}
+
+static bool claims_member(jwtsvid_Scanner *s, const char *key, int depth,
+                          void *arg)
+{
+    jwtsvid_Claims *claims = arg;
+    if(!strcmp(key, "iss"))
+        return scan_string_member(s, depth, &(claims->issuer));
+    else if(!strcmp(key, "sub"))
+        return scan_string_member(s, depth, &(claims->subject));
+    else if(!strcmp(key, "jti"))
+        return scan_string_member(s, depth, &(claims->id));
+    else if(!strcmp(key, "exp"))
+        return scan_time_member(s, depth, &(claims->expiry));
+    else if(!strcmp(key, "nbf"))
+        return scan_time_member(s, depth, &(claims->not_before));
+    else if(!strcmp(key, "iat"))
+        return scan_time_member(s, depth, &(claims->issued_at));
+    else if(!strcmp(key, "aud"))
+        return scan_audience(s, depth, &(claims->audience));
+    return skip_value(s, depth);
+}
+
+// scans a whole text holding one object
+static err_t scan_document(char *json, size_t len, member_func_t member,
+                           void *arg)
+{
+    jwtsvid_Scanner s = { .pos = json, .end = json + len };
+    skip_ws(&s);
+    if(scan_object(&s, 1, member, arg)) {
+        skip_ws(&s);
+        if(s.pos == s.end) {
+            return NO_ERROR;
+        }
+    }
+    // not a json object
+    return ERR_PARSING;
+}
+
+err_t jwtsvid_ScanHeader(char *json, size_t len, jwtsvid_Header *header)
+{
+    memset(header, 0, sizeof *header);
+    return scan_document(json, len, header_member, header);
+}
+
+err_t jwtsvid_ScanClaims(char *json, size_t len, jwtsvid_Claims *claims)
+{
+    memset(claims, 0, sizeof *claims);
+    return scan_document(json, len, claims_member, claims);
+}
@@ -24,214 +24,100 @@
 
 #include "c-spiffe/svid/jwtsvid/parse.h"
 #include "c-spiffe/bundle/jwtbundle/source.h"
+#include "c-spiffe/svid/jwtsvid/claims.h"
+#include "c-spiffe/svid/jwtsvid/verifier.h"
+#include "c-spiffe/utils/base64.h"
 #include <cjose/cjose.h>
-#include <openssl/ec.h>
-#include <openssl/ecdsa.h>
 #include <time.h>
 
 // one minute leeway
 const time_t DEFAULT_LEEWAY = 60L;
 
-typedef struct {
-    string_t issuer;
-    string_t subject;
-    string_arr_t audience;
-    time_t expiry;
-    time_t not_before;
-    time_t issued_at;
-    string_t id;
-} jwtsvid_Claims;
+// decoded header and payload of most tokens fit on the stack
+#define JWTSVID_DECODE_STACK 2048
 
-static void jwtsvid_JWT_Free(jwtsvid_JWT *jwt)
+// frees what token_to_jwt allocated
+static void jwtsvid_JWT_Release(jwtsvid_JWT *jwt, char *stack_buffer)
 {
-    if(jwt) {
-        free(jwt->header);
-        free(jwt->payload);
-        arrfree(jwt->header_str);
-        arrfree(jwt->payload_str);
-        arrfree(jwt->signature);
+    arrfree(jwt->claims.audience);
+    if(jwt->decoded != stack_buffer) {
+        free(jwt->decoded);
+    }
+    jwt->decoded = NULL;
+}
 
-        free(jwt);
+// decodes a Base64URL JSON part of a token into out, null terminated
+static bool decode_part(const char *part, size_t len, char *out,
+                        size_t *out_len)
+{
+    if(util_Base64_Decode(part, len, (uint8_t *) out, out_len,
+                          UTIL_BASE64_URL)) {
+        out[*out_len] = '\0';
+        return true;
     }
+    return false;
 }
 
-static jwtsvid_JWT *token_to_jwt(char *token, err_t *err)
+// splits the token in one scan, leaving it untouched, and scans the header
+// and payload. The parts of the JWT point into the token, its fields into
+// the decoded buffer, which is stack_buffer if it fits
+static err_t token_to_jwt(const char *token, size_t len, jwtsvid_JWT *jwt,
+                          char *stack_buffer, size_t stack_size)
 {
+    memset(jwt, 0, sizeof *jwt);
     if(token) {
-        const char dot[] = ".";
-        const char *header = strtok(token, dot);
-        if(!empty_str(header)) {
-            string_t header_new = string_new(header);
-            uint8_t *header_str = NULL;
-            size_t header_str_len;
-            cjose_base64url_decode(header, strlen(header), &header_str,
-                                   &header_str_len, NULL);
-            char *payload = strtok(NULL, dot);
-            payload[-1] = '.';
-
-            if(!empty_str(payload)) {
-                string_t payload_new = string_new(payload);
-                uint8_t *payload_str = NULL;
-                size_t payload_str_len;
-                cjose_base64url_decode(payload, strlen(payload), &payload_str,
-                                       &payload_str_len, NULL);
-
-                jwtsvid_JWT *jwt = malloc(sizeof *jwt);
-                jwt->header_str = header_new;
-                jwt->payload_str = payload_new;
-                jwt->header = json_loadb((const char *) header_str,
-                                         header_str_len, 0, NULL);
-                jwt->payload = json_loadb((const char *) payload_str,
-                                          payload_str_len, 0, NULL);
-
-                char *signature = strtok(NULL, dot);
-                signature[-1] = '.';
-                jwt->signature = string_new(signature);
-                free(header_str);
-                free(payload_str);
-
-                if(jwt->header && jwt->payload && jwt->signature) {
-                    // everything was parsed correctly
-                    *err = NO_ERROR;
-                    return jwt;
-                }
-                // error parsing
-                jwtsvid_JWT_Free(jwt);
-                *err = ERR_PARSING;
-                return NULL;
+        const char *end = token + len;
+        const char *dot1 = memchr(token, '.', len);
+        const char *dot2
+            = dot1 ? memchr(dot1 + 1, '.', end - (dot1 + 1)) : NULL;
+        const char *payload_end = dot2 ? dot2 : end;
+
+        if(dot1 && dot1 > token && payload_end > dot1 + 1) {
+            jwt->header_str = token;
+            jwt->header_len = dot1 - token;
+            jwt->payload_str = dot1 + 1;
+            jwt->payload_len = payload_end - (dot1 + 1);
+            jwt->signature = dot2 ? dot2 + 1 : NULL;
+            jwt->signature_len = dot2 ? end - (dot2 + 1) : 0;
+
+            const size_t header_size
+                = util_Base64_DecodedLen(jwt->header_len) + 1;
+            const size_t size = header_size
+                                + util_Base64_DecodedLen(jwt->payload_len)
+                                + 1;
+            jwt->decoded = size <= stack_size ? stack_buffer : malloc(size);
+            char *payload = jwt->decoded + header_size;
+            size_t header_len, payload_len;
+
+            if(jwt->signature_len > 0
+               && decode_part(jwt->header_str, jwt->header_len,
+                              jwt->decoded, &header_len)
+               && decode_part(jwt->payload_str, jwt->payload_len, payload,
+                              &payload_len)
+               && !jwtsvid_ScanHeader(jwt->decoded, header_len,
+                                      &(jwt->header))
+               && !jwtsvid_ScanClaims(payload, payload_len,
+                                      &(jwt->claims))) {
+                // everything was parsed correctly
+                return NO_ERROR;
             }
-            arrfree(header_new);
-            free(header_str);
+            // error parsing
+            jwtsvid_JWT_Release(jwt, stack_buffer);
+            return ERR_PARSING;
         }
         // header or payload are empty
-        *err = ERR_EMPTY_DATA;
-        return NULL;
+        return ERR_EMPTY_DATA;
     }
     // token is null
-    *err = ERR_NULL_TOKEN;
-    return NULL;
-}
-
-static string_t ec_sig_to_as1n(const uint8_t *sig, size_t len, unsigned deg,
-                               bool *suc)
-{
-    const unsigned bn_len = (deg + 7) / 8;
-    string_t ret_sig = NULL;
-    *suc = false;
-    if(2 * bn_len == len) {
-        // get left side from signature
-        BIGNUM *bn_r = BN_bin2bn(sig, bn_len, NULL);
-        // get right side from signature
-        BIGNUM *bn_s = BN_bin2bn(sig + bn_len, bn_len, NULL);
-
-        // create a EC signature from EC point
-        ECDSA_SIG *ec_sig = ECDSA_SIG_new();
-        ECDSA_SIG_set0(ec_sig, bn_r, bn_s);
-
-        // get length to reserve on string
-        int sig_len = i2d_ECDSA_SIG(ec_sig, NULL);
-
-        if(sig_len > 0) {
-            arrsetlen(ret_sig, sig_len);
-            unsigned char *p_out = (unsigned char *) ret_sig;
-
-            // convert EC signature to DER format
-            i2d_ECDSA_SIG(ec_sig, &p_out);
-            *suc = true;
-        }
-
-        ECDSA_SIG_free(ec_sig);
-    }
-
-    return ret_sig;
+    return ERR_NULL_TOKEN;
 }
 
 static err_t validate_jwt(jwtsvid_JWT *jwt, EVP_PKEY *pkey)
 {
     if(jwt) {
-        json_t *alg_json = json_object_get(jwt->header, "alg");
-
-        const char *alg_str = NULL;
-        if(alg_json)
-            alg_str = json_typeof(alg_json) == JSON_STRING
-                          ? json_string_value(alg_json)
-                          : NULL;
-
-        if(alg_str) {
-            int sha_alg_num = 0;
-            sscanf(alg_str, "%*c%*c%d", &sha_alg_num);
-
-            const EVP_MD *(*sha_alg)(void) = NULL;
-            if(sha_alg_num == 256)
-                sha_alg = EVP_sha256;
-            else if(sha_alg_num == 384)
-                sha_alg = EVP_sha384;
-            else if(sha_alg_num == 512)
-                sha_alg = EVP_sha512;
-
-            if(sha_alg) {
-                EVP_MD_CTX *ctx = EVP_MD_CTX_new();
-
-                const int init
-                    = EVP_DigestVerifyInit(ctx, NULL, sha_alg(), NULL, pkey);
-                if(init != 1) {
-                    EVP_MD_CTX_free(ctx);
-                    // could not initialize ctx with public key
-                    return ERR_INITIALIZING;
-                }
-
-                string_t md = string_new(jwt->header_str);
-                md = string_push(md, ".");
-                md = string_push(md, jwt->payload_str);
-
-                uint8_t *buffer;
-                size_t buffer_size;
-                cjose_base64url_decode(jwt->signature, strlen(jwt->signature),
-                                       &buffer, &buffer_size, NULL);
-
-                int ret = EVP_DigestVerifyUpdate(
-                    ctx, (const unsigned char *) md, strlen(md));
-                if(ret != 1) {
-                    EVP_MD_CTX_free(ctx);
-                    arrfree(md);
-                    free(buffer);
-                    // could not initialize ctx with message digest
-                    return ERR_INITIALIZING;
-                }
-
-                const int key_type = EVP_PKEY_base_id(pkey);
-
-                if(key_type == EVP_PKEY_RSA) {
-                    ret = EVP_DigestVerifyFinal(
-                        ctx, (const unsigned char *) buffer, buffer_size);
-                } else if(key_type == EVP_PKEY_EC) {
-                    EC_KEY *ec_key = EVP_PKEY_get0_EC_KEY(pkey);
-                    const int deg
-                        = EC_GROUP_get_degree(EC_KEY_get0_group(ec_key));
-
-                    bool suc;
-                    string_t sig
-                        = ec_sig_to_as1n(buffer, buffer_size, deg, &suc);
-                    if(suc && sig) {
-                        ret = EVP_DigestVerifyFinal(
-                            ctx, (const unsigned char *) sig, arrlenu(sig));
-                    } else {
-                        ret = 0;
-                    }
-                    arrfree(sig);
-                }
-
-                EVP_MD_CTX_free(ctx);
-                arrfree(md);
-                free(buffer);
-
-                if(ret == 1)
-                    return NO_ERROR;
-                // the signature does not match the MD
-                return ERR_UNMATCH;
-            }
-            // invalid algorithm
-            return ERR_INVALID_ALGORITHM;
+        if(jwt->header.alg) {
+            // same checks as a verifier, without its prepared state
+            return jwtsvid_VerifyJWT(jwt, pkey);
         }
         // could not get algorithm field
         return ERR_INVALID_DATA;
@@ -240,20 +126,7 @@ static err_t validate_jwt(jwtsvid_JWT *jwt, EVP_PKEY *pkey)
     return ERR_NULL_JWT;
 }
 
-static void jwtsvid_Claims_Free(jwtsvid_Claims *claims)
-{
-    if(claims) {
-        arrfree(claims->issuer);
-        arrfree(claims->subject);
-        arrfree(claims->id);
-        for(size_t i = 0, size = arrlenu(claims->audience); i < size; ++i) {
-            arrfree(claims->audience[i]);
-        }
-        arrfree(claims->audience);
-    }
-}
-
-static map_string_claim *json_to_map(json_t *obj)
+map_string_claim *jwtsvid_ClaimsFromJSON(json_t *obj)
 {
     if(obj) {
         if(json_typeof(obj) == JSON_OBJECT) {
@@ -274,42 +147,37 @@ static map_string_claim *json_to_map(json_t *obj)
     return NULL;
 }
 
-static map_string_claim *parseAndValidate(jwtsvid_JWT *jwt,
-                                          spiffeid_TrustDomain td, void *arg,
-                                          err_t *err)
+const char *jwtsvid_JWT_KeyID(jwtsvid_JWT *jwt)
 {
-    if(jwt) {
-        json_t *kid_json = json_object_get(jwt->header, "kid");
-        json_t *type_json = json_object_get(jwt->header, "typ");
-
-        const char *kid_str = NULL;
-        bool type_correct = true;
-        if(kid_json) {
-            kid_str = json_typeof(kid_json) == JSON_STRING
-                          ? json_string_value(kid_json)
-                          : NULL;
-        }
-        if(type_json) {
-            const char *type_str = json_typeof(type_json) == JSON_STRING
-                                       ? json_string_value(type_json)
-                                       : NULL;
-            if(type_str) {
-                if(strcmp(type_str, "JWT") != 0
-                   && strcmp(type_str, "JOSE") != 0) {
-                    type_correct = false;
-                }
-            }
+    const char *kid_str = jwt->header.kid;
+    const char *type_str = jwt->header.typ;
+
+    bool type_correct = true;
+    if(type_str) {
+        if(strcmp(type_str, "JWT") != 0 && strcmp(type_str, "JOSE") != 0) {
+            type_correct = false;
         }
+    }
+
+    return !empty_str(kid_str) && type_correct ? kid_str : NULL;
+}
 
-        if(!empty_str(kid_str) && type_correct) {
-            jwtbundle_Source *bundles = arg;
+// verifies the token signature with the bundle key it names. On success,
+// sets pkey to the key used and kid to a copy of its ID, if not NULL
+static err_t verifyToken(jwtsvid_JWT *jwt, spiffeid_TrustDomain td,
+                         jwtbundle_Source *bundles, EVP_PKEY **pkey_out,
+                         string_t *kid_out)
+{
+    if(jwt) {
+        const char *kid_str = jwtsvid_JWT_KeyID(jwt);
+        if(kid_str) {
+            err_t err;
             jwtbundle_Bundle *bundle
                 = jwtbundle_Source_GetJWTBundleForTrustDomain(bundles, td,
-                                                              err);
-            if(*err) {
+                                                              &err);
+            if(err) {
                 // could not find bundle for given trust domain
-                *err = ERR_NOT_FOUND;
-                return NULL;
+                return ERR_NOT_FOUND;
             }
 
             bool suc;
@@ -317,122 +185,70 @@ static map_string_claim *parseAndValidate(jwtsvid_JWT *jwt,
                 = jwtbundle_Bundle_FindJWTAuthority(bundle, kid_str, &suc);
 
             if(suc) {
-                err_t err2 = validate_jwt(jwt, pkey);
-                if(!err2) {
-                    map_string_claim *claims = json_to_map(jwt->payload);
-                    if(claims) {
-                        *err = NO_ERROR;
-                        return claims;
+                err = validate_jwt(jwt, pkey);
+                if(!err) {
+                    if(pkey_out && kid_out) {
+                        *pkey_out = pkey;
+                        *kid_out = string_new(kid_str);
                     }
-                    // error converting payload to a map
-                    *err = ERR_PARSING;
-                    return NULL;
+                    return NO_ERROR;
                 }
                 // not validated
-                *err = ERR_INVALID_DATA;
-                return NULL;
+                return ERR_INVALID_DATA;
             }
             // authority not found
-            *err = ERR_NOAUTHORITY;
-            return NULL;
+            return ERR_NOAUTHORITY;
         }
         // key id is empty or type is incorrect
-        *err = ERR_EMPTY_DATA;
-        return NULL;
+        return ERR_EMPTY_DATA;
     }
     // jwt is NULL
-    *err = ERR_NULL_JWT;
-    return NULL;
+    return ERR_NULL_JWT;
 }
 
-static map_string_claim *parseInsecure(jwtsvid_JWT *jwt,
-                                       spiffeid_TrustDomain td, void *unused,
-                                       err_t *err)
+// the claims map is left to jwtsvid_SVID_GetClaims
+static map_string_claim *parseAndValidate(jwtsvid_JWT *jwt,
+                                          spiffeid_TrustDomain td, void *arg,
+                                          err_t *err)
 {
-    if(jwt) {
-        map_string_claim *claims = json_to_map(jwt->payload);
-        if(claims) {
-            *err = NO_ERROR;
-            return claims;
-        }
-        // payload is not a json object
-        *err = ERR_PAYLOAD;
-        return NULL;
-    }
-    // jwt is NULL
-    *err = ERR_NULL_JWT;
+    *err = verifyToken(jwt, td, arg, NULL, NULL);
     return NULL;
 }
 
-static jwtsvid_Claims *json_to_claims(json_t *obj)
-{
-    if(obj) {
-        if(json_typeof(obj) == JSON_OBJECT) {
-            json_t *issuer_json = json_object_get(obj, "iss");
-            json_t *subject_json = json_object_get(obj, "sub");
-            json_t *id_json = json_object_get(obj, "jti");
-            json_t *expiry_json = json_object_get(obj, "exp");
-            json_t *notbefore_json = json_object_get(obj, "nbf");
-            json_t *issuedat_json = json_object_get(obj, "iat");
-            json_t *audience_json = json_object_get(obj, "aud");
-
-            jwtsvid_Claims *claims = malloc(sizeof *claims);
-            memset(claims, 0, sizeof *claims);
-
-            if(issuer_json)
-                claims->issuer
-                    = json_typeof(issuer_json) == JSON_STRING
-                          ? string_new(json_string_value(issuer_json))
-                          : NULL;
-            if(subject_json)
-                claims->subject
-                    = json_typeof(subject_json) == JSON_STRING
-                          ? string_new(json_string_value(subject_json))
-                          : NULL;
-            if(id_json)
-                claims->id = json_typeof(id_json) == JSON_STRING
-                                 ? string_new(json_string_value(id_json))
-                                 : NULL;
-            if(expiry_json)
-                claims->expiry = json_typeof(expiry_json) == JSON_INTEGER
-                                     ? (time_t) json_integer_value(expiry_json)
-                                     : -1;
-            if(notbefore_json)
-                claims->not_before
-                    = json_typeof(notbefore_json) == JSON_INTEGER
-                          ? (time_t) json_integer_value(notbefore_json)
-                          : -1;
-            if(issuedat_json)
-                claims->issued_at
-                    = json_typeof(issuedat_json) == JSON_INTEGER
-                          ? (time_t) json_integer_value(issuedat_json)
-                          : -1;
-
-            if(audience_json) {
-                if(json_typeof(audience_json) == JSON_ARRAY) {
-                    size_t i;
-                    json_t *value;
-                    json_array_foreach(audience_json, i, value)
-                    {
-                        if(json_typeof(value) == JSON_STRING) {
-                            arrput(claims->audience,
-                                   string_new(json_string_value(value)));
-                        }
-                    }
-                } else if(json_typeof(audience_json) == JSON_STRING) {
-                    arrput(claims->audience,
-                           string_new(json_string_value(audience_json)));
-                }
-            }
+// argument of parseAndValidateKey, getting back the key that verified and
+// the time claims
+typedef struct {
+    jwtbundle_Source *bundles;
+    EVP_PKEY *pkey;
+    string_t kid;
+    time_t not_before;
+    time_t issued_at;
+} jwtsvid_Verification;
 
-            return claims;
-        }
+static map_string_claim *parseAndValidateKey(jwtsvid_JWT *jwt,
+                                             spiffeid_TrustDomain td,
+                                             void *arg, err_t *err)
+{
+    jwtsvid_Verification *verification = arg;
+    *err = verifyToken(jwt, td, verification->bundles, &(verification->pkey),
+                       &(verification->kid));
+    if(!*err) {
+        verification->not_before = jwt->claims.not_before;
+        verification->issued_at = jwt->claims.issued_at;
     }
+    return NULL;
+}
 
+static map_string_claim *parseInsecure(jwtsvid_JWT *jwt,
+                                       spiffeid_TrustDomain td, void *unused,
+                                       err_t *err)
+{
+    // the payload was scanned as a json object already
+    *err = jwt ? NO_ERROR : ERR_NULL_JWT;
     return NULL;
 }
 
-static bool strarr_contains(string_arr_t arr, string_t str)
+static bool strarr_contains(const char **arr, const char *str)
 {
     for(size_t i = 0, size = arrlenu(arr); i < size; ++i) {
         if(!strcmp(arr[i], str))
@@ -476,10 +292,8 @@ static err_t validate_claims(jwtsvid_Claims *claims, string_arr_t audience)
 static err_t jwtsvid_validateTokenAlgorithm(jwtsvid_JWT *jwt)
 {
     if(jwt) {
-        if(json_typeof(jwt->header) == JSON_OBJECT) {
-            json_t *alg_json = json_object_get(jwt->header, "alg");
-            const char *alg_str = json_string_value(alg_json);
-
+        const char *alg_str = jwt->header.alg;
+        if(alg_str) {
             const char *supported_algs[] = {
                 CJOSE_HDR_ALG_RS256, CJOSE_HDR_ALG_RS384, CJOSE_HDR_ALG_RS512,
                 CJOSE_HDR_ALG_ES256, CJOSE_HDR_ALG_ES384, CJOSE_HDR_ALG_ES512,
@@ -497,97 +311,273 @@ static err_t jwtsvid_validateTokenAlgorithm(jwtsvid_JWT *jwt)
             // algorithm not supported
             return ERR_INVALID_ALGORITHM;
         }
-        // header is not a json object
-        return ERR_INVALID_DATA;
+        // alg is missing or not a string
+        return ERR_INVALID_ALGORITHM;
     }
     // jwt object is NULL
     return ERR_NULL_JWT;
 }
 
-jwtsvid_SVID *jwtsvid_ParseAndValidate(char *token, jwtbundle_Source *bundles,
+jwtsvid_SVID *jwtsvid_ParseAndValidate(const char *token,
+                                       jwtbundle_Source *bundles,
                                        string_arr_t audience, err_t *err)
 {
-    return jwtsvid_parse(token, audience, parseAndValidate, bundles, err);
+    // keeps an update from freeing the bundle and key mid verification
+    workloadapi_JWTSnapshot *snapshot;
+    jwtbundle_Source pinned;
+    bundles = jwtbundle_Source_Pin(bundles, &pinned, &snapshot);
+    jwtsvid_SVID *svid
+        = jwtsvid_parse(token, audience, parseAndValidate, bundles, err);
+    workloadapi_JWTSnapshot_Release(snapshot);
+
+    return svid;
 }
 
-jwtsvid_SVID *jwtsvid_ParseInsecure(char *token, string_arr_t audience,
-                                    err_t *err)
+jwtsvid_SVID *jwtsvid_ParseAndValidateView(const char *token, size_t len,
+                                           jwtbundle_Source *bundles,
+                                           string_arr_t audience, err_t *err)
 {
-    return jwtsvid_parse(token, audience, parseInsecure, NULL, err);
+    workloadapi_JWTSnapshot *snapshot;
+    jwtbundle_Source pinned;
+    bundles = jwtbundle_Source_Pin(bundles, &pinned, &snapshot);
+    jwtsvid_SVID *svid = jwtsvid_parseView(token, len, audience,
+                                           parseAndValidate, bundles, err);
+    workloadapi_JWTSnapshot_Release(snapshot);
+
+    return svid;
 }
 
-jwtsvid_SVID *jwtsvid_parse(char *token, string_arr_t audience,
-                            token_validator_t validator, void *arg, err_t *err)
+// whether the bundle still has the key that verified the entry
+static bool entry_key_current(jwtsvid_TokenCacheEntry *entry,
+                              jwtbundle_Source *bundles)
 {
-    jwtsvid_JWT *jwt = NULL;
-    jwtsvid_Claims *claims = NULL;
-    if(token) {
-        err_t err2;
-        jwt = token_to_jwt(token, &err2);
+    err_t err;
+    jwtbundle_Bundle *bundle = jwtbundle_Source_GetJWTBundleForTrustDomain(
+        bundles, entry->svid->id.td, &err);
+    if(err) {
+        return false;
+    }
+    bool suc;
+    EVP_PKEY *pkey
+        = jwtbundle_Bundle_FindJWTAuthority(bundle, entry->kid, &suc);
+    if(!suc) {
+        return false;
+    } else if(pkey == entry->pkey) {
+        // updates usually share the key
+        return true;
+    }
+    // a bundle fetched again has a copy
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    return EVP_PKEY_eq(pkey, entry->pkey) == 1;
+#else
+    return EVP_PKEY_cmp(pkey, entry->pkey) == 1;
+#endif
+}
 
-        if(!err2) {
-            err2 = jwtsvid_validateTokenAlgorithm(jwt);
+// same checks as validate_claims, the audience is part of the digest
+static err_t validate_entry_times(jwtsvid_TokenCacheEntry *entry)
+{
+    const time_t now = time(NULL);
+    if(entry->svid->expiry < now - DEFAULT_LEEWAY) {
+        // expired
+        return ERR_EXPIRED;
+    } else if(entry->not_before > 0
+              && entry->not_before > now + DEFAULT_LEEWAY) {
+        // not valid yet
+        return ERR_INVALID_DATA;
+    } else if(entry->issued_at > 0
+              && entry->issued_at > now + DEFAULT_LEEWAY) {
+        // issued in the future
+        return ERR_DEFAULT;
+    }
 
-            if(!err2) {
-                claims = json_to_claims(jwt->payload);
+    return NO_ERROR;
+}
 
-                if(empty_str(claims->subject) || claims->expiry <= 0) {
-                    // either subject or expiry are missing
-                    *err = ERR_INVALID_DATA;
-                    goto ret;
-                }
+static jwtsvid_SVID *parseAndValidateCached(jwtsvid_TokenCache *cache,
+                                            const char *token,
+                                            jwtbundle_Source *bundles,
+                                            string_arr_t audience, err_t *err)
+{
+    if(!cache || !token || strlen(token) > JWTSVID_TOKENCACHE_MAX_TOKEN) {
+        return jwtsvid_ParseAndValidate(token, bundles, audience, err);
+    }
 
-                spiffeid_ID id = spiffeid_FromString(claims->subject, &err2);
+    const jwtsvid_TokenDigest digest
+        = jwtsvid_TokenCache_Digest(token, audience);
+    jwtsvid_TokenCacheShard *shard
+        = jwtsvid_TokenCache_GetShard(cache, &digest);
+
+    mtx_lock(&(shard->mtx));
+    jwtsvid_TokenCacheEntry *entry
+        = jwtsvid_TokenCacheShard_Get(shard, &digest);
+    if(entry && !entry_key_current(entry, bundles)) {
+        // the key was rotated out, the token has to be verified again
+        jwtsvid_TokenCacheShard_Remove(shard, entry);
+        ++(shard->stats.invalidations);
+        entry = NULL;
+    }
+    if(entry) {
+        ++(shard->stats.hits);
+        err_t err2 = validate_entry_times(entry);
+        if(err2 == ERR_EXPIRED) {
+            // would never be valid again
+            jwtsvid_TokenCacheShard_Remove(shard, entry);
+        }
+        jwtsvid_SVID *svid = err2 ? NULL : jwtsvid_SVID_Clone(entry->svid);
+        mtx_unlock(&(shard->mtx));
 
-                if(err2) {
-                    // subject claim is not a valid spiffe id
-                    *err = ERR_INVALID_CLAIM;
-                    goto ret;
-                }
+        // claims not valid, as jwtsvid_parse reports it
+        *err = err2 ? ERR_INVALID_CLAIM : NO_ERROR;
+        return svid;
+    }
+    ++(shard->stats.misses);
+    mtx_unlock(&(shard->mtx));
+
+    // verified out of the lock, so other tokens of the shard are served
+    jwtsvid_Verification verification = { .bundles = bundles };
+    jwtsvid_SVID *svid = jwtsvid_parse(token, audience, parseAndValidateKey,
+                                       &verification, err);
+    if(!svid) {
+        arrfree(verification.kid);
+        return NULL;
+    }
 
-                map_string_claim *claims_map = NULL;
-                sh_new_strdup(claims_map);
+    entry = malloc(sizeof *entry);
+    entry->digest = digest;
+    entry->svid = jwtsvid_SVID_Clone(svid);
+    EVP_PKEY_up_ref(verification.pkey);
+    entry->pkey = verification.pkey;
+    entry->kid = verification.kid;
+    entry->not_before = verification.not_before;
+    entry->issued_at = verification.issued_at;
+    entry->prev = entry->next = NULL;
+
+    mtx_lock(&(shard->mtx));
+    jwtsvid_TokenCacheShard_Put(shard, entry);
+    mtx_unlock(&(shard->mtx));
+
+    return svid;
+}
 
-                if(validator)
-                    claims_map = validator(jwt, spiffeid_ID_TrustDomain(id),
-                                           arg, &err2);
-                if(err2) {
-                    // could not validate jwt object
-                    *err = ERR_INVALID_JWT;
-                    goto ret;
-                }
+jwtsvid_SVID *jwtsvid_ParseAndValidateCached(jwtsvid_TokenCache *cache,
+                                             const char *token,
+                                             jwtbundle_Source *bundles,
+                                             string_arr_t audience, err_t *err)
+{
+    // the key of a new entry is referenced before the snapshot is released
+    workloadapi_JWTSnapshot *snapshot;
+    jwtbundle_Source pinned;
+    bundles = jwtbundle_Source_Pin(bundles, &pinned, &snapshot);
+    jwtsvid_SVID *svid
+        = parseAndValidateCached(cache, token, bundles, audience, err);
+    workloadapi_JWTSnapshot_Release(snapshot);
+
+    return svid;
+}
 
-                err2 = validate_claims(claims, audience);
-                if(err2) {
-                    // claims not valid
-                    *err = ERR_INVALID_CLAIM;
-                    goto ret;
-                }
+jwtsvid_SVID *jwtsvid_ParseInsecure(const char *token, string_arr_t audience,
+                                    err_t *err)
+{
+    return jwtsvid_parse(token, audience, parseInsecure, NULL, err);
+}
+
+jwtsvid_SVID *jwtsvid_parse(const char *token, string_arr_t audience,
+                            token_validator_t validator, void *arg, err_t *err)
+{
+    return jwtsvid_parseView(token, token ? strlen(token) : 0, audience,
+                             validator, arg, err);
+}
 
-                jwtsvid_SVID *svid = malloc(sizeof *svid);
-                svid->id = id;
-                svid->audience = claims->audience;
-                svid->expiry = claims->expiry;
-                svid->claims = claims_map;
-                svid->token = string_new(token);
+static void free_claims_map(map_string_claim *claims)
+{
+    for(size_t i = 0, size = shlenu(claims); i < size; ++i) {
+        json_decref(claims[i].value);
+    }
+    shfree(claims);
+}
 
-                jwtsvid_JWT_Free(jwt);
-                arrfree(claims->issuer);
-                arrfree(claims->subject);
-                arrfree(claims->id);
+jwtsvid_SVID *jwtsvid_parseView(const char *token, size_t len,
+                                string_arr_t audience,
+                                token_validator_t validator, void *arg,
+                                err_t *err)
+{
+    if(!token) {
+        // token is NULL
+        *err = ERR_NULL_TOKEN;
+        return NULL;
+    }
 
-                *err = NO_ERROR;
-                return svid;
-            }
-        }
+    char stack_buffer[JWTSVID_DECODE_STACK];
+    jwtsvid_JWT jwt;
+    err_t err2 = token_to_jwt(token, len, &jwt, stack_buffer,
+                              sizeof stack_buffer);
+    if(!err2) {
+        err2 = jwtsvid_validateTokenAlgorithm(&jwt);
+    }
+    if(err2) {
         // unable to parse token
+        jwtsvid_JWT_Release(&jwt, stack_buffer);
         *err = ERR_PARSING;
+        return NULL;
+    }
+
+    jwtsvid_Claims *claims = &(jwt.claims);
+    map_string_claim *claims_map = NULL;
+    spiffeid_ID id = { .td = { .name = NULL }, .path = NULL };
+    if(empty_str(claims->subject) || claims->expiry <= 0) {
+        // either subject or expiry are missing
+        *err = ERR_INVALID_DATA;
+        goto ret;
+    }
+
+    id = spiffeid_FromString(claims->subject, &err2);
+    if(err2) {
+        // subject claim is not a valid spiffe id
+        *err = ERR_INVALID_CLAIM;
+        goto ret;
+    }
+
+    if(validator)
+        claims_map
+            = validator(&jwt, spiffeid_ID_TrustDomain(id), arg, &err2);
+    if(err2) {
+        // could not validate jwt object. a missing bundle or key is
+        // reported as is, so callers can look elsewhere
+        *err = (err2 == ERR_NOT_FOUND || err2 == ERR_NOAUTHORITY)
+                   ? err2
+                   : ERR_INVALID_JWT;
         goto ret;
     }
-    // token is NULL
-    *err = ERR_NULL_TOKEN;
+
+    err2 = validate_claims(claims, audience);
+    if(err2) {
+        // claims not valid
+        *err = ERR_INVALID_CLAIM;
+        goto ret;
+    }
+
+    jwtsvid_SVID *svid = malloc(sizeof *svid);
+    svid->id = id;
+    svid->audience = NULL;
+    for(size_t i = 0, size = arrlenu(claims->audience); i < size; ++i) {
+        arrput(svid->audience, string_new(claims->audience[i]));
+    }
+    svid->expiry = claims->expiry;
+    // built on demand, unless the validator made it
+    svid->claims = claims_map;
+    atomic_init(&(svid->claims_state), claims_map ? JWTSVID_CLAIMS_BUILT
+                                                  : JWTSVID_CLAIMS_PENDING);
+    svid->token = string_new_range(token, token + len);
+
+    jwtsvid_JWT_Release(&jwt, stack_buffer);
+
+    *err = NO_ERROR;
+    return svid;
+
 ret:
-    jwtsvid_JWT_Free(jwt);
-    jwtsvid_Claims_Free(claims);
+    spiffeid_ID_Free(&id);
+    free_claims_map(claims_map);
+    jwtsvid_JWT_Release(&jwt, stack_buffer);
     return NULL;
 }
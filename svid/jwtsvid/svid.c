@@ -24,9 +24,12 @@
 
 #include "c-spiffe/svid/jwtsvid/svid.h"
 #include "c-spiffe/bundle/jwtbundle/source.h"
+#include "c-spiffe/utils/base64.h"
 #include <cjose/cjose.h>
 #include <openssl/ec.h>
 #include <openssl/ecdsa.h>
+#include <stdlib.h>
+#include <threads.h>
 
 // one minute leeway
 const time_t DEFAULT_LEEWAY = 60L;
@@ -38,6 +41,61 @@ const char *jwtsvid_SVID_Marshal(jwtsvid_SVID *svid)
     return NULL;
 }
 
+// claims map of the payload of token, NULL if it is not a JSON object
+static map_string_claim *jwtsvid_buildClaims(const char *token)
+{
+    map_string_claim *claims = NULL;
+    const char *payload = token ? strchr(token, '.') : NULL;
+    if(payload) {
+        ++payload;
+        const char *end = strchr(payload, '.');
+        const size_t len = end ? (size_t) (end - payload) : strlen(payload);
+
+        uint8_t *buffer = malloc(util_Base64_DecodedLen(len) + 1);
+        size_t buffer_len;
+        json_t *obj = NULL;
+        if(util_Base64_Decode(payload, len, buffer, &buffer_len,
+                              UTIL_BASE64_URL)) {
+            obj = json_loadb((const char *) buffer, buffer_len, 0, NULL);
+        }
+        free(buffer);
+
+        if(json_is_object(obj)) {
+            const char *key;
+            json_t *value;
+            sh_new_strdup(claims);
+            json_object_foreach(obj, key, value)
+            {
+                shput(claims, key, json_incref(value));
+            }
+        }
+        json_decref(obj);
+    }
+
+    return claims;
+}
+
+map_string_claim *jwtsvid_SVID_GetClaims(jwtsvid_SVID *svid)
+{
+    if(!svid) {
+        return NULL;
+    }
+    int state = JWTSVID_CLAIMS_PENDING;
+    if(atomic_compare_exchange_strong(&(svid->claims_state), &state,
+                                      JWTSVID_CLAIMS_BUILDING)) {
+        svid->claims = jwtsvid_buildClaims(svid->token);
+        atomic_store(&(svid->claims_state), JWTSVID_CLAIMS_BUILT);
+    } else {
+        // another caller is building it, which takes microseconds
+        while(state != JWTSVID_CLAIMS_BUILT) {
+            thrd_yield();
+            state = atomic_load(&(svid->claims_state));
+        }
+    }
+
+    return svid->claims;
+}
+
 void jwtsvid_SVID_Free(jwtsvid_SVID *svid)
 {
     if(svid) {
@@ -45,12 +103,81 @@ void jwtsvid_SVID_Free(jwtsvid_SVID *svid)
         spiffeid_ID_Free(&(svid->id));
         // free array of strings
         util_string_arr_t_Free(svid->audience);
-        // free each json object
+        // release each json object
         for(size_t i = 0, size = shlenu(svid->claims); i < size; ++i) {
-            free(svid->claims[i].value);
+            json_decref(svid->claims[i].value);
         }
         shfree(svid->claims);
         // free token string
         arrfree(svid->token);
+
+        free(svid);
     }
 }
+
+jwtsvid_SVID *jwtsvid_SVID_Clone(const jwtsvid_SVID *svid)
+{
+    if(svid) {
+        jwtsvid_SVID *clone = malloc(sizeof *clone);
+        clone->id.td.name = string_new(svid->id.td.name);
+        clone->id.path = string_new(svid->id.path);
+        clone->audience = NULL;
+        for(size_t i = 0, size = arrlenu(svid->audience); i < size; ++i) {
+            arrput(clone->audience, string_new(svid->audience[i]));
+        }
+        clone->expiry = svid->expiry;
+        // json objects are immutable after parsing, so they are shared.
+        // claims not built yet are built for the clone when it needs them
+        clone->claims = NULL;
+        const bool built
+            = atomic_load(&(svid->claims_state)) == JWTSVID_CLAIMS_BUILT;
+        atomic_init(&(clone->claims_state),
+                    built ? JWTSVID_CLAIMS_BUILT : JWTSVID_CLAIMS_PENDING);
+        if(built && svid->claims) {
+            sh_new_strdup(clone->claims);
+            for(size_t i = 0, size = shlenu(svid->claims); i < size; ++i) {
+                shput(clone->claims, svid->claims[i].key,
+                      json_incref(svid->claims[i].value));
+            }
+        }
+        clone->token = string_new(svid->token);
+
+        return clone;
+    }
+
+    return NULL;
+}
+
+static int cmp_string(const void *a, const void *b)
+{
+    return strcmp(*(const char **) a, *(const char **) b);
+}
+
+string_t jwtsvid_Params_Key(const jwtsvid_Params *params)
+{
+    // audiences are borrowed, only the array is allocated.
+    string_arr_t audiences = NULL;
+    // extra audiences are only sent along with audience
+    if(params->audience) {
+        arrput(audiences, params->audience);
+        for(size_t i = 0, size = arrlenu(params->extra_audiences); i < size;
+            ++i) {
+            arrput(audiences, params->extra_audiences[i]);
+        }
+    }
+    qsort(audiences, arrlenu(audiences), sizeof *audiences, cmp_string);
+
+    string_t key = spiffeid_ID_IsZero(params->subject)
+                       ? string_new("")
+                       : spiffeid_ID_String(params->subject);
+    for(size_t i = 0, size = arrlenu(audiences); i < size; ++i) {
+        if(i > 0 && !strcmp(audiences[i], audiences[i - 1])) {
+            continue;
+        }
+        key = string_push(key, "\n");
+        key = string_push(key, audiences[i]);
+    }
+    arrfree(audiences);
+
+    return key;
+}
@@ -0,0 +1,206 @@
+/**
+ *
+ * (C) Copyright 2020-2021 Hewlett Packard Enterprise Development LP
+ *
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include "c-spiffe/svid/jwtsvid/tokencache.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+static int jwtsvid_strcmp(const void *str1, const void *str2)
+{
+    return strcmp(*(const char *const *) str1, *(const char *const *) str2);
+}
+
+// hashes str prefixed by its length, so bytes cannot move between fields
+static void jwtsvid_digestString(EVP_MD_CTX *ctx, const char *str)
+{
+    const uint64_t len = strlen(str);
+    EVP_DigestUpdate(ctx, &len, sizeof len);
+    EVP_DigestUpdate(ctx, str, len);
+}
+
+static void jwtsvid_unlink(jwtsvid_TokenCacheShard *shard,
+                           jwtsvid_TokenCacheEntry *entry)
+{
+    if(entry->prev) {
+        entry->prev->next = entry->next;
+    } else {
+        shard->head = entry->next;
+    }
+    if(entry->next) {
+        entry->next->prev = entry->prev;
+    } else {
+        shard->tail = entry->prev;
+    }
+    entry->prev = entry->next = NULL;
+}
+
+static void jwtsvid_pushFront(jwtsvid_TokenCacheShard *shard,
+                              jwtsvid_TokenCacheEntry *entry)
+{
+    entry->prev = NULL;
+    entry->next = shard->head;
+    if(shard->head) {
+        shard->head->prev = entry;
+    } else {
+        shard->tail = entry;
+    }
+    shard->head = entry;
+}
+
+jwtsvid_TokenCache *jwtsvid_NewTokenCache(size_t max_entries)
+{
+    if(max_entries == 0) {
+        max_entries = JWTSVID_TOKENCACHE_DEFAULT_ENTRIES;
+    }
+    size_t capacity = max_entries / JWTSVID_TOKENCACHE_SHARDS;
+    if(capacity == 0) {
+        capacity = 1;
+    }
+
+    jwtsvid_TokenCache *cache = calloc(1, sizeof *cache);
+    for(int i = 0; i < JWTSVID_TOKENCACHE_SHARDS; ++i) {
+        cache->shards[i].capacity = capacity;
+        mtx_init(&(cache->shards[i].mtx), mtx_plain);
+    }
+
+    return cache;
+}
+
+void jwtsvid_TokenCacheEntry_Free(jwtsvid_TokenCacheEntry *entry)
+{
+    if(entry) {
+        jwtsvid_SVID_Free(entry->svid);
+        EVP_PKEY_free(entry->pkey);
+        arrfree(entry->kid);
+        free(entry);
+    }
+}
+
+void jwtsvid_TokenCache_Free(jwtsvid_TokenCache *cache)
+{
+    if(cache) {
+        for(int i = 0; i < JWTSVID_TOKENCACHE_SHARDS; ++i) {
+            jwtsvid_TokenCacheShard *shard = &(cache->shards[i]);
+            for(size_t j = 0, size = hmlenu(shard->entries); j < size; ++j) {
+                jwtsvid_TokenCacheEntry_Free(shard->entries[j].value);
+            }
+            hmfree(shard->entries);
+            mtx_destroy(&(shard->mtx));
+        }
+        free(cache);
+    }
+}
+
+jwtsvid_TokenCacheStats jwtsvid_TokenCache_GetStats(jwtsvid_TokenCache *cache)
+{
+    jwtsvid_TokenCacheStats stats = { 0, 0, 0, 0 };
+    for(int i = 0; i < JWTSVID_TOKENCACHE_SHARDS; ++i) {
+        jwtsvid_TokenCacheShard *shard = &(cache->shards[i]);
+        mtx_lock(&(shard->mtx));
+        stats.hits += shard->stats.hits;
+        stats.misses += shard->stats.misses;
+        stats.evictions += shard->stats.evictions;
+        stats.invalidations += shard->stats.invalidations;
+        mtx_unlock(&(shard->mtx));
+    }
+
+    return stats;
+}
+
+jwtsvid_TokenDigest jwtsvid_TokenCache_Digest(const char *token,
+                                              string_arr_t audience)
+{
+    // sorted, so the same set in any order has the same digest
+    const size_t size = arrlenu(audience);
+    const char **sorted = NULL;
+    if(size > 0) {
+        sorted = malloc(size * sizeof *sorted);
+        memcpy(sorted, audience, size * sizeof *sorted);
+        qsort(sorted, size, sizeof *sorted, jwtsvid_strcmp);
+    }
+
+    EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+    EVP_DigestInit_ex(ctx, EVP_sha256(), NULL);
+    jwtsvid_digestString(ctx, token);
+    for(size_t i = 0; i < size; ++i) {
+        if(i == 0 || strcmp(sorted[i - 1], sorted[i])) {
+            jwtsvid_digestString(ctx, sorted[i]);
+        }
+    }
+    jwtsvid_TokenDigest digest;
+    EVP_DigestFinal_ex(ctx, digest.bytes, NULL);
+    EVP_MD_CTX_free(ctx);
+    free(sorted);
+
+    return digest;
+}
+
+jwtsvid_TokenCacheShard *
+jwtsvid_TokenCache_GetShard(jwtsvid_TokenCache *cache,
+                            const jwtsvid_TokenDigest *digest)
+{
+    // the digest is uniformly distributed already
+    return &(cache->shards[digest->bytes[0] % JWTSVID_TOKENCACHE_SHARDS]);
+}
+
+jwtsvid_TokenCacheEntry *
+jwtsvid_TokenCacheShard_Get(jwtsvid_TokenCacheShard *shard,
+                            const jwtsvid_TokenDigest *digest)
+{
+    const ptrdiff_t idx = hmgeti(shard->entries, *digest);
+    if(idx < 0) {
+        return NULL;
+    }
+    jwtsvid_TokenCacheEntry *entry = shard->entries[idx].value;
+    if(entry != shard->head) {
+        jwtsvid_unlink(shard, entry);
+        jwtsvid_pushFront(shard, entry);
+    }
+
+    return entry;
+}
+
+void jwtsvid_TokenCacheShard_Put(jwtsvid_TokenCacheShard *shard,
+                                 jwtsvid_TokenCacheEntry *entry)
+{
+    if(hmgeti(shard->entries, entry->digest) >= 0) {
+        // cached by a concurrent validation of the same token
+        jwtsvid_TokenCacheEntry_Free(entry);
+        return;
+    }
+    if(hmlenu(shard->entries) >= shard->capacity) {
+        jwtsvid_TokenCacheShard_Remove(shard, shard->tail);
+        ++(shard->stats.evictions);
+    }
+    hmput(shard->entries, entry->digest, entry);
+    jwtsvid_pushFront(shard, entry);
+}
+
+void jwtsvid_TokenCacheShard_Remove(jwtsvid_TokenCacheShard *shard,
+                                    jwtsvid_TokenCacheEntry *entry)
+{
+    jwtsvid_unlink(shard, entry);
+    hmdel(shard->entries, entry->digest);
+    jwtsvid_TokenCacheEntry_Free(entry);
+}
@@ -0,0 +1,466 @@
+/**
+ *
+ * (C) Copyright 2020-2021 Hewlett Packard Enterprise Development LP
+ *
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include "c-spiffe/svid/jwtsvid/verifier.h"
+#include "c-spiffe/svid/jwtsvid/parse.h"
+#include "c-spiffe/utils/base64.h"
+#include <openssl/rsa.h>
+
+// bytes of r and s for the largest curve, P-521
+#define JWTSVID_EC_MAX_LEN 66
+
+// what a JWS algorithm verifies with
+typedef struct {
+    const char *name;
+    int key_type;
+    const EVP_MD *(*digest)(void);
+    // RSA padding, 0 for EC
+    int padding;
+    // degree of the curve, 0 for RSA
+    int ec_bits;
+} jwtsvid_Algorithm;
+
+// by index of jwtsvid_VerifierKey templates
+static const jwtsvid_Algorithm
+    jwtsvid_algorithms[JWTSVID_VERIFIER_ALGORITHMS]
+    = { { "RS256", EVP_PKEY_RSA, EVP_sha256, RSA_PKCS1_PADDING, 0 },
+        { "RS384", EVP_PKEY_RSA, EVP_sha384, RSA_PKCS1_PADDING, 0 },
+        { "RS512", EVP_PKEY_RSA, EVP_sha512, RSA_PKCS1_PADDING, 0 },
+        { "PS256", EVP_PKEY_RSA, EVP_sha256, RSA_PKCS1_PSS_PADDING, 0 },
+        { "PS384", EVP_PKEY_RSA, EVP_sha384, RSA_PKCS1_PSS_PADDING, 0 },
+        { "PS512", EVP_PKEY_RSA, EVP_sha512, RSA_PKCS1_PSS_PADDING, 0 },
+        { "ES256", EVP_PKEY_EC, EVP_sha256, 0, 256 },
+        { "ES384", EVP_PKEY_EC, EVP_sha384, 0, 384 },
+        { "ES512", EVP_PKEY_EC, EVP_sha512, 0, 521 } };
+
+static int algorithm_index(const char *alg)
+{
+    if(alg) {
+        for(int i = 0; i < JWTSVID_VERIFIER_ALGORITHMS; ++i) {
+            if(!strcmp(alg, jwtsvid_algorithms[i].name))
+                return i;
+        }
+    }
+
+    return -1;
+}
+
+// whether pkey is of the key type, and curve, the algorithm signs with
+static bool algorithm_fits(int alg, EVP_PKEY *pkey)
+{
+    const jwtsvid_Algorithm *algorithm = jwtsvid_algorithms + alg;
+    return EVP_PKEY_base_id(pkey) == algorithm->key_type
+           && (algorithm->key_type != EVP_PKEY_EC
+               || EVP_PKEY_bits(pkey) == algorithm->ec_bits);
+}
+
+// bytes of each of r and s in the EC signatures of pkey, 0 for RSA
+static size_t key_ec_len(EVP_PKEY *pkey)
+{
+    return EVP_PKEY_base_id(pkey) == EVP_PKEY_EC
+               ? (size_t) (EVP_PKEY_bits(pkey) + 7) / 8
+               : 0;
+}
+
+// initializes ctx for verifying the algorithm with pkey
+static err_t init_context(EVP_MD_CTX *ctx, int alg, EVP_PKEY *pkey)
+{
+    const jwtsvid_Algorithm *algorithm = jwtsvid_algorithms + alg;
+    EVP_PKEY_CTX *pkey_ctx = NULL;
+    if(EVP_DigestVerifyInit(ctx, &pkey_ctx, algorithm->digest(), NULL, pkey)
+       != 1) {
+        // could not initialize ctx with public key
+        return ERR_INITIALIZING;
+    }
+    if(algorithm->padding == RSA_PKCS1_PSS_PADDING
+       && (EVP_PKEY_CTX_set_rsa_padding(pkey_ctx, RSA_PKCS1_PSS_PADDING) != 1
+           || EVP_PKEY_CTX_set_rsa_pss_saltlen(pkey_ctx,
+                                               RSA_PSS_SALTLEN_DIGEST)
+                  != 1)) {
+        // could not set the PSS padding
+        return ERR_INITIALIZING;
+    }
+
+    return NO_ERROR;
+}
+
+static void jwtsvid_VerifierKey_Free(jwtsvid_VerifierKey *key)
+{
+    if(key) {
+        for(int i = 0; i < JWTSVID_VERIFIER_ALGORITHMS; ++i) {
+            EVP_MD_CTX_free(key->templates[i]);
+        }
+        EVP_PKEY_free(key->pkey);
+        util_string_t_Free(key->td);
+        free(key);
+    }
+}
+
+static jwtsvid_VerifierKey *prepare_key(EVP_PKEY *pkey, const char *td,
+                                        err_t *err)
+{
+    jwtsvid_VerifierKey *key = calloc(1, sizeof *key);
+    EVP_PKEY_up_ref(pkey);
+    key->pkey = pkey;
+    key->td = string_new(td);
+    key->key_type = EVP_PKEY_base_id(pkey);
+    key->ec_len = key_ec_len(pkey);
+    // all of them now, so readers never modify the key
+    bool fits = false;
+    for(int i = 0; i < JWTSVID_VERIFIER_ALGORITHMS; ++i) {
+        if(!algorithm_fits(i, pkey)) {
+            continue;
+        }
+        fits = true;
+        key->templates[i] = EVP_MD_CTX_new();
+        *err = init_context(key->templates[i], i, pkey);
+        if(*err) {
+            jwtsvid_VerifierKey_Free(key);
+            return NULL;
+        }
+    }
+    if(!fits) {
+        jwtsvid_VerifierKey_Free(key);
+        // key type not supported for JWT-SVIDs
+        *err = ERR_UNSUPPORTED_TYPE;
+        return NULL;
+    }
+
+    *err = NO_ERROR;
+    return key;
+}
+
+// encodes a big endian unsigned integer as a DER INTEGER
+static size_t der_integer(unsigned char *out, const uint8_t *bytes,
+                          size_t len)
+{
+    // shortest form, with a zero byte only to keep it positive
+    while(len > 1 && bytes[0] == 0) {
+        ++bytes;
+        --len;
+    }
+    const size_t pad = (bytes[0] & 0x80) ? 1 : 0;
+    out[0] = 0x02;
+    out[1] = (unsigned char) (len + pad);
+    out[2] = 0;
+    memcpy(out + 2 + pad, bytes, len);
+
+    return 2 + pad + len;
+}
+
+// converts a JWS EC signature, r and s concatenated, to the DER
+// ECDSA-Sig-Value OpenSSL verifies. out must hold 3 + 2 * (len / 2 + 3)
+// bytes
+static size_t ec_sig_to_der(unsigned char *out, const uint8_t *sig,
+                            size_t len)
+{
+    // content written after the longest header, moved if it is shorter
+    unsigned char *content = out + 3;
+    size_t content_len = der_integer(content, sig, len / 2);
+    content_len += der_integer(content + content_len, sig + len / 2, len / 2);
+
+    out[0] = 0x30;
+    if(content_len < 0x80) {
+        out[1] = (unsigned char) content_len;
+        memmove(out + 2, content, content_len);
+        return 2 + content_len;
+    }
+    out[1] = 0x81;
+    out[2] = (unsigned char) content_len;
+    return 3 + content_len;
+}
+
+// prepared key of kid, if it is still pkey. Called with the lock held
+static jwtsvid_VerifierKey *find_key(jwtsvid_Verifier *verifier,
+                                     const char *kid, EVP_PKEY *pkey)
+{
+    const ptrdiff_t index = util_shgeti_ts(verifier->keys, kid);
+    if(index < 0 || verifier->keys[index].value->pkey != pkey) {
+        return NULL;
+    }
+    return verifier->keys[index].value;
+}
+
+// drops the keys their bundle no longer has, or has replaced. Called with
+// the lock held for writing
+static void sweep_keys(jwtsvid_Verifier *verifier, jwtbundle_Source *bundles)
+{
+    // backwards, as shdel moves the last entry into the deleted one
+    for(ptrdiff_t i = shlen(verifier->keys) - 1; i >= 0; --i) {
+        jwtsvid_VerifierKey *key = verifier->keys[i].value;
+        const spiffeid_TrustDomain td = { key->td };
+        err_t err;
+        jwtbundle_Bundle *bundle
+            = jwtbundle_Source_GetJWTBundleForTrustDomain(bundles, td, &err);
+        bool suc = false;
+        EVP_PKEY *pkey
+            = err == NO_ERROR ? jwtbundle_Bundle_FindJWTAuthority(
+                  bundle, verifier->keys[i].key, &suc)
+                              : NULL;
+        if(!suc || pkey != key->pkey) {
+            jwtsvid_VerifierKey_Free(key);
+            shdel(verifier->keys, verifier->keys[i].key);
+        }
+    }
+}
+
+// drops the prepared key of a key ID its bundle no longer has
+static void forget_key(jwtsvid_Verifier *verifier,
+                       jwtbundle_Source *bundles, const char *kid)
+{
+    // most unknown key IDs were never prepared, so look first
+    pthread_rwlock_rdlock(&(verifier->lock));
+    const ptrdiff_t index = util_shgeti_ts(verifier->keys, kid);
+    pthread_rwlock_unlock(&(verifier->lock));
+    if(index >= 0) {
+        pthread_rwlock_wrlock(&(verifier->lock));
+        sweep_keys(verifier, bundles);
+        pthread_rwlock_unlock(&(verifier->lock));
+    }
+}
+
+// copies the prepared context for the token key and algorithm
+static EVP_MD_CTX *verifier_context(jwtsvid_Verifier *verifier,
+                                    jwtbundle_Source *bundles,
+                                    spiffeid_TrustDomain td, const char *kid,
+                                    EVP_PKEY *pkey, int alg, size_t *ec_len,
+                                    err_t *err)
+{
+    pthread_rwlock_rdlock(&(verifier->lock));
+    jwtsvid_VerifierKey *key = find_key(verifier, kid, pkey);
+    if(!key) {
+        // first token of the key ID, or the key was rotated
+        pthread_rwlock_unlock(&(verifier->lock));
+        pthread_rwlock_wrlock(&(verifier->lock));
+        // unless another thread prepared it in between
+        key = find_key(verifier, kid, pkey);
+    }
+    if(!key) {
+        key = prepare_key(pkey, td.name, err);
+        if(!key) {
+            pthread_rwlock_unlock(&(verifier->lock));
+            return NULL;
+        }
+        // the bundle changed, drop what it no longer has
+        sweep_keys(verifier, bundles);
+        jwtsvid_VerifierKey_Free(shget(verifier->keys, kid));
+        shput(verifier->keys, kid, key);
+    }
+
+    if(!key->templates[alg]) {
+        pthread_rwlock_unlock(&(verifier->lock));
+        // the key does not sign with the algorithm of the token
+        *err = ERR_INVALID_ALGORITHM;
+        return NULL;
+    }
+    EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+    if(EVP_MD_CTX_copy_ex(ctx, key->templates[alg]) != 1) {
+        EVP_MD_CTX_free(ctx);
+        ctx = NULL;
+    }
+    *ec_len = key->ec_len;
+    pthread_rwlock_unlock(&(verifier->lock));
+
+    *err = ctx ? NO_ERROR : ERR_INITIALIZING;
+    return ctx;
+}
+
+static err_t verify_signature(EVP_MD_CTX *ctx, jwtsvid_JWT *jwt,
+                              size_t ec_len)
+{
+    // the signed message is the token up to the second dot
+    if(EVP_DigestVerifyUpdate(ctx, jwt->header_str,
+                              jwt->header_len + 1 + jwt->payload_len)
+       != 1) {
+        // could not update ctx with message digest
+        return ERR_INITIALIZING;
+    }
+
+    uint8_t buffer[JWTSVID_MAX_SIGNATURE];
+    size_t buffer_size = 0;
+    if(util_Base64_DecodedLen(jwt->signature_len) > sizeof buffer
+       || !util_Base64_Decode(jwt->signature, jwt->signature_len, buffer,
+                              &buffer_size, UTIL_BASE64_URL)) {
+        // too long or not Base64URL, matches nothing
+        return ERR_UNMATCH;
+    }
+
+    int ret = 0;
+    if(ec_len == 0) {
+        ret = EVP_DigestVerifyFinal(ctx, buffer, buffer_size);
+    } else if(buffer_size == 2 * ec_len) {
+        unsigned char der[3 + 2 * (JWTSVID_EC_MAX_LEN + 3)];
+        const size_t der_len = ec_sig_to_der(der, buffer, buffer_size);
+        ret = EVP_DigestVerifyFinal(ctx, der, der_len);
+    }
+
+    // the signature does not match the MD
+    return ret == 1 ? NO_ERROR : ERR_UNMATCH;
+}
+
+err_t jwtsvid_VerifyJWT(jwtsvid_JWT *jwt, EVP_PKEY *pkey)
+{
+    const int alg = algorithm_index(jwt->header.alg);
+    if(alg < 0 || !algorithm_fits(alg, pkey)) {
+        // invalid algorithm, or not one the key signs with
+        return ERR_INVALID_ALGORITHM;
+    }
+
+    EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+    err_t err = init_context(ctx, alg, pkey);
+    if(!err) {
+        err = verify_signature(ctx, jwt, key_ec_len(pkey));
+    }
+    EVP_MD_CTX_free(ctx);
+
+    return err;
+}
+
+// argument of verifierValidate, with the bundles of the verifier pinned
+typedef struct {
+    jwtsvid_Verifier *verifier;
+    jwtbundle_Source *bundles;
+} jwtsvid_VerifierCall;
+
+static map_string_claim *verifierValidate(jwtsvid_JWT *jwt,
+                                          spiffeid_TrustDomain td, void *arg,
+                                          err_t *err)
+{
+    jwtsvid_VerifierCall *call = arg;
+    jwtsvid_Verifier *verifier = call->verifier;
+    const char *kid = jwtsvid_JWT_KeyID(jwt);
+    if(!kid) {
+        // key id is empty or type is incorrect
+        *err = ERR_EMPTY_DATA;
+        return NULL;
+    }
+
+    jwtbundle_Bundle *bundle
+        = jwtbundle_Source_GetJWTBundleForTrustDomain(call->bundles, td, err);
+    if(*err) {
+        // could not find bundle for given trust domain
+        *err = ERR_NOT_FOUND;
+        return NULL;
+    }
+    bool suc;
+    EVP_PKEY *pkey = jwtbundle_Bundle_FindJWTAuthority(bundle, kid, &suc);
+    if(!suc) {
+        forget_key(verifier, call->bundles, kid);
+        // authority not found
+        *err = ERR_NOAUTHORITY;
+        return NULL;
+    }
+
+    const int alg = algorithm_index(jwt->header.alg);
+    if(alg < 0) {
+        // invalid algorithm
+        *err = ERR_INVALID_ALGORITHM;
+        return NULL;
+    }
+
+    size_t ec_len;
+    EVP_MD_CTX *ctx = verifier_context(verifier, call->bundles, td, kid,
+                                       pkey, alg, &ec_len, err);
+    if(!ctx) {
+        return NULL;
+    }
+    *err = verify_signature(ctx, jwt, ec_len);
+    EVP_MD_CTX_free(ctx);
+    if(*err) {
+        // not validated
+        *err = ERR_INVALID_DATA;
+        return NULL;
+    }
+
+    // the claims map is left to jwtsvid_SVID_GetClaims
+    return NULL;
+}
+
+jwtsvid_Verifier *jwtsvid_NewVerifier(jwtbundle_Source *bundles,
+                                      string_arr_t audience, err_t *err)
+{
+    if(!bundles) {
+        *err = ERR_NULL;
+        return NULL;
+    }
+
+    jwtsvid_Verifier *verifier = malloc(sizeof *verifier);
+    verifier->bundles = bundles;
+    verifier->audience = NULL;
+    for(size_t i = 0, size = arrlenu(audience); i < size; ++i) {
+        arrput(verifier->audience, string_new(audience[i]));
+    }
+    verifier->keys = NULL;
+    sh_new_strdup(verifier->keys);
+    shdefault(verifier->keys, NULL);
+    pthread_rwlock_init(&(verifier->lock), NULL);
+
+    *err = NO_ERROR;
+    return verifier;
+}
+
+void jwtsvid_Verifier_Free(jwtsvid_Verifier *verifier)
+{
+    if(verifier) {
+        util_string_arr_t_Free(verifier->audience);
+        for(size_t i = 0, size = shlenu(verifier->keys); i < size; ++i) {
+            jwtsvid_VerifierKey_Free(verifier->keys[i].value);
+        }
+        shfree(verifier->keys);
+        pthread_rwlock_destroy(&(verifier->lock));
+        free(verifier);
+    }
+}
+
+jwtsvid_SVID *jwtsvid_Verifier_Validate(jwtsvid_Verifier *verifier,
+                                        const char *token, err_t *err)
+{
+    // keeps an update from freeing the bundle and key mid verification
+    workloadapi_JWTSnapshot *snapshot;
+    jwtbundle_Source pinned;
+    jwtsvid_VerifierCall call = { .verifier = verifier };
+    call.bundles
+        = jwtbundle_Source_Pin(verifier->bundles, &pinned, &snapshot);
+    jwtsvid_SVID *svid = jwtsvid_parse(token, verifier->audience,
+                                       verifierValidate, &call, err);
+    workloadapi_JWTSnapshot_Release(snapshot);
+
+    return svid;
+}
+
+jwtsvid_SVID *jwtsvid_Verifier_ValidateView(jwtsvid_Verifier *verifier,
+                                            const char *token, size_t len,
+                                            err_t *err)
+{
+    workloadapi_JWTSnapshot *snapshot;
+    jwtbundle_Source pinned;
+    jwtsvid_VerifierCall call = { .verifier = verifier };
+    call.bundles
+        = jwtbundle_Source_Pin(verifier->bundles, &pinned, &snapshot);
+    jwtsvid_SVID *svid = jwtsvid_parseView(token, len, verifier->audience,
+                                           verifierValidate, &call, err);
+    workloadapi_JWTSnapshot_Release(snapshot);
+
+    return svid;
+}
@@ -376,6 +376,22 @@ void x509svid_SVID_Free(x509svid_SVID *svid)
     }
 }
 
+x509svid_SVID *x509svid_SVID_Clone(const x509svid_SVID *svid)
+{
+    if(svid) {
+        x509svid_SVID *clone = malloc(sizeof *clone);
+        clone->id.td.name = string_new(svid->id.td.name);
+        clone->id.path = string_new(svid->id.path);
+        clone->certs = x509util_CopyX509Authorities(svid->certs);
+        EVP_PKEY_up_ref(svid->private_key);
+        clone->private_key = svid->private_key;
+
+        return clone;
+    }
+
+    return NULL;
+}
+
 x509svid_SVID *x509svid_SVID_GetDefaultX509SVID(x509svid_SVID **svids)
 {
     if(arrlenu(svids) > 0) {
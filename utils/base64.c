@@ -0,0 +1,489 @@
+/**
+ *
+ * (C) Copyright 2020-2021 Hewlett Packard Enterprise Development LP
+ *
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include "c-spiffe/utils/base64.h"
+#include <string.h>
+#include <threads.h>
+
+#if !defined(UTIL_BASE64_NO_SIMD) && defined(__GNUC__)                     \
+    && (defined(__x86_64__) || defined(__i386__))
+#define UTIL_BASE64_X86
+#include <immintrin.h>
+#endif
+
+// characters for 62 and 63, the only ones that differ between alphabets
+static const char base64_chars62[] = { '+', '-' };
+static const char base64_chars63[] = { '/', '_' };
+
+// 6 bit values by character, 0xFF outside the alphabet
+static uint8_t base64_values[2][256];
+static util_Base64Impl base64_best = UTIL_BASE64_SCALAR;
+static once_flag base64_once = ONCE_FLAG_INIT;
+
+static void base64_init(void)
+{
+    static const char common[]
+        = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789";
+    for(int a = 0; a < 2; ++a) {
+        memset(base64_values[a], 0xFF, sizeof base64_values[a]);
+        for(int i = 0; i < 62; ++i) {
+            base64_values[a][(uint8_t) common[i]] = (uint8_t) i;
+        }
+        base64_values[a][(uint8_t) base64_chars62[a]] = 62;
+        base64_values[a][(uint8_t) base64_chars63[a]] = 63;
+    }
+
+#ifdef UTIL_BASE64_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) {
+        base64_best = UTIL_BASE64_AVX2;
+    } else if(__builtin_cpu_supports("sse4.1")) {
+        base64_best = UTIL_BASE64_SSE41;
+    }
+#endif
+}
+
+static char base64_char(uint32_t value, util_Base64Alphabet alphabet)
+{
+    if(value < 26)
+        return 'A' + value;
+    else if(value < 52)
+        return 'a' + (value - 26);
+    else if(value < 62)
+        return '0' + (value - 52);
+    else if(value == 62)
+        return base64_chars62[alphabet];
+    return base64_chars63[alphabet];
+}
+
+// decodes from character i on, returns false on an invalid character or a
+// truncated group
+static bool decode_scalar(const char *in, size_t len, size_t i, uint8_t *out,
+                          size_t *out_len, util_Base64Alphabet alphabet)
+{
+    const uint8_t *values = base64_values[alphabet];
+    size_t o = *out_len;
+    for(; i + 4 <= len; i += 4) {
+        const uint32_t a = values[(uint8_t) in[i]];
+        const uint32_t b = values[(uint8_t) in[i + 1]];
+        const uint32_t c = values[(uint8_t) in[i + 2]];
+        const uint32_t d = values[(uint8_t) in[i + 3]];
+        if((a | b | c | d) & 0x80) {
+            return false;
+        }
+        const uint32_t group = a << 18 | b << 12 | c << 6 | d;
+        out[o++] = (uint8_t) (group >> 16);
+        out[o++] = (uint8_t) (group >> 8);
+        out[o++] = (uint8_t) group;
+    }
+
+    const size_t rest = len - i;
+    if(rest == 1) {
+        // a single character holds less than a byte
+        return false;
+    } else if(rest > 1) {
+        const uint32_t a = values[(uint8_t) in[i]];
+        const uint32_t b = values[(uint8_t) in[i + 1]];
+        const uint32_t c = rest == 3 ? values[(uint8_t) in[i + 2]] : 0;
+        if((a | b | c) & 0x80) {
+            return false;
+        }
+        const uint32_t group = a << 18 | b << 12 | c << 6;
+        out[o++] = (uint8_t) (group >> 16);
+        if(rest == 3) {
+            out[o++] = (uint8_t) (group >> 8);
+        }
+    }
+
+    *out_len = o;
+    return true;
+}
+
+// encodes from byte i on
+static size_t encode_scalar(const uint8_t *in, size_t len, size_t i,
+                            char *out, size_t o,
+                            util_Base64Alphabet alphabet)
+{
+    for(; i + 3 <= len; i += 3) {
+        const uint32_t group = in[i] << 16 | in[i + 1] << 8 | in[i + 2];
+        out[o++] = base64_char(group >> 18, alphabet);
+        out[o++] = base64_char((group >> 12) & 0x3F, alphabet);
+        out[o++] = base64_char((group >> 6) & 0x3F, alphabet);
+        out[o++] = base64_char(group & 0x3F, alphabet);
+    }
+
+    const size_t rest = len - i;
+    if(rest > 0) {
+        const uint32_t group
+            = in[i] << 16 | (rest == 2 ? in[i + 1] << 8 : 0);
+        out[o++] = base64_char(group >> 18, alphabet);
+        out[o++] = base64_char((group >> 12) & 0x3F, alphabet);
+        if(rest == 2) {
+            out[o++] = base64_char((group >> 6) & 0x3F, alphabet);
+        }
+        if(alphabet == UTIL_BASE64_STD) {
+            out[o++] = '=';
+            if(rest == 1) {
+                out[o++] = '=';
+            }
+        }
+    }
+    out[o] = '\0';
+
+    return o;
+}
+
+#ifdef UTIL_BASE64_X86
+/*
+ * The SIMD versions work on whole blocks of 16 or 32 characters and leave
+ * the rest to the scalar code. A block with an invalid character stops the
+ * loop, and the scalar code then reports it.
+ *
+ * Characters are mapped to values by range, the same way for both
+ * alphabets, and values are packed into bytes with multiply-adds, as
+ * described by Wojciech Mula and Daniel Lemire in "Faster Base64 Encoding
+ * and Decoding Using AVX2 Instructions".
+ */
+
+__attribute__((target("sse4.1"))) static __m128i
+sse41_values(__m128i in, char c62, char c63, int *valid)
+{
+    const __m128i upper
+        = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('A' - 1)),
+                        _mm_cmplt_epi8(in, _mm_set1_epi8('Z' + 1)));
+    const __m128i lower
+        = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('a' - 1)),
+                        _mm_cmplt_epi8(in, _mm_set1_epi8('z' + 1)));
+    const __m128i digit
+        = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('0' - 1)),
+                        _mm_cmplt_epi8(in, _mm_set1_epi8('9' + 1)));
+    const __m128i is62 = _mm_cmpeq_epi8(in, _mm_set1_epi8(c62));
+    const __m128i is63 = _mm_cmpeq_epi8(in, _mm_set1_epi8(c63));
+
+    const __m128i any = _mm_or_si128(
+        _mm_or_si128(upper, lower),
+        _mm_or_si128(digit, _mm_or_si128(is62, is63)));
+    *valid = _mm_movemask_epi8(any) == 0xFFFF;
+
+    __m128i shift = _mm_and_si128(upper, _mm_set1_epi8(-'A'));
+    shift = _mm_or_si128(shift,
+                         _mm_and_si128(lower, _mm_set1_epi8(26 - 'a')));
+    shift = _mm_or_si128(shift,
+                         _mm_and_si128(digit, _mm_set1_epi8(52 - '0')));
+    shift = _mm_or_si128(shift, _mm_and_si128(is62, _mm_set1_epi8(62 - c62)));
+    shift = _mm_or_si128(shift, _mm_and_si128(is63, _mm_set1_epi8(63 - c63)));
+
+    return _mm_add_epi8(in, shift);
+}
+
+// packs 16 values of 6 bits into the first 12 bytes
+__attribute__((target("sse4.1"))) static __m128i sse41_pack(__m128i values)
+{
+    const __m128i pairs
+        = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+    const __m128i groups = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00011000));
+    return _mm_shuffle_epi8(groups, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8,
+                                                  14, 13, 12, -1, -1, -1,
+                                                  -1));
+}
+
+__attribute__((target("sse4.1"))) static size_t
+decode_sse41(const char *in, size_t len, uint8_t *out, size_t *out_len,
+             util_Base64Alphabet alphabet)
+{
+    const char c62 = base64_chars62[alphabet];
+    const char c63 = base64_chars63[alphabet];
+    size_t i = 0, o = 0;
+    for(; i + 16 <= len; i += 16, o += 12) {
+        int valid;
+        const __m128i values = sse41_values(
+            _mm_loadu_si128((const __m128i *) (in + i)), c62, c63, &valid);
+        if(!valid) {
+            break;
+        }
+        const __m128i bytes = sse41_pack(values);
+        _mm_storel_epi64((__m128i *) (out + o), bytes);
+        const uint32_t last = (uint32_t) _mm_extract_epi32(bytes, 2);
+        memcpy(out + o + 8, &last, sizeof last);
+    }
+
+    *out_len = o;
+    return i;
+}
+
+// splits the first 12 bytes into 16 values of 6 bits
+__attribute__((target("sse4.1"))) static __m128i sse41_split(__m128i in)
+{
+    in = _mm_shuffle_epi8(in, _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8,
+                                            7, 10, 9, 11, 10));
+    const __m128i ac = _mm_mulhi_epu16(
+        _mm_and_si128(in, _mm_set1_epi32(0x0FC0FC00)),
+        _mm_set1_epi32(0x04000040));
+    const __m128i bd = _mm_mullo_epi16(
+        _mm_and_si128(in, _mm_set1_epi32(0x003F03F0)),
+        _mm_set1_epi32(0x01000010));
+    return _mm_or_si128(ac, bd);
+}
+
+__attribute__((target("sse4.1"))) static __m128i
+sse41_chars(__m128i values, char c62, char c63)
+{
+    __m128i shift = _mm_set1_epi8('A');
+    shift = _mm_blendv_epi8(shift, _mm_set1_epi8('a' - 26),
+                            _mm_cmpgt_epi8(values, _mm_set1_epi8(25)));
+    shift = _mm_blendv_epi8(shift, _mm_set1_epi8('0' - 52),
+                            _mm_cmpgt_epi8(values, _mm_set1_epi8(51)));
+    shift = _mm_blendv_epi8(shift, _mm_set1_epi8(c62 - 62),
+                            _mm_cmpeq_epi8(values, _mm_set1_epi8(62)));
+    shift = _mm_blendv_epi8(shift, _mm_set1_epi8(c63 - 63),
+                            _mm_cmpeq_epi8(values, _mm_set1_epi8(63)));
+    return _mm_add_epi8(values, shift);
+}
+
+__attribute__((target("sse4.1"))) static size_t
+encode_sse41(const uint8_t *in, size_t len, char *out, size_t *out_len,
+             util_Base64Alphabet alphabet)
+{
+    const char c62 = base64_chars62[alphabet];
+    const char c63 = base64_chars63[alphabet];
+    size_t i = 0, o = 0;
+    // 16 bytes are loaded for 12 used
+    for(; i + 16 <= len; i += 12, o += 16) {
+        const __m128i values
+            = sse41_split(_mm_loadu_si128((const __m128i *) (in + i)));
+        _mm_storeu_si128((__m128i *) (out + o),
+                         sse41_chars(values, c62, c63));
+    }
+
+    *out_len = o;
+    return i;
+}
+
+__attribute__((target("avx2"))) static __m256i
+avx2_values(__m256i in, char c62, char c63, int *valid)
+{
+    const __m256i upper = _mm256_and_si256(
+        _mm256_cmpgt_epi8(in, _mm256_set1_epi8('A' - 1)),
+        _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), in));
+    const __m256i lower = _mm256_and_si256(
+        _mm256_cmpgt_epi8(in, _mm256_set1_epi8('a' - 1)),
+        _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), in));
+    const __m256i digit = _mm256_and_si256(
+        _mm256_cmpgt_epi8(in, _mm256_set1_epi8('0' - 1)),
+        _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), in));
+    const __m256i is62 = _mm256_cmpeq_epi8(in, _mm256_set1_epi8(c62));
+    const __m256i is63 = _mm256_cmpeq_epi8(in, _mm256_set1_epi8(c63));
+
+    const __m256i any = _mm256_or_si256(
+        _mm256_or_si256(upper, lower),
+        _mm256_or_si256(digit, _mm256_or_si256(is62, is63)));
+    *valid = _mm256_movemask_epi8(any) == -1;
+
+    __m256i shift = _mm256_and_si256(upper, _mm256_set1_epi8(-'A'));
+    shift = _mm256_or_si256(
+        shift, _mm256_and_si256(lower, _mm256_set1_epi8(26 - 'a')));
+    shift = _mm256_or_si256(
+        shift, _mm256_and_si256(digit, _mm256_set1_epi8(52 - '0')));
+    shift = _mm256_or_si256(
+        shift, _mm256_and_si256(is62, _mm256_set1_epi8(62 - c62)));
+    shift = _mm256_or_si256(
+        shift, _mm256_and_si256(is63, _mm256_set1_epi8(63 - c63)));
+
+    return _mm256_add_epi8(in, shift);
+}
+
+__attribute__((target("avx2"))) static size_t
+decode_avx2(const char *in, size_t len, uint8_t *out, size_t *out_len,
+            util_Base64Alphabet alphabet)
+{
+    const char c62 = base64_chars62[alphabet];
+    const char c63 = base64_chars63[alphabet];
+    size_t i = 0, o = 0;
+    for(; i + 32 <= len; i += 32, o += 24) {
+        int valid;
+        const __m256i values = avx2_values(
+            _mm256_loadu_si256((const __m256i *) (in + i)), c62, c63,
+            &valid);
+        if(!valid) {
+            break;
+        }
+        const __m256i pairs
+            = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+        const __m256i groups
+            = _mm256_madd_epi16(pairs, _mm256_set1_epi32(0x00011000));
+        // 12 bytes at the start of each lane, then moved together
+        __m256i bytes = _mm256_shuffle_epi8(
+            groups, _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12,
+                                     -1, -1, -1, -1, 2, 1, 0, 6, 5, 4, 10, 9,
+                                     8, 14, 13, 12, -1, -1, -1, -1));
+        bytes = _mm256_permutevar8x32_epi32(
+            bytes, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+        _mm_storeu_si128((__m128i *) (out + o),
+                         _mm256_castsi256_si128(bytes));
+        _mm_storel_epi64((__m128i *) (out + o + 16),
+                         _mm256_extracti128_si256(bytes, 1));
+    }
+
+    *out_len = o;
+    return i;
+}
+
+__attribute__((target("avx2"))) static size_t
+encode_avx2(const uint8_t *in, size_t len, char *out, size_t *out_len,
+            util_Base64Alphabet alphabet)
+{
+    const char c62 = base64_chars62[alphabet];
+    const char c63 = base64_chars63[alphabet];
+    size_t i = 0, o = 0;
+    // 12 bytes per lane, the second lane loaded from byte 12
+    for(; i + 28 <= len; i += 24, o += 32) {
+        __m256i in256 = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(
+                _mm_loadu_si128((const __m128i *) (in + i))),
+            _mm_loadu_si128((const __m128i *) (in + i + 12)), 1);
+        in256 = _mm256_shuffle_epi8(
+            in256,
+            _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11,
+                             10, 1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9,
+                             11, 10));
+        const __m256i ac = _mm256_mulhi_epu16(
+            _mm256_and_si256(in256, _mm256_set1_epi32(0x0FC0FC00)),
+            _mm256_set1_epi32(0x04000040));
+        const __m256i bd = _mm256_mullo_epi16(
+            _mm256_and_si256(in256, _mm256_set1_epi32(0x003F03F0)),
+            _mm256_set1_epi32(0x01000010));
+        const __m256i values = _mm256_or_si256(ac, bd);
+
+        __m256i shift = _mm256_set1_epi8('A');
+        shift = _mm256_blendv_epi8(
+            shift, _mm256_set1_epi8('a' - 26),
+            _mm256_cmpgt_epi8(values, _mm256_set1_epi8(25)));
+        shift = _mm256_blendv_epi8(
+            shift, _mm256_set1_epi8('0' - 52),
+            _mm256_cmpgt_epi8(values, _mm256_set1_epi8(51)));
+        shift = _mm256_blendv_epi8(
+            shift, _mm256_set1_epi8(c62 - 62),
+            _mm256_cmpeq_epi8(values, _mm256_set1_epi8(62)));
+        shift = _mm256_blendv_epi8(
+            shift, _mm256_set1_epi8(c63 - 63),
+            _mm256_cmpeq_epi8(values, _mm256_set1_epi8(63)));
+        _mm256_storeu_si256((__m256i *) (out + o),
+                            _mm256_add_epi8(values, shift));
+    }
+
+    *out_len = o;
+    return i;
+}
+#endif
+
+size_t util_Base64_DecodedLen(size_t len)
+{
+    return len / 4 * 3 + (len % 4 > 1 ? len % 4 - 1 : 0);
+}
+
+size_t util_Base64_EncodedLen(size_t len, util_Base64Alphabet alphabet)
+{
+    if(alphabet == UTIL_BASE64_STD) {
+        return (len + 2) / 3 * 4;
+    }
+    return len / 3 * 4 + (len % 3 ? len % 3 + 1 : 0);
+}
+
+bool util_Base64_Supported(util_Base64Impl impl)
+{
+    call_once(&base64_once, base64_init);
+    switch(impl) {
+    case UTIL_BASE64_AUTO:
+    case UTIL_BASE64_SCALAR:
+        return true;
+    case UTIL_BASE64_SSE41:
+        return base64_best == UTIL_BASE64_SSE41
+               || base64_best == UTIL_BASE64_AVX2;
+    case UTIL_BASE64_AVX2:
+        return base64_best == UTIL_BASE64_AVX2;
+    }
+
+    return false;
+}
+
+bool util_Base64_DecodeWith(util_Base64Impl impl, const char *in, size_t len,
+                            uint8_t *out, size_t *out_len,
+                            util_Base64Alphabet alphabet)
+{
+    if(!util_Base64_Supported(impl)) {
+        return false;
+    }
+    if(impl == UTIL_BASE64_AUTO) {
+        impl = base64_best;
+    }
+    // padding carries no bits
+    for(int pad = 0; pad < 2 && len > 0 && in[len - 1] == '='; ++pad) {
+        --len;
+    }
+
+    size_t i = 0;
+    *out_len = 0;
+#ifdef UTIL_BASE64_X86
+    if(impl == UTIL_BASE64_AVX2) {
+        i = decode_avx2(in, len, out, out_len, alphabet);
+    } else if(impl == UTIL_BASE64_SSE41) {
+        i = decode_sse41(in, len, out, out_len, alphabet);
+    }
+#endif
+    return decode_scalar(in, len, i, out, out_len, alphabet);
+}
+
+size_t util_Base64_EncodeWith(util_Base64Impl impl, const uint8_t *in,
+                              size_t len, char *out,
+                              util_Base64Alphabet alphabet)
+{
+    if(!util_Base64_Supported(impl)) {
+        impl = UTIL_BASE64_SCALAR;
+    } else if(impl == UTIL_BASE64_AUTO) {
+        impl = base64_best;
+    }
+
+    size_t i = 0, o = 0;
+#ifdef UTIL_BASE64_X86
+    if(impl == UTIL_BASE64_AVX2) {
+        i = encode_avx2(in, len, out, &o, alphabet);
+    } else if(impl == UTIL_BASE64_SSE41) {
+        i = encode_sse41(in, len, out, &o, alphabet);
+    }
+#endif
+    return encode_scalar(in, len, i, out, o, alphabet);
+}
+
+bool util_Base64_Decode(const char *in, size_t len, uint8_t *out,
+                        size_t *out_len, util_Base64Alphabet alphabet)
+{
+    return util_Base64_DecodeWith(UTIL_BASE64_AUTO, in, len, out, out_len,
+                                  alphabet);
+}
+
+size_t util_Base64_Encode(const uint8_t *in, size_t len, char *out,
+                          util_Base64Alphabet alphabet)
+{
+    return util_Base64_EncodeWith(UTIL_BASE64_AUTO, in, len, out, alphabet);
+}
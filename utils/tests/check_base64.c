@@ -0,0 +1,167 @@
+/**
+ *
+ * (C) Copyright 2020-2021 Hewlett Packard Enterprise Development LP
+ *
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include "c-spiffe/utils/base64.h"
+#include <check.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const util_Base64Impl impls[]
+    = { UTIL_BASE64_SCALAR, UTIL_BASE64_SSE41, UTIL_BASE64_AVX2 };
+static const size_t num_impls = sizeof impls / sizeof *impls;
+
+// RFC 4648 section 10 test vectors
+START_TEST(test_util_Base64_vectors)
+{
+    const char *plain[] = { "", "f", "fo", "foo", "foob", "fooba", "foobar" };
+    const char *std[]
+        = { "", "Zg==", "Zm8=", "Zm9v", "Zm9vYg==", "Zm9vYmE=", "Zm9vYmFy" };
+    const char *url[]
+        = { "", "Zg", "Zm8", "Zm9v", "Zm9vYg", "Zm9vYmE", "Zm9vYmFy" };
+
+    for(size_t i = 0; i < sizeof plain / sizeof *plain; ++i) {
+        const size_t len = strlen(plain[i]);
+        char encoded[16];
+        ck_assert_uint_eq(util_Base64_EncodedLen(len, UTIL_BASE64_STD),
+                          strlen(std[i]));
+        ck_assert_uint_eq(util_Base64_Encode((const uint8_t *) plain[i], len,
+                                             encoded, UTIL_BASE64_STD),
+                          strlen(std[i]));
+        ck_assert_str_eq(encoded, std[i]);
+        ck_assert_uint_eq(util_Base64_EncodedLen(len, UTIL_BASE64_URL),
+                          strlen(url[i]));
+        util_Base64_Encode((const uint8_t *) plain[i], len, encoded,
+                           UTIL_BASE64_URL);
+        ck_assert_str_eq(encoded, url[i]);
+
+        uint8_t decoded[16];
+        size_t decoded_len;
+        ck_assert(util_Base64_Decode(std[i], strlen(std[i]), decoded,
+                                     &decoded_len, UTIL_BASE64_STD));
+        ck_assert_uint_eq(decoded_len, len);
+        ck_assert(!memcmp(decoded, plain[i], len));
+        ck_assert(util_Base64_Decode(url[i], strlen(url[i]), decoded,
+                                     &decoded_len, UTIL_BASE64_URL));
+        ck_assert_uint_eq(decoded_len, len);
+        ck_assert(!memcmp(decoded, plain[i], len));
+    }
+}
+END_TEST
+
+// every implementation gives the scalar result, across block boundaries
+START_TEST(test_util_Base64_impls)
+{
+    uint8_t bytes[300];
+    for(size_t i = 0; i < sizeof bytes; ++i) {
+        bytes[i] = (uint8_t) (i * 151 + 7);
+    }
+
+    for(size_t len = 0; len <= sizeof bytes; ++len) {
+        for(int a = UTIL_BASE64_STD; a <= UTIL_BASE64_URL; ++a) {
+            char expected[512];
+            const size_t expected_len = util_Base64_EncodeWith(
+                UTIL_BASE64_SCALAR, bytes, len, expected, a);
+
+            for(size_t i = 0; i < num_impls; ++i) {
+                if(!util_Base64_Supported(impls[i])) {
+                    continue;
+                }
+                char encoded[512];
+                ck_assert_uint_eq(
+                    util_Base64_EncodeWith(impls[i], bytes, len, encoded, a),
+                    expected_len);
+                ck_assert_str_eq(encoded, expected);
+
+                uint8_t decoded[300];
+                size_t decoded_len;
+                ck_assert(util_Base64_DecodeWith(impls[i], expected,
+                                                 expected_len, decoded,
+                                                 &decoded_len, a));
+                ck_assert_uint_eq(decoded_len, len);
+                ck_assert(!memcmp(decoded, bytes, len));
+            }
+        }
+    }
+}
+END_TEST
+
+// characters outside the alphabet are rejected wherever they are
+START_TEST(test_util_Base64_Decode_invalid)
+{
+    char encoded[512];
+    uint8_t bytes[200], decoded[200];
+    memset(bytes, 0xA5, sizeof bytes);
+    const size_t len = util_Base64_Encode(bytes, sizeof bytes, encoded,
+                                          UTIL_BASE64_URL);
+    const char invalid[] = { '+', '/', '.', ' ', '=', '\n', (char) 0x80 };
+
+    for(size_t i = 0; i < num_impls; ++i) {
+        if(!util_Base64_Supported(impls[i])) {
+            continue;
+        }
+        for(size_t pos = 0; pos < len - 2; pos += 7) {
+            for(size_t c = 0; c < sizeof invalid; ++c) {
+                const char saved = encoded[pos];
+                encoded[pos] = invalid[c];
+                size_t decoded_len;
+                ck_assert(!util_Base64_DecodeWith(impls[i], encoded, len,
+                                                  decoded, &decoded_len,
+                                                  UTIL_BASE64_URL));
+                encoded[pos] = saved;
+            }
+        }
+        // a lone character is not a byte
+        size_t decoded_len;
+        ck_assert(!util_Base64_DecodeWith(impls[i], "QUJD" "Q", 5, decoded,
+                                          &decoded_len, UTIL_BASE64_URL));
+    }
+}
+END_TEST
+
+Suite *base64_suite(void)
+{
+    Suite *s = suite_create("base64");
+    TCase *tc_core = tcase_create("core");
+
+    tcase_add_test(tc_core, test_util_Base64_vectors);
+    tcase_add_test(tc_core, test_util_Base64_impls);
+    tcase_add_test(tc_core, test_util_Base64_Decode_invalid);
+
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void)
+{
+    Suite *s = base64_suite();
+    SRunner *sr = srunner_create(s);
+
+    srunner_run_all(sr, CK_NORMAL);
+    const int number_failed = srunner_ntests_failed(sr);
+
+    srunner_free(sr);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
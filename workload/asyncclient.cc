@@ -0,0 +1,657 @@
+/**
+ *
+ * (C) Copyright 2020-2021 Hewlett Packard Enterprise Development LP
+ *
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include "c-spiffe/workload/asyncclient.h"
+#include "c-spiffe/workload/backoff.h"
+#include "workload.grpc.pb.h"
+#include "workload.pb.h"
+#include <atomic>
+#include <chrono>
+#include <google/protobuf/arena.h>
+#include <grpc/grpc.h>
+#include <grpcpp/alarm.h>
+#include <grpcpp/grpcpp.h>
+
+/// Implemented in client.cc
+workloadapi_X509Context *
+workloadapi_parseX509ContextCached(X509SVIDResponse *resp,
+                                   workloadapi_UpdateCache *cache, err_t *err);
+jwtsvid_SVID *workloadapi_parseJWTSVID(const JWTSVIDResponse *resp,
+                                       jwtsvid_Params *params, err_t *err);
+jwtbundle_Set *
+workloadapi_parseJWTBundlesCached(const JWTBundlesResponse *resp,
+                                  workloadapi_UpdateCache *cache, err_t *err);
+google::protobuf::ArenaOptions workloadapi_responseArenaOptions(char *block);
+
+namespace
+{
+
+/// A call in flight on the completion queue. The call object itself is the
+/// tag of its only pending operation, so Proceed() is never run
+/// concurrently for the same call.
+class AsyncCall
+{
+  public:
+    AsyncCall(workloadapi_AsyncClient *async_client, void *owner)
+        : async_client(async_client), owner(owner), cancelled(false)
+    {
+    }
+    virtual ~AsyncCall() {}
+
+    /// called from the event thread with the result of the pending
+    /// operation.
+    virtual void Proceed(bool ok) = 0;
+
+    /// called with calls_mutex held.
+    virtual void Cancel() = 0;
+
+    workloadapi_AsyncClient *async_client;
+    void *owner;
+    bool cancelled;
+
+  protected:
+    grpc::CompletionQueue *cq()
+    {
+        return (grpc::CompletionQueue *) async_client->cq;
+    }
+
+    SpiffeWorkloadAPI::StubInterface *stub()
+    {
+        return (SpiffeWorkloadAPI::StubInterface *) async_client->client->stub;
+    }
+
+    grpc::ClientContext *newContext()
+    {
+        grpc::ClientContext *ctx = new grpc::ClientContext();
+        workloadapi_Client *client = async_client->client;
+        if(client->headers) {
+            for(int i = 0; i < arrlen(client->headers); i += 2)
+                ctx->AddMetadata(client->headers[i], client->headers[i + 1]);
+        }
+        return ctx;
+    }
+
+    bool isCancelled()
+    {
+        mtx_lock(&(async_client->calls_mutex));
+        bool ret = cancelled;
+        mtx_unlock(&(async_client->calls_mutex));
+        return ret;
+    }
+
+    /// removes the call from the client and deletes it. Must be the last
+    /// thing a call does.
+    void done()
+    {
+        workloadapi_AsyncClient *ac = async_client;
+        mtx_lock(&(ac->calls_mutex));
+        for(size_t i = 0, size = arrlenu(ac->calls); i < size; ++i) {
+            if(ac->calls[i] == (void *) this) {
+                arrdelswap(ac->calls, i);
+                break;
+            }
+        }
+        cnd_broadcast(&(ac->calls_cond));
+        mtx_unlock(&(ac->calls_mutex));
+        delete this;
+    }
+};
+
+/// Server streaming call, restarted with backoff until cancelled.
+template <typename Request, typename Response>
+class StreamCall : public AsyncCall
+{
+  public:
+    StreamCall(workloadapi_AsyncClient *async_client, void *owner)
+        : AsyncCall(async_client, owner), state(STARTING),
+          backoff(workloadapi_NewBackoff({ 1, 0 }, { 30, 0 })),
+          block(new char[WORKLOADAPI_RESPONSE_ARENA_SIZE]),
+          arena(workloadapi_responseArenaOptions(block.get())),
+          response(nullptr)
+    {
+    }
+
+    /// called with calls_mutex held.
+    void StartStream()
+    {
+        state = STARTING;
+        ctx.reset(newContext());
+        reader = prepare(ctx.get());
+        reader->StartCall(this);
+    }
+
+    void Proceed(bool ok) override
+    {
+        switch(state) {
+        case STARTING:
+            if(!ok) {
+                finish();
+            } else {
+                state = READING;
+                resetResponse();
+                reader->Read(response, this);
+            }
+            break;
+        case READING:
+            if(!ok || isCancelled()) {
+                finish();
+            } else {
+                workloadapi_Backoff_Reset(&backoff);
+                onMessage(response);
+                resetResponse();
+                reader->Read(response, this);
+            }
+            break;
+        case FINISHING:
+            onFinish();
+            break;
+        case BACKING_OFF:
+            mtx_lock(&(async_client->calls_mutex));
+            if(cancelled) {
+                mtx_unlock(&(async_client->calls_mutex));
+                done();
+                return;
+            }
+            StartStream();
+            mtx_unlock(&(async_client->calls_mutex));
+            break;
+        }
+    }
+
+    void Cancel() override
+    {
+        cancelled = true;
+        if(state == BACKING_OFF) {
+            alarm.Cancel();
+        } else if(ctx) {
+            ctx->TryCancel();
+        }
+    }
+
+  protected:
+    virtual std::unique_ptr<grpc::ClientAsyncReaderInterface<Response>>
+    prepare(grpc::ClientContext *ctx) = 0;
+    virtual void onMessage(Response *response) = 0;
+    virtual void onError(err_t error) = 0;
+
+  private:
+    enum State { STARTING, READING, FINISHING, BACKING_OFF };
+
+    /// drops the previous response and allocates a new one on the arena.
+    void resetResponse()
+    {
+        arena.Reset();
+        response = google::protobuf::Arena::CreateMessage<Response>(&arena);
+    }
+
+    void finish()
+    {
+        state = FINISHING;
+        reader->Finish(&status, this);
+    }
+
+    void onFinish()
+    {
+        err_t err = ERR_NO_MESSAGE; // no more messages.
+        if(status.error_code() == grpc::StatusCode::CANCELLED) {
+            err = ERR_CANCELLED_STATUS;
+        } else if(status.error_code() == grpc::StatusCode::INVALID_ARGUMENT) {
+            err = ERR_INVALID_STATUS;
+        }
+
+        mtx_lock(&(async_client->calls_mutex));
+        if(cancelled) {
+            mtx_unlock(&(async_client->calls_mutex));
+            done();
+            return;
+        }
+        mtx_unlock(&(async_client->calls_mutex));
+
+        onError(err);
+        if(err != ERR_NO_MESSAGE) {
+            done();
+            return;
+        }
+
+        struct timespec retry_after = workloadapi_Backoff_NextTime(&backoff);
+        std::chrono::system_clock::time_point deadline
+            = std::chrono::system_clock::time_point(
+                std::chrono::duration_cast<
+                    std::chrono::system_clock::duration>(
+                    std::chrono::seconds(retry_after.tv_sec)
+                    + std::chrono::nanoseconds(retry_after.tv_nsec)));
+
+        mtx_lock(&(async_client->calls_mutex));
+        if(cancelled) {
+            mtx_unlock(&(async_client->calls_mutex));
+            done();
+            return;
+        }
+        state = BACKING_OFF;
+        alarm.Set(cq(), deadline, this);
+        mtx_unlock(&(async_client->calls_mutex));
+    }
+
+    /// written by the event thread, read by Cancel() from others
+    std::atomic<State> state;
+    workloadapi_Backoff backoff;
+    std::unique_ptr<grpc::ClientContext> ctx;
+    std::unique_ptr<grpc::ClientAsyncReaderInterface<Response>> reader;
+    /// responses are decoded into an arena that is reset after each one
+    std::unique_ptr<char[]> block;
+    google::protobuf::Arena arena;
+    Response *response;
+    grpc::Status status;
+    grpc::Alarm alarm;
+};
+
+class X509ContextCall : public StreamCall<X509SVIDRequest, X509SVIDResponse>
+{
+  public:
+    X509ContextCall(workloadapi_AsyncClient *async_client,
+                    workloadapi_Watcher *watcher)
+        : StreamCall(async_client, watcher), watcher(watcher)
+    {
+    }
+
+  protected:
+    std::unique_ptr<grpc::ClientAsyncReaderInterface<X509SVIDResponse>>
+    prepare(grpc::ClientContext *ctx) override
+    {
+        X509SVIDRequest req = X509SVIDRequest(); // empty request
+        return stub()->PrepareAsyncFetchX509SVID(ctx, req, cq());
+    }
+
+    void onMessage(X509SVIDResponse *response) override
+    {
+        err_t err = NO_ERROR;
+        workloadapi_X509Context *x509context
+            = workloadapi_parseX509ContextCached(
+                response, watcher->update_cache, &err);
+        if(err != NO_ERROR) {
+            workloadapi_Watcher_OnX509ContextWatchError(watcher, err);
+        } else {
+            workloadapi_Watcher_OnX509ContextUpdate(watcher, x509context);
+            free(x509context);
+        }
+    }
+
+    void onError(err_t error) override
+    {
+        workloadapi_Watcher_OnX509ContextWatchError(watcher, error);
+    }
+
+  private:
+    workloadapi_Watcher *watcher;
+};
+
+class JWTBundlesCall
+    : public StreamCall<JWTBundlesRequest, JWTBundlesResponse>
+{
+  public:
+    JWTBundlesCall(workloadapi_AsyncClient *async_client,
+                   workloadapi_JWTWatcher *watcher)
+        : StreamCall(async_client, watcher), watcher(watcher)
+    {
+    }
+
+  protected:
+    std::unique_ptr<grpc::ClientAsyncReaderInterface<JWTBundlesResponse>>
+    prepare(grpc::ClientContext *ctx) override
+    {
+        JWTBundlesRequest req;
+        return stub()->PrepareAsyncFetchJWTBundles(ctx, req, cq());
+    }
+
+    void onMessage(JWTBundlesResponse *response) override
+    {
+        err_t err = NO_ERROR;
+        jwtbundle_Set *set = workloadapi_parseJWTBundlesCached(
+            response, watcher->update_cache, &err);
+        if(err != NO_ERROR) {
+            workloadapi_JWTWatcher_OnJWTBundlesWatchError(watcher, err);
+        } else {
+            workloadapi_JWTWatcher_OnJWTBundlesUpdate(watcher, set);
+            jwtbundle_Set_Free(set);
+        }
+    }
+
+    void onError(err_t error) override
+    {
+        workloadapi_JWTWatcher_OnJWTBundlesWatchError(watcher, error);
+    }
+
+  private:
+    workloadapi_JWTWatcher *watcher;
+};
+
+/// Unary JWT-SVID fetch, the callback is called exactly once.
+class FetchJWTSVIDCall : public AsyncCall
+{
+  public:
+    FetchJWTSVIDCall(workloadapi_AsyncClient *async_client,
+                     jwtsvid_Params *params,
+                     workloadapi_JWTSVIDCallback callback)
+        : AsyncCall(async_client, NULL), callback(callback), audiences(NULL)
+    {
+        // set spiffe id
+        if(!spiffeid_ID_IsZero(params->subject)) {
+            string_t id = spiffeid_ID_String(params->subject);
+            req.set_spiffe_id(id);
+            arrfree(id);
+        }
+
+        // set audiences, keeping a copy for parsing the response
+        if(params->audience) {
+            req.add_audience(params->audience);
+            arrput(audiences, string_new(params->audience));
+            for(size_t i = 0, size = arrlenu(params->extra_audiences);
+                i < size; ++i) {
+                req.add_audience(params->extra_audiences[i]);
+                arrput(audiences, string_new(params->extra_audiences[i]));
+            }
+        }
+    }
+
+    ~FetchJWTSVIDCall() { util_string_arr_t_Free(audiences); }
+
+    /// called with calls_mutex held.
+    void Start()
+    {
+        ctx.reset(newContext());
+        reader = stub()->PrepareAsyncFetchJWTSVID(ctx.get(), req, cq());
+        reader->StartCall();
+        reader->Finish(&resp, &status, this);
+    }
+
+    void Proceed(bool ok) override
+    {
+        err_t err = NO_ERROR;
+        jwtsvid_SVID *svid = NULL;
+        if(ok && status.ok()) {
+            // parse response
+            jwtsvid_Params params = {};
+            params.extra_audiences = audiences;
+            svid = workloadapi_parseJWTSVID(&resp, &params, &err);
+        } else {
+            // could not fetch jwt svid
+            err = ERR_BAD_REQUEST;
+        }
+        callback.func(svid, err, callback.args);
+        done();
+    }
+
+    void Cancel() override
+    {
+        cancelled = true;
+        ctx->TryCancel();
+    }
+
+  private:
+    workloadapi_JWTSVIDCallback callback;
+    string_arr_t audiences;
+    JWTSVIDRequest req;
+    JWTSVIDResponse resp;
+    grpc::Status status;
+    std::unique_ptr<grpc::ClientContext> ctx;
+    std::unique_ptr<grpc::ClientAsyncResponseReaderInterface<JWTSVIDResponse>>
+        reader;
+};
+
+} // namespace
+
+// whether the caller runs on the event thread, where waiting for calls to
+// retire would never end. called with calls_mutex held.
+static bool
+workloadapi_AsyncClient_onEventThread(workloadapi_AsyncClient *async_client)
+{
+    return async_client->running
+           && thrd_equal(thrd_current(), async_client->event_thread);
+}
+
+// Function that will run on thread spun for the async client
+int workloadapi_AsyncClient_eventLoop(void *_async_client)
+{
+    workloadapi_AsyncClient *async_client
+        = (workloadapi_AsyncClient *) _async_client;
+    grpc::CompletionQueue *cq = (grpc::CompletionQueue *) async_client->cq;
+
+    void *tag;
+    bool ok;
+    while(cq->Next(&tag, &ok)) {
+        static_cast<AsyncCall *>(tag)->Proceed(ok);
+    }
+    return (int) NO_ERROR;
+}
+
+workloadapi_AsyncClient *
+workloadapi_NewAsyncClient(workloadapi_Client *client, err_t *err)
+{
+    workloadapi_AsyncClient *async_client
+        = (workloadapi_AsyncClient *) calloc(1, sizeof *async_client);
+    if(!async_client) {
+        *err = ERR_NULL;
+        return NULL;
+    }
+
+    if(client) {
+        async_client->client = client;
+        async_client->owns_client = false;
+    } else {
+        async_client->client = workloadapi_NewClient(err);
+        if(*err != NO_ERROR) {
+            free(async_client);
+            return NULL;
+        }
+        workloadapi_Client_defaultOptions(async_client->client, NULL);
+        async_client->owns_client = true;
+    }
+
+    mtx_init(&(async_client->calls_mutex), mtx_plain);
+    cnd_init(&(async_client->calls_cond));
+    async_client->cq = NULL;
+    async_client->calls = NULL;
+    async_client->running = false;
+    async_client->closing = false;
+
+    *err = NO_ERROR;
+    return async_client;
+}
+
+err_t workloadapi_AsyncClient_Start(workloadapi_AsyncClient *async_client)
+{
+    if(!async_client) {
+        return ERR_NULL;
+    }
+    mtx_lock(&(async_client->calls_mutex));
+    if(async_client->running) {
+        mtx_unlock(&(async_client->calls_mutex));
+        return ERR_EXISTS; // already started
+    }
+    err_t error = workloadapi_Client_Connect(async_client->client);
+    if(error != NO_ERROR) {
+        mtx_unlock(&(async_client->calls_mutex));
+        return error;
+    }
+    async_client->cq = new grpc::CompletionQueue();
+    async_client->closing = false;
+
+    int thread_error = thrd_create(&(async_client->event_thread),
+                                   workloadapi_AsyncClient_eventLoop,
+                                   async_client);
+    if(thread_error != thrd_success) {
+        delete(grpc::CompletionQueue *) async_client->cq;
+        async_client->cq = NULL;
+        mtx_unlock(&(async_client->calls_mutex));
+        return ERR_THREAD;
+    }
+    async_client->running = true;
+    mtx_unlock(&(async_client->calls_mutex));
+    return NO_ERROR;
+}
+
+err_t workloadapi_AsyncClient_Close(workloadapi_AsyncClient *async_client)
+{
+    if(!async_client) {
+        return ERR_NULL;
+    }
+    mtx_lock(&(async_client->calls_mutex));
+    if(!async_client->running || async_client->closing) {
+        mtx_unlock(&(async_client->calls_mutex));
+        return ERR_CLOSED; // already closed
+    }
+    if(workloadapi_AsyncClient_onEventThread(async_client)) {
+        mtx_unlock(&(async_client->calls_mutex));
+        return ERR_THREAD; // called from a callback
+    }
+    async_client->closing = true;
+    for(size_t i = 0, size = arrlenu(async_client->calls); i < size; ++i) {
+        ((AsyncCall *) async_client->calls[i])->Cancel();
+    }
+    // no operation may be started once the queue is shut down.
+    while(arrlenu(async_client->calls) > 0) {
+        cnd_wait(&(async_client->calls_cond), &(async_client->calls_mutex));
+    }
+    arrfree(async_client->calls);
+    mtx_unlock(&(async_client->calls_mutex));
+
+    grpc::CompletionQueue *cq = (grpc::CompletionQueue *) async_client->cq;
+    cq->Shutdown();
+    int join_return;
+    thrd_join(async_client->event_thread, &join_return);
+    delete cq;
+
+    mtx_lock(&(async_client->calls_mutex));
+    async_client->cq = NULL;
+    async_client->running = false;
+    mtx_unlock(&(async_client->calls_mutex));
+
+    if(async_client->owns_client) {
+        workloadapi_Client_Close(async_client->client);
+    }
+    return NO_ERROR;
+}
+
+err_t workloadapi_AsyncClient_Free(workloadapi_AsyncClient *async_client)
+{
+    if(!async_client) {
+        return ERR_NULL;
+    }
+    mtx_destroy(&(async_client->calls_mutex));
+    cnd_destroy(&(async_client->calls_cond));
+    if(async_client->owns_client) {
+        workloadapi_Client_Free(async_client->client);
+    }
+    free(async_client);
+    return NO_ERROR;
+}
+
+err_t workloadapi_AsyncClient_WatchX509Context(
+    workloadapi_AsyncClient *async_client, workloadapi_Watcher *watcher)
+{
+    if(!async_client || !watcher) {
+        return ERR_NULL;
+    }
+    mtx_lock(&(async_client->calls_mutex));
+    if(!async_client->running || async_client->closing) {
+        mtx_unlock(&(async_client->calls_mutex));
+        return ERR_CLOSED;
+    }
+    X509ContextCall *call = new X509ContextCall(async_client, watcher);
+    arrput(async_client->calls, (void *) call);
+    call->StartStream();
+    mtx_unlock(&(async_client->calls_mutex));
+    return NO_ERROR;
+}
+
+err_t workloadapi_AsyncClient_WatchJWTBundles(
+    workloadapi_AsyncClient *async_client, workloadapi_JWTWatcher *watcher)
+{
+    if(!async_client || !watcher) {
+        return ERR_NULL;
+    }
+    mtx_lock(&(async_client->calls_mutex));
+    if(!async_client->running || async_client->closing) {
+        mtx_unlock(&(async_client->calls_mutex));
+        return ERR_CLOSED;
+    }
+    JWTBundlesCall *call = new JWTBundlesCall(async_client, watcher);
+    arrput(async_client->calls, (void *) call);
+    call->StartStream();
+    mtx_unlock(&(async_client->calls_mutex));
+    return NO_ERROR;
+}
+
+err_t workloadapi_AsyncClient_CancelWatch(
+    workloadapi_AsyncClient *async_client, void *owner)
+{
+    if(!async_client || !owner) {
+        return ERR_NULL;
+    }
+    mtx_lock(&(async_client->calls_mutex));
+    if(workloadapi_AsyncClient_onEventThread(async_client)) {
+        mtx_unlock(&(async_client->calls_mutex));
+        return ERR_THREAD; // called from a callback
+    }
+    bool found = true;
+    while(found) {
+        found = false;
+        for(size_t i = 0, size = arrlenu(async_client->calls); i < size;
+            ++i) {
+            AsyncCall *call = (AsyncCall *) async_client->calls[i];
+            if(call->owner == owner) {
+                if(!call->cancelled) {
+                    call->Cancel();
+                }
+                found = true;
+            }
+        }
+        if(found) {
+            cnd_wait(&(async_client->calls_cond),
+                     &(async_client->calls_mutex));
+        }
+    }
+    mtx_unlock(&(async_client->calls_mutex));
+    return NO_ERROR;
+}
+
+err_t workloadapi_AsyncClient_FetchJWTSVID(
+    workloadapi_AsyncClient *async_client, jwtsvid_Params *params,
+    workloadapi_JWTSVIDCallback callback)
+{
+    if(!async_client || !params || !callback.func) {
+        return ERR_NULL;
+    }
+    mtx_lock(&(async_client->calls_mutex));
+    if(!async_client->running || async_client->closing) {
+        mtx_unlock(&(async_client->calls_mutex));
+        return ERR_CLOSED;
+    }
+    FetchJWTSVIDCall *call
+        = new FetchJWTSVIDCall(async_client, params, callback);
+    arrput(async_client->calls, (void *) call);
+    call->Start();
+    mtx_unlock(&(async_client->calls_mutex));
+    return NO_ERROR;
+}
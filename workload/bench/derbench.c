@@ -0,0 +1,163 @@
+/**
+ *
+ * (C) Copyright 2020-2021 Hewlett Packard Enterprise Development LP
+ *
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+/*
+ * DER bundle parsing benchmark, see README.md.
+ *
+ * Builds a bundle of concatenated DER certificates, the way the Workload API
+ * sends them, then parses it with the memory BIO path x509util used to take
+ * and with x509util_ParseCertificates, and reports time per bundle.
+ */
+
+#include "c-spiffe/internal/x509util/util.h"
+#include <openssl/bio.h>
+#include <openssl/evp.h>
+#include <openssl/x509.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+static long iterations = 100;
+static long certificates = 256;
+
+static double nowSeconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// self-signed P-256 certificate with the given serial number
+static X509 *newCertificate(EVP_PKEY *pkey, long serial)
+{
+    X509 *cert = X509_new();
+    X509_set_version(cert, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(cert), serial);
+    X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+    X509_gmtime_adj(X509_getm_notAfter(cert), 3600);
+    X509_NAME *name = X509_get_subject_name(cert);
+    X509_NAME_add_entry_by_txt(name, "O", MBSTRING_ASC,
+                               (const unsigned char *) "SPIFFE", -1, -1, 0);
+    X509_set_issuer_name(cert, name);
+    X509_set_pubkey(cert, pkey);
+    X509_sign(cert, pkey, EVP_sha256());
+    return cert;
+}
+
+// x509util_ParseCertificates before it decoded in place: the bundle is
+// copied into a memory BIO and read back one certificate at a time
+static X509 **parseWithBIO(const byte *bytes, size_t len, err_t *err)
+{
+    *err = ERR_DEFAULT;
+    BIO *bio_mem = BIO_new(BIO_s_mem());
+    X509 **certs = NULL;
+
+    if(BIO_write(bio_mem, bytes, len) > 0) {
+        X509 *cert;
+        while((cert = d2i_X509_bio(bio_mem, NULL))) {
+            arrput(certs, cert);
+        }
+        *err = NO_ERROR;
+    }
+    BIO_free(bio_mem);
+
+    return certs;
+}
+
+static X509 **parseInPlace(const byte *bytes, size_t len, err_t *err)
+{
+    return x509util_ParseCertificates(bytes, len, err);
+}
+
+static void freeCertificates(X509 **certs)
+{
+    for(size_t i = 0, size = arrlenu(certs); i < size; ++i) {
+        X509_free(certs[i]);
+    }
+    arrfree(certs);
+}
+
+static void bench(const char *name,
+                  X509 **(*parse)(const byte *, size_t, err_t *),
+                  const byte *bytes, size_t len)
+{
+    const double start = nowSeconds();
+    for(long i = 0; i < iterations; ++i) {
+        err_t err;
+        X509 **certs = parse(bytes, len, &err);
+        if(err != NO_ERROR || arrlen(certs) != certificates) {
+            fprintf(stderr, "%s: parsed %td certificates\n", name,
+                    arrlen(certs));
+            exit(EXIT_FAILURE);
+        }
+        freeCertificates(certs);
+    }
+    const double elapsed = nowSeconds() - start;
+    printf("  %-8s %9.1f us %9.1f MB/s\n", name, elapsed * 1e6 / iterations,
+           len * iterations / elapsed / 1e6);
+}
+
+int main(int argc, char **argv)
+{
+    int opt;
+    while((opt = getopt(argc, argv, "c:n:")) != -1) {
+        switch(opt) {
+        case 'c':
+            certificates = atol(optarg);
+            break;
+        case 'n':
+            iterations = atol(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-c certificates] [-n iterations]\n",
+                    argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if(certificates <= 0 || iterations <= 0) {
+        fprintf(stderr, "certificates and iterations must be positive\n");
+        return EXIT_FAILURE;
+    }
+
+    EVP_PKEY *pkey = EVP_EC_gen("P-256");
+    byte *bytes = NULL;
+    for(long i = 0; i < certificates; ++i) {
+        X509 *cert = newCertificate(pkey, i + 1);
+        const int cert_len = i2d_X509(cert, NULL);
+        byte *ptr = arraddnptr(bytes, cert_len);
+        i2d_X509(cert, &ptr);
+        X509_free(cert);
+    }
+    EVP_PKEY_free(pkey);
+
+    const size_t len = arrlenu(bytes);
+    printf("bundle: %ld certificates, %zu bytes\n", certificates, len);
+    bench("bio", parseWithBIO, bytes, len);
+    bench("in place", parseInPlace, bytes, len);
+
+    arrfree(bytes);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,354 @@
+/**
+ *
+ * (C) Copyright 2020-2021 Hewlett Packard Enterprise Development LP
+ *
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+/*
+ * Load driver for the mock Workload API, see README.md.
+ *
+ * Runs X.509 and JWT bundle watchers and JWT-SVID fetch loops against a
+ * Workload API for a while, then reports throughput and latencies. Update
+ * propagation latency relies on the mock server stamping each rotation in
+ * the leaf serial number and the JWT key ID, so it is only meaningful
+ * against that server, on the same host.
+ */
+
+#include "c-spiffe/workload/asyncclient.h"
+#include "c-spiffe/workload/client.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct {
+    const char *name;
+    mtx_t mtx;
+    /** stb array of latencies, in microseconds */
+    long *samples;
+    unsigned long errors;
+} driver_Stats;
+
+typedef struct {
+    driver_Stats *stats;
+    /** the first update carries the last rotation before connecting */
+    bool initial;
+} driver_WatcherArgs;
+
+typedef struct {
+    driver_Stats *stats;
+    workloadapi_Client *client;
+    const char *audience;
+} driver_FetchArgs;
+
+static const char *address = "unix:///tmp/agent.sock";
+static atomic_bool stopping = false;
+
+static long nowMicros(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return now.tv_sec * 1000000L + now.tv_nsec / 1000;
+}
+
+static void driver_Stats_Init(driver_Stats *stats, const char *name)
+{
+    memset(stats, 0, sizeof *stats);
+    stats->name = name;
+    mtx_init(&(stats->mtx), mtx_plain);
+}
+
+static void driver_Stats_Add(driver_Stats *stats, long sample)
+{
+    mtx_lock(&(stats->mtx));
+    arrput(stats->samples, sample);
+    mtx_unlock(&(stats->mtx));
+}
+
+static void driver_Stats_Error(driver_Stats *stats)
+{
+    mtx_lock(&(stats->mtx));
+    ++stats->errors;
+    mtx_unlock(&(stats->mtx));
+}
+
+static int compareLong(const void *a, const void *b)
+{
+    const long x = *(const long *) a, y = *(const long *) b;
+    return (x > y) - (x < y);
+}
+
+static void driver_Stats_Print(driver_Stats *stats, double seconds)
+{
+    mtx_lock(&(stats->mtx));
+    const size_t n = arrlenu(stats->samples);
+    printf("%-12s %8zu ok %6lu err %10.1f/s", stats->name, n, stats->errors,
+           n / seconds);
+    if(n > 0) {
+        qsort(stats->samples, n, sizeof *stats->samples, compareLong);
+        printf("   ms p50 %.3f p90 %.3f p99 %.3f max %.3f",
+               stats->samples[n / 2] / 1000.0,
+               stats->samples[n * 9 / 10] / 1000.0,
+               stats->samples[n * 99 / 100] / 1000.0,
+               stats->samples[n - 1] / 1000.0);
+    }
+    printf("\n");
+    arrfree(stats->samples);
+    mtx_unlock(&(stats->mtx));
+    mtx_destroy(&(stats->mtx));
+}
+
+static void setAddressOption(workloadapi_Client *client, void *not_used)
+{
+    workloadapi_Client_SetAddress(client, address);
+    workloadapi_Client_setDefaultHeaderOption(client, NULL);
+}
+
+static void onX509Context(workloadapi_X509Context *context, void *args)
+{
+    driver_WatcherArgs *watcher_args = args;
+    if(watcher_args->initial) {
+        watcher_args->initial = false;
+        return;
+    }
+    if(arrlenu(context->svids) == 0
+       || arrlenu(context->svids[0]->certs) == 0) {
+        driver_Stats_Error(watcher_args->stats);
+        return;
+    }
+    uint64_t stamp = 0;
+    ASN1_INTEGER_get_uint64(
+        &stamp, X509_get0_serialNumber(context->svids[0]->certs[0]));
+    driver_Stats_Add(watcher_args->stats, nowMicros() - (long) stamp);
+}
+
+static void onJWTBundles(jwtbundle_Set *set, void *args)
+{
+    driver_WatcherArgs *watcher_args = args;
+    if(watcher_args->initial) {
+        watcher_args->initial = false;
+        return;
+    }
+    // newest key ID is mock-<generation>-<stamp>
+    err_t err = NO_ERROR;
+    spiffeid_TrustDomain td = { "example.org" };
+    jwtbundle_Bundle *bundle
+        = jwtbundle_Set_GetJWTBundleForTrustDomain(set, td, &err);
+    unsigned long gen, newest_gen = 0;
+    long stamp, newest_stamp = 0;
+    for(size_t i = 0, size = bundle ? shlenu(bundle->auths) : 0; i < size;
+        ++i) {
+        if(sscanf(bundle->auths[i].key, "mock-%lu-%ld", &gen, &stamp) == 2
+           && gen > newest_gen) {
+            newest_gen = gen;
+            newest_stamp = stamp;
+        }
+    }
+    if(newest_gen == 0) {
+        driver_Stats_Error(watcher_args->stats);
+        return;
+    }
+    driver_Stats_Add(watcher_args->stats, nowMicros() - newest_stamp);
+}
+
+static int fetchLoop(void *args)
+{
+    driver_FetchArgs *fetch_args = args;
+    jwtsvid_Params params = { .audience = (char *) fetch_args->audience,
+                              .extra_audiences = NULL,
+                              .subject = { { NULL }, NULL } };
+    while(!atomic_load(&stopping)) {
+        err_t err = NO_ERROR;
+        const long start = nowMicros();
+        jwtsvid_SVID *svid = workloadapi_Client_FetchJWTSVID(
+            fetch_args->client, &params, &err);
+        if(err == NO_ERROR) {
+            driver_Stats_Add(fetch_args->stats, nowMicros() - start);
+        } else {
+            driver_Stats_Error(fetch_args->stats);
+        }
+        jwtsvid_SVID_Free(svid);
+    }
+    return 0;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -a address   Workload API address (unix:///tmp/agent.sock)\n"
+            "  -x n         X.509 context watchers (1)\n"
+            "  -j n         JWT bundles watchers (0)\n"
+            "  -t n         threads fetching JWT-SVIDs in a loop (0)\n"
+            "  -d seconds   how long to run (10)\n"
+            "  -A           drive the watchers from one async client\n",
+            name);
+}
+
+int main(int argc, char **argv)
+{
+    int x509_watchers = 1, jwt_watchers = 0, fetch_threads = 0, duration = 10;
+    bool use_async = false;
+    int opt;
+    while((opt = getopt(argc, argv, "a:x:j:t:d:Ah")) != -1) {
+        switch(opt) {
+        case 'a':
+            address = optarg;
+            break;
+        case 'x':
+            x509_watchers = atoi(optarg);
+            break;
+        case 'j':
+            jwt_watchers = atoi(optarg);
+            break;
+        case 't':
+            fetch_threads = atoi(optarg);
+            break;
+        case 'd':
+            duration = atoi(optarg);
+            break;
+        case 'A':
+            use_async = true;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    driver_Stats x509_stats, jwt_stats, fetch_stats;
+    driver_Stats_Init(&x509_stats, "x509 update");
+    driver_Stats_Init(&jwt_stats, "jwt update");
+    driver_Stats_Init(&fetch_stats, "jwt fetch");
+
+    err_t err = NO_ERROR;
+    workloadapi_Client *client = workloadapi_NewClient(&err);
+    setAddressOption(client, NULL);
+    err = workloadapi_Client_Connect(client);
+    if(err != NO_ERROR) {
+        fprintf(stderr, "could not connect to %s: %d\n", address, err);
+        return EXIT_FAILURE;
+    }
+    workloadapi_AsyncClient *async_client = NULL;
+    if(use_async) {
+        async_client = workloadapi_NewAsyncClient(client, &err);
+        if(err == NO_ERROR) {
+            err = workloadapi_AsyncClient_Start(async_client);
+        }
+        if(err != NO_ERROR) {
+            fprintf(stderr, "could not start async client: %d\n", err);
+            return EXIT_FAILURE;
+        }
+    }
+
+    workloadapi_ClientOption *options = NULL;
+    arrput(options, setAddressOption);
+    workloadapi_WatcherConfig x509_config
+        = { .client = NULL, .client_options = options };
+    workloadapi_JWTWatcherConfig jwt_config
+        = { .client = NULL, .client_options = options };
+
+    const long start = nowMicros();
+
+    driver_WatcherArgs *x509_args
+        = calloc(x509_watchers + 1, sizeof *x509_args);
+    workloadapi_Watcher **watchers = NULL;
+    for(int i = 0; i < x509_watchers; ++i) {
+        x509_args[i] = (driver_WatcherArgs){ &x509_stats, true };
+        workloadapi_X509Callback callback = { &x509_args[i], onX509Context };
+        workloadapi_Watcher *watcher
+            = workloadapi_newWatcher(x509_config, callback, &err);
+        if(async_client) {
+            workloadapi_Watcher_SetAsyncClient(watcher, async_client);
+        }
+        err = workloadapi_Watcher_Start(watcher);
+        if(err != NO_ERROR) {
+            fprintf(stderr, "could not start X.509 watcher: %d\n", err);
+        }
+        arrput(watchers, watcher);
+    }
+
+    driver_WatcherArgs *jwt_args = calloc(jwt_watchers + 1, sizeof *jwt_args);
+    workloadapi_JWTWatcher **jwt_watchers_arr = NULL;
+    for(int i = 0; i < jwt_watchers; ++i) {
+        jwt_args[i] = (driver_WatcherArgs){ &jwt_stats, true };
+        workloadapi_JWTCallback callback = { &jwt_args[i], onJWTBundles };
+        workloadapi_JWTWatcher *watcher
+            = workloadapi_newJWTWatcher(jwt_config, callback, &err);
+        if(async_client) {
+            workloadapi_JWTWatcher_SetAsyncClient(watcher, async_client);
+        }
+        err = workloadapi_JWTWatcher_Start(watcher);
+        if(err != NO_ERROR) {
+            fprintf(stderr, "could not start JWT watcher: %d\n", err);
+        }
+        arrput(jwt_watchers_arr, watcher);
+    }
+    printf("%d X.509 and %d JWT watchers started in %.3f ms\n", x509_watchers,
+           jwt_watchers, (nowMicros() - start) / 1000.0);
+
+    driver_FetchArgs fetch_args
+        = { &fetch_stats, client, "spiffe://example.org/audience" };
+    thrd_t *threads = calloc(fetch_threads + 1, sizeof *threads);
+    for(int i = 0; i < fetch_threads; ++i) {
+        thrd_create(&threads[i], fetchLoop, &fetch_args);
+    }
+
+    const long run_start = nowMicros();
+    sleep(duration);
+    atomic_store(&stopping, true);
+    for(int i = 0; i < fetch_threads; ++i) {
+        thrd_join(threads[i], NULL);
+    }
+    const double seconds = (nowMicros() - run_start) / 1e6;
+
+    for(size_t i = 0, size = arrlenu(watchers); i < size; ++i) {
+        workloadapi_Watcher_Close(watchers[i]);
+        workloadapi_Watcher_Free(watchers[i]);
+    }
+    for(size_t i = 0, size = arrlenu(jwt_watchers_arr); i < size; ++i) {
+        workloadapi_JWTWatcher_Close(jwt_watchers_arr[i]);
+        workloadapi_JWTWatcher_Free(jwt_watchers_arr[i]);
+    }
+    if(async_client) {
+        workloadapi_AsyncClient_Close(async_client);
+        workloadapi_AsyncClient_Free(async_client);
+    }
+    workloadapi_Client_Close(client);
+    workloadapi_Client_Free(client);
+
+    printf("ran for %.3f s\n", seconds);
+    driver_Stats_Print(&x509_stats, seconds);
+    driver_Stats_Print(&jwt_stats, seconds);
+    driver_Stats_Print(&fetch_stats, seconds);
+
+    arrfree(watchers);
+    arrfree(jwt_watchers_arr);
+    arrfree(options);
+    free(x509_args);
+    free(jwt_args);
+    free(threads);
+
+    return EXIT_SUCCESS;
+}
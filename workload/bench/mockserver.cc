@@ -0,0 +1,633 @@
+/**
+ *
+ * (C) Copyright 2020-2021 Hewlett Packard Enterprise Development LP
+ *
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+/*
+ * Fake Workload API for benchmarks and soak tests, see README.md.
+ *
+ * Every rotation signs new X.509-SVIDs and a new JWT key. The rotation time,
+ * in microseconds since the epoch, is the serial number of the leaf
+ * certificates and part of the JWT key ID, so a client can tell how long an
+ * update took to reach it.
+ */
+
+#include "workload.grpc.pb.h"
+#include "workload.pb.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <google/protobuf/util/json_util.h>
+#include <grpcpp/grpcpp.h>
+#include <memory>
+#include <mutex>
+#include <openssl/ec.h>
+#include <openssl/ecdsa.h>
+#include <openssl/evp.h>
+#include <openssl/x509v3.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#define MOCK_TRUST_DOMAIN "example.org"
+#define MOCK_JWT_LIFETIME 300
+
+typedef struct {
+    const char *address;
+    /** X.509-SVIDs in every X509SVIDResponse */
+    int svids;
+    /** CA certificates in every bundle */
+    int bundle_size;
+    /** federated trust domains */
+    int federated;
+    /** JWT keys kept in the bundle, the newest signs */
+    int jwt_keys;
+    /** time between rotations, 0 never rotates */
+    int rotation_ms;
+    /** rotations before shutting down, 0 runs forever */
+    int rotations;
+    /** delay before every response and stream message */
+    int latency_ms;
+    /** every n-th call fails with UNAVAILABLE, 0 never fails */
+    int error_every;
+} MockConfig;
+
+static uint64_t nowMicros(void)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::system_clock::now().time_since_epoch())
+        .count();
+}
+
+static std::string base64url(const unsigned char *bytes, size_t len)
+{
+    std::string out(4 * ((len + 2) / 3) + 1, '\0');
+    const int n = EVP_EncodeBlock((unsigned char *) &out[0], bytes, len);
+    out.resize(n);
+    while(!out.empty() && out.back() == '=') {
+        out.pop_back();
+    }
+    for(char &c : out) {
+        if(c == '+') {
+            c = '-';
+        } else if(c == '/') {
+            c = '_';
+        }
+    }
+    return out;
+}
+
+static std::string base64url(const std::string &str)
+{
+    return base64url((const unsigned char *) str.data(), str.size());
+}
+
+static std::string base64urlDecode(std::string str)
+{
+    for(char &c : str) {
+        if(c == '-') {
+            c = '+';
+        } else if(c == '_') {
+            c = '/';
+        }
+    }
+    while(str.size() % 4) {
+        str.push_back('=');
+    }
+    std::string out(3 * str.size() / 4, '\0');
+    const int n = EVP_DecodeBlock((unsigned char *) &out[0],
+                                  (const unsigned char *) str.data(),
+                                  str.size());
+    if(n < 0) {
+        return std::string();
+    }
+    // EVP_DecodeBlock counts the padding as data
+    size_t len = n;
+    for(size_t i = str.size(); i > 0 && str[i - 1] == '='; --i) {
+        --len;
+    }
+    out.resize(len);
+    return out;
+}
+
+static EVP_PKEY *newKey(void)
+{
+    EVP_PKEY *pkey = NULL;
+    EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, NULL);
+    EVP_PKEY_keygen_init(ctx);
+    EVP_PKEY_CTX_set_ec_paramgen_curve_nid(ctx, NID_X9_62_prime256v1);
+    EVP_PKEY_keygen(ctx, &pkey);
+    EVP_PKEY_CTX_free(ctx);
+    return pkey;
+}
+
+static void addExtension(X509 *cert, X509 *issuer, int nid, const char *value)
+{
+    X509V3_CTX ctx;
+    X509V3_set_ctx_nodb(&ctx);
+    X509V3_set_ctx(&ctx, issuer, cert, NULL, NULL, 0);
+    X509_EXTENSION *ext
+        = X509V3_EXT_conf_nid(NULL, &ctx, nid, const_cast<char *>(value));
+    X509_add_ext(cert, ext, -1);
+    X509_EXTENSION_free(ext);
+}
+
+// signs a certificate for key. issuer NULL makes it self-signed.
+static X509 *newCertificate(EVP_PKEY *key, X509 *issuer, EVP_PKEY *signer,
+                            uint64_t serial, const std::string &uri, bool ca)
+{
+    X509 *cert = X509_new();
+    X509_set_version(cert, 2);
+    ASN1_INTEGER_set_uint64(X509_get_serialNumber(cert), serial);
+    X509_gmtime_adj(X509_getm_notBefore(cert), -60);
+    X509_gmtime_adj(X509_getm_notAfter(cert), 3600);
+    X509_set_pubkey(cert, key);
+
+    X509_NAME *name = X509_get_subject_name(cert);
+    X509_NAME_add_entry_by_txt(name, "O", MBSTRING_ASC,
+                               (const unsigned char *) "SPIFFE", -1, -1, 0);
+    // leaves and their CA must not share a name
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+                               (const unsigned char *) uri.c_str(), -1, -1, 0);
+    X509_set_issuer_name(cert, issuer ? X509_get_subject_name(issuer) : name);
+
+    if(!issuer) {
+        issuer = cert;
+        signer = key;
+    }
+    addExtension(cert, issuer, NID_basic_constraints,
+                 ca ? "critical,CA:TRUE" : "critical,CA:FALSE");
+    addExtension(cert, issuer, NID_key_usage,
+                 ca ? "critical,keyCertSign,cRLSign"
+                    : "critical,digitalSignature");
+    addExtension(cert, issuer, NID_subject_alt_name, ("URI:" + uri).c_str());
+
+    X509_sign(cert, signer, EVP_sha256());
+    return cert;
+}
+
+static std::string certificateDER(X509 *cert)
+{
+    std::string der(i2d_X509(cert, NULL), '\0');
+    unsigned char *p = (unsigned char *) &der[0];
+    i2d_X509(cert, &p);
+    return der;
+}
+
+static std::string privateKeyDER(EVP_PKEY *key)
+{
+    PKCS8_PRIV_KEY_INFO *p8 = EVP_PKEY2PKCS8(key);
+    std::string der(i2d_PKCS8_PRIV_KEY_INFO(p8, NULL), '\0');
+    unsigned char *p = (unsigned char *) &der[0];
+    i2d_PKCS8_PRIV_KEY_INFO(p8, &p);
+    PKCS8_PRIV_KEY_INFO_free(p8);
+    return der;
+}
+
+// concatenated DER of count new self-signed CAs for td.
+static std::string newBundle(const std::string &td, int count)
+{
+    std::string bundle;
+    for(int i = 0; i < count; ++i) {
+        EVP_PKEY *key = newKey();
+        X509 *cert = newCertificate(key, NULL, NULL, i + 1,
+                                    "spiffe://" + td, true);
+        bundle += certificateDER(cert);
+        X509_free(cert);
+        EVP_PKEY_free(key);
+    }
+    return bundle;
+}
+
+static std::string jwkCoordinate(const BIGNUM *bn)
+{
+    unsigned char bytes[32];
+    BN_bn2binpad(bn, bytes, sizeof bytes);
+    return base64url(bytes, sizeof bytes);
+}
+
+static std::string publicJWK(EVP_PKEY *key, const std::string &kid)
+{
+    const EC_KEY *ec_key = EVP_PKEY_get0_EC_KEY(key);
+    BIGNUM *x = BN_new(), *y = BN_new();
+    EC_POINT_get_affine_coordinates(EC_KEY_get0_group(ec_key),
+                                    EC_KEY_get0_public_key(ec_key), x, y,
+                                    NULL);
+    std::string jwk = "{\"kty\":\"EC\",\"crv\":\"P-256\",\"use\":\"jwt-svid\","
+                      "\"kid\":\""
+                      + kid + "\",\"x\":\"" + jwkCoordinate(x)
+                      + "\",\"y\":\"" + jwkCoordinate(y) + "\"}";
+    BN_free(x);
+    BN_free(y);
+    return jwk;
+}
+
+// ES256 signature, r and s concatenated as JWS wants them.
+static std::string signES256(EVP_PKEY *key, const std::string &input)
+{
+    EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+    size_t len = 0;
+    EVP_DigestSignInit(ctx, NULL, EVP_sha256(), NULL, key);
+    EVP_DigestSign(ctx, NULL, &len, (const unsigned char *) input.data(),
+                   input.size());
+    std::vector<unsigned char> der(len);
+    EVP_DigestSign(ctx, der.data(), &len, (const unsigned char *) input.data(),
+                   input.size());
+    EVP_MD_CTX_free(ctx);
+
+    const unsigned char *p = der.data();
+    ECDSA_SIG *sig = d2i_ECDSA_SIG(NULL, &p, len);
+    unsigned char raw[64];
+    BN_bn2binpad(ECDSA_SIG_get0_r(sig), raw, 32);
+    BN_bn2binpad(ECDSA_SIG_get0_s(sig), raw + 32, 32);
+    ECDSA_SIG_free(sig);
+    return base64url(raw, sizeof raw);
+}
+
+/** material of the current rotation, shared by every call */
+class MockMaterial
+{
+  public:
+    explicit MockMaterial(const MockConfig &config) : config(config)
+    {
+        ca_key = newKey();
+        ca_cert = newCertificate(ca_key, NULL, NULL, 1,
+                                 "spiffe://" MOCK_TRUST_DOMAIN, true);
+        bundle = certificateDER(ca_cert);
+        if(config.bundle_size > 1) {
+            bundle += newBundle(MOCK_TRUST_DOMAIN, config.bundle_size - 1);
+        }
+        for(int i = 0; i < config.federated; ++i) {
+            const std::string td
+                = "federated" + std::to_string(i) + "." MOCK_TRUST_DOMAIN;
+            federated.emplace_back(td, newBundle(td, config.bundle_size));
+        }
+        for(int i = 0; i < config.svids; ++i) {
+            svid_keys.push_back(newKey());
+        }
+    }
+
+    ~MockMaterial()
+    {
+        for(EVP_PKEY *key : svid_keys) {
+            EVP_PKEY_free(key);
+        }
+        for(auto &jwt_key : jwt_keys) {
+            EVP_PKEY_free(jwt_key.second);
+        }
+        X509_free(ca_cert);
+        EVP_PKEY_free(ca_key);
+    }
+
+    /** signs new SVIDs and a new JWT key, and wakes up every stream */
+    void Rotate(void)
+    {
+        const uint64_t stamp = nowMicros();
+
+        auto x509 = std::make_shared<X509SVIDResponse>();
+        for(int i = 0; i < config.svids; ++i) {
+            const std::string id = "spiffe://" MOCK_TRUST_DOMAIN "/workload"
+                                   + std::to_string(i);
+            X509 *leaf = newCertificate(svid_keys[i], ca_cert, ca_key, stamp,
+                                        id, false);
+            X509SVID *svid = x509->add_svids();
+            svid->set_spiffe_id(id);
+            svid->set_x509_svid(certificateDER(leaf));
+            svid->set_x509_svid_key(privateKeyDER(svid_keys[i]));
+            svid->set_bundle(bundle);
+            X509_free(leaf);
+        }
+        for(const auto &fed : federated) {
+            (*x509->mutable_federated_bundles())[fed.first] = fed.second;
+        }
+
+        EVP_PKEY *jwt_key = newKey();
+        std::lock_guard<std::mutex> lock(mtx);
+        jwt_keys.emplace_back("mock-" + std::to_string(generation + 1) + "-"
+                                  + std::to_string(stamp),
+                              jwt_key);
+        while((int) jwt_keys.size() > std::max(config.jwt_keys, 1)) {
+            EVP_PKEY_free(jwt_keys.front().second);
+            jwt_keys.erase(jwt_keys.begin());
+        }
+        std::string jwks = "{\"keys\":[";
+        for(size_t i = 0; i < jwt_keys.size(); ++i) {
+            jwks += (i ? "," : "")
+                    + publicJWK(jwt_keys[i].second, jwt_keys[i].first);
+        }
+        jwks += "]}";
+        auto jwt = std::make_shared<JWTBundlesResponse>();
+        (*jwt->mutable_bundles())[MOCK_TRUST_DOMAIN] = jwks;
+
+        x509_response = x509;
+        jwt_response = jwt;
+        ++generation;
+        cond.notify_all();
+    }
+
+    /** ends every stream */
+    void Stop(void)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stopped = true;
+        cond.notify_all();
+    }
+
+    /** waits for a generation newer than seen. false if stopped or ctx was
+     * cancelled. */
+    bool WaitNewer(grpc::ServerContext *ctx, uint64_t *seen,
+                   std::shared_ptr<const X509SVIDResponse> *x509,
+                   std::shared_ptr<const JWTBundlesResponse> *jwt)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        while(!stopped && generation == *seen) {
+            if(ctx->IsCancelled()) {
+                return false;
+            }
+            cond.wait_for(lock, std::chrono::milliseconds(100));
+        }
+        if(stopped) {
+            return false;
+        }
+        *seen = generation;
+        if(x509) {
+            *x509 = x509_response;
+        }
+        if(jwt) {
+            *jwt = jwt_response;
+        }
+        return true;
+    }
+
+    /** signs a JWT-SVID with the newest key */
+    std::string SignJWTSVID(const JWTSVIDRequest &req)
+    {
+        const uint64_t now = nowMicros() / 1000000;
+        std::string aud;
+        for(const auto &audience : req.audience()) {
+            aud += (aud.empty() ? "\"" : ",\"") + audience + "\"";
+        }
+        const std::string sub = req.spiffe_id().empty()
+                                    ? "spiffe://" MOCK_TRUST_DOMAIN "/workload0"
+                                    : req.spiffe_id();
+        const std::string payload
+            = "{\"sub\":\"" + sub + "\",\"aud\":[" + aud
+              + "],\"iat\":" + std::to_string(now)
+              + ",\"exp\":" + std::to_string(now + MOCK_JWT_LIFETIME) + "}";
+
+        std::lock_guard<std::mutex> lock(mtx);
+        const auto &jwt_key = jwt_keys.back();
+        const std::string header = "{\"alg\":\"ES256\",\"typ\":\"JWT\","
+                                   "\"kid\":\""
+                                   + jwt_key.first + "\"}";
+        const std::string input
+            = base64url(header) + "." + base64url(payload);
+        return input + "." + signES256(jwt_key.second, input);
+    }
+
+  private:
+    const MockConfig config;
+
+    EVP_PKEY *ca_key;
+    X509 *ca_cert;
+    std::string bundle;
+    std::vector<std::pair<std::string, std::string>> federated;
+    std::vector<EVP_PKEY *> svid_keys;
+
+    /** protects everything below */
+    std::mutex mtx;
+    std::condition_variable cond;
+    uint64_t generation = 0;
+    bool stopped = false;
+    std::vector<std::pair<std::string, EVP_PKEY *>> jwt_keys;
+    std::shared_ptr<const X509SVIDResponse> x509_response;
+    std::shared_ptr<const JWTBundlesResponse> jwt_response;
+};
+
+class MockWorkloadAPI final : public SpiffeWorkloadAPI::Service
+{
+  public:
+    MockWorkloadAPI(const MockConfig &config, MockMaterial *material)
+        : config(config), material(material)
+    {
+    }
+
+    grpc::Status FetchJWTSVID(grpc::ServerContext *ctx,
+                              const JWTSVIDRequest *req,
+                              JWTSVIDResponse *resp) override
+    {
+        if(injectError()) {
+            return grpc::Status(grpc::UNAVAILABLE, "injected error");
+        }
+        delay();
+        JWTSVID *svid = resp->add_svids();
+        svid->set_spiffe_id(req->spiffe_id());
+        svid->set_svid(material->SignJWTSVID(*req));
+        return grpc::Status::OK;
+    }
+
+    grpc::Status
+    FetchJWTBundles(grpc::ServerContext *ctx, const JWTBundlesRequest *req,
+                    grpc::ServerWriter<JWTBundlesResponse> *writer) override
+    {
+        if(injectError()) {
+            return grpc::Status(grpc::UNAVAILABLE, "injected error");
+        }
+        uint64_t seen = 0;
+        std::shared_ptr<const JWTBundlesResponse> resp;
+        while(material->WaitNewer(ctx, &seen, NULL, &resp)) {
+            delay();
+            if(!writer->Write(*resp)) {
+                break;
+            }
+        }
+        return ctx->IsCancelled()
+                   ? grpc::Status::CANCELLED
+                   : grpc::Status(grpc::UNAVAILABLE, "server stopped");
+    }
+
+    // no signature check, the claims of any well formed token are echoed
+    grpc::Status ValidateJWTSVID(grpc::ServerContext *ctx,
+                                 const ValidateJWTSVIDRequest *req,
+                                 ValidateJWTSVIDResponse *resp) override
+    {
+        if(injectError()) {
+            return grpc::Status(grpc::UNAVAILABLE, "injected error");
+        }
+        delay();
+        const std::string &token = req->svid();
+        const size_t dot1 = token.find('.');
+        const size_t dot2 = token.find('.', dot1 + 1);
+        if(dot1 == std::string::npos || dot2 == std::string::npos) {
+            return grpc::Status(grpc::INVALID_ARGUMENT, "malformed token");
+        }
+        const std::string payload
+            = base64urlDecode(token.substr(dot1 + 1, dot2 - dot1 - 1));
+        if(!google::protobuf::util::JsonStringToMessage(
+                payload, resp->mutable_claims())
+                .ok()) {
+            return grpc::Status(grpc::INVALID_ARGUMENT, "malformed claims");
+        }
+        const auto &fields = resp->claims().fields();
+        auto sub = fields.find("sub");
+        if(sub != fields.end()) {
+            resp->set_spiffe_id(sub->second.string_value());
+        }
+        return grpc::Status::OK;
+    }
+
+    grpc::Status
+    FetchX509SVID(grpc::ServerContext *ctx, const X509SVIDRequest *req,
+                  grpc::ServerWriter<X509SVIDResponse> *writer) override
+    {
+        if(injectError()) {
+            return grpc::Status(grpc::UNAVAILABLE, "injected error");
+        }
+        uint64_t seen = 0;
+        std::shared_ptr<const X509SVIDResponse> resp;
+        while(material->WaitNewer(ctx, &seen, &resp, NULL)) {
+            delay();
+            if(!writer->Write(*resp)) {
+                break;
+            }
+        }
+        return ctx->IsCancelled()
+                   ? grpc::Status::CANCELLED
+                   : grpc::Status(grpc::UNAVAILABLE, "server stopped");
+    }
+
+  private:
+    bool injectError(void)
+    {
+        return config.error_every > 0
+               && ++calls % (unsigned) config.error_every == 0;
+    }
+
+    void delay(void)
+    {
+        if(config.latency_ms > 0) {
+            std::this_thread::sleep_for(
+                std::chrono::milliseconds(config.latency_ms));
+        }
+    }
+
+    const MockConfig config;
+    MockMaterial *material;
+    std::atomic<unsigned> calls{ 0 };
+};
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -a address   listening address (unix:///tmp/agent.sock)\n"
+            "  -s n         X.509-SVIDs per response (1)\n"
+            "  -b n         CA certificates per bundle (1)\n"
+            "  -f n         federated trust domains (0)\n"
+            "  -k n         JWT keys per bundle (1)\n"
+            "  -r ms        time between rotations, 0 never rotates (1000)\n"
+            "  -n n         rotations before exiting, 0 runs forever (0)\n"
+            "  -l ms        delay before every response (0)\n"
+            "  -e n         every n-th call fails with UNAVAILABLE (0)\n",
+            name);
+}
+
+int main(int argc, char **argv)
+{
+    MockConfig config = { "unix:///tmp/agent.sock", 1, 1, 0, 1, 1000, 0,
+                          0, 0 };
+    int opt;
+    while((opt = getopt(argc, argv, "a:s:b:f:k:r:n:l:e:h")) != -1) {
+        switch(opt) {
+        case 'a':
+            config.address = optarg;
+            break;
+        case 's':
+            config.svids = atoi(optarg);
+            break;
+        case 'b':
+            config.bundle_size = atoi(optarg);
+            break;
+        case 'f':
+            config.federated = atoi(optarg);
+            break;
+        case 'k':
+            config.jwt_keys = atoi(optarg);
+            break;
+        case 'r':
+            config.rotation_ms = atoi(optarg);
+            break;
+        case 'n':
+            config.rotations = atoi(optarg);
+            break;
+        case 'l':
+            config.latency_ms = atoi(optarg);
+            break;
+        case 'e':
+            config.error_every = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if(config.svids < 1 || config.bundle_size < 1) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    MockMaterial material(config);
+    material.Rotate();
+
+    MockWorkloadAPI service(config, &material);
+    grpc::ServerBuilder builder;
+    builder.AddListeningPort(config.address,
+                             grpc::InsecureServerCredentials());
+    builder.RegisterService(&service);
+    std::unique_ptr<grpc::Server> server = builder.BuildAndStart();
+    if(!server) {
+        fprintf(stderr, "could not listen on %s\n", config.address);
+        return EXIT_FAILURE;
+    }
+    printf("mock Workload API listening on %s\n", config.address);
+    fflush(stdout);
+
+    if(config.rotation_ms <= 0) {
+        server->Wait();
+        return EXIT_SUCCESS;
+    }
+    for(int i = 0; config.rotations == 0 || i < config.rotations; ++i) {
+        std::this_thread::sleep_for(
+            std::chrono::milliseconds(config.rotation_ms));
+        material.Rotate();
+    }
+    // give the last rotation time to reach the clients
+    std::this_thread::sleep_for(std::chrono::milliseconds(config.rotation_ms));
+    material.Stop();
+    server->Shutdown(std::chrono::system_clock::now()
+                     + std::chrono::seconds(1));
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,158 @@
+/**
+ *
+ * (C) Copyright 2020-2021 Hewlett Packard Enterprise Development LP
+ *
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+/*
+ * Base64 decoding benchmark, see README.md.
+ *
+ * Decodes inputs the size of the parts of ES256 and RS256 JWT-SVIDs and of
+ * an x5c certificate with cjose and with each util_Base64 implementation
+ * the CPU supports, then reports nanoseconds per decode and throughput.
+ */
+
+#include "c-spiffe/utils/base64.h"
+#include <cjose/cjose.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct {
+    const char *name;
+    /** decoded length */
+    size_t len;
+    util_Base64Alphabet alphabet;
+} bench_Input;
+
+static const bench_Input inputs[] = {
+    { "header", 60, UTIL_BASE64_URL },
+    { "payload", 180, UTIL_BASE64_URL },
+    { "ES256 signature", 64, UTIL_BASE64_URL },
+    { "RS256 signature", 256, UTIL_BASE64_URL },
+    { "x5c certificate", 1100, UTIL_BASE64_STD },
+};
+
+static const struct {
+    const char *name;
+    util_Base64Impl impl;
+} impls[] = {
+    { "scalar", UTIL_BASE64_SCALAR },
+    { "sse4.1", UTIL_BASE64_SSE41 },
+    { "avx2", UTIL_BASE64_AVX2 },
+};
+
+static long iterations = 1000000;
+/** keeps the decodes from being optimized out */
+static volatile uint8_t sink;
+
+static double nowSeconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static void report(const char *name, size_t len, double elapsed)
+{
+    const double ns = elapsed * 1e9 / iterations;
+    printf("  %-8s %9.1f ns %9.1f MB/s\n", name, ns,
+           len * iterations / elapsed / 1e6);
+}
+
+static void bench(const bench_Input *input)
+{
+    uint8_t *bytes = malloc(input->len);
+    for(size_t i = 0; i < input->len; ++i) {
+        bytes[i] = (uint8_t) rand();
+    }
+    char *encoded
+        = malloc(util_Base64_EncodedLen(input->len, input->alphabet) + 1);
+    const size_t encoded_len
+        = util_Base64_Encode(bytes, input->len, encoded, input->alphabet);
+    uint8_t *decoded = malloc(input->len);
+
+    printf("%s: %zu bytes, %zu characters\n", input->name, input->len,
+           encoded_len);
+
+    double start = nowSeconds();
+    for(long i = 0; i < iterations; ++i) {
+        uint8_t *out = NULL;
+        size_t out_len;
+        cjose_err err;
+        const bool ok
+            = input->alphabet == UTIL_BASE64_URL
+                  ? cjose_base64url_decode(encoded, encoded_len, &out,
+                                           &out_len, &err)
+                  : cjose_base64_decode(encoded, encoded_len, &out,
+                                        &out_len, &err);
+        if(ok) {
+            sink = out[0];
+        }
+        free(out);
+    }
+    report("cjose", input->len, nowSeconds() - start);
+
+    for(size_t i = 0; i < sizeof impls / sizeof *impls; ++i) {
+        if(!util_Base64_Supported(impls[i].impl)) {
+            continue;
+        }
+        start = nowSeconds();
+        for(long j = 0; j < iterations; ++j) {
+            size_t out_len;
+            util_Base64_DecodeWith(impls[i].impl, encoded, encoded_len,
+                                   decoded, &out_len, input->alphabet);
+            sink = decoded[0];
+        }
+        report(impls[i].name, input->len, nowSeconds() - start);
+    }
+
+    free(decoded);
+    free(encoded);
+    free(bytes);
+}
+
+int main(int argc, char **argv)
+{
+    int opt;
+    while((opt = getopt(argc, argv, "n:")) != -1) {
+        switch(opt) {
+        case 'n':
+            iterations = atol(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n iterations]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if(iterations <= 0) {
+        fprintf(stderr, "iterations must be positive\n");
+        return EXIT_FAILURE;
+    }
+
+    for(size_t i = 0; i < sizeof inputs / sizeof *inputs; ++i) {
+        bench(inputs + i);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -63,10 +63,10 @@ int main(int argc, char **argv)
             printf("Trust Domain: %s\n", svid->id.td.name);
             printf("Token: %s\n", svid->token);
             printf("Claims:\n");
-            for(size_t i = 0, size = shlenu(svid->claims); i < size; ++i) {
-                char *value
-                    = json_dumps(svid->claims[i].value, JSON_DECODE_ANY);
-                printf("key: %s, value: %s\n", svid->claims[i].key, value);
+            map_string_claim *claims = jwtsvid_SVID_GetClaims(svid);
+            for(size_t i = 0, size = shlenu(claims); i < size; ++i) {
+                char *value = json_dumps(claims[i].value, JSON_DECODE_ANY);
+                printf("key: %s, value: %s\n", claims[i].key, value);
                 free(value);
             }
             jwtsvid_SVID_Free(svid);
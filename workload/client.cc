@@ -30,8 +30,22 @@
 #include "c-spiffe/svid/x509svid/svid.h"
 #include "workload.grpc.pb.h"
 #include "workload.pb.h"
+#include <google/protobuf/arena.h>
 #include <grpc/grpc.h>
 #include <grpcpp/grpcpp.h>
+#include <chrono>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+google::protobuf::ArenaOptions workloadapi_responseArenaOptions(char *block)
+{
+    google::protobuf::ArenaOptions options;
+    // a user provided initial block survives Arena::Reset()
+    options.initial_block = block;
+    options.initial_block_size = WORKLOADAPI_RESPONSE_ARENA_SIZE;
+    return options;
+}
 
 x509bundle_Bundle *workloadapi_parseX509Bundle(const char *id,
                                                const byte *bundle_bytes,
@@ -56,30 +70,104 @@ x509bundle_Bundle *workloadapi_parseX509Bundle(const char *id,
     return bundle;
 }
 
-x509bundle_Set *workloadapi_parseX509Bundles(const X509SVIDResponse *rep,
-                                             err_t *err)
+namespace
+{
+/// hashes and compares bundle bytes through pointers into the response, so
+/// they are not copied to be used as keys.
+struct BytesPtrHash {
+    size_t operator()(const std::string *bytes) const
+    {
+        return std::hash<std::string>()(*bytes);
+    }
+};
+
+struct BytesPtrEqual {
+    bool operator()(const std::string *lhs, const std::string *rhs) const
+    {
+        return *lhs == *rhs;
+    }
+};
+} // namespace
+
+static x509bundle_Set *
+workloadapi_parseX509BundlesCached(const X509SVIDResponse *rep,
+                                   workloadapi_UpdateCache *cache, err_t *err)
 {
     if(rep) {
         x509bundle_Set *set = x509bundle_NewSet(0);
-
-        auto ids = rep->svids();
-        for(auto &&id : ids) {
+        // bytes of the bundle of each trust domain, in the order they were
+        // first named. A later entry for the same trust domain replaces an
+        // earlier one, so federated bundles win over SVID bundles
+        std::vector<std::pair<std::string, const std::string *>> td_bytes;
+        std::unordered_map<std::string, size_t> td_index;
+        // authorities decoded from each distinct bundle, when not cached
+        std::unordered_map<const std::string *, X509 **, BytesPtrHash,
+                           BytesPtrEqual>
+            decoded;
+
+        auto pick = [&](const std::string &id, const std::string &bytes) {
             err_t err;
-            x509bundle_Bundle *b = workloadapi_parseX509Bundle(
-                id.spiffe_id().c_str(),
-                reinterpret_cast<const byte *>(id.bundle().data()),
-                id.bundle().length(), &err);
-            x509bundle_Set_Add(set, b);
+            spiffeid_TrustDomain td
+                = spiffeid_TrustDomainFromString(id.c_str(), &err);
+            if(err == NO_ERROR) {
+                auto found = td_index.find(td.name);
+                if(found != td_index.end()) {
+                    td_bytes[found->second].second = &bytes;
+                } else {
+                    td_index[td.name] = td_bytes.size();
+                    td_bytes.emplace_back(td.name, &bytes);
+                }
+            }
+            spiffeid_TrustDomain_Free(&td);
+        };
+        for(auto const &id : rep->svids()) {
+            pick(id.spiffe_id(), id.bundle());
+        }
+        for(auto const &td_byte : rep->federated_bundles()) {
+            pick(td_byte.first, td_byte.second);
         }
 
-        auto map_td_bytes = rep->federated_bundles();
-        for(auto const &td_byte : map_td_bytes) {
+        // every SVID of a trust domain carries the same bundle, which may
+        // also be in the federated bundles, so each distinct one is
+        // decoded only once, by the cache when there is one.
+        for(auto const &entry : td_bytes) {
+            spiffeid_TrustDomain td
+                = { const_cast<char *>(entry.first.c_str()) };
+            const std::string &bytes = *(entry.second);
+            const byte *data = reinterpret_cast<const byte *>(bytes.data());
+            x509bundle_Bundle *bundle = NULL;
             err_t err;
-            x509bundle_Bundle *b = workloadapi_parseX509Bundle(
-                td_byte.first.c_str(),
-                reinterpret_cast<const byte *>(td_byte.second.data()),
-                td_byte.second.length(), &err);
-            x509bundle_Set_Add(set, b);
+            auto found = decoded.find(&bytes);
+            if(cache) {
+                bundle = workloadapi_UpdateCache_ParseX509Bundle(
+                    cache, td, data, bytes.length(), &err);
+            } else if(found != decoded.end()) {
+                // same bytes as the bundle of another trust domain
+                bundle = x509bundle_FromX509Authorities(td, found->second);
+            } else {
+                X509 **certs
+                    = x509util_ParseCertificates(data, bytes.length(), &err);
+                if(err == NO_ERROR) {
+                    bundle = x509bundle_FromX509Authorities(td, certs);
+                    decoded[&bytes] = certs;
+                } else {
+                    for(size_t i = 0, size = arrlenu(certs); i < size; ++i) {
+                        X509_free(certs[i]);
+                    }
+                    arrfree(certs);
+                }
+            }
+            if(bundle) {
+                x509bundle_Set_Add(set, bundle);
+            }
+        }
+
+        for(auto const &entry : decoded) {
+            X509 **certs = entry.second;
+            for(size_t i = 0, size = arrlenu(certs); i < size; ++i) {
+                X509_free(certs[i]);
+            }
+            arrfree(certs);
         }
 
         return set;
@@ -89,8 +177,15 @@ x509bundle_Set *workloadapi_parseX509Bundles(const X509SVIDResponse *rep,
     return NULL;
 }
 
-x509svid_SVID **workloadapi_parseX509SVIDs(X509SVIDResponse *resp,
-                                           bool firstOnly, err_t *err)
+x509bundle_Set *workloadapi_parseX509Bundles(const X509SVIDResponse *rep,
+                                             err_t *err)
+{
+    return workloadapi_parseX509BundlesCached(rep, NULL, err);
+}
+
+static x509svid_SVID **
+workloadapi_parseX509SVIDsCached(X509SVIDResponse *resp, bool firstOnly,
+                                 workloadapi_UpdateCache *cache, err_t *err)
 {
     if(!resp) {
         *err = ERR_PARSING;
@@ -100,13 +195,26 @@ x509svid_SVID **workloadapi_parseX509SVIDs(X509SVIDResponse *resp,
     *err = NO_ERROR;
     for(auto &&id : resp->svids()) {
         // assemble SVID from response.
-        auto x509svid = x509svid_ParseRaw((byte *) id.x509_svid().data(),
-                                          id.x509_svid().length(),
-                                          (byte *) id.x509_svid_key().data(),
-                                          id.x509_svid_key().length(), err);
-        if(*err != NO_ERROR)
+        x509svid_SVID *x509svid = NULL;
+        if(cache) {
+            x509svid = workloadapi_UpdateCache_ParseX509SVID(
+                cache, id.spiffe_id().c_str(),
+                (byte *) id.x509_svid().data(), id.x509_svid().length(),
+                (byte *) id.x509_svid_key().data(),
+                id.x509_svid_key().length(), err);
+        } else {
+            x509svid = x509svid_ParseRaw((byte *) id.x509_svid().data(),
+                                         id.x509_svid().length(),
+                                         (byte *) id.x509_svid_key().data(),
+                                         id.x509_svid_key().length(), err);
+        }
+        if(*err != NO_ERROR) {
+            for(size_t i = 0, size = arrlenu(x509svids); i < size; ++i) {
+                x509svid_SVID_Free(x509svids[i]);
+            }
+            arrfree(x509svids);
             return NULL;
-        else
+        } else
             arrpush(x509svids, x509svid);
         if(firstOnly)
             break; // first SVID done.
@@ -114,15 +222,31 @@ x509svid_SVID **workloadapi_parseX509SVIDs(X509SVIDResponse *resp,
     return x509svids;
 }
 
-workloadapi_X509Context *workloadapi_parseX509Context(X509SVIDResponse *resp,
-                                                      err_t *err)
+x509svid_SVID **workloadapi_parseX509SVIDs(X509SVIDResponse *resp,
+                                           bool firstOnly, err_t *err)
+{
+    return workloadapi_parseX509SVIDsCached(resp, firstOnly, NULL, err);
+}
+
+workloadapi_X509Context *
+workloadapi_parseX509ContextCached(X509SVIDResponse *resp,
+                                   workloadapi_UpdateCache *cache, err_t *err)
 {
-    auto svids = workloadapi_parseX509SVIDs(resp, false, err);
+    if(cache) {
+        workloadapi_UpdateCache_Begin(cache);
+    }
+    auto svids = workloadapi_parseX509SVIDsCached(resp, false, cache, err);
     if(*err != NO_ERROR) {
+        if(cache) {
+            workloadapi_UpdateCache_Abort(cache);
+        }
         return NULL;
     }
-    auto bundles = workloadapi_parseX509Bundles(resp, err);
+    auto bundles = workloadapi_parseX509BundlesCached(resp, cache, err);
     if(*err != NO_ERROR) {
+        if(cache) {
+            workloadapi_UpdateCache_Abort(cache);
+        }
         for(int i = 0; i < arrlen(svids); i++) {
             x509svid_SVID_Free(svids[i]);
         }
@@ -138,31 +262,52 @@ workloadapi_X509Context *workloadapi_parseX509Context(X509SVIDResponse *resp,
         }
         arrfree(svids);
         x509bundle_Set_Free(bundles);
+        if(cache) {
+            workloadapi_UpdateCache_Abort(cache);
+        }
         *err = ERR_PARSING;
         return NULL;
     }
     cntx->bundles = bundles;
     cntx->svids = svids;
+    if(cache) {
+        workloadapi_UpdateCache_End(cache);
+    }
 
     return cntx;
 }
 
+workloadapi_X509Context *workloadapi_parseX509Context(X509SVIDResponse *resp,
+                                                      err_t *err)
+{
+    return workloadapi_parseX509ContextCached(resp, NULL, err);
+}
+
+// audiences params stands for, audience first. strings are borrowed.
+static string_arr_t workloadapi_paramsAudiences(const jwtsvid_Params *params)
+{
+    string_arr_t audiences = NULL;
+    if(params->audience) {
+        arrput(audiences, params->audience);
+    }
+    for(size_t i = 0, size = arrlenu(params->extra_audiences); i < size;
+        ++i) {
+        arrput(audiences, params->extra_audiences[i]);
+    }
+    return audiences;
+}
+
 jwtsvid_SVID *workloadapi_parseJWTSVID(const JWTSVIDResponse *resp,
                                        jwtsvid_Params *params, err_t *err)
 {
     if(resp) {
-        // insert audience at the beginning of the array
-        if(params->audience) {
-            arrins(params->extra_audiences, 0, params->audience);
-            // for memory safety
-            params->audience = NULL;
-        }
-
         if(resp->svids_size() > 0) {
             auto id = resp->svids(0);
             string_t token = string_new(id.svid().c_str());
+            string_arr_t audiences = workloadapi_paramsAudiences(params);
             jwtsvid_SVID *svid
-                = jwtsvid_ParseInsecure(token, params->extra_audiences, err);
+                = jwtsvid_ParseInsecure(token, audiences, err);
+            arrfree(audiences);
             arrfree(token);
 
             return svid;
@@ -177,25 +322,73 @@ jwtsvid_SVID *workloadapi_parseJWTSVID(const JWTSVIDResponse *resp,
     return NULL;
 }
 
-jwtbundle_Set *workloadapi_parseJWTBundles(const JWTBundlesResponse *resp,
-                                           err_t *err)
+jwtsvid_SVID **workloadapi_parseJWTSVIDs(const JWTSVIDResponse *resp,
+                                         jwtsvid_Params *params, err_t *err)
+{
+    if(resp) {
+        if(resp->svids_size() > 0) {
+            string_arr_t audiences = workloadapi_paramsAudiences(params);
+            jwtsvid_SVID **svids = NULL;
+            *err = NO_ERROR;
+            for(auto &&id : resp->svids()) {
+                string_t token = string_new(id.svid().c_str());
+                jwtsvid_SVID *svid
+                    = jwtsvid_ParseInsecure(token, audiences, err);
+                arrfree(token);
+                if(*err != NO_ERROR) {
+                    for(size_t i = 0, size = arrlenu(svids); i < size; ++i) {
+                        jwtsvid_SVID_Free(svids[i]);
+                    }
+                    arrfree(svids);
+                    break;
+                }
+                arrput(svids, svid);
+            }
+            arrfree(audiences);
+
+            return svids;
+        } else {
+            // no SVID returned
+            *err = ERR_NULL_SVID;
+            return NULL;
+        }
+    }
+    // null pointer error
+    *err = ERR_NULL;
+    return NULL;
+}
+
+jwtbundle_Set *
+workloadapi_parseJWTBundlesCached(const JWTBundlesResponse *resp,
+                                  workloadapi_UpdateCache *cache, err_t *err)
 {
     if(resp) {
         jwtbundle_Set *set = jwtbundle_NewSet(0);
 
+        if(cache) {
+            workloadapi_UpdateCache_Begin(cache);
+        }
         auto map_td_bytes = resp->bundles();
         for(auto const &td_byte : map_td_bytes) {
             spiffeid_TrustDomain td
                 = spiffeid_TrustDomainFromString(td_byte.first.c_str(), err);
             if(!(*err)) {
                 jwtbundle_Bundle *bundle
-                    = jwtbundle_Parse(td, td_byte.second.c_str(), err);
+                    = cache ? workloadapi_UpdateCache_ParseJWTBundle(
+                          cache, td, td_byte.second.c_str(),
+                          td_byte.second.length(), err)
+                            : jwtbundle_Parse(td, td_byte.second.c_str(), err);
                 if(!(*err) && bundle) {
                     jwtbundle_Set_Add(set, bundle);
                 }
             }
             spiffeid_TrustDomain_Free(&td);
         }
+        if(cache && *err != NO_ERROR) {
+            workloadapi_UpdateCache_Abort(cache);
+        } else if(cache) {
+            workloadapi_UpdateCache_End(cache);
+        }
 
         return set;
     }
@@ -204,6 +397,12 @@ jwtbundle_Set *workloadapi_parseJWTBundles(const JWTBundlesResponse *resp,
     return NULL;
 }
 
+jwtbundle_Set *workloadapi_parseJWTBundles(const JWTBundlesResponse *resp,
+                                           err_t *err)
+{
+    return workloadapi_parseJWTBundlesCached(resp, NULL, err);
+}
+
 workloadapi_Client *workloadapi_NewClient(err_t *error)
 {
     workloadapi_Client *client
@@ -215,7 +414,13 @@ workloadapi_Client *workloadapi_NewClient(err_t *error)
     client->stub = NULL;
     client->address = NULL;
     client->headers = NULL;
-    client->context_list = NULL;
+    client->calls = NULL;
+    client->free_calls = NULL;
+    mtx_init(&(client->calls_mutex), mtx_plain);
+    client->jwtsvid_calls = NULL;
+    sh_new_strdup(client->jwtsvid_calls);
+    shdefault(client->jwtsvid_calls, NULL);
+    mtx_init(&(client->jwtsvid_calls_mutex), mtx_plain);
     mtx_init(&(client->closed_mutex), mtx_plain);
     cnd_init(&(client->closed_cond));
     mtx_lock(&(client->closed_mutex));
@@ -239,6 +444,11 @@ err_t workloadapi_Client_Free(workloadapi_Client *client)
 
     mtx_destroy(&(client->closed_mutex));
     cnd_destroy(&(client->closed_cond));
+    arrfree(client->calls);
+    arrfree(client->free_calls);
+    mtx_destroy(&(client->calls_mutex));
+    shfree(client->jwtsvid_calls);
+    mtx_destroy(&(client->jwtsvid_calls_mutex));
 
     free(client);
     return NO_ERROR;
@@ -291,10 +501,13 @@ err_t workloadapi_Client_Close(workloadapi_Client *client)
         delete((SpiffeWorkloadAPI::Stub *) client->stub);
         client->owns_stub = false;
     }
-    for(size_t i = 0, size = arrlenu(client->context_list); i < size; i++) {
-        ((grpc::ClientContext *) client->context_list[i])->TryCancel();
+    mtx_lock(&(client->calls_mutex));
+    for(size_t i = 0, size = arrlenu(client->calls); i < size; i++) {
+        if(client->calls[i]) {
+            ((grpc::ClientContext *) client->calls[i])->TryCancel();
+        }
     }
-    arrfree(client->context_list);
+    mtx_unlock(&(client->calls_mutex));
 
     client->stub = NULL;
     cnd_broadcast(&(client->closed_cond));
@@ -419,6 +632,16 @@ err_t workloadapi_Client_WatchX509Context(workloadapi_Client *client,
     while(true) {
         err_t err
             = workloadapi_Client_watchX509Context(client, watcher, &backoff);
+        if(err == NO_ERROR) {
+            // restarted, open a new stream unless closed meanwhile
+            mtx_lock(&(client->closed_mutex));
+            const bool closed = client->closed;
+            mtx_unlock(&(client->closed_mutex));
+            if(closed) {
+                return ERR_CLOSED;
+            }
+            continue;
+        }
         workloadapi_Watcher_OnX509ContextWatchError(watcher, err);
         err = workloadapi_Client_HandleWatchError(client, err, &backoff);
         if(err == (int) grpc::CANCELLED
@@ -430,6 +653,322 @@ err_t workloadapi_Client_WatchX509Context(workloadapi_Client *client,
     }
 }
 
+// registers the context of a call for Close to cancel. Returns its slot,
+// or -1 if the client already has WORKLOADAPI_MAX_CALLS calls in flight.
+static int workloadapi_Client_addCall(workloadapi_Client *client,
+                                      grpc::ClientContext *ctx)
+{
+    int slot = -1;
+
+    mtx_lock(&(client->calls_mutex));
+    if(arrlen(client->free_calls) > 0) {
+        slot = arrpop(client->free_calls);
+        client->calls[slot] = (workloadapi_Context) ctx;
+    } else if(arrlen(client->calls) < WORKLOADAPI_MAX_CALLS) {
+        slot = (int) arrlen(client->calls);
+        arrput(client->calls, (workloadapi_Context) ctx);
+    }
+    mtx_unlock(&(client->calls_mutex));
+
+    return slot;
+}
+
+static void workloadapi_Client_removeCall(workloadapi_Client *client,
+                                          int slot)
+{
+    mtx_lock(&(client->calls_mutex));
+    client->calls[slot] = NULL;
+    arrput(client->free_calls, slot);
+    mtx_unlock(&(client->calls_mutex));
+}
+
+// keeps a context registered in the client while it is in scope. Declare it
+// after the context, so the context outlives its registration.
+class workloadapi_Call
+{
+  public:
+    workloadapi_Call(workloadapi_Client *client, grpc::ClientContext *ctx)
+        : client(client), slot(workloadapi_Client_addCall(client, ctx))
+    {
+        if(client->headers) {
+            for(int i = 0; i < arrlen(client->headers); i += 2)
+                ctx->AddMetadata(client->headers[i], client->headers[i + 1]);
+        }
+    }
+
+    ~workloadapi_Call()
+    {
+        if(slot >= 0) {
+            workloadapi_Client_removeCall(client, slot);
+        }
+    }
+
+    bool ok() const { return slot >= 0; }
+
+  private:
+    workloadapi_Call(const workloadapi_Call &) = delete;
+    workloadapi_Call &operator=(const workloadapi_Call &) = delete;
+
+    workloadapi_Client *client;
+    const int slot;
+};
+
+// publishes the context of a watcher stream while it is in scope, for
+// workloadapi_Watcher_Restart to cancel. Declare it after the context.
+class workloadapi_WatchStream
+{
+  public:
+    workloadapi_WatchStream(workloadapi_Watcher *watcher,
+                            grpc::ClientContext *ctx)
+        : watcher(watcher)
+    {
+        mtx_lock(&(watcher->update_mutex));
+        watcher->stream = ctx;
+        watcher->restart = false;
+        mtx_unlock(&(watcher->update_mutex));
+    }
+
+    ~workloadapi_WatchStream()
+    {
+        mtx_lock(&(watcher->update_mutex));
+        watcher->stream = NULL;
+        mtx_unlock(&(watcher->update_mutex));
+    }
+
+    // was the stream cancelled by workloadapi_Watcher_Restart?
+    bool restarted()
+    {
+        mtx_lock(&(watcher->update_mutex));
+        const bool restart = watcher->restart;
+        watcher->restart = false;
+        mtx_unlock(&(watcher->update_mutex));
+        return restart;
+    }
+
+  private:
+    workloadapi_WatchStream(const workloadapi_WatchStream &) = delete;
+    workloadapi_WatchStream &
+    operator=(const workloadapi_WatchStream &) = delete;
+
+    workloadapi_Watcher *watcher;
+};
+
+void workloadapi_Client_CancelContext(workloadapi_Context ctx)
+{
+    ((grpc::ClientContext *) ctx)->TryCancel();
+}
+
+// hands the responses of a watch stream from the thread reading it to a
+// thread parsing and dispatching them, so a slow callback does not stall the
+// stream. At most one response waits: a newer one replaces it, as only the
+// latest update matters. Stats are guarded by the watcher update_mutex.
+template <typename Response, typename Watcher> class workloadapi_UpdatePipeline
+{
+  public:
+    typedef void (*dispatch_t)(Watcher *, Response *);
+
+    // response decoded into its own arena, reused once dispatched. Reading,
+    // waiting and dispatching use at most 3 of them.
+    struct Slot {
+        std::unique_ptr<char[]> block;
+        google::protobuf::Arena arena;
+        Response *response;
+        std::chrono::steady_clock::time_point read_at;
+
+        Slot()
+            : block(new char[WORKLOADAPI_RESPONSE_ARENA_SIZE]),
+              arena(workloadapi_responseArenaOptions(block.get())),
+              response(NULL)
+        {
+        }
+    };
+
+    workloadapi_UpdatePipeline(Watcher *watcher, dispatch_t dispatch)
+        : watcher(watcher), dispatch(dispatch), reading(NULL), pending(NULL),
+          stopping(false)
+    {
+        mtx_init(&mtx, mtx_plain);
+        cnd_init(&cond);
+        running = thrd_create(&thread, run, this) == thrd_success;
+    }
+
+    // dispatches the waiting response, if any, before returning
+    ~workloadapi_UpdatePipeline()
+    {
+        if(running) {
+            mtx_lock(&mtx);
+            stopping = true;
+            cnd_signal(&cond);
+            mtx_unlock(&mtx);
+            thrd_join(thread, NULL);
+        }
+        cnd_destroy(&cond);
+        mtx_destroy(&mtx);
+    }
+
+    // returns an empty response to read the next message into
+    Response *next()
+    {
+        mtx_lock(&mtx);
+        Slot *slot;
+        if(free_slots.empty()) {
+            slots.emplace_back(new Slot());
+            slot = slots.back().get();
+        } else {
+            slot = free_slots.back();
+            free_slots.pop_back();
+        }
+        mtx_unlock(&mtx);
+        slot->arena.Reset();
+        slot->response
+            = google::protobuf::Arena::CreateMessage<Response>(&(slot->arena));
+        reading = slot;
+        return slot->response;
+    }
+
+    // queues the response returned by next(), once read
+    void push()
+    {
+        Slot *slot = reading;
+        reading = NULL;
+        slot->read_at = std::chrono::steady_clock::now();
+        if(!running) {
+            // no dispatch thread, do it inline as before
+            dispatchSlot(slot);
+            mtx_lock(&mtx);
+            free_slots.push_back(slot);
+            mtx_unlock(&mtx);
+            return;
+        }
+
+        mtx_lock(&mtx);
+        Slot *dropped = pending;
+        pending = slot;
+        if(dropped) {
+            free_slots.push_back(dropped);
+        }
+        mtx_lock(&(watcher->update_mutex));
+        ++(watcher->pipeline_stats.received);
+        if(dropped) {
+            ++(watcher->pipeline_stats.coalesced);
+        }
+        watcher->pipeline_stats.depth = 1;
+        mtx_unlock(&(watcher->update_mutex));
+        cnd_signal(&cond);
+        mtx_unlock(&mtx);
+    }
+
+    // gives back the response returned by next(), when nothing was read
+    void discard()
+    {
+        mtx_lock(&mtx);
+        free_slots.push_back(reading);
+        mtx_unlock(&mtx);
+        reading = NULL;
+    }
+
+  private:
+    workloadapi_UpdatePipeline(const workloadapi_UpdatePipeline &) = delete;
+    workloadapi_UpdatePipeline &operator=(const workloadapi_UpdatePipeline &)
+        = delete;
+
+    void dispatchSlot(Slot *slot)
+    {
+        dispatch(watcher, slot->response);
+        const uint64_t latency
+            = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                  std::chrono::steady_clock::now() - slot->read_at)
+                  .count();
+
+        mtx_lock(&(watcher->update_mutex));
+        workloadapi_PipelineStats *stats = &(watcher->pipeline_stats);
+        if(!running) {
+            ++(stats->received);
+        }
+        ++(stats->dispatched);
+        stats->last_latency_ns = latency;
+        if(latency > stats->max_latency_ns) {
+            stats->max_latency_ns = latency;
+        }
+        stats->total_latency_ns += latency;
+        mtx_unlock(&(watcher->update_mutex));
+    }
+
+    static int run(void *arg)
+    {
+        workloadapi_UpdatePipeline *pipeline
+            = (workloadapi_UpdatePipeline *) arg;
+
+        mtx_lock(&(pipeline->mtx));
+        while(true) {
+            while(!pipeline->pending && !pipeline->stopping) {
+                cnd_wait(&(pipeline->cond), &(pipeline->mtx));
+            }
+            Slot *slot = pipeline->pending;
+            if(!slot) {
+                break; // stopping, and nothing left to dispatch
+            }
+            pipeline->pending = NULL;
+            mtx_lock(&(pipeline->watcher->update_mutex));
+            pipeline->watcher->pipeline_stats.depth = 0;
+            mtx_unlock(&(pipeline->watcher->update_mutex));
+            mtx_unlock(&(pipeline->mtx));
+
+            pipeline->dispatchSlot(slot);
+
+            mtx_lock(&(pipeline->mtx));
+            pipeline->free_slots.push_back(slot);
+        }
+        mtx_unlock(&(pipeline->mtx));
+
+        return 0;
+    }
+
+    Watcher *watcher;
+    const dispatch_t dispatch;
+
+    std::vector<std::unique_ptr<Slot>> slots;
+    std::vector<Slot *> free_slots;
+    // only touched by the reading thread
+    Slot *reading;
+    Slot *pending;
+    bool stopping;
+
+    mtx_t mtx;
+    cnd_t cond;
+    thrd_t thread;
+    bool running;
+};
+
+static void workloadapi_dispatchX509SVIDResponse(workloadapi_Watcher *watcher,
+                                                 X509SVIDResponse *response)
+{
+    err_t err = NO_ERROR;
+    workloadapi_X509Context *x509context = workloadapi_parseX509ContextCached(
+        response, watcher->update_cache, &err);
+    if(err != NO_ERROR) {
+        workloadapi_Watcher_OnX509ContextWatchError(watcher, err);
+    } else {
+        workloadapi_Watcher_OnX509ContextUpdate(watcher, x509context);
+        free(x509context);
+    }
+}
+
+static void
+workloadapi_dispatchJWTBundlesResponse(workloadapi_JWTWatcher *watcher,
+                                       JWTBundlesResponse *response)
+{
+    err_t err = NO_ERROR;
+    jwtbundle_Set *set = workloadapi_parseJWTBundlesCached(
+        response, watcher->update_cache, &err);
+    if(err != NO_ERROR) {
+        workloadapi_JWTWatcher_OnJWTBundlesWatchError(watcher, err);
+    } else {
+        workloadapi_JWTWatcher_OnJWTBundlesUpdate(watcher, set);
+        jwtbundle_Set_Free(set);
+    }
+}
+
 err_t workloadapi_Client_watchX509Context(workloadapi_Client *client,
                                           workloadapi_Watcher *watcher,
                                           workloadapi_Backoff *backoff)
@@ -445,32 +984,33 @@ err_t workloadapi_Client_watchX509Context(workloadapi_Client *client,
         return ERR_NULL;
     }
 
-    grpc::ClientContext *ctx = new grpc::ClientContext();
-
-    if(client->headers) {
-        for(int i = 0; i < arrlen(client->headers); i += 2)
-            ctx->AddMetadata(client->headers[i], client->headers[i + 1]);
+    grpc::ClientContext ctx;
+    workloadapi_Call call(client, &ctx);
+    if(!call.ok()) {
+        return ERR_TOO_MANY_CALLS;
     }
 
+    workloadapi_WatchStream stream(watcher, &ctx);
+
     X509SVIDRequest req = X509SVIDRequest(); // empty request
-    X509SVIDResponse response;
+
+    // this thread only reads, the pipeline parses and calls the watcher
+    workloadapi_UpdatePipeline<X509SVIDResponse, workloadapi_Watcher>
+        pipeline(watcher, workloadapi_dispatchX509SVIDResponse);
 
     // unique_ptr gets freed after it goes out of scope
     std::unique_ptr<grpc::ClientReaderInterface<X509SVIDResponse>> c_reader
         = ((SpiffeWorkloadAPI::StubInterface *) client->stub)
-              ->FetchX509SVID(ctx, req); // get response reader
-    arrput(client->context_list, (void *) ctx);
+              ->FetchX509SVID(&ctx, req); // get response reader
     while(true) {
+        X509SVIDResponse *response = pipeline.next();
 
-        response.clear_svids();
-        response.clear_crl();
-        response.clear_federated_bundles();
-
-        bool ok = c_reader->Read(&response);
+        bool ok = c_reader->Read(response);
         if(!ok) {
+            pipeline.discard();
             auto status = c_reader->Finish();
             if(status.error_code() == (int) grpc::StatusCode::CANCELLED) {
-                return ERR_CANCELLED_STATUS;
+                return stream.restarted() ? NO_ERROR : ERR_CANCELLED_STATUS;
             }
             if(status.error_code()
                == (int) grpc::StatusCode::INVALID_ARGUMENT) {
@@ -479,15 +1019,7 @@ err_t workloadapi_Client_watchX509Context(workloadapi_Client *client,
             return ERR_NO_MESSAGE; // no more messages.
         }
         workloadapi_Backoff_Reset(backoff);
-        err_t err = NO_ERROR;
-        workloadapi_X509Context *x509context
-            = workloadapi_parseX509Context(&response, &err);
-        if(err != NO_ERROR) {
-            workloadapi_Watcher_OnX509ContextWatchError(watcher, err);
-        } else {
-            workloadapi_Watcher_OnX509ContextUpdate(watcher, x509context);
-            free(x509context);
-        }
+        pipeline.push();
     }
 }
 
@@ -526,24 +1058,41 @@ err_t workloadapi_Client_HandleWatchError(workloadapi_Client *client,
     return ERR_DEFAULT; /// shouldn't reach this.
 }
 
-workloadapi_X509Context *
-workloadapi_Client_FetchX509Context(workloadapi_Client *client, err_t *error)
+// reads the first message of a FetchX509SVID stream, then cancels it so
+// the agent does not keep pushing updates nobody reads.
+static bool
+workloadapi_Client_fetchX509SVIDResponse(workloadapi_Client *client,
+                                         X509SVIDResponse *response,
+                                         err_t *err)
 {
-    grpc::ClientContext *ctx = new grpc::ClientContext();
-
-    if(client->headers) {
-        for(int i = 0; i < arrlen(client->headers); i += 2)
-            ctx->AddMetadata(client->headers[i], client->headers[i + 1]);
+    grpc::ClientContext ctx;
+    workloadapi_Call call(client, &ctx);
+    if(!call.ok()) {
+        *err = ERR_TOO_MANY_CALLS;
+        return false;
     }
 
     X509SVIDRequest req = X509SVIDRequest(); // empty request
-    X509SVIDResponse response;
 
     std::unique_ptr<grpc::ClientReaderInterface<X509SVIDResponse>> c_reader
         = ((SpiffeWorkloadAPI::StubInterface *) client->stub)
-              ->FetchX509SVID(ctx, req); // get response reader
-    arrput(client->context_list, (void *) ctx);
-    bool success = c_reader->Read(&response);
+              ->FetchX509SVID(&ctx, req); // get response reader
+    bool success = c_reader->Read(response);
+    ctx.TryCancel();
+    c_reader->Finish();
+    if(!success) {
+        *err = ERR_BAD_REQUEST;
+    }
+
+    return success;
+}
+
+workloadapi_X509Context *
+workloadapi_Client_FetchX509Context(workloadapi_Client *client, err_t *error)
+{
+    X509SVIDResponse response;
+    bool success
+        = workloadapi_Client_fetchX509SVIDResponse(client, &response, error);
     workloadapi_X509Context *ret = NULL;
 
     if(success) {
@@ -554,7 +1103,6 @@ workloadapi_Client_FetchX509Context(workloadapi_Client *client, err_t *error)
         return ret;
     } else {
         // could not fetch x509 context
-        *error = ERR_BAD_REQUEST;
         return NULL;
     }
 }
@@ -562,21 +1110,9 @@ workloadapi_Client_FetchX509Context(workloadapi_Client *client, err_t *error)
 x509bundle_Set *workloadapi_Client_FetchX509Bundles(workloadapi_Client *client,
                                                     err_t *err)
 {
-    grpc::ClientContext *ctx = new grpc::ClientContext();
-
-    if(client->headers) {
-        for(int i = 0; i < arrlen(client->headers); i += 2)
-            ctx->AddMetadata(client->headers[i], client->headers[i + 1]);
-    }
-
-    X509SVIDRequest req = X509SVIDRequest(); // empty request
     X509SVIDResponse response;
-
-    std::unique_ptr<grpc::ClientReaderInterface<X509SVIDResponse>> c_reader
-        = ((SpiffeWorkloadAPI::StubInterface *) client->stub)
-              ->FetchX509SVID(ctx, req); // get response reader
-    arrput(client->context_list, (void *) ctx);
-    bool success = c_reader->Read(&response);
+    bool success
+        = workloadapi_Client_fetchX509SVIDResponse(client, &response, err);
     x509bundle_Set *ret_set = NULL;
     if(success) {
         ret_set = workloadapi_parseX509Bundles(&response, err);
@@ -586,7 +1122,6 @@ x509bundle_Set *workloadapi_Client_FetchX509Bundles(workloadapi_Client *client,
         return ret_set;
     } else {
         // could not fetch x509 bundles
-        *err = ERR_BAD_REQUEST;
         return NULL;
     }
 }
@@ -594,21 +1129,9 @@ x509bundle_Set *workloadapi_Client_FetchX509Bundles(workloadapi_Client *client,
 x509svid_SVID **workloadapi_Client_FetchX509SVIDs(workloadapi_Client *client,
                                                   err_t *err)
 {
-    grpc::ClientContext *ctx = new grpc::ClientContext();
-
-    if(client->headers) {
-        for(int i = 0; i < arrlen(client->headers); i += 2)
-            ctx->AddMetadata(client->headers[i], client->headers[i + 1]);
-    }
-
-    X509SVIDRequest req = X509SVIDRequest(); // empty request
     X509SVIDResponse response;
-
-    std::unique_ptr<grpc::ClientReaderInterface<X509SVIDResponse>> c_reader
-        = ((SpiffeWorkloadAPI::StubInterface *) client->stub)
-              ->FetchX509SVID(ctx, req); // get response reader
-    arrput(client->context_list, (void *) ctx);
-    bool success = c_reader->Read(&response);
+    bool success
+        = workloadapi_Client_fetchX509SVIDResponse(client, &response, err);
     x509svid_SVID **ret_svids = NULL;
     if(success) {
         ret_svids = workloadapi_parseX509SVIDs(&response, false, err);
@@ -618,7 +1141,6 @@ x509svid_SVID **workloadapi_Client_FetchX509SVIDs(workloadapi_Client *client,
         return ret_svids;
     } else {
         // could not parse x509 svids
-        *err = ERR_BAD_REQUEST;
         return NULL;
     }
 }
@@ -626,21 +1148,9 @@ x509svid_SVID **workloadapi_Client_FetchX509SVIDs(workloadapi_Client *client,
 x509svid_SVID *workloadapi_Client_FetchX509SVID(workloadapi_Client *client,
                                                 err_t *err)
 {
-    grpc::ClientContext *ctx = new grpc::ClientContext();
-
-    if(client->headers) {
-        for(int i = 0; i < arrlen(client->headers); i += 2)
-            ctx->AddMetadata(client->headers[i], client->headers[i + 1]);
-    }
-
-    X509SVIDRequest req = X509SVIDRequest(); // empty request
     X509SVIDResponse response;
-
-    std::unique_ptr<grpc::ClientReaderInterface<X509SVIDResponse>> c_reader
-        = ((SpiffeWorkloadAPI::StubInterface *) client->stub)
-              ->FetchX509SVID(ctx, req); // get response reader
-    arrput(client->context_list, (void *) ctx);
-    bool success = c_reader->Read(&response);
+    bool success
+        = workloadapi_Client_fetchX509SVIDResponse(client, &response, err);
     x509svid_SVID **svids = NULL;
     if(success) {
         svids = workloadapi_parseX509SVIDs(&response, true, err);
@@ -657,44 +1167,47 @@ x509svid_SVID *workloadapi_Client_FetchX509SVID(workloadapi_Client *client,
         arrfree(svids);  // free outer array
         return ret_svid; // no response -> no bundle
     } else {
-        // could not fetch x509 svid;
-        *err = ERR_BAD_REQUEST;
+        // could not fetch x509 svid
         return NULL;
     }
 }
 
-jwtsvid_SVID *workloadapi_Client_FetchJWTSVID(workloadapi_Client *client,
-                                              jwtsvid_Params *params,
-                                              err_t *err)
+static void workloadapi_setJWTSVIDRequest(JWTSVIDRequest *req,
+                                          const jwtsvid_Params *params)
 {
-    grpc::ClientContext *ctx = new grpc::ClientContext();
-
-    if(client->headers) {
-        for(int i = 0; i < arrlen(client->headers); i += 2)
-            ctx->AddMetadata(client->headers[i], client->headers[i + 1]);
-    }
-
-    JWTSVIDRequest req;
-
     // set spiffe id
     if(!spiffeid_ID_IsZero(params->subject)) {
         string_t id = spiffeid_ID_String(params->subject);
-        req.set_spiffe_id(id);
+        req->set_spiffe_id(id);
         arrfree(id);
     }
 
     // set audiences
     if(params->audience) {
-        req.add_audience(params->audience);
+        req->add_audience(params->audience);
         for(size_t i = 0, size = arrlenu(params->extra_audiences); i < size;
             ++i) {
-            req.add_audience(params->extra_audiences[i]);
+            req->add_audience(params->extra_audiences[i]);
         }
     }
+}
+
+static jwtsvid_SVID *workloadapi_Client_fetchJWTSVID(
+    workloadapi_Client *client, jwtsvid_Params *params, err_t *err)
+{
+    grpc::ClientContext ctx;
+    workloadapi_Call call(client, &ctx);
+    if(!call.ok()) {
+        *err = ERR_TOO_MANY_CALLS;
+        return NULL;
+    }
+
+    JWTSVIDRequest req;
+    workloadapi_setJWTSVIDRequest(&req, params);
 
     JWTSVIDResponse resp;
     grpc::Status status = ((SpiffeWorkloadAPI::StubInterface *) client->stub)
-                              ->FetchJWTSVID(ctx, req, &resp);
+                              ->FetchJWTSVID(&ctx, req, &resp);
 
     if(status.ok()) {
         // parse response
@@ -706,14 +1219,149 @@ jwtsvid_SVID *workloadapi_Client_FetchJWTSVID(workloadapi_Client *client,
     }
 }
 
+jwtsvid_SVID *workloadapi_Client_FetchJWTSVID(workloadapi_Client *client,
+                                              jwtsvid_Params *params,
+                                              err_t *err)
+{
+    string_t key = jwtsvid_Params_Key(params);
+
+    mtx_lock(&(client->jwtsvid_calls_mutex));
+    workloadapi_JWTSVIDCall *call = shget(client->jwtsvid_calls, key);
+    if(call) {
+        // identical request in flight, wait for its result
+        ++(call->waiters);
+        while(!call->done) {
+            cnd_wait(&(call->done_cond), &(client->jwtsvid_calls_mutex));
+        }
+        jwtsvid_SVID *svid = jwtsvid_SVID_Clone(call->svid);
+        *err = call->err;
+        if(--(call->waiters) == 0) {
+            jwtsvid_SVID_Free(call->svid);
+            cnd_destroy(&(call->done_cond));
+            free(call);
+        }
+        mtx_unlock(&(client->jwtsvid_calls_mutex));
+        arrfree(key);
+        return svid;
+    }
+    call = (workloadapi_JWTSVIDCall *) calloc(1, sizeof *call);
+    cnd_init(&(call->done_cond));
+    call->waiters = 1;
+    shput(client->jwtsvid_calls, key, call);
+    mtx_unlock(&(client->jwtsvid_calls_mutex));
+
+    jwtsvid_SVID *svid = workloadapi_Client_fetchJWTSVID(client, params, err);
+
+    mtx_lock(&(client->jwtsvid_calls_mutex));
+    shdel(client->jwtsvid_calls, key);
+    call->svid = svid;
+    call->err = *err;
+    call->done = true;
+    cnd_broadcast(&(call->done_cond));
+    if(--(call->waiters) == 0) {
+        cnd_destroy(&(call->done_cond));
+        free(call);
+    } else {
+        // followers copy from call->svid, the last one frees it
+        svid = jwtsvid_SVID_Clone(svid);
+    }
+    mtx_unlock(&(client->jwtsvid_calls_mutex));
+    arrfree(key);
+
+    return svid;
+}
+
+workloadapi_JWTSVIDResult *
+workloadapi_Client_FetchJWTSVIDs(workloadapi_Client *client,
+                                 jwtsvid_Params *params, err_t *err)
+{
+    if(!client || !params) {
+        *err = ERR_NULL;
+        return NULL;
+    }
+
+    struct PendingCall {
+        PendingCall(workloadapi_Client *client) : call(client, &ctx) {}
+
+        grpc::ClientContext ctx;
+        workloadapi_Call call;
+        JWTSVIDResponse resp;
+        grpc::Status status;
+        std::unique_ptr<
+            grpc::ClientAsyncResponseReaderInterface<JWTSVIDResponse>>
+            reader;
+    };
+
+    const size_t size = arrlenu(params);
+    workloadapi_JWTSVIDResult *results = NULL;
+    arrsetlen(results, size);
+    std::vector<std::unique_ptr<PendingCall>> calls(size);
+    grpc::CompletionQueue cq;
+    size_t started = 0;
+
+    // pipeline every request over the channel before waiting on any.
+    for(size_t i = 0; i < size; ++i) {
+        results[i].svids = NULL;
+        results[i].err = ERR_BAD_REQUEST;
+
+        calls[i].reset(new PendingCall(client));
+        PendingCall *call = calls[i].get();
+        if(!call->call.ok()) {
+            results[i].err = ERR_TOO_MANY_CALLS;
+            calls[i].reset();
+            continue;
+        }
+        JWTSVIDRequest req;
+        workloadapi_setJWTSVIDRequest(&req, &params[i]);
+        call->reader = ((SpiffeWorkloadAPI::StubInterface *) client->stub)
+                           ->AsyncFetchJWTSVID(&(call->ctx), req, &cq);
+        call->reader->Finish(&(call->resp), &(call->status), (void *) i);
+        ++started;
+    }
+
+    void *tag;
+    bool ok;
+    for(size_t done = 0; done < started && cq.Next(&tag, &ok); ++done) {
+        const size_t i = (size_t) tag;
+        PendingCall *call = calls[i].get();
+        if(ok && call->status.ok()) {
+            // parse response
+            results[i].svids = workloadapi_parseJWTSVIDs(
+                &(call->resp), &params[i], &(results[i].err));
+        } else {
+            // could not fetch jwt svid
+            results[i].err = ERR_BAD_REQUEST;
+        }
+    }
+    cq.Shutdown();
+    while(cq.Next(&tag, &ok)) {
+        // drain
+    }
+
+    *err = NO_ERROR;
+    return results;
+}
+
+void workloadapi_JWTSVIDResults_Free(workloadapi_JWTSVIDResult *results)
+{
+    for(size_t i = 0, size = arrlenu(results); i < size; ++i) {
+        for(size_t j = 0, size2 = arrlenu(results[i].svids); j < size2;
+            ++j) {
+            jwtsvid_SVID_Free(results[i].svids[j]);
+        }
+        arrfree(results[i].svids);
+    }
+    arrfree(results);
+}
+
 jwtbundle_Set *workloadapi_Client_FetchJWTBundles(workloadapi_Client *client,
                                                   err_t *err)
 {
     grpc::ClientContext ctx;
-
-    if(client->headers) {
-        for(int i = 0; i < arrlen(client->headers); i += 2)
-            ctx.AddMetadata(client->headers[i], client->headers[i + 1]);
+    workloadapi_Call call(client, &ctx);
+    if(!call.ok()) {
+        *err = ERR_TOO_MANY_CALLS;
+        return NULL;
     }
 
     JWTBundlesRequest req;
@@ -723,6 +1371,9 @@ jwtbundle_Set *workloadapi_Client_FetchJWTBundles(workloadapi_Client *client,
 
     JWTBundlesResponse resp;
     bool success = c_reader->Read(&resp);
+    // only the first message is needed, stop the stream
+    ctx.TryCancel();
+    c_reader->Finish();
     if(success) {
         // parse response
         return workloadapi_parseJWTBundles(&resp, err);
@@ -733,11 +1384,118 @@ jwtbundle_Set *workloadapi_Client_FetchJWTBundles(workloadapi_Client *client,
     }
 }
 
+typedef google::protobuf::Value Value;
+
+// converts a protobuf Value to a new json reference.
+static json_t *workloadapi_valueToJSON(const Value &value)
+{
+    switch(value.kind_case()) {
+    case Value::kNumberValue: {
+        // Struct has no integers, keep the ones that fit as integers
+        const double number = value.number_value();
+        const json_int_t integer = (json_int_t) number;
+        if((double) integer == number) {
+            return json_integer(integer);
+        }
+        return json_real(number);
+    }
+    case Value::kStringValue:
+        return json_stringn(value.string_value().data(),
+                            value.string_value().size());
+    case Value::kBoolValue:
+        return json_boolean(value.bool_value());
+    case Value::kStructValue: {
+        json_t *obj = json_object();
+        for(const auto &field : value.struct_value().fields()) {
+            json_object_set_new(obj, field.first.c_str(),
+                                workloadapi_valueToJSON(field.second));
+        }
+        return obj;
+    }
+    case Value::kListValue: {
+        json_t *arr = json_array();
+        for(const auto &elem : value.list_value().values()) {
+            json_array_append_new(arr, workloadapi_valueToJSON(elem));
+        }
+        return arr;
+    }
+    default:
+        return json_null();
+    }
+}
+
+// builds the JWT-SVID from the claims the Workload API validated.
+static jwtsvid_SVID *
+workloadapi_parseValidateJWTSVIDResponse(const ValidateJWTSVIDResponse &resp,
+                                         const char *token, err_t *err)
+{
+    const auto &fields = resp.claims().fields();
+    std::string subject = resp.spiffe_id();
+    if(subject.empty()) {
+        auto sub = fields.find("sub");
+        if(sub != fields.end()
+           && sub->second.kind_case() == Value::kStringValue) {
+            subject = sub->second.string_value();
+        }
+    }
+
+    auto exp = fields.find("exp");
+    if(exp == fields.end() || exp->second.kind_case() != Value::kNumberValue
+       || exp->second.number_value() <= 0) {
+        // expiry is missing
+        *err = ERR_INVALID_DATA;
+        return NULL;
+    }
+
+    spiffeid_ID id = spiffeid_FromString(subject.c_str(), err);
+    if(*err != NO_ERROR) {
+        // subject is not a valid spiffe id
+        *err = ERR_INVALID_CLAIM;
+        return NULL;
+    }
+
+    jwtsvid_SVID *svid = (jwtsvid_SVID *) malloc(sizeof *svid);
+    svid->id = id;
+    svid->audience = NULL;
+    svid->expiry = (time_t) exp->second.number_value();
+    svid->claims = NULL;
+    sh_new_strdup(svid->claims);
+    for(const auto &field : fields) {
+        shput(svid->claims, field.first.c_str(),
+              workloadapi_valueToJSON(field.second));
+    }
+    svid->claims_state.store(JWTSVID_CLAIMS_BUILT);
+    svid->token = string_new(token);
+
+    auto aud = fields.find("aud");
+    if(aud != fields.end()) {
+        if(aud->second.kind_case() == Value::kStringValue) {
+            arrput(svid->audience,
+                   string_new(aud->second.string_value().c_str()));
+        } else if(aud->second.kind_case() == Value::kListValue) {
+            for(const auto &elem : aud->second.list_value().values()) {
+                if(elem.kind_case() == Value::kStringValue) {
+                    arrput(svid->audience,
+                           string_new(elem.string_value().c_str()));
+                }
+            }
+        }
+    }
+
+    *err = NO_ERROR;
+    return svid;
+}
+
 jwtsvid_SVID *workloadapi_Client_ValidateJWTSVID(workloadapi_Client *client,
                                                  char *token, char *audience,
                                                  err_t *err)
 {
     grpc::ClientContext ctx;
+    workloadapi_Call call(client, &ctx);
+    if(!call.ok()) {
+        *err = ERR_TOO_MANY_CALLS;
+        return NULL;
+    }
 
     ValidateJWTSVIDRequest req;
     req.set_svid(token);
@@ -748,7 +1506,11 @@ jwtsvid_SVID *workloadapi_Client_ValidateJWTSVID(workloadapi_Client *client,
                               ->ValidateJWTSVID(&ctx, req, &resp);
 
     if(status.ok()) {
-        // parse response
+        if(resp.claims().fields_size() > 0) {
+            // the agent already parsed the token for us
+            return workloadapi_parseValidateJWTSVIDResponse(resp, token, err);
+        }
+        // no claims in the response, parse them from the token
         string_arr_t audiences_array = NULL;
         arrput(audiences_array, audience);
         jwtsvid_SVID *svid
@@ -763,6 +1525,32 @@ jwtsvid_SVID *workloadapi_Client_ValidateJWTSVID(workloadapi_Client *client,
     }
 }
 
+jwtsvid_SVID *workloadapi_Client_ValidateJWTSVIDWithBundles(
+    workloadapi_Client *client, jwtbundle_Set *bundles, char *token,
+    char *audience, err_t *err)
+{
+    if(bundles) {
+        jwtbundle_Source source;
+        source.type = jwtbundle_Source::JWTBUNDLE_SET;
+        source.source.set = bundles;
+
+        string_arr_t audiences_array = NULL;
+        arrput(audiences_array, audience);
+        jwtsvid_SVID *svid
+            = jwtsvid_ParseAndValidate(token, &source, audiences_array, err);
+        arrfree(audiences_array);
+
+        if(*err != ERR_NOAUTHORITY) {
+            // validated, or rejected, without asking the agent. A trust
+            // domain with no bundle is rejected too, so tokens naming any
+            // trust domain do not each cost a round trip
+            return svid;
+        }
+    }
+
+    return workloadapi_Client_ValidateJWTSVID(client, token, audience, err);
+}
+
 err_t workloadapi_Client_WatchJWTBundles(workloadapi_Client *client,
                                          workloadapi_JWTWatcher *watcher)
 {
@@ -793,21 +1581,24 @@ err_t workloadapi_Client_watchJWTBundles(workloadapi_Client *client,
     if(!client || !watcher || !backoff) {
         return ERR_NULL;
     }
-    grpc::ClientContext *ctx = new grpc::ClientContext();
-    if(client->headers) {
-        for(int i = 0; i < arrlen(client->headers); i += 2)
-            ctx->AddMetadata(client->headers[i], client->headers[i + 1]);
+    grpc::ClientContext ctx;
+    workloadapi_Call call(client, &ctx);
+    if(!call.ok()) {
+        return ERR_TOO_MANY_CALLS;
     }
     JWTBundlesRequest req;
-    JWTBundlesResponse resp;
+    // this thread only reads, the pipeline parses and calls the watcher
+    workloadapi_UpdatePipeline<JWTBundlesResponse, workloadapi_JWTWatcher>
+        pipeline(watcher, workloadapi_dispatchJWTBundlesResponse);
     // unique_ptr gets freed after it goes out of scope
     std::unique_ptr<grpc::ClientReaderInterface<JWTBundlesResponse>> c_reader
         = ((SpiffeWorkloadAPI::StubInterface *) client->stub)
-              ->FetchJWTBundles(ctx, req); // get response reader
-    arrput(client->context_list, (void *) ctx);
+              ->FetchJWTBundles(&ctx, req); // get response reader
     while(true) {
-        bool ok = c_reader->Read(&resp);
+        JWTBundlesResponse *resp = pipeline.next();
+        bool ok = c_reader->Read(resp);
         if(!ok) {
+            pipeline.discard();
             auto status = c_reader->Finish();
             if(status.error_code() == (int) grpc::StatusCode::CANCELLED) {
                 return ERR_CANCELLED_STATUS;
@@ -819,13 +1610,6 @@ err_t workloadapi_Client_watchJWTBundles(workloadapi_Client *client,
             return ERR_NO_MESSAGE; // no more messages.
         }
         workloadapi_Backoff_Reset(backoff);
-        err_t err = NO_ERROR;
-        jwtbundle_Set *set = workloadapi_parseJWTBundles(&resp, &err);
-        if(err != NO_ERROR) {
-            workloadapi_JWTWatcher_OnJWTBundlesWatchError(watcher, err);
-        } else {
-            workloadapi_JWTWatcher_OnJWTBundlesUpdate(watcher, set);
-            jwtbundle_Set_Free(set);
-        }
+        pipeline.push();
     }
 }
@@ -75,10 +75,10 @@ int main(int argc, char **argv)
                       << "Trust Domain: " << svid->id.td.name << std::endl
                       << "Token: " << svid->token << std::endl
                       << "Claims: " << std::endl;
-            for(size_t i = 0, size = shlenu(svid->claims); i < size; ++i) {
-                char *value
-                    = json_dumps(svid->claims[i].value, JSON_DECODE_ANY);
-                std::cout << "key: " << svid->claims[i].key << ", "
+            map_string_claim *claims = jwtsvid_SVID_GetClaims(svid);
+            for(size_t i = 0, size = shlenu(claims); i < size; ++i) {
+                char *value = json_dumps(claims[i].value, JSON_DECODE_ANY);
+                std::cout << "key: " << claims[i].key << ", "
                           << "value: " << value << std::endl;
                 free(value);
             }
@@ -0,0 +1,263 @@
+/**
+ *
+ * (C) Copyright 2020-2021 Hewlett Packard Enterprise Development LP
+ *
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include "c-spiffe/workload/expirymonitor.h"
+
+// alert of an entry, copied out of the monitor to be reported unlocked
+typedef struct {
+    string_t key;
+    time_t expiry;
+} workloadapi_ExpiryAlert;
+
+static void workloadapi_expiryUnlink(workloadapi_ExpiryMonitor *monitor,
+                                     workloadapi_ExpiryEntry *entry)
+{
+    if(entry->slot < 0) {
+        return;
+    }
+    if(entry->prev) {
+        entry->prev->next = entry->next;
+    } else {
+        monitor->wheel[entry->slot] = entry->next;
+    }
+    if(entry->next) {
+        entry->next->prev = entry->prev;
+    }
+    entry->prev = entry->next = NULL;
+    entry->slot = -1;
+}
+
+// links the entry in the slot its alert falls in, at least one tick ahead
+static void workloadapi_expirySchedule(workloadapi_ExpiryMonitor *monitor,
+                                       workloadapi_ExpiryEntry *entry,
+                                       time_t issued)
+{
+    const time_t alert
+        = issued + (time_t) (monitor->fraction * (entry->expiry - issued));
+    unsigned long ticks = 1;
+    if(alert > monitor->current_time) {
+        ticks = (alert - monitor->current_time + monitor->tick - 1)
+                / monitor->tick;
+    }
+    entry->slot = (int) ((monitor->current + ticks)
+                         % WORKLOADAPI_EXPIRY_WHEEL_SLOTS);
+    entry->rounds = (ticks - 1) / WORKLOADAPI_EXPIRY_WHEEL_SLOTS;
+    entry->prev = NULL;
+    entry->next = monitor->wheel[entry->slot];
+    if(entry->next) {
+        entry->next->prev = entry;
+    }
+    monitor->wheel[entry->slot] = entry;
+}
+
+// Function that will run on thread spun for advancing the wheel
+static int workloadapi_ExpiryMonitor_backgroundFunc(void *_monitor)
+{
+    workloadapi_ExpiryMonitor *monitor = (workloadapi_ExpiryMonitor *) _monitor;
+
+    mtx_lock(&(monitor->mtx));
+    while(monitor->running) {
+        mtx_unlock(&(monitor->mtx));
+        workloadapi_ExpiryMonitor_Advance(monitor, time(NULL));
+        mtx_lock(&(monitor->mtx));
+        if(!monitor->running) {
+            break;
+        }
+        struct timespec deadline
+            = { monitor->current_time + monitor->tick, 0 };
+        cnd_timedwait(&(monitor->cond), &(monitor->mtx), &deadline);
+    }
+    mtx_unlock(&(monitor->mtx));
+
+    return (int) NO_ERROR;
+}
+
+workloadapi_ExpiryMonitor *
+workloadapi_NewExpiryMonitor(double fraction, time_t tick,
+                             workloadapi_ExpiryCallback callback, err_t *err)
+{
+    if(!callback.func) {
+        *err = ERR_NULL;
+        return NULL;
+    }
+    if(fraction < 0 || fraction > 1 || tick < 0) {
+        *err = ERR_BAD_ARGUMENT;
+        return NULL;
+    }
+
+    workloadapi_ExpiryMonitor *monitor = calloc(1, sizeof *monitor);
+    monitor->fraction
+        = fraction == 0 ? WORKLOADAPI_EXPIRY_ALERT_FRACTION : fraction;
+    monitor->tick = tick == 0 ? 1 : tick;
+    monitor->callback = callback;
+    monitor->current_time = time(NULL);
+    sh_new_strdup(monitor->entries);
+    shdefault(monitor->entries, NULL);
+    mtx_init(&(monitor->mtx), mtx_plain);
+    cnd_init(&(monitor->cond));
+
+    *err = NO_ERROR;
+    return monitor;
+}
+
+void workloadapi_ExpiryMonitor_Free(workloadapi_ExpiryMonitor *monitor)
+{
+    if(monitor) {
+        workloadapi_ExpiryMonitor_Stop(monitor);
+        for(size_t i = 0, size = shlenu(monitor->entries); i < size; ++i) {
+            util_string_t_Free(monitor->entries[i].value->key);
+            free(monitor->entries[i].value);
+        }
+        shfree(monitor->entries);
+        cnd_destroy(&(monitor->cond));
+        mtx_destroy(&(monitor->mtx));
+        free(monitor);
+    }
+}
+
+err_t workloadapi_ExpiryMonitor_Start(workloadapi_ExpiryMonitor *monitor)
+{
+    if(!monitor) {
+        return ERR_NULL;
+    }
+    mtx_lock(&(monitor->mtx));
+    if(monitor->running) {
+        mtx_unlock(&(monitor->mtx));
+        return ERR_EXISTS; // already started
+    }
+    monitor->running = true;
+    int thread_error
+        = thrd_create(&(monitor->thread),
+                      workloadapi_ExpiryMonitor_backgroundFunc, monitor);
+    if(thread_error != thrd_success) {
+        monitor->running = false;
+        mtx_unlock(&(monitor->mtx));
+        return ERR_THREAD;
+    }
+    mtx_unlock(&(monitor->mtx));
+
+    return NO_ERROR;
+}
+
+err_t workloadapi_ExpiryMonitor_Stop(workloadapi_ExpiryMonitor *monitor)
+{
+    if(!monitor) {
+        return ERR_NULL;
+    }
+    mtx_lock(&(monitor->mtx));
+    const bool running = monitor->running;
+    monitor->running = false;
+    cnd_broadcast(&(monitor->cond));
+    mtx_unlock(&(monitor->mtx));
+    if(running) {
+        thrd_join(monitor->thread, NULL);
+    }
+
+    return NO_ERROR;
+}
+
+void workloadapi_ExpiryMonitor_Track(workloadapi_ExpiryMonitor *monitor,
+                                     const char *key, time_t issued,
+                                     time_t expiry)
+{
+    mtx_lock(&(monitor->mtx));
+    workloadapi_ExpiryEntry *entry = shget(monitor->entries, key);
+    if(entry && entry->expiry == expiry) {
+        // same SVID, keep its alert
+        mtx_unlock(&(monitor->mtx));
+        return;
+    }
+    if(entry) {
+        workloadapi_expiryUnlink(monitor, entry);
+    } else {
+        entry = calloc(1, sizeof *entry);
+        entry->key = string_new(key);
+        entry->slot = -1;
+        shput(monitor->entries, key, entry);
+    }
+    entry->expiry = expiry;
+    workloadapi_expirySchedule(monitor, entry, issued);
+    mtx_unlock(&(monitor->mtx));
+}
+
+void workloadapi_ExpiryMonitor_Untrack(workloadapi_ExpiryMonitor *monitor,
+                                       const char *key)
+{
+    mtx_lock(&(monitor->mtx));
+    workloadapi_ExpiryEntry *entry = shget(monitor->entries, key);
+    if(entry) {
+        workloadapi_expiryUnlink(monitor, entry);
+        shdel(monitor->entries, key);
+        util_string_t_Free(entry->key);
+        free(entry);
+    }
+    mtx_unlock(&(monitor->mtx));
+}
+
+void workloadapi_ExpiryMonitor_Advance(workloadapi_ExpiryMonitor *monitor,
+                                       time_t now)
+{
+    workloadapi_ExpiryAlert *alerts = NULL;
+
+    mtx_lock(&(monitor->mtx));
+    while(monitor->current_time + monitor->tick <= now) {
+        monitor->current
+            = (monitor->current + 1) % WORKLOADAPI_EXPIRY_WHEEL_SLOTS;
+        monitor->current_time += monitor->tick;
+        workloadapi_ExpiryEntry *entry = monitor->wheel[monitor->current];
+        while(entry) {
+            workloadapi_ExpiryEntry *next = entry->next;
+            if(entry->rounds == 0) {
+                // reported once, until tracked with a new expiry
+                workloadapi_expiryUnlink(monitor, entry);
+                workloadapi_ExpiryAlert alert
+                    = { string_new(entry->key), entry->expiry };
+                arrput(alerts, alert);
+                ++(monitor->stats.alerts);
+            } else {
+                --(entry->rounds);
+            }
+            entry = next;
+        }
+    }
+    mtx_unlock(&(monitor->mtx));
+
+    for(size_t i = 0, size = arrlenu(alerts); i < size; ++i) {
+        monitor->callback.func(alerts[i].key, alerts[i].expiry,
+                               monitor->callback.args);
+        util_string_t_Free(alerts[i].key);
+    }
+    arrfree(alerts);
+}
+
+workloadapi_ExpiryMonitorStats
+workloadapi_ExpiryMonitor_GetStats(workloadapi_ExpiryMonitor *monitor)
+{
+    mtx_lock(&(monitor->mtx));
+    workloadapi_ExpiryMonitorStats stats = monitor->stats;
+    stats.tracked = shlenu(monitor->entries);
+    mtx_unlock(&(monitor->mtx));
+
+    return stats;
+}
@@ -23,7 +23,180 @@
  */
 
 #include "c-spiffe/workload/jwtsource.h"
+#include "c-spiffe/svid/jwtsvid/parse.h"
 #include "c-spiffe/workload/jwtwatcher.h"
+#include <time.h>
+
+// longest the refresh thread sleeps when there is nothing to refresh
+const time_t JWTSVID_REFRESH_IDLE = 3600L;
+
+static jwtsvid_Params jwtsvid_Params_copy(const jwtsvid_Params *params)
+{
+    jwtsvid_Params copy;
+    memset(&copy, 0, sizeof copy);
+    copy.audience = string_new(params->audience);
+    for(size_t i = 0, size = arrlenu(params->extra_audiences); i < size;
+        ++i) {
+        arrput(copy.extra_audiences, string_new(params->extra_audiences[i]));
+    }
+    copy.subject.td.name = string_new(params->subject.td.name);
+    copy.subject.path = string_new(params->subject.path);
+
+    return copy;
+}
+
+static void jwtsvid_Params_free(jwtsvid_Params *params)
+{
+    util_string_t_Free(params->audience);
+    util_string_arr_t_Free(params->extra_audiences);
+    spiffeid_ID_Free(&(params->subject));
+}
+
+static void JWTSVIDCacheEntry_Free(workloadapi_JWTSVIDCacheEntry *entry)
+{
+    if(entry) {
+        jwtsvid_Params_free(&(entry->params));
+        jwtsvid_SVID_Free(entry->svid);
+        free(entry);
+    }
+}
+
+static double jwtsvid_refreshFraction(workloadapi_JWTSource *source)
+{
+    const double fraction = source->config->svid_refresh_fraction;
+    if(fraction == 0) {
+        return WORKLOADAPI_JWTSVID_REFRESH_FRACTION;
+    } else if(fraction > 1) {
+        return 1;
+    }
+    return fraction;
+}
+
+static bool jwtsvid_cacheEnabled(workloadapi_JWTSource *source)
+{
+    return source->config->svid_refresh_fraction >= 0;
+}
+
+static size_t jwtsvid_cacheEntries(workloadapi_JWTSource *source)
+{
+    const long entries = source->config->svid_cache_entries;
+    return entries > 0 ? (size_t) entries : WORKLOADAPI_JWTSVID_CACHE_ENTRIES;
+}
+
+// an SVID outlived its refreshes, reported to the user only: JWT-SVIDs are
+// fetched by unary calls, there is no stream to reopen
+static void jwtsvid_onExpiry(const char *key, time_t expiry, void *args)
+{
+    workloadapi_JWTSource *source = (workloadapi_JWTSource *) args;
+    workloadapi_ExpiryCallback *callback
+        = &(source->config->expiry_callback);
+    if(callback->func) {
+        callback->func(key, expiry, callback->args);
+    }
+}
+
+static void jwtsvid_untrackExpiry(workloadapi_JWTSource *source,
+                                  const char *key)
+{
+    if(source->expiry_monitor) {
+        workloadapi_ExpiryMonitor_Untrack(source->expiry_monitor, key);
+    }
+}
+
+static jwtsvid_SVID *fetchJWTSVID(workloadapi_JWTSource *source,
+                                  jwtsvid_Params *params, err_t *err)
+{
+    return workloadapi_Client_FetchJWTSVID(source->watcher->client, params,
+                                           err);
+}
+
+// Function that will run on thread spun for refreshing cached JWT-SVIDs
+int workloadapi_JWTSource_refreshFunc(void *_source)
+{
+    workloadapi_JWTSource *source = (workloadapi_JWTSource *) _source;
+
+    mtx_lock(&(source->svid_cache_mutex));
+    while(source->svid_refresh_running) {
+        time_t next;
+        jwtsvid_Params *due
+            = workloadapi_JWTSource_dueJWTSVIDs(source, time(NULL), &next);
+
+        if(arrlenu(due) > 0) {
+            mtx_unlock(&(source->svid_cache_mutex));
+            for(size_t i = 0, size = arrlenu(due); i < size; ++i) {
+                err_t err = NO_ERROR;
+                jwtsvid_SVID *svid = fetchJWTSVID(source, &due[i], &err);
+                if(svid) {
+                    workloadapi_JWTSource_cacheJWTSVID(source, &due[i], svid);
+                    mtx_lock(&(source->svid_cache_mutex));
+                    ++(source->svid_cache_stats.refreshes);
+                    mtx_unlock(&(source->svid_cache_mutex));
+                } else {
+                    // retry halfway to expiry
+                    string_t key = jwtsvid_Params_Key(&due[i]);
+                    mtx_lock(&(source->svid_cache_mutex));
+                    workloadapi_JWTSVIDCacheEntry *entry
+                        = shget(source->svid_cache, key);
+                    if(entry) {
+                        const time_t retry = time(NULL);
+                        entry->refresh_at
+                            = retry + (entry->svid->expiry - retry) / 2;
+                        if(entry->refresh_at <= retry) {
+                            entry->refresh_at = retry + 1;
+                        }
+                    }
+                    mtx_unlock(&(source->svid_cache_mutex));
+                    arrfree(key);
+                }
+                jwtsvid_Params_free(&due[i]);
+            }
+            arrfree(due);
+            mtx_lock(&(source->svid_cache_mutex));
+            continue;
+        }
+
+        struct timespec deadline = { next, 0 };
+        cnd_timedwait(&(source->svid_cache_cond), &(source->svid_cache_mutex),
+                      &deadline);
+    }
+    mtx_unlock(&(source->svid_cache_mutex));
+
+    return (int) NO_ERROR;
+}
+
+jwtsvid_Params *workloadapi_JWTSource_dueJWTSVIDs(workloadapi_JWTSource *source,
+                                                  time_t now, time_t *next)
+{
+    jwtsvid_Params *due = NULL;
+    *next = now + JWTSVID_REFRESH_IDLE;
+
+    // backwards, since deleting moves the last entry into the hole
+    for(ptrdiff_t i = shlen(source->svid_cache) - 1; i >= 0; --i) {
+        workloadapi_JWTSVIDCacheEntry *entry = source->svid_cache[i].value;
+        if(entry->svid->expiry <= now) {
+            jwtsvid_untrackExpiry(source, source->svid_cache[i].key);
+            shdel(source->svid_cache, source->svid_cache[i].key);
+            JWTSVIDCacheEntry_Free(entry);
+            ++(source->svid_cache_stats.evictions);
+            continue;
+        }
+        time_t deadline = entry->refresh_at;
+        if(entry->refresh_at <= now) {
+            if(entry->last_used > entry->fetched) {
+                arrput(due, jwtsvid_Params_copy(&(entry->params)));
+                // don't pick it again while being fetched
+                entry->refresh_at = entry->svid->expiry;
+            }
+            // idle ones are left to expire, unless used before that
+            deadline = entry->svid->expiry;
+        }
+        if(deadline < *next) {
+            *next = deadline;
+        }
+    }
+
+    return due;
+}
 
 void workloadapi_JWTSource_onJWTBundle_SetCallback(jwtbundle_Set *jwt_set,
                                                    void *args)
@@ -42,11 +215,38 @@ workloadapi_NewJWTSource(workloadapi_JWTSourceConfig *config, err_t *err)
 
     workloadapi_JWTSource *source
         = (workloadapi_JWTSource *) malloc(sizeof *source);
-    source->closed = true;
+    atomic_init(&(source->closed), true);
     mtx_init(&(source->mtx), mtx_plain);
     mtx_init(&(source->closed_mutex), mtx_plain);
-    source->bundles = NULL;
+    atomic_init(&(source->snapshot), NULL);
+    source->retired = NULL;
+    atomic_init(&(source->epoch), 0);
+    atomic_init(&(source->readers[0]), 0);
+    atomic_init(&(source->readers[1]), 0);
+    source->subscribers = NULL;
+    source->last_subscriber_id = 0;
+    mtx_init(&(source->subscribers_mutex), mtx_plain);
     source->config = config;
+    source->svid_cache = NULL;
+    sh_new_strdup(source->svid_cache);
+    shdefault(source->svid_cache, NULL);
+    mtx_init(&(source->svid_cache_mutex), mtx_plain);
+    cnd_init(&(source->svid_cache_cond));
+    memset(&(source->svid_cache_stats), 0, sizeof source->svid_cache_stats);
+    source->svid_cache_clock = 0;
+    source->svid_refresh_running = false;
+    source->expiry_monitor = NULL;
+    const double fraction = source->config->expiry_alert_fraction;
+    if(jwtsvid_cacheEnabled(source) && fraction >= 0) {
+        workloadapi_ExpiryCallback callback
+            = { .args = source, .func = jwtsvid_onExpiry };
+        source->expiry_monitor = workloadapi_NewExpiryMonitor(
+            fraction > 1 ? 1 : fraction, 0, callback, err);
+    }
+    source->token_cache = source->config->token_cache_entries >= 0
+                              ? jwtsvid_NewTokenCache(
+                                  source->config->token_cache_entries)
+                              : NULL;
     if(!source->config->watcher_config.client_options) {
         arrpush(source->config->watcher_config.client_options,
                 workloadapi_Client_defaultOptions);
@@ -66,15 +266,76 @@ workloadapi_NewJWTSource(workloadapi_JWTSourceConfig *config, err_t *err)
 
 // blocks until first SVID update is received
 err_t workloadapi_JWTSource_Start(workloadapi_JWTSource *source)
+{
+    err_t err = workloadapi_JWTSource_StartAsync(source);
+    if(err != NO_ERROR) {
+        return err;
+    }
+    return workloadapi_JWTWatcher_WaitUntilUpdated(source->watcher);
+}
+
+static void jwtsvid_stopRefresh(workloadapi_JWTSource *source)
+{
+    mtx_lock(&(source->svid_cache_mutex));
+    const bool running = source->svid_refresh_running;
+    source->svid_refresh_running = false;
+    cnd_broadcast(&(source->svid_cache_cond));
+    mtx_unlock(&(source->svid_cache_mutex));
+    if(running) {
+        thrd_join(source->svid_refresh_thread, NULL);
+    }
+}
+
+err_t workloadapi_JWTSource_StartAsync(workloadapi_JWTSource *source)
 {
     if(!source) {
         return ERR_NULL;
     }
     mtx_lock(&(source->closed_mutex));
+    if(!source->closed) {
+        // already started by another user of the source
+        mtx_unlock(&(source->closed_mutex));
+        return NO_ERROR;
+    }
     source->closed = false;
     mtx_unlock(&(source->closed_mutex));
-    err_t err = workloadapi_JWTWatcher_Start(
-        source->watcher); // blocks until first update
+    err_t err = workloadapi_JWTWatcher_StartAsync(source->watcher);
+    if(err != NO_ERROR) {
+        goto fail_closed;
+    }
+
+    if(jwtsvid_cacheEnabled(source)) {
+        mtx_lock(&(source->svid_cache_mutex));
+        source->svid_refresh_running = true;
+        int thread_error = thrd_create(&(source->svid_refresh_thread),
+                                       workloadapi_JWTSource_refreshFunc,
+                                       source);
+        if(thread_error != thrd_success) {
+            source->svid_refresh_running = false;
+            err = ERR_THREAD;
+        }
+        mtx_unlock(&(source->svid_cache_mutex));
+    }
+    if(err != NO_ERROR) {
+        goto fail_watcher;
+    }
+    if(source->expiry_monitor) {
+        err = workloadapi_ExpiryMonitor_Start(source->expiry_monitor);
+        if(err != NO_ERROR) {
+            goto fail_refresh;
+        }
+    }
+    return NO_ERROR;
+
+    // undo what started, so a later start can try again
+fail_refresh:
+    jwtsvid_stopRefresh(source);
+fail_watcher:
+    workloadapi_JWTWatcher_Close(source->watcher);
+fail_closed:
+    mtx_lock(&(source->closed_mutex));
+    source->closed = true;
+    mtx_unlock(&(source->closed_mutex));
     return err;
 }
 
@@ -84,6 +345,9 @@ err_t workloadapi_JWTSource_Close(workloadapi_JWTSource *source)
     source->closed = true;
     mtx_unlock(&(source->closed_mutex));
 
+    jwtsvid_stopRefresh(source);
+    workloadapi_ExpiryMonitor_Stop(source->expiry_monitor);
+
     return workloadapi_JWTWatcher_Close(source->watcher);
 }
 
@@ -93,25 +357,224 @@ jwtsvid_SVID *workloadapi_JWTSource_GetJWTSVID(workloadapi_JWTSource *source,
 {
     *err = workloadapi_JWTSource_checkClosed(source);
     if(!(*err)) {
-        return workloadapi_Client_FetchJWTSVID(source->watcher->client, params,
-                                               err);
+        if(!params) {
+            *err = ERR_NULL;
+            return NULL;
+        }
+        if(!jwtsvid_cacheEnabled(source)) {
+            return fetchJWTSVID(source, params, err);
+        }
+
+        string_t key = jwtsvid_Params_Key(params);
+        mtx_lock(&(source->svid_cache_mutex));
+        workloadapi_JWTSVIDCacheEntry *entry = shget(source->svid_cache, key);
+        const time_t now = time(NULL);
+        if(entry && entry->svid->expiry > now) {
+            jwtsvid_SVID *svid = jwtsvid_SVID_Clone(entry->svid);
+            entry->last_used = ++(source->svid_cache_clock);
+            if(entry->refresh_at <= now) {
+                // was idle when due, have the refresh thread pick it now
+                cnd_broadcast(&(source->svid_cache_cond));
+            }
+            ++(source->svid_cache_stats.hits);
+            mtx_unlock(&(source->svid_cache_mutex));
+            arrfree(key);
+            return svid;
+        }
+        if(entry) {
+            // expired
+            jwtsvid_untrackExpiry(source, key);
+            shdel(source->svid_cache, key);
+            JWTSVIDCacheEntry_Free(entry);
+            ++(source->svid_cache_stats.evictions);
+        }
+        ++(source->svid_cache_stats.misses);
+        mtx_unlock(&(source->svid_cache_mutex));
+        arrfree(key);
+
+        jwtsvid_SVID *svid = fetchJWTSVID(source, params, err);
+        if(svid) {
+            workloadapi_JWTSource_cacheJWTSVID(source, params,
+                                               jwtsvid_SVID_Clone(svid));
+        }
+        return svid;
     }
     return NULL;
 }
 
-jwtbundle_Bundle *workloadapi_JWTSource_GetJWTBundleForTrustDomain(
-    workloadapi_JWTSource *source, const spiffeid_TrustDomain td, err_t *err)
+void workloadapi_JWTSource_cacheJWTSVID(workloadapi_JWTSource *source,
+                                        jwtsvid_Params *params,
+                                        jwtsvid_SVID *svid)
+{
+    workloadapi_JWTSVIDCacheEntry *entry = malloc(sizeof *entry);
+    entry->params = jwtsvid_Params_copy(params);
+    entry->svid = svid;
+    const time_t now = time(NULL);
+    entry->refresh_at = now;
+    if(svid->expiry > now) {
+        entry->refresh_at += (time_t) (jwtsvid_refreshFraction(source)
+                                       * (double) (svid->expiry - now));
+    }
+
+    string_t key = jwtsvid_Params_Key(params);
+    mtx_lock(&(source->svid_cache_mutex));
+    entry->fetched = entry->last_used = ++(source->svid_cache_clock);
+    workloadapi_JWTSVIDCacheEntry *old = shget(source->svid_cache, key);
+    if(!old && shlenu(source->svid_cache) >= jwtsvid_cacheEntries(source)) {
+        // full, drop the least recently used entry
+        size_t lru = 0;
+        for(size_t i = 1, size = shlenu(source->svid_cache); i < size; ++i) {
+            if(source->svid_cache[i].value->last_used
+               < source->svid_cache[lru].value->last_used) {
+                lru = i;
+            }
+        }
+        workloadapi_JWTSVIDCacheEntry *dropped
+            = source->svid_cache[lru].value;
+        jwtsvid_untrackExpiry(source, source->svid_cache[lru].key);
+        shdel(source->svid_cache, source->svid_cache[lru].key);
+        JWTSVIDCacheEntry_Free(dropped);
+        ++(source->svid_cache_stats.evictions);
+    }
+    JWTSVIDCacheEntry_Free(old);
+    shput(source->svid_cache, key, entry);
+    if(source->expiry_monitor) {
+        // fetched now, JWT-SVIDs do not tell when they were issued
+        workloadapi_ExpiryMonitor_Track(source->expiry_monitor, key, now,
+                                        svid->expiry);
+    }
+    // wake up refresh thread, so it accounts for the new deadline
+    cnd_broadcast(&(source->svid_cache_cond));
+    mtx_unlock(&(source->svid_cache_mutex));
+    arrfree(key);
+}
+
+workloadapi_JWTSVIDCacheStats
+workloadapi_JWTSource_GetJWTSVIDCacheStats(workloadapi_JWTSource *source)
+{
+    mtx_lock(&(source->svid_cache_mutex));
+    workloadapi_JWTSVIDCacheStats stats = source->svid_cache_stats;
+    mtx_unlock(&(source->svid_cache_mutex));
+    return stats;
+}
+
+workloadapi_ExpiryMonitorStats
+workloadapi_JWTSource_GetExpiryStats(workloadapi_JWTSource *source)
+{
+    if(!source->expiry_monitor) {
+        workloadapi_ExpiryMonitorStats stats = { 0, 0 };
+        return stats;
+    }
+    return workloadapi_ExpiryMonitor_GetStats(source->expiry_monitor);
+}
+
+jwtsvid_TokenCacheStats
+workloadapi_JWTSource_GetTokenCacheStats(workloadapi_JWTSource *source)
+{
+    if(!source->token_cache) {
+        jwtsvid_TokenCacheStats stats = { 0, 0, 0, 0 };
+        return stats;
+    }
+    return jwtsvid_TokenCache_GetStats(source->token_cache);
+}
+
+workloadapi_JWTSnapshot *
+workloadapi_JWTSource_AcquireSnapshot(workloadapi_JWTSource *source,
+                                      err_t *err)
 {
     *err = workloadapi_JWTSource_checkClosed(source);
-    if(!(*err)) {
-        jwtbundle_Bundle *bundle = jwtbundle_Set_GetJWTBundleForTrustDomain(
-            source->bundles, td, err);
-        if(*err == ERR_TRUSTDOMAIN_NOTAVAILABLE) {
-            *err = ERR_INVALID_TRUSTDOMAIN;
+    if(*err) {
+        return NULL;
+    }
+
+    // same protocol as workloadapi_X509Source_AcquireSnapshot
+    unsigned int epoch;
+    while(true) {
+        epoch = atomic_load(&(source->epoch));
+        atomic_fetch_add(&(source->readers[epoch & 1]), 1);
+        if(atomic_load(&(source->epoch)) == epoch) {
+            break;
         }
-        return bundle;
+        atomic_fetch_sub(&(source->readers[epoch & 1]), 1);
     }
-    return NULL;
+    workloadapi_JWTSnapshot *snapshot = atomic_load(&(source->snapshot));
+    if(snapshot) {
+        atomic_fetch_add(&(snapshot->refs), 1);
+    }
+    atomic_fetch_sub(&(source->readers[epoch & 1]), 1);
+
+    if(!snapshot) {
+        // no update received yet
+        *err = ERR_NULL_DATA;
+    }
+    return snapshot;
+}
+
+void workloadapi_JWTSnapshot_Release(workloadapi_JWTSnapshot *snapshot)
+{
+    if(snapshot && atomic_fetch_sub(&(snapshot->refs), 1) == 1) {
+        jwtbundle_Set_Free(snapshot->bundles);
+        free(snapshot);
+    }
+}
+
+jwtbundle_Bundle *workloadapi_JWTSource_GetJWTBundleForTrustDomain(
+    workloadapi_JWTSource *source, const spiffeid_TrustDomain td, err_t *err)
+{
+    workloadapi_JWTSnapshot *snapshot
+        = workloadapi_JWTSource_AcquireSnapshot(source, err);
+    if(*err == ERR_CLOSED) {
+        return NULL;
+    }
+
+    jwtbundle_Bundle *bundle = NULL;
+    *err = ERR_TRUSTDOMAIN_NOTAVAILABLE;
+    if(snapshot) {
+        // borrowed past this release, until the second update from now:
+        // the source retires a replaced snapshot and frees it only on the
+        // update after. Published sets are never modified, so readers do
+        // not lock them
+        bundle = jwtbundle_Set_LookupJWTBundleForTrustDomain(
+            snapshot->bundles, td, err);
+    }
+    workloadapi_JWTSnapshot_Release(snapshot);
+    if(*err == ERR_TRUSTDOMAIN_NOTAVAILABLE) {
+        *err = ERR_INVALID_TRUSTDOMAIN;
+    }
+    return bundle;
+}
+
+jwtsvid_SVID *workloadapi_JWTSource_ValidateJWTSVID(
+    workloadapi_JWTSource *source, char *token, char *audience, err_t *err)
+{
+    // holding the snapshot keeps an update from freeing the bundles while
+    // the signature is checked
+    workloadapi_JWTSnapshot *snapshot
+        = workloadapi_JWTSource_AcquireSnapshot(source, err);
+    if(*err == ERR_CLOSED) {
+        return NULL;
+    }
+
+    jwtsvid_SVID *svid = NULL;
+    *err = ERR_NOAUTHORITY;
+    if(snapshot) {
+        jwtbundle_Source bundles = { .type = JWTBUNDLE_FROZEN_SET };
+        bundles.source.set = snapshot->bundles;
+        string_arr_t audiences = NULL;
+        arrput(audiences, audience);
+        svid = jwtsvid_ParseAndValidateCached(source->token_cache, token,
+                                              &bundles, audiences, err);
+        arrfree(audiences);
+    }
+    workloadapi_JWTSnapshot_Release(snapshot);
+
+    if(*err != ERR_NOAUTHORITY) {
+        // an unknown trust domain is not worth a round trip
+        return svid;
+    }
+    // the agent may already have a key the source has not received yet
+    return workloadapi_Client_ValidateJWTSVID(source->watcher->client, token,
+                                              audience, err);
 }
 
 err_t workloadapi_JWTSource_WaitUntilUpdated(workloadapi_JWTSource *source)
@@ -119,32 +582,130 @@ err_t workloadapi_JWTSource_WaitUntilUpdated(workloadapi_JWTSource *source)
     return workloadapi_JWTWatcher_WaitUntilUpdated(source->watcher);
 }
 
+err_t workloadapi_JWTSource_TimedWaitUntilUpdated(
+    workloadapi_JWTSource *source, const struct timespec *deadline)
+{
+    err_t err = workloadapi_JWTSource_checkClosed(source);
+    if(err != NO_ERROR) {
+        // not started, would never be updated
+        return err;
+    }
+    return workloadapi_JWTWatcher_TimedWaitUntilUpdated(source->watcher,
+                                                        deadline);
+}
+
+int workloadapi_JWTSource_Subscribe(
+    workloadapi_JWTSource *source,
+    workloadapi_JWTSnapshotCallback callback, err_t *err)
+{
+    if(!source || !callback.func) {
+        *err = ERR_NULL;
+        return 0;
+    }
+    mtx_lock(&(source->subscribers_mutex));
+    workloadapi_JWTSubscriber subscriber
+        = { .id = ++(source->last_subscriber_id), .callback = callback };
+    arrput(source->subscribers, subscriber);
+    mtx_unlock(&(source->subscribers_mutex));
+
+    *err = NO_ERROR;
+    return subscriber.id;
+}
+
+err_t workloadapi_JWTSource_Unsubscribe(workloadapi_JWTSource *source,
+                                        int id)
+{
+    if(!source) {
+        return ERR_NULL;
+    }
+    err_t err = ERR_NOT_FOUND;
+    // waits for a running update to finish calling the listeners
+    mtx_lock(&(source->subscribers_mutex));
+    for(size_t i = 0, size = arrlenu(source->subscribers); i < size; ++i) {
+        if(source->subscribers[i].id == id) {
+            // keeps the order of the others
+            arrdel(source->subscribers, i);
+            err = NO_ERROR;
+            break;
+        }
+    }
+    mtx_unlock(&(source->subscribers_mutex));
+    return err;
+}
+
+int workloadapi_JWTSource_GetUpdateFd(workloadapi_JWTSource *source)
+{
+    return workloadapi_JWTWatcher_GetUpdateFd(source->watcher);
+}
+
+uint64_t workloadapi_JWTSource_ClearUpdateFd(workloadapi_JWTSource *source)
+{
+    return workloadapi_JWTWatcher_ClearUpdateFd(source->watcher);
+}
+
 void workloadapi_JWTSource_applyJWTBundle_Set(workloadapi_JWTSource *source,
                                               jwtbundle_Set *set)
 {
+    workloadapi_JWTSnapshot *snapshot = malloc(sizeof *snapshot);
+    // the watcher builds a new set on every update, so move its bundles
+    // instead of copying them
+    snapshot->bundles = jwtbundle_Set_Take(set);
+    // the reference held by the source
+    atomic_init(&(snapshot->refs), 1);
+
     mtx_lock(&(source->mtx));
-    jwtbundle_Set_Free(source->bundles);
-    source->bundles = jwtbundle_Set_Clone(set);
+    workloadapi_JWTSnapshot *old = atomic_load(&(source->snapshot));
+    snapshot->generation = old ? old->generation + 1 : 1;
+    atomic_store(&(source->snapshot), snapshot);
+    // readers still in the previous epoch may be taking a reference to old
+    const unsigned int epoch = atomic_fetch_add(&(source->epoch), 1);
+    while(atomic_load(&(source->readers[epoch & 1])) > 0) {
+        thrd_yield();
+    }
+    workloadapi_JWTSnapshot *retired = source->retired;
+    source->retired = old;
+    // for the listeners, as the source may replace it meanwhile
+    atomic_fetch_add(&(snapshot->refs), 1);
     mtx_unlock(&(source->mtx));
+
+    workloadapi_JWTSnapshot_Release(retired);
+
+    mtx_lock(&(source->subscribers_mutex));
+    for(size_t i = 0, size = arrlenu(source->subscribers); i < size; ++i) {
+        workloadapi_JWTSnapshotCallback *callback
+            = &(source->subscribers[i].callback);
+        callback->func(snapshot, callback->args);
+    }
+    mtx_unlock(&(source->subscribers_mutex));
+    workloadapi_JWTSnapshot_Release(snapshot);
 }
 
 err_t workloadapi_JWTSource_checkClosed(workloadapi_JWTSource *source)
 {
-    err_t err = NO_ERROR;
-    mtx_lock(&(source->closed_mutex));
-    if(source->closed) {
+    // read on every lookup and validation, so no lock
+    if(atomic_load(&(source->closed))) {
         // source is closed
-        err = ERR_CLOSED;
+        return ERR_CLOSED;
     }
-    mtx_unlock(&(source->closed_mutex));
-    return err;
+    return NO_ERROR;
 }
 
 void workloadapi_JWTSource_Free(workloadapi_JWTSource *source)
 {
     if(source) {
         mtx_lock(&(source->mtx));
-        jwtbundle_Set_Free(source->bundles);
+        workloadapi_JWTSnapshot_Release(atomic_load(&(source->snapshot)));
+        workloadapi_JWTSnapshot_Release(source->retired);
+        arrfree(source->subscribers);
+        mtx_destroy(&(source->subscribers_mutex));
+        for(size_t i = 0, size = shlenu(source->svid_cache); i < size; ++i) {
+            JWTSVIDCacheEntry_Free(source->svid_cache[i].value);
+        }
+        shfree(source->svid_cache);
+        workloadapi_ExpiryMonitor_Free(source->expiry_monitor);
+        jwtsvid_TokenCache_Free(source->token_cache);
+        mtx_destroy(&(source->svid_cache_mutex));
+        cnd_destroy(&(source->svid_cache_cond));
         if(source->watcher)
             workloadapi_JWTWatcher_Free(source->watcher);
         if(source->config)
@@ -58,16 +58,19 @@ int print_forever(void *args)
             printf(" Expiry:%s", ctime(&svid->expiry));
             printf(" Claims: [\n");
 
-            for(size_t j = 0, size = shlenu(svid->claims); j < size; ++j) {
-                char *value
-                    = json_dumps(svid->claims[j].value, JSON_ENCODE_ANY);
-                printf("  '%s':'%s'\n", svid->claims[j].key, value);
+            map_string_claim *claims = jwtsvid_SVID_GetClaims(svid);
+            for(size_t j = 0, size = shlenu(claims); j < size; ++j) {
+                char *value = json_dumps(claims[j].value, JSON_ENCODE_ANY);
+                printf("  '%s':'%s'\n", claims[j].key, value);
                 free(value);
             }
             printf(" ]\n");
-            jwtbundle_Set_Print(source->bundles);
+            workloadapi_JWTSnapshot *snapshot
+                = workloadapi_JWTSource_AcquireSnapshot(source, &err);
+            jwtbundle_Set_Print(snapshot->bundles);
             jwtbundle_Source *src = jwtbundle_SourceFromSet(
-                jwtbundle_Set_Clone(source->bundles));
+                jwtbundle_Set_Clone(snapshot->bundles));
+            workloadapi_JWTSnapshot_Release(snapshot);
             jwtsvid_SVID *svid2 = jwtsvid_ParseAndValidate(
                 svid->token, src, svid->audience, &err);
 
@@ -78,11 +81,11 @@ int print_forever(void *args)
                 printf("   Token: %s\n", svid2->token);
                 printf("   Expiry:%s", ctime(&svid->expiry));
                 printf("   Claims: [\n");
-                for(size_t j = 0, size = shlenu(svid2->claims); j < size;
-                    ++j) {
+                map_string_claim *claims2 = jwtsvid_SVID_GetClaims(svid2);
+                for(size_t j = 0, size = shlenu(claims2); j < size; ++j) {
                     char *value
-                        = json_dumps(svid2->claims[j].value, JSON_ENCODE_ANY);
-                    printf("    key: %s, value: %s\n", svid2->claims[j].key,
+                        = json_dumps(claims2[j].value, JSON_ENCODE_ANY);
+                    printf("    key: %s, value: %s\n", claims2[j].key,
                            value);
                     free(value);
                 }
@@ -23,7 +23,10 @@
  */
 
 #include "c-spiffe/workload/jwtwatcher.h"
+#include "c-spiffe/workload/asyncclient.h"
 #include "c-spiffe/workload/client.h"
+#include <sys/eventfd.h>
+#include <unistd.h>
 
 // Function that will run on thread spun for watcher
 int workloadapi_JWTWatcher_JWTbackgroundFunc(void *_watcher)
@@ -98,42 +101,65 @@ workloadapi_newJWTWatcher(workloadapi_JWTWatcherConfig config,
         *error = ERR_NULL;
         return NULL;
     }
+    newW->update_cache = workloadapi_NewUpdateCache();
+    // not fatal, only pollers need it
+    newW->update_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
 
     return newW;
 }
 
-// starts watcher and blocks waiting on an update.
-err_t workloadapi_JWTWatcher_Start(workloadapi_JWTWatcher *watcher)
+// starts watcher without waiting for an update.
+err_t workloadapi_JWTWatcher_StartAsync(workloadapi_JWTWatcher *watcher)
 {
     err_t error = NO_ERROR;
     if(!watcher) {
         return ERR_NULL; /// NULL WATCHER;
     }
+    if(watcher->async_client) {
+        /// register stream on the async client event thread.
+        error = workloadapi_AsyncClient_WatchJWTBundles(watcher->async_client,
+                                                        watcher);
+        if(error != NO_ERROR) {
+            return error;
+        }
+    } else {
+        error = workloadapi_Client_Connect(watcher->client);
+        if(error != NO_ERROR) {
+            return error;
+        }
+        /// spin watcher thread out.
 
-    error = workloadapi_Client_Connect(watcher->client);
-    if(error != NO_ERROR) {
-        return error;
-    }
-    /// spin watcher thread out.
-
-    int thread_error
-        = thrd_create(&(watcher->watcher_thread),
-                      workloadapi_JWTWatcher_JWTbackgroundFunc, watcher);
+        int thread_error
+            = thrd_create(&(watcher->watcher_thread),
+                          workloadapi_JWTWatcher_JWTbackgroundFunc, watcher);
 
-    if(thread_error != thrd_success) {
-        watcher->thread_error = thread_error;
-        return ERR_THREAD; // THREAD ERROR, see watcher->threadERROR for error
+        if(thread_error != thrd_success) {
+            watcher->thread_error = thread_error;
+            // THREAD ERROR, see watcher->threadERROR for error
+            return ERR_THREAD;
+        }
     }
 
     mtx_lock(&(watcher->close_mutex));
     watcher->closed = false;
     mtx_unlock(&(watcher->close_mutex));
 
+    return NO_ERROR;
+}
+
+// starts watcher and blocks waiting on an update.
+err_t workloadapi_JWTWatcher_Start(workloadapi_JWTWatcher *watcher)
+{
+    err_t error = workloadapi_JWTWatcher_StartAsync(watcher);
+    if(error != NO_ERROR) {
+        return error;
+    }
+
     error = workloadapi_JWTWatcher_WaitUntilUpdated(watcher);
     if(error != NO_ERROR) {
         mtx_lock(&(watcher->update_mutex));
         watcher->update_error = error;
-        mtx_lock(&(watcher->update_mutex));
+        mtx_unlock(&(watcher->update_mutex));
         return ERR_WAITING;
     }
 
@@ -143,6 +169,14 @@ err_t workloadapi_JWTWatcher_Start(workloadapi_JWTWatcher *watcher)
 // drops connection to WorkloadAPI (if owns client)
 err_t workloadapi_JWTWatcher_Close(workloadapi_JWTWatcher *watcher)
 {
+    if(watcher->async_client) {
+        mtx_lock(&(watcher->close_mutex));
+        watcher->closed = true;
+        mtx_unlock(&(watcher->close_mutex));
+        // no callback runs for this watcher once the call returns.
+        return workloadapi_AsyncClient_CancelWatch(watcher->async_client,
+                                                   watcher);
+    }
     mtx_lock(&(watcher->close_mutex));
     watcher->closed = true;
     err_t error = NO_ERROR;
@@ -165,6 +199,43 @@ err_t workloadapi_JWTWatcher_Close(workloadapi_JWTWatcher *watcher)
     return ERR_CLOSING;
 }
 
+err_t workloadapi_JWTWatcher_SetAsyncClient(
+    workloadapi_JWTWatcher *watcher, workloadapi_AsyncClient *async_client)
+{
+    if(!watcher || !async_client) {
+        return ERR_NULL;
+    }
+    mtx_lock(&(watcher->close_mutex));
+    if(!watcher->closed) {
+        mtx_unlock(&(watcher->close_mutex));
+        return ERR_EXISTS; // already started
+    }
+    if(watcher->owns_client) {
+        workloadapi_Client_Free(watcher->client);
+        watcher->owns_client = false;
+    }
+    watcher->client = async_client->client;
+    watcher->async_client = async_client;
+    mtx_unlock(&(watcher->close_mutex));
+    return NO_ERROR;
+}
+
+err_t workloadapi_JWTWatcher_SetDeltaCallback(
+    workloadapi_JWTWatcher *watcher, workloadapi_DeltaCallback callback)
+{
+    if(!watcher) {
+        return ERR_NULL;
+    }
+    mtx_lock(&(watcher->close_mutex));
+    if(!watcher->closed) {
+        mtx_unlock(&(watcher->close_mutex));
+        return ERR_EXISTS; // already started
+    }
+    watcher->delta_callback = callback;
+    mtx_unlock(&(watcher->close_mutex));
+    return NO_ERROR;
+}
+
 // Free's JWTWatcher (MUST ALREADY BE CLOSED)
 err_t workloadapi_JWTWatcher_Free(/*context,*/ workloadapi_JWTWatcher *watcher)
 {
@@ -174,6 +245,10 @@ err_t workloadapi_JWTWatcher_Free(/*context,*/ workloadapi_JWTWatcher *watcher)
     if(watcher->owns_client) {
         workloadapi_Client_Free(watcher->client);
     }
+    workloadapi_UpdateCache_Free(watcher->update_cache);
+    if(watcher->update_fd >= 0) {
+        close(watcher->update_fd);
+    }
     free(watcher);
     return NO_ERROR;
 }
@@ -184,6 +259,11 @@ void workloadapi_JWTWatcher_OnJWTBundlesUpdate(workloadapi_JWTWatcher *watcher,
 {
     void *args = watcher->jwt_callback.args;
     watcher->jwt_callback.func(set, args);
+    if(watcher->delta_callback.func
+       && workloadapi_UpdateCache_Changed(watcher->update_cache)) {
+        watcher->delta_callback.func(&(watcher->update_cache->delta),
+                                     watcher->delta_callback.args);
+    }
     workloadapi_JWTWatcher_TriggerUpdated(watcher);
 }
 
@@ -204,10 +284,8 @@ err_t workloadapi_JWTWatcher_TimedWaitUntilUpdated(
     workloadapi_JWTWatcher *watcher, const struct timespec *timer)
 {
     mtx_lock(&watcher->update_mutex);
-    if(watcher->updated) {
-        mtx_unlock(&watcher->update_mutex);
-        return NO_ERROR;
-    } else {
+    // loops on spurious wakeups, only an update sets updated
+    while(!watcher->updated) {
         int thread_error = thrd_success;
         if(timer != NULL) {
             thread_error = cnd_timedwait(&(watcher->update_cond),
@@ -220,13 +298,13 @@ err_t workloadapi_JWTWatcher_TimedWaitUntilUpdated(
             thread_error
                 = cnd_wait(&(watcher->update_cond), &(watcher->update_mutex));
         }
-        mtx_unlock(&watcher->update_mutex);
         if(thread_error != thrd_success) {
+            mtx_unlock(&watcher->update_mutex);
             return ERR_WAITING;
-        } else {
-            return NO_ERROR;
         }
     }
+    mtx_unlock(&watcher->update_mutex);
+    return NO_ERROR;
 }
 
 err_t workloadapi_JWTWatcher_TriggerUpdated(workloadapi_JWTWatcher *watcher)
@@ -236,6 +314,7 @@ err_t workloadapi_JWTWatcher_TriggerUpdated(workloadapi_JWTWatcher *watcher)
         return error; // lock error
     }
     watcher->updated = true;
+    ++(watcher->generation);
     if(error = (err_t) cnd_broadcast(&(watcher->update_cond))) {
         // save broadcast error, so if we also error on unlock
         // we have a way to check it
@@ -245,8 +324,50 @@ err_t workloadapi_JWTWatcher_TriggerUpdated(workloadapi_JWTWatcher *watcher)
         // if unlock
         return error;
     }
+    if(watcher->update_fd >= 0) {
+        // written after the generation is bumped, so a woken poller sees it.
+        // only fails once the counter saturates, it is readable then anyway
+        const uint64_t one = 1;
+        const ssize_t written = write(watcher->update_fd, &one, sizeof one);
+        (void) written;
+    }
     if(!error) {
         return (err_t) watcher->thread_error;
     }
     return error;
 }
+
+uint64_t workloadapi_JWTWatcher_GetGeneration(workloadapi_JWTWatcher *watcher)
+{
+    mtx_lock(&(watcher->update_mutex));
+    const uint64_t generation = watcher->generation;
+    mtx_unlock(&(watcher->update_mutex));
+    return generation;
+}
+
+workloadapi_PipelineStats
+workloadapi_JWTWatcher_GetPipelineStats(workloadapi_JWTWatcher *watcher)
+{
+    mtx_lock(&(watcher->update_mutex));
+    workloadapi_PipelineStats stats = watcher->pipeline_stats;
+    mtx_unlock(&(watcher->update_mutex));
+    return stats;
+}
+
+int workloadapi_JWTWatcher_GetUpdateFd(workloadapi_JWTWatcher *watcher)
+{
+    return watcher->update_fd;
+}
+
+uint64_t workloadapi_JWTWatcher_ClearUpdateFd(workloadapi_JWTWatcher *watcher)
+{
+    if(watcher->update_fd >= 0) {
+        // non blocking, fails with EAGAIN if already cleared
+        uint64_t count;
+        const ssize_t nread = read(watcher->update_fd, &count, sizeof count);
+        (void) nread;
+    }
+    // read after clearing, an update landing in between is reported here
+    // and makes the descriptor readable again
+    return workloadapi_JWTWatcher_GetGeneration(watcher);
+}
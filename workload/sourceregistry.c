@@ -0,0 +1,228 @@
+/**
+ *
+ * (C) Copyright 2020-2021 Hewlett Packard Enterprise Development LP
+ *
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include "c-spiffe/workload/sourceregistry.h"
+
+typedef struct {
+    workloadapi_X509Source *source;
+    /** config the source points to, owned by the registry */
+    workloadapi_X509SourceConfig *config;
+    int refs;
+} workloadapi_SharedX509Source;
+
+typedef struct {
+    string_t key;
+    workloadapi_SharedX509Source *value;
+} map_string_SharedX509Source;
+
+typedef struct {
+    workloadapi_JWTSource *source;
+    /** client options of the source config, which the source does not free
+     * along with the config */
+    workloadapi_ClientOption *client_options;
+    int refs;
+} workloadapi_SharedJWTSource;
+
+typedef struct {
+    string_t key;
+    workloadapi_SharedJWTSource *value;
+} map_string_SharedJWTSource;
+
+// shared sources by Workload API address
+static map_string_SharedX509Source *x509sources = NULL;
+static map_string_SharedJWTSource *jwtsources = NULL;
+static mtx_t registry_mutex;
+static once_flag registry_once = ONCE_FLAG_INIT;
+
+static void workloadapi_registryInit(void)
+{
+    mtx_init(&registry_mutex, mtx_plain);
+    sh_new_strdup(x509sources);
+    shdefault(x509sources, NULL);
+    sh_new_strdup(jwtsources);
+    shdefault(jwtsources, NULL);
+}
+
+workloadapi_X509Source *workloadapi_AcquireX509Source(const char *address,
+                                                      err_t *err)
+{
+    call_once(&registry_once, workloadapi_registryInit);
+    if(!address) {
+        address = WORKLOADAPI_DEFAULT_ADDRESS;
+    }
+
+    mtx_lock(&registry_mutex);
+    workloadapi_SharedX509Source *shared = shget(x509sources, address);
+    if(!shared) {
+        workloadapi_X509SourceConfig *config = calloc(1, sizeof *config);
+        workloadapi_X509Source *source
+            = workloadapi_NewX509Source(config, err);
+        if(*err != NO_ERROR) {
+            mtx_unlock(&registry_mutex);
+            arrfree(config->watcher_config.client_options);
+            free(config);
+            return NULL;
+        }
+        // the default client options are applied already, override them
+        workloadapi_Client_SetAddress(source->watcher->client, address);
+
+        shared = calloc(1, sizeof *shared);
+        shared->source = source;
+        shared->config = config;
+        shput(x509sources, address, shared);
+    }
+    ++(shared->refs);
+    mtx_unlock(&registry_mutex);
+
+    *err = NO_ERROR;
+    return shared->source;
+}
+
+void workloadapi_ReleaseX509Source(workloadapi_X509Source *source)
+{
+    if(!source) {
+        return;
+    }
+    call_once(&registry_once, workloadapi_registryInit);
+
+    workloadapi_SharedX509Source *last = NULL;
+    mtx_lock(&registry_mutex);
+    for(size_t i = 0, size = shlenu(x509sources); i < size; ++i) {
+        workloadapi_SharedX509Source *shared = x509sources[i].value;
+        if(shared->source == source) {
+            if(--(shared->refs) == 0) {
+                last = shared;
+                shdel(x509sources, x509sources[i].key);
+            }
+            break;
+        }
+    }
+    mtx_unlock(&registry_mutex);
+
+    if(last) {
+        // closing joins the watcher thread, do it outside the lock
+        if(workloadapi_X509Source_checkClosed(source) == NO_ERROR) {
+            workloadapi_X509Source_Close(source);
+        }
+        workloadapi_X509Source_Free(source);
+        arrfree(last->config->watcher_config.client_options);
+        free(last->config);
+        free(last);
+    }
+}
+
+workloadapi_JWTSource *workloadapi_AcquireJWTSource(const char *address,
+                                                    err_t *err)
+{
+    call_once(&registry_once, workloadapi_registryInit);
+    if(!address) {
+        address = WORKLOADAPI_DEFAULT_ADDRESS;
+    }
+
+    mtx_lock(&registry_mutex);
+    workloadapi_SharedJWTSource *shared = shget(jwtsources, address);
+    if(!shared) {
+        // the source frees its config, even when it fails to create, but
+        // not the client options, so they are kept here
+        workloadapi_JWTSourceConfig *config = calloc(1, sizeof *config);
+        arrpush(config->watcher_config.client_options,
+                workloadapi_Client_defaultOptions);
+        workloadapi_ClientOption *client_options
+            = config->watcher_config.client_options;
+        workloadapi_JWTSource *source = workloadapi_NewJWTSource(config, err);
+        if(*err != NO_ERROR) {
+            mtx_unlock(&registry_mutex);
+            arrfree(client_options);
+            return NULL;
+        }
+        // the default client options are applied already, override them
+        workloadapi_Client_SetAddress(source->watcher->client, address);
+
+        shared = calloc(1, sizeof *shared);
+        shared->source = source;
+        shared->client_options = client_options;
+        shput(jwtsources, address, shared);
+    }
+    ++(shared->refs);
+    mtx_unlock(&registry_mutex);
+
+    *err = NO_ERROR;
+    return shared->source;
+}
+
+void workloadapi_ReleaseJWTSource(workloadapi_JWTSource *source)
+{
+    if(!source) {
+        return;
+    }
+    call_once(&registry_once, workloadapi_registryInit);
+
+    workloadapi_SharedJWTSource *last = NULL;
+    mtx_lock(&registry_mutex);
+    for(size_t i = 0, size = shlenu(jwtsources); i < size; ++i) {
+        workloadapi_SharedJWTSource *shared = jwtsources[i].value;
+        if(shared->source == source) {
+            if(--(shared->refs) == 0) {
+                last = shared;
+                shdel(jwtsources, jwtsources[i].key);
+            }
+            break;
+        }
+    }
+    mtx_unlock(&registry_mutex);
+
+    if(last) {
+        // closing joins the watcher threads, do it outside the lock
+        if(workloadapi_JWTSource_checkClosed(source) == NO_ERROR) {
+            workloadapi_JWTSource_Close(source);
+        }
+        workloadapi_JWTSource_Free(source);
+        arrfree(last->client_options);
+        free(last);
+    }
+}
+
+err_t workloadapi_WaitUntilReady(workloadapi_X509Source **x509_sources,
+                                 workloadapi_JWTSource **jwt_sources,
+                                 const struct timespec *deadline)
+{
+    // the sources update in parallel, so waiting for them in turn with the
+    // same deadline lasts as long as the slowest one
+    for(size_t i = 0, size = arrlenu(x509_sources); i < size; ++i) {
+        err_t err = workloadapi_X509Source_TimedWaitUntilUpdated(
+            x509_sources[i], deadline);
+        if(err != NO_ERROR) {
+            return err;
+        }
+    }
+    for(size_t i = 0, size = arrlenu(jwt_sources); i < size; ++i) {
+        err_t err = workloadapi_JWTSource_TimedWaitUntilUpdated(
+            jwt_sources[i], deadline);
+        if(err != NO_ERROR) {
+            return err;
+        }
+    }
+
+    return NO_ERROR;
+}
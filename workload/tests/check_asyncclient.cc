@@ -0,0 +1,367 @@
+/**
+ *
+ * (C) Copyright 2020-2021 Hewlett Packard Enterprise Development LP
+ *
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include "c-spiffe/workload/asyncclient.h"
+#include "workload.grpc.pb.h"
+#include "workload.pb.h"
+#include <chrono>
+#include <check.h>
+#include <grpc/grpc.h>
+#include <grpcpp/grpcpp.h>
+#include <thread>
+
+#define TEST_ADDRESS "unix:///tmp/check_asyncclient.sock"
+
+const char token1[]
+    = "eyJhbGciOiJSUzI1NiIsInR5cCI6IkpXVCIsImtpZCI6ImZmM2M1Yzk2LTM5MmUtNDZlZi1"
+      "hODM5LTZmZjE2MDI3YWY3OCJ9."
+      "eyJzdWIiOiJzcGlmZmU6Ly9leGFtcGxlLmNvbS93b3JrbG9hZDEiLCJuYW1lIjoiSm9obiB"
+      "Eb2UiLCJpYXQiOjE1MTYyMzkwMjIsImV4cCI6OTk5MDAwMDAwMH0.GaVfjoPAKmc991DEl-"
+      "Su5uYNvzYMBn2mzTxbWsQjVowNBVa4M6m91no7zX0l0pGBN31kP1xT3MwUae5JZGajx_"
+      "J05HzvkHJrF9VoFj7iJncHYQjz_"
+      "IlEXDL8smNRzazIES9PD3Zq39D0pt9PdCLDDZRoKRPyTC9LzpUoa0nVvXWGIECwH0DRnKks"
+      "_HFVIlrIkV8PVIE-A8wl3QiC9TRdvnav4DGlYlO3y3Bz3oGN2y-iBD8yBNhdw9Dkmw0T-"
+      "lQq01wUJRR84GXblBoB9TL3aIxVpJnfDADoDy4iD0kZ-"
+      "ne0v5W62tSEx8mT0dvBEwE8PWm0xCKR2uxM2jlICKADIw";
+
+// in-process Workload API, streams stay open until cancelled.
+class TestWorkloadAPI final : public SpiffeWorkloadAPI::Service
+{
+    grpc::Status FetchJWTSVID(grpc::ServerContext *ctx,
+                              const JWTSVIDRequest *req,
+                              JWTSVIDResponse *resp) override
+    {
+        auto svid = resp->add_svids();
+        svid->set_spiffe_id(req->spiffe_id());
+        svid->set_svid(token1);
+        return grpc::Status::OK;
+    }
+
+    grpc::Status
+    FetchJWTBundles(grpc::ServerContext *ctx, const JWTBundlesRequest *req,
+                    grpc::ServerWriter<JWTBundlesResponse> *writer) override
+    {
+        FILE *f = fopen("./resources/jwk_keys.json", "r");
+        ck_assert_ptr_ne(f, NULL);
+        string_t str = FILE_to_string(f);
+        fclose(f);
+
+        JWTBundlesResponse resp;
+        (*resp.mutable_bundles())["example.org"] = str;
+        arrfree(str);
+
+        writer->Write(resp);
+        while(!ctx->IsCancelled()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return grpc::Status::CANCELLED;
+    }
+};
+
+static std::unique_ptr<grpc::Server> start_server(TestWorkloadAPI *service)
+{
+    grpc::ServerBuilder builder;
+    builder.AddListeningPort(TEST_ADDRESS, grpc::InsecureServerCredentials());
+    builder.RegisterService(service);
+    return builder.BuildAndStart();
+}
+
+static workloadapi_AsyncClient *new_started_client(void)
+{
+    err_t err = NO_ERROR;
+    workloadapi_Client *client = workloadapi_NewClient(&err);
+    ck_assert_int_eq(err, NO_ERROR);
+    workloadapi_Client_SetAddress(client, TEST_ADDRESS);
+    workloadapi_Client_setDefaultHeaderOption(client, NULL);
+
+    workloadapi_AsyncClient *async_client
+        = workloadapi_NewAsyncClient(client, &err);
+    ck_assert_int_eq(err, NO_ERROR);
+    ck_assert_ptr_eq(async_client->client, client);
+    ck_assert(!async_client->owns_client);
+
+    err = workloadapi_AsyncClient_Start(async_client);
+    ck_assert_int_eq(err, NO_ERROR);
+    ck_assert(async_client->running);
+    return async_client;
+}
+
+static void close_client(workloadapi_AsyncClient *async_client)
+{
+    workloadapi_Client *client = async_client->client;
+    ck_assert_int_eq(workloadapi_AsyncClient_Close(async_client), NO_ERROR);
+    ck_assert(!async_client->running);
+    ck_assert_ptr_eq(async_client->calls, NULL);
+    workloadapi_AsyncClient_Free(async_client);
+    workloadapi_Client_Close(client);
+    workloadapi_Client_Free(client);
+}
+
+START_TEST(test_workloadapi_NewAsyncClient)
+{
+    err_t err = NO_ERROR;
+    workloadapi_AsyncClient *async_client
+        = workloadapi_NewAsyncClient(NULL, &err);
+
+    ck_assert_int_eq(err, NO_ERROR);
+    ck_assert_ptr_ne(async_client, NULL);
+    ck_assert_ptr_ne(async_client->client, NULL);
+    ck_assert(async_client->owns_client);
+    ck_assert_ptr_eq(async_client->cq, NULL);
+    ck_assert(!async_client->running);
+
+    // not started yet
+    ck_assert_int_eq(workloadapi_AsyncClient_Close(async_client), ERR_CLOSED);
+    jwtsvid_Params params = {};
+    workloadapi_JWTSVIDCallback callback = { NULL, NULL };
+    ck_assert_int_eq(
+        workloadapi_AsyncClient_FetchJWTSVID(async_client, &params, callback),
+        ERR_NULL);
+
+    workloadapi_AsyncClient_Free(async_client);
+
+    ck_assert_int_eq(workloadapi_AsyncClient_Start(NULL), ERR_NULL);
+    ck_assert_int_eq(workloadapi_AsyncClient_Close(NULL), ERR_NULL);
+    ck_assert_int_eq(workloadapi_AsyncClient_Free(NULL), ERR_NULL);
+    ck_assert_int_eq(workloadapi_AsyncClient_WatchX509Context(NULL, NULL),
+                     ERR_NULL);
+    ck_assert_int_eq(workloadapi_AsyncClient_WatchJWTBundles(NULL, NULL),
+                     ERR_NULL);
+    ck_assert_int_eq(workloadapi_AsyncClient_CancelWatch(NULL, NULL),
+                     ERR_NULL);
+}
+END_TEST
+
+typedef struct {
+    mtx_t mtx;
+    cnd_t cond;
+    bool done;
+    jwtsvid_SVID *svid;
+    err_t err;
+} fetch_result;
+
+static void fetch_callback(jwtsvid_SVID *svid, err_t err, void *args)
+{
+    fetch_result *result = (fetch_result *) args;
+    mtx_lock(&result->mtx);
+    result->svid = svid;
+    result->err = err;
+    result->done = true;
+    cnd_broadcast(&result->cond);
+    mtx_unlock(&result->mtx);
+}
+
+START_TEST(test_workloadapi_AsyncClient_FetchJWTSVID)
+{
+    TestWorkloadAPI service;
+    std::unique_ptr<grpc::Server> server = start_server(&service);
+    workloadapi_AsyncClient *async_client = new_started_client();
+
+    err_t err = NO_ERROR;
+    jwtsvid_Params params = {};
+    params.subject
+        = spiffeid_FromString("spiffe://example.com/workload1", &err);
+
+    fetch_result result = {};
+    mtx_init(&result.mtx, mtx_plain);
+    cnd_init(&result.cond);
+    workloadapi_JWTSVIDCallback callback = { &result, fetch_callback };
+
+    err = workloadapi_AsyncClient_FetchJWTSVID(async_client, &params,
+                                               callback);
+    ck_assert_int_eq(err, NO_ERROR);
+
+    mtx_lock(&result.mtx);
+    while(!result.done) {
+        cnd_wait(&result.cond, &result.mtx);
+    }
+    mtx_unlock(&result.mtx);
+
+    ck_assert_int_eq(result.err, NO_ERROR);
+    ck_assert_ptr_ne(result.svid, NULL);
+    ck_assert_str_eq(result.svid->token, token1);
+    ck_assert_str_eq(result.svid->id.path, "/workload1");
+
+    close_client(async_client);
+    server->Shutdown();
+
+    jwtsvid_SVID_Free(result.svid);
+    spiffeid_ID_Free(&params.subject);
+    mtx_destroy(&result.mtx);
+    cnd_destroy(&result.cond);
+}
+END_TEST
+
+typedef struct {
+    fetch_result result;
+    workloadapi_AsyncClient *async_client;
+    err_t close_err;
+    err_t cancel_err;
+} reentrant_result;
+
+// calls back into the client from the event thread.
+static void reentrant_callback(jwtsvid_SVID *svid, err_t err, void *args)
+{
+    reentrant_result *reentrant = (reentrant_result *) args;
+    reentrant->close_err
+        = workloadapi_AsyncClient_Close(reentrant->async_client);
+    reentrant->cancel_err
+        = workloadapi_AsyncClient_CancelWatch(reentrant->async_client, args);
+    fetch_callback(svid, err, &reentrant->result);
+}
+
+START_TEST(test_workloadapi_AsyncClient_Close_from_callback)
+{
+    TestWorkloadAPI service;
+    std::unique_ptr<grpc::Server> server = start_server(&service);
+    workloadapi_AsyncClient *async_client = new_started_client();
+
+    err_t err = NO_ERROR;
+    jwtsvid_Params params = {};
+    params.subject
+        = spiffeid_FromString("spiffe://example.com/workload1", &err);
+
+    reentrant_result reentrant = {};
+    reentrant.async_client = async_client;
+    mtx_init(&reentrant.result.mtx, mtx_plain);
+    cnd_init(&reentrant.result.cond);
+    workloadapi_JWTSVIDCallback callback = { &reentrant, reentrant_callback };
+
+    err = workloadapi_AsyncClient_FetchJWTSVID(async_client, &params,
+                                               callback);
+    ck_assert_int_eq(err, NO_ERROR);
+
+    mtx_lock(&reentrant.result.mtx);
+    while(!reentrant.result.done) {
+        cnd_wait(&reentrant.result.cond, &reentrant.result.mtx);
+    }
+    mtx_unlock(&reentrant.result.mtx);
+
+    // waiting on the event thread for itself would never return.
+    ck_assert_int_eq(reentrant.close_err, ERR_THREAD);
+    ck_assert_int_eq(reentrant.cancel_err, ERR_THREAD);
+    ck_assert(async_client->running);
+
+    close_client(async_client);
+    server->Shutdown();
+
+    jwtsvid_SVID_Free(reentrant.result.svid);
+    spiffeid_ID_Free(&params.subject);
+    mtx_destroy(&reentrant.result.mtx);
+    cnd_destroy(&reentrant.result.cond);
+}
+END_TEST
+
+// callback that counts updates, and ignores the set.
+static void count_callback(jwtbundle_Set *set, void *args)
+{
+    int *count = (int *) args;
+    ck_assert_ptr_ne(set, NULL);
+    ck_assert_uint_eq(jwtbundle_Set_Len(set), 1);
+    ++(*count);
+}
+
+START_TEST(test_workloadapi_AsyncClient_WatchJWTBundles)
+{
+    TestWorkloadAPI service;
+    std::unique_ptr<grpc::Server> server = start_server(&service);
+    workloadapi_AsyncClient *async_client = new_started_client();
+
+    err_t err = NO_ERROR;
+    int count = 0;
+    workloadapi_JWTCallback callback = { &count, count_callback };
+    workloadapi_JWTWatcherConfig config;
+    config.client = NULL;
+    config.client_options = NULL;
+
+    workloadapi_JWTWatcher *watchers[2];
+    for(int i = 0; i < 2; ++i) {
+        watchers[i] = workloadapi_newJWTWatcher(config, callback, &err);
+        ck_assert_int_eq(err, NO_ERROR);
+        err = workloadapi_JWTWatcher_SetAsyncClient(watchers[i],
+                                                    async_client);
+        ck_assert_int_eq(err, NO_ERROR);
+        ck_assert_ptr_eq(watchers[i]->client, async_client->client);
+        ck_assert(!watchers[i]->owns_client);
+
+        // blocks until the first update arrives on the event thread.
+        err = workloadapi_JWTWatcher_Start(watchers[i]);
+        ck_assert_int_eq(err, NO_ERROR);
+    }
+    ck_assert_int_eq(count, 2);
+    ck_assert_uint_eq(arrlenu(async_client->calls), 2);
+
+    // can't switch clients once started.
+    err = workloadapi_JWTWatcher_SetAsyncClient(watchers[0], async_client);
+    ck_assert_int_eq(err, ERR_EXISTS);
+
+    err = workloadapi_JWTWatcher_Close(watchers[0]);
+    ck_assert_int_eq(err, NO_ERROR);
+    ck_assert_uint_eq(arrlenu(async_client->calls), 1);
+    workloadapi_JWTWatcher_Free(watchers[0]);
+
+    // closing the async client cancels the remaining stream.
+    err = workloadapi_AsyncClient_Close(async_client);
+    ck_assert_int_eq(err, NO_ERROR);
+    ck_assert_ptr_eq(async_client->calls, NULL);
+    err = workloadapi_JWTWatcher_Close(watchers[1]);
+    ck_assert_int_eq(err, NO_ERROR);
+    workloadapi_JWTWatcher_Free(watchers[1]);
+
+    workloadapi_Client *client = async_client->client;
+    workloadapi_AsyncClient_Free(async_client);
+    workloadapi_Client_Close(client);
+    workloadapi_Client_Free(client);
+    server->Shutdown();
+}
+END_TEST
+
+Suite *asyncclient_suite(void)
+{
+    Suite *s = suite_create("asyncclient");
+    TCase *tc_core = tcase_create("core");
+    tcase_set_timeout(tc_core, 30);
+
+    tcase_add_test(tc_core, test_workloadapi_NewAsyncClient);
+    tcase_add_test(tc_core, test_workloadapi_AsyncClient_FetchJWTSVID);
+    tcase_add_test(tc_core, test_workloadapi_AsyncClient_WatchJWTBundles);
+    tcase_add_test(tc_core, test_workloadapi_AsyncClient_Close_from_callback);
+
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(int argc, char **argv)
+{
+    Suite *s = asyncclient_suite();
+    SRunner *sr = srunner_create(s);
+
+    srunner_run_all(sr, CK_NORMAL);
+    const int number_failed = srunner_ntests_failed(sr);
+
+    srunner_free(sr);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
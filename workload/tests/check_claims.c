@@ -0,0 +1,240 @@
+/**
+ *
+ * (C) Copyright 2020-2021 Hewlett Packard Enterprise Development LP
+ *
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <check.h>
+#include <stdlib.h>
+
+#include "c-spiffe/svid/jwtsvid/claims.h"
+
+// scans a copy of json, which the scanner alters
+static err_t scan_claims(const char *json, char **copy,
+                         jwtsvid_Claims *claims)
+{
+    *copy = strdup(json);
+    return jwtsvid_ScanClaims(*copy, strlen(json), claims);
+}
+
+// precondition: header with the fields in any order and other members
+// postcondition: alg, kid and typ found
+START_TEST(test_jwtsvid_ScanHeader)
+{
+    char json[]
+        = " { \"typ\" : \"JWT\", \"x5t\": [\"a\", {\"b\": null}],"
+          "\"kid\":\"key\\/1\",\"alg\":\"ES256\" }\n";
+    jwtsvid_Header header;
+
+    err_t err = jwtsvid_ScanHeader(json, strlen(json), &header);
+
+    ck_assert_uint_eq(err, NO_ERROR);
+    ck_assert_str_eq(header.alg, "ES256");
+    ck_assert_str_eq(header.kid, "key/1");
+    ck_assert_str_eq(header.typ, "JWT");
+
+    // fields that are not strings are absent
+    char json2[] = "{\"alg\":256,\"kid\":null}";
+    err = jwtsvid_ScanHeader(json2, strlen(json2), &header);
+
+    ck_assert_uint_eq(err, NO_ERROR);
+    ck_assert_ptr_eq(header.alg, NULL);
+    ck_assert_ptr_eq(header.kid, NULL);
+    ck_assert_ptr_eq(header.typ, NULL);
+}
+END_TEST
+
+// precondition: payload with every registered claim and private ones
+// postcondition: registered claims found, private ones skipped
+START_TEST(test_jwtsvid_ScanClaims)
+{
+    char *json;
+    jwtsvid_Claims claims;
+    err_t err = scan_claims(
+        "{\"iss\":\"issuer\",\"ext\":{\"a\":[1,2.5e-3,true,false,null]},"
+        "\"sub\":\"spiffe://example.com/workload1\",\"aud\":[\"aud1\",2,"
+        "\"aud2\"],\"exp\":9990000000,\"nbf\":1400000000,\"iat\":-1,"
+        "\"jti\":\"ABCDEFGH\",\"name\":\"John Doe\"}",
+        &json, &claims);
+
+    ck_assert_uint_eq(err, NO_ERROR);
+    ck_assert_str_eq(claims.issuer, "issuer");
+    ck_assert_str_eq(claims.subject, "spiffe://example.com/workload1");
+    ck_assert_str_eq(claims.id, "ABCDEFGH");
+    ck_assert_uint_eq(arrlenu(claims.audience), 2);
+    ck_assert_str_eq(claims.audience[0], "aud1");
+    ck_assert_str_eq(claims.audience[1], "aud2");
+    ck_assert_int_eq(claims.expiry, 9990000000);
+    ck_assert_int_eq(claims.not_before, 1400000000);
+    ck_assert_int_eq(claims.issued_at, -1);
+
+    arrfree(claims.audience);
+    free(json);
+}
+END_TEST
+
+// precondition: claims of unexpected types, repeated and missing
+// postcondition: as jansson reads them, the last member wins
+START_TEST(test_jwtsvid_ScanClaims_types)
+{
+    char *json;
+    jwtsvid_Claims claims;
+    err_t err = scan_claims("{\"sub\":1,\"aud\":[\"a\"],\"aud\":\"b\","
+                            "\"exp\":\"soon\",\"nbf\":1.5,"
+                            "\"iat\":99999999999999999999}",
+                            &json, &claims);
+
+    ck_assert_uint_eq(err, NO_ERROR);
+    ck_assert_ptr_eq(claims.subject, NULL);
+    ck_assert_ptr_eq(claims.issuer, NULL);
+    ck_assert_ptr_eq(claims.id, NULL);
+    ck_assert_uint_eq(arrlenu(claims.audience), 1);
+    ck_assert_str_eq(claims.audience[0], "b");
+    ck_assert_int_eq(claims.expiry, -1);
+    ck_assert_int_eq(claims.not_before, -1);
+    ck_assert_int_eq(claims.issued_at, -1);
+
+    arrfree(claims.audience);
+    free(json);
+
+    err = scan_claims("{}", &json, &claims);
+
+    ck_assert_uint_eq(err, NO_ERROR);
+    ck_assert_ptr_eq(claims.audience, NULL);
+    ck_assert_int_eq(claims.expiry, 0);
+
+    free(json);
+}
+END_TEST
+
+// precondition: strings with escapes
+// postcondition: strings unescaped to UTF-8
+START_TEST(test_jwtsvid_ScanClaims_escapes)
+{
+    char *json;
+    jwtsvid_Claims claims;
+    err_t err = scan_claims("{\"s\\u0075b\":\"a\\\"b\\\\c\\/d\\n\","
+                            "\"iss\":\"\\u00e9\\u20ac\\ud83d\\ude00\","
+                            "\"jti\":\"\xc3\xa9t\xc3\xa9\"}",
+                            &json, &claims);
+
+    ck_assert_uint_eq(err, NO_ERROR);
+    ck_assert_str_eq(claims.subject, "a\"b\\c/d\n");
+    ck_assert_str_eq(claims.issuer, "\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80");
+    ck_assert_str_eq(claims.id, "\xc3\xa9t\xc3\xa9");
+
+    arrfree(claims.audience);
+    free(json);
+}
+END_TEST
+
+// precondition: texts that are not a json object
+// postcondition: parsing error
+START_TEST(test_jwtsvid_ScanClaims_invalid)
+{
+    const char *texts[] = { "",
+                            "[]",
+                            "\"sub\"",
+                            "{",
+                            "{\"sub\":\"a\",}",
+                            "{\"sub\" \"a\"}",
+                            "{\"sub\":\"a}",
+                            "{\"sub\":\"a\"} {}",
+                            "{\"sub\":tru}",
+                            "{\"exp\":01}",
+                            "{\"exp\":1.}",
+                            "{\"exp\":-}",
+                            "{\"aud\":[\"a\",]}",
+                            "{\"sub\":\"a\tb\"}",
+                            "{\"sub\":\"\\x\"}",
+                            "{\"sub\":\"\\u12\"}",
+                            "{\"sub\":\"\\u0000\"}",
+                            "{\"sub\":\"\\udc00\"}",
+                            "{\"sub\":\"\\ud800x\"}",
+                            "{\"sub\":\"\xc3\"}",
+                            "{\"sub\":\"\xe0\x80\xaf\"}",
+                            "{\"sub\":\"\xff\"}" };
+
+    for(size_t i = 0; i < sizeof texts / sizeof *texts; ++i) {
+        char *json;
+        jwtsvid_Claims claims;
+        err_t err = scan_claims(texts[i], &json, &claims);
+        ck_assert_uint_eq(err, ERR_PARSING);
+        arrfree(claims.audience);
+        free(json);
+    }
+}
+END_TEST
+
+// precondition: private claims nested past and within the limit
+// postcondition: only the deepest is rejected
+START_TEST(test_jwtsvid_ScanClaims_depth)
+{
+    const size_t depths[] = { JWTSVID_SCAN_MAX_DEPTH - 1,
+                              JWTSVID_SCAN_MAX_DEPTH + 1 };
+    for(size_t i = 0; i < 2; ++i) {
+        // the payload object is the first level
+        const size_t depth = depths[i];
+        char *json = malloc(2 * depth + 16);
+        char *pos = json + sprintf(json, "{\"ext\":");
+        memset(pos, '[', depth - 1);
+        pos += depth - 1;
+        memset(pos, ']', depth - 1);
+        pos += depth - 1;
+        strcpy(pos, "}");
+
+        jwtsvid_Claims claims;
+        err_t err = jwtsvid_ScanClaims(json, strlen(json), &claims);
+        ck_assert_uint_eq(err, i == 0 ? NO_ERROR : ERR_PARSING);
+        free(json);
+    }
+}
+END_TEST
+
+Suite *claims_suite(void)
+{
+    Suite *s = suite_create("claims");
+    TCase *tc_core = tcase_create("core");
+
+    tcase_add_test(tc_core, test_jwtsvid_ScanHeader);
+    tcase_add_test(tc_core, test_jwtsvid_ScanClaims);
+    tcase_add_test(tc_core, test_jwtsvid_ScanClaims_types);
+    tcase_add_test(tc_core, test_jwtsvid_ScanClaims_escapes);
+    tcase_add_test(tc_core, test_jwtsvid_ScanClaims_invalid);
+    tcase_add_test(tc_core, test_jwtsvid_ScanClaims_depth);
+
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void)
+{
+    Suite *s = claims_suite();
+    SRunner *sr = srunner_create(s);
+
+    srunner_run_all(sr, CK_NORMAL);
+    const int number_failed = srunner_ntests_failed(sr);
+
+    srunner_free(sr);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -30,15 +30,18 @@
 #include <check.h>
 #include <gmock/gmock.h>
 #include <grpc/grpc.h>
+#include <grpcpp/alarm.h>
 #include <grpcpp/grpcpp.h>
 #include <grpcpp/test/mock_stream.h>
 #include <iostream> //keep at top
 #include <openssl/bio.h>
 #include <openssl/pem.h>
+#include <thread>
 
 using ::testing::_;
 using ::testing::AtLeast;
 using ::testing::DoAll;
+using ::testing::Invoke;
 using ::testing::Return;
 using ::testing::SaveArg;
 using ::testing::SetArgPointee;
@@ -60,6 +63,8 @@ x509svid_SVID **workloadapi_parseX509SVIDs(X509SVIDResponse *resp,
                                            bool firstOnly, err_t *err);
 jwtsvid_SVID *workloadapi_parseJWTSVID(const JWTSVIDResponse *resp,
                                        jwtsvid_Params *params, err_t *err);
+jwtsvid_SVID **workloadapi_parseJWTSVIDs(const JWTSVIDResponse *resp,
+                                         jwtsvid_Params *params, err_t *err);
 jwtbundle_Set *workloadapi_parseJWTBundles(const JWTBundlesResponse *resp,
                                            err_t *err);
 
@@ -117,6 +122,72 @@ START_TEST(test_workloadapi_parseX509Bundles)
 }
 END_TEST
 
+START_TEST(test_workloadapi_parseX509Bundles_shared)
+{
+    const int ITERS = 4;
+
+    FILE *f = fopen("./resources/certs.pem", "r");
+    ck_assert(f != NULL);
+    unsigned char der_bytes[10000];
+    unsigned char *pout = der_bytes;
+    for(int i = 0; i < ITERS; ++i) {
+        X509 *cert = PEM_read_X509(f, NULL, NULL, NULL);
+        if(cert) {
+            i2d_X509(cert, &pout);
+            X509_free(cert);
+        }
+    }
+    fclose(f);
+    const std::string bundle((char *) der_bytes, pout - der_bytes);
+
+    X509SVIDResponse rep;
+
+    // three SVIDs of the same trust domain, carrying the same bundle
+    for(int i = 0; i < 3; ++i) {
+        auto new_svid = rep.mutable_svids()->Add();
+        new_svid->set_spiffe_id("spiffe://example1.com/workload");
+        new_svid->set_bundle(bundle);
+    }
+    // also sent as a federated bundle, and as another trust domain's
+    (*rep.mutable_federated_bundles())["spiffe://example1.com"] = bundle;
+    (*rep.mutable_federated_bundles())["spiffe://example2.com"] = bundle;
+    // a different bundle
+    (*rep.mutable_federated_bundles())["spiffe://example3.com"]
+        = bundle.substr(0, bundle.size() / 2);
+
+    err_t err = NO_ERROR;
+    x509bundle_Set *set = workloadapi_parseX509Bundles(&rep, &err);
+    ck_assert_ptr_ne(set, NULL);
+    ck_assert_uint_eq(x509bundle_Set_Len(set), 3);
+
+    spiffeid_TrustDomain td1 = { string_new("example1.com") };
+    spiffeid_TrustDomain td2 = { string_new("example2.com") };
+    spiffeid_TrustDomain td3 = { string_new("example3.com") };
+    bool suc = false;
+    x509bundle_Bundle *b1 = x509bundle_Set_Get(set, td1, &suc);
+    ck_assert(suc);
+    x509bundle_Bundle *b2 = x509bundle_Set_Get(set, td2, &suc);
+    ck_assert(suc);
+    x509bundle_Bundle *b3 = x509bundle_Set_Get(set, td3, &suc);
+    ck_assert(suc);
+
+    // identical bytes were decoded once, and the certificates shared
+    ck_assert_uint_eq(arrlenu(b1->auths), ITERS);
+    ck_assert_uint_eq(arrlenu(b2->auths), ITERS);
+    for(int i = 0; i < ITERS; ++i) {
+        ck_assert_ptr_eq(b1->auths[i], b2->auths[i]);
+    }
+    ck_assert_uint_gt(arrlenu(b3->auths), 0);
+    ck_assert_ptr_ne(b3->auths[0], b1->auths[0]);
+    ck_assert_int_eq(X509_cmp(b3->auths[0], b1->auths[0]), 0);
+
+    spiffeid_TrustDomain_Free(&td1);
+    spiffeid_TrustDomain_Free(&td2);
+    spiffeid_TrustDomain_Free(&td3);
+    x509bundle_Set_Free(set);
+}
+END_TEST
+
 START_TEST(test_workloadapi_NewClient)
 {
     // when we create a new client
@@ -643,7 +714,7 @@ START_TEST(test_workloadapi_Client_FetchJWTSVID)
 
     ck_assert_ptr_ne(svid, NULL);
     ck_assert_ptr_eq(svid->audience, NULL);
-    ck_assert_ptr_ne(svid->claims, NULL);
+    ck_assert_ptr_ne(jwtsvid_SVID_GetClaims(svid), NULL);
     ck_assert_uint_eq(shlenu(svid->claims), 4);
     ck_assert_int_ge(shgeti(svid->claims, "sub"), 0);
     ck_assert_int_ge(shgeti(svid->claims, "name"), 0);
@@ -665,6 +736,184 @@ START_TEST(test_workloadapi_Client_FetchJWTSVID)
 }
 END_TEST
 
+ACTION(delay_JWTSVID_response)
+{
+    // keep the call in flight while the other callers join it
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+}
+
+START_TEST(test_workloadapi_Client_FetchJWTSVID_single_flight)
+{
+    const int N = 8;
+    err_t err = NO_ERROR;
+    workloadapi_Client *client = workloadapi_NewClient(&err);
+
+    MockSpiffeWorkloadAPIStub *stub = new MockSpiffeWorkloadAPIStub();
+    workloadapi_Client_SetStub(client, stub);
+    workloadapi_Client_setDefaultAddressOption(client, NULL);
+    workloadapi_Client_setDefaultHeaderOption(client, NULL);
+
+    err = workloadapi_Client_Connect(client);
+
+    EXPECT_CALL(*stub, FetchJWTSVID(_, _, _))
+        .Times(1)
+        .WillOnce(DoAll(delay_JWTSVID_response(),
+                        WithArgs<1, 2>(set_JWTSVID_response()),
+                        Return(grpc::Status::OK)));
+
+    jwtsvid_SVID *svids[N];
+    err_t errs[N];
+    std::vector<std::thread> threads;
+    for(int i = 0; i < N; ++i) {
+        threads.emplace_back([client, &svids, &errs, i]() {
+            err_t err = NO_ERROR;
+            jwtsvid_Params params
+                = { .audience = NULL,
+                    .extra_audiences = NULL,
+                    .subject = spiffeid_FromString(
+                        "spiffe://example.org/workload-1", &err) };
+            svids[i] = workloadapi_Client_FetchJWTSVID(client, &params,
+                                                       &errs[i]);
+            spiffeid_ID_Free(&(params.subject));
+        });
+    }
+    for(auto &thread : threads) {
+        thread.join();
+    }
+
+    ck_assert_uint_eq(shlenu(client->jwtsvid_calls), 0);
+    workloadapi_Client_Close(client);
+    workloadapi_Client_Free(client);
+
+    for(int i = 0; i < N; ++i) {
+        ck_assert_int_eq(errs[i], NO_ERROR);
+        ck_assert_ptr_ne(svids[i], NULL);
+        ck_assert_str_eq(svids[i]->token, token1);
+        for(int j = 0; j < i; ++j) {
+            // every caller owns its copy
+            ck_assert_ptr_ne(svids[i], svids[j]);
+        }
+    }
+    for(int i = 0; i < N; ++i) {
+        jwtsvid_SVID_Free(svids[i]);
+    }
+
+    delete stub;
+}
+END_TEST
+
+START_TEST(test_workloadapi_parseJWTSVIDs)
+{
+    err_t err = NO_ERROR;
+    jwtsvid_Params params = { NULL, NULL, NULL };
+    jwtsvid_SVID **svids = workloadapi_parseJWTSVIDs(NULL, &params, &err);
+    ck_assert_ptr_eq(svids, NULL);
+    ck_assert_int_eq(err, ERR_NULL);
+
+    JWTSVIDResponse resp;
+    svids = workloadapi_parseJWTSVIDs(&resp, &params, &err);
+    ck_assert_ptr_eq(svids, NULL);
+    ck_assert_int_eq(err, ERR_NULL_SVID);
+
+    // every SVID in the response is parsed
+    resp.add_svids()->set_svid(token1);
+    resp.add_svids()->set_svid(token1);
+    resp.add_svids()->set_svid(token1);
+    svids = workloadapi_parseJWTSVIDs(&resp, &params, &err);
+    ck_assert_int_eq(err, NO_ERROR);
+    ck_assert_uint_eq(arrlenu(svids), 3);
+    for(size_t i = 0; i < arrlenu(svids); ++i) {
+        ck_assert_str_eq(svids[i]->token, token1);
+        jwtsvid_SVID_Free(svids[i]);
+    }
+    arrfree(svids);
+
+    // one bad token fails the whole response
+    resp.add_svids()->set_svid("not.a.token");
+    svids = workloadapi_parseJWTSVIDs(&resp, &params, &err);
+    ck_assert_ptr_eq(svids, NULL);
+    ck_assert_int_ne(err, NO_ERROR);
+}
+END_TEST
+
+START_TEST(test_workloadapi_Client_FetchJWTSVIDs)
+{
+    err_t err = NO_ERROR;
+    workloadapi_Client *client = workloadapi_NewClient(&err);
+
+    MockSpiffeWorkloadAPIStub *stub = new MockSpiffeWorkloadAPIStub();
+    workloadapi_Client_SetStub(client, stub);
+    workloadapi_Client_setDefaultAddressOption(client, NULL);
+    workloadapi_Client_setDefaultHeaderOption(client, NULL);
+
+    err = workloadapi_Client_Connect(client);
+
+    // completes each call through the completion queue it was started on
+    std::vector<std::unique_ptr<grpc::Alarm>> alarms;
+    EXPECT_CALL(*stub, AsyncFetchJWTSVIDRaw(_, _, _))
+        .Times(3)
+        .WillRepeatedly(Invoke([&alarms](grpc::ClientContext *ctx,
+                                         const JWTSVIDRequest &req,
+                                         grpc::CompletionQueue *cq) {
+            auto reader = new grpc::testing::MockClientAsyncResponseReader<
+                JWTSVIDResponse>();
+            const bool fail
+                = req.audience_size() > 0 && req.audience(0) == "fail";
+            EXPECT_CALL(*reader, Finish(_, _, _))
+                .WillOnce(Invoke([&alarms, cq, fail](JWTSVIDResponse *resp,
+                                                     grpc::Status *status,
+                                                     void *tag) {
+                    if(fail) {
+                        *status = grpc::Status(grpc::StatusCode::UNAVAILABLE,
+                                               "unavailable");
+                    } else {
+                        resp->add_svids()->set_svid(token1);
+                        resp->add_svids()->set_svid(token1);
+                        *status = grpc::Status::OK;
+                    }
+                    alarms.emplace_back(new grpc::Alarm());
+                    alarms.back()->Set(cq, gpr_now(GPR_CLOCK_REALTIME), tag);
+                }));
+            return reader;
+        }));
+
+    jwtsvid_Params *params = NULL;
+    jwtsvid_Params ok_params = { NULL, NULL, NULL };
+    jwtsvid_Params fail_params = { string_new("fail"), NULL, NULL };
+    arrput(params, ok_params);
+    arrput(params, fail_params);
+    arrput(params, ok_params);
+
+    workloadapi_JWTSVIDResult *results
+        = workloadapi_Client_FetchJWTSVIDs(client, params, &err);
+
+    ck_assert_int_eq(err, NO_ERROR);
+    ck_assert_uint_eq(arrlenu(results), 3);
+    ck_assert_int_eq(results[0].err, NO_ERROR);
+    ck_assert_uint_eq(arrlenu(results[0].svids), 2);
+    ck_assert_str_eq(results[0].svids[1]->token, token1);
+    ck_assert_int_eq(results[1].err, ERR_BAD_REQUEST);
+    ck_assert_ptr_eq(results[1].svids, NULL);
+    ck_assert_int_eq(results[2].err, NO_ERROR);
+    ck_assert_uint_eq(arrlenu(results[2].svids), 2);
+    // params are left untouched
+    ck_assert_str_eq(params[1].audience, "fail");
+    ck_assert_ptr_eq(params[1].extra_audiences, NULL);
+
+    workloadapi_JWTSVIDResults_Free(results);
+    util_string_t_Free(fail_params.audience);
+    arrfree(params);
+
+    results = workloadapi_Client_FetchJWTSVIDs(client, NULL, &err);
+    ck_assert_ptr_eq(results, NULL);
+    ck_assert_int_eq(err, ERR_NULL);
+
+    workloadapi_Client_Close(client);
+    workloadapi_Client_Free(client);
+    delete stub;
+}
+END_TEST
+
 const char token2[]
     = "eyJhbGciOiJSUzI1NiIsInR5cCI6IkpXVCIsImtpZCI6ImZmM2M1Yzk2LTM5MmUtNDZlZi1"
       "hODM5LTZmZjE2MDI3YWY3OCJ9."
@@ -706,7 +955,7 @@ START_TEST(test_workloadapi_Client_ValidateJWTSVID)
     workloadapi_Client_Free(client);
 
     ck_assert_ptr_ne(svid, NULL);
-    ck_assert_ptr_ne(svid->claims, NULL);
+    ck_assert_ptr_ne(jwtsvid_SVID_GetClaims(svid), NULL);
     ck_assert_ptr_ne(svid->audience, NULL);
     ck_assert_uint_eq(arrlenu(svid->audience), 1);
     ck_assert_uint_eq(shlenu(svid->claims), 5);
@@ -728,6 +977,167 @@ START_TEST(test_workloadapi_Client_ValidateJWTSVID)
 }
 END_TEST
 
+// token2 signed with ./resources/privkey.pem
+const char token3[]
+    = "eyJhbGciOiJSUzI1NiIsInR5cCI6IkpXVCIsImtpZCI6ImZmM2M1Yzk2LTM5MmUtNDZlZi1"
+      "hODM5LTZmZjE2MDI3YWY3OCJ9."
+      "eyJzdWIiOiJzcGlmZmU6Ly9leGFtcGxlLmNvbS93b3JrbG9hZDEiLCJhdWQiOiJzcGlmZmU"
+      "6Ly9leGFtcGxlLm9yZy9hdWRpZW5jZTEiLCJuYW1lIjoiSm9obiBEb2UiLCJpYXQiOjE1MT"
+      "YyMzkwMjIsImV4cCI6OTk5MDAwMDAwMH0."
+      "XqUdgXD4-E7ZwzRtUzbCOnHaJJzVD93H-kmLL7F5SVVlvCUdDwUJrKzJrELprWUmCpTTzo"
+      "SwBRNwARqkzxAEJx3DAR6FSUs-JBpmC4leJfytUinewJYz9Zwwdd8neQeYfCM7rbSEZl09"
+      "NxVS2uuxsAajMn1_WaTPRvwkfGKCJ2ekUjbS-w3dlaatD6qj6jsQgYF2GTpfNaTurDt2Tn"
+      "TQjd52ellkZ4NjflIvsUta3aKqGjzYdLV9QISsfVhpqDHQvFuk8rb6LsStW8J5KyS_O-Bb"
+      "Qs59syWnLV0TYI24aRNtHTu70mHQ9qSsS0_8GMB7hnufFBK_89LDwe4BLvZ8FA";
+
+static jwtbundle_Set *newJWTBundleSet(const char *kid)
+{
+    FILE *f = fopen("./resources/privkey.pem", "r");
+    ck_assert_ptr_ne(f, NULL);
+    EVP_PKEY *pkey = PEM_read_PrivateKey(f, NULL, NULL, NULL);
+    fclose(f);
+
+    spiffeid_TrustDomain td = { string_new("example.com") };
+    jwtbundle_Bundle *bundle = jwtbundle_New(td);
+    jwtbundle_Bundle_AddJWTAuthority(bundle, kid, pkey);
+    EVP_PKEY_free(pkey);
+    spiffeid_TrustDomain_Free(&td);
+
+    jwtbundle_Set *set = jwtbundle_NewSet(0);
+    jwtbundle_Set_Add(set, bundle);
+    return set;
+}
+
+START_TEST(test_workloadapi_Client_ValidateJWTSVIDWithBundles)
+{
+    err_t err = NO_ERROR;
+    workloadapi_Client *client = workloadapi_NewClient(&err);
+
+    MockSpiffeWorkloadAPIStub *stub = new MockSpiffeWorkloadAPIStub();
+    workloadapi_Client_SetStub(client, stub);
+    workloadapi_Client_setDefaultAddressOption(client, NULL);
+    workloadapi_Client_setDefaultHeaderOption(client, NULL);
+    workloadapi_Client_Connect(client);
+
+    char audience[] = "spiffe://example.org/audience1";
+
+    // the key is known, validated locally
+    EXPECT_CALL(*stub, ValidateJWTSVID(_, _, _)).Times(0);
+    jwtbundle_Set *set
+        = newJWTBundleSet("ff3c5c96-392e-46ef-a839-6ff16027af78");
+    string_t my_token = string_new(token3);
+    jwtsvid_SVID *svid = workloadapi_Client_ValidateJWTSVIDWithBundles(
+        client, set, my_token, audience, &err);
+    arrfree(my_token);
+
+    ck_assert_uint_eq(err, NO_ERROR);
+    ck_assert_ptr_ne(svid, NULL);
+    ck_assert_uint_eq(shlenu(jwtsvid_SVID_GetClaims(svid)), 5);
+    ck_assert_int_eq(svid->expiry, 9990000000);
+    ck_assert_str_eq(svid->id.td.name, "example.com");
+    ck_assert_str_eq(svid->id.path, "/workload1");
+    ck_assert_str_eq(svid->token, token3);
+    jwtsvid_SVID_Free(svid);
+
+    // bad signature with a known key, rejected locally
+    my_token = string_new(token2);
+    svid = workloadapi_Client_ValidateJWTSVIDWithBundles(
+        client, set, my_token, audience, &err);
+    arrfree(my_token);
+    jwtbundle_Set_Free(set);
+
+    ck_assert_uint_eq(err, ERR_INVALID_JWT);
+    ck_assert_ptr_eq(svid, NULL);
+
+    // no bundle for the trust domain, rejected locally
+    set = jwtbundle_NewSet(0);
+    my_token = string_new(token3);
+    svid = workloadapi_Client_ValidateJWTSVIDWithBundles(
+        client, set, my_token, audience, &err);
+    arrfree(my_token);
+    jwtbundle_Set_Free(set);
+
+    ck_assert_uint_eq(err, ERR_NOT_FOUND);
+    ck_assert_ptr_eq(svid, NULL);
+    testing::Mock::VerifyAndClearExpectations(stub);
+
+    // unknown key, the agent is asked
+    EXPECT_CALL(*stub, ValidateJWTSVID(_, _, _))
+        .WillOnce(Return(grpc::Status::OK));
+    set = newJWTBundleSet("rotated-key");
+    my_token = string_new(token3);
+    svid = workloadapi_Client_ValidateJWTSVIDWithBundles(
+        client, set, my_token, audience, &err);
+    arrfree(my_token);
+    jwtbundle_Set_Free(set);
+
+    ck_assert_uint_eq(err, NO_ERROR);
+    ck_assert_ptr_ne(svid, NULL);
+    ck_assert_str_eq(svid->token, token3);
+    jwtsvid_SVID_Free(svid);
+
+    workloadapi_Client_Close(client);
+    workloadapi_Client_Free(client);
+    delete stub;
+}
+END_TEST
+
+START_TEST(test_workloadapi_Client_ValidateJWTSVID_claims)
+{
+    err_t err = NO_ERROR;
+    workloadapi_Client *client = workloadapi_NewClient(&err);
+
+    MockSpiffeWorkloadAPIStub *stub = new MockSpiffeWorkloadAPIStub();
+    workloadapi_Client_SetStub(client, stub);
+    workloadapi_Client_setDefaultAddressOption(client, NULL);
+    workloadapi_Client_setDefaultHeaderOption(client, NULL);
+    workloadapi_Client_Connect(client);
+
+    ValidateJWTSVIDResponse resp;
+    resp.set_spiffe_id("spiffe://example.com/workload1");
+    auto &fields = *resp.mutable_claims()->mutable_fields();
+    fields["sub"].set_string_value("spiffe://example.com/workload1");
+    fields["exp"].set_number_value(9990000000);
+    fields["iat"].set_number_value(1516239022);
+    auto *aud = fields["aud"].mutable_list_value();
+    aud->add_values()->set_string_value("spiffe://example.org/audience1");
+    aud->add_values()->set_string_value("spiffe://example.org/audience2");
+    (*fields["ext"].mutable_struct_value()->mutable_fields())["admin"]
+        .set_bool_value(true);
+
+    EXPECT_CALL(*stub, ValidateJWTSVID(_, _, _))
+        .WillOnce(DoAll(SetArgPointee<2>(resp), Return(grpc::Status::OK)));
+
+    // the token is not parsed again, anything the agent accepted will do
+    char token[] = "opaque";
+    char audience[] = "spiffe://example.org/audience1";
+    jwtsvid_SVID *svid
+        = workloadapi_Client_ValidateJWTSVID(client, token, audience, &err);
+
+    workloadapi_Client_Close(client);
+    workloadapi_Client_Free(client);
+
+    ck_assert_uint_eq(err, NO_ERROR);
+    ck_assert_ptr_ne(svid, NULL);
+    ck_assert_str_eq(svid->id.td.name, "example.com");
+    ck_assert_str_eq(svid->id.path, "/workload1");
+    ck_assert_int_eq(svid->expiry, 9990000000);
+    ck_assert_uint_eq(arrlenu(svid->audience), 2);
+    ck_assert_str_eq(svid->audience[1], "spiffe://example.org/audience2");
+    ck_assert_uint_eq(shlenu(svid->claims), 5);
+    json_t *iat = shget(svid->claims, "iat");
+    ck_assert(json_is_integer(iat));
+    ck_assert_int_eq(json_integer_value(iat), 1516239022);
+    json_t *ext = shget(svid->claims, "ext");
+    ck_assert(json_is_object(ext));
+    ck_assert(json_is_true(json_object_get(ext, "admin")));
+    ck_assert_str_eq(svid->token, "opaque");
+
+    delete stub;
+    jwtsvid_SVID_Free(svid);
+}
+END_TEST
+
 ACTION(set_double_SVID_response)
 {
     const int ITERS = 4;
@@ -857,50 +1267,30 @@ START_TEST(test_workloadapi_Client_WatchX509Context)
     workloadapi_Client_Close(client);
     workloadapi_Client_Free(client);
 
-    ck_assert_int_eq(arrlen(ctxs), 4);
-    ck_assert_ptr_ne(ctxs[0], NULL);
-    ck_assert_ptr_ne(ctxs[0]->svids, NULL);
-    ck_assert_int_eq(arrlen(ctxs[0]->svids), 1);
-
-    x509bundle_Set_Free(ctxs[0]->bundles);
-    x509svid_SVID_Free(ctxs[0]->svids[0]);
-    arrpop(ctxs[0]->svids);
-    free(ctxs[0]);
-
-    ck_assert_ptr_ne(ctxs[1], NULL);
-    ck_assert_ptr_ne(ctxs[1]->svids, NULL);
-    ck_assert_int_eq(arrlen(ctxs[1]->svids), 2);
-
-    x509bundle_Set_Free(ctxs[1]->bundles);
-    x509svid_SVID_Free(ctxs[1]->svids[0]);
-    x509svid_SVID_Free(ctxs[1]->svids[1]);
-    arrpop(ctxs[1]->svids);
-    free(ctxs[1]);
-
-    ck_assert_ptr_ne(ctxs[2], NULL);
-    ck_assert_ptr_ne(ctxs[2]->svids, NULL);
-    ck_assert_int_eq(arrlen(ctxs[2]->svids), 1);
-
-    x509bundle_Set_Free(ctxs[2]->bundles);
-    x509svid_SVID_Free(ctxs[2]->svids[0]);
-    arrpop(ctxs[2]->svids);
-    arrpop(ctxs[2]->svids);
-    free(ctxs[2]);
-
-    ck_assert_ptr_ne(ctxs[3], NULL);
-    ck_assert_ptr_ne(ctxs[3]->svids, NULL);
-    ck_assert_int_eq(arrlen(ctxs[3]->svids), 2);
-
-    x509bundle_Set_Free(ctxs[3]->bundles);
-    x509svid_SVID_Free(ctxs[3]->svids[0]);
-    x509svid_SVID_Free(ctxs[3]->svids[1]);
-    arrpop(ctxs[3]->svids);
-    free(ctxs[3]);
-
-    arrpop(ctxs);
-    arrpop(ctxs);
-    arrpop(ctxs);
-    arrpop(ctxs);
+    // updates read faster than dispatched coalesce, the last one always
+    // gets through
+    workloadapi_PipelineStats stats
+        = workloadapi_Watcher_GetPipelineStats(watcher);
+    ck_assert_uint_eq(stats.received, 4);
+    ck_assert_uint_eq(stats.dispatched + stats.coalesced, 4);
+    ck_assert_uint_eq(stats.depth, 0);
+    ck_assert_int_eq(arrlen(ctxs), stats.dispatched);
+    ck_assert_int_ge(arrlen(ctxs), 1);
+    ck_assert_uint_ge(stats.max_latency_ns, stats.last_latency_ns);
+    ck_assert_int_eq(arrlen(ctxs[arrlen(ctxs) - 1]->svids), 2);
+
+    for(int i = 0; i < arrlen(ctxs); ++i) {
+        ck_assert_ptr_ne(ctxs[i], NULL);
+        ck_assert_ptr_ne(ctxs[i]->svids, NULL);
+        x509bundle_Set_Free(ctxs[i]->bundles);
+        for(int j = 0; j < arrlen(ctxs[i]->svids); ++j) {
+            x509svid_SVID_Free(ctxs[i]->svids[j]);
+        }
+        arrfree(ctxs[i]->svids);
+        free(ctxs[i]);
+    }
+    arrfree(ctxs);
+    workloadapi_Watcher_Free(watcher);
 
     delete stub;
 
@@ -978,21 +1368,21 @@ START_TEST(test_workloadapi_Client_WatchJWTBundles)
     workloadapi_Client_Close(client);
     workloadapi_Client_Free(client);
 
+    workloadapi_PipelineStats stats
+        = workloadapi_JWTWatcher_GetPipelineStats(watcher);
+    ck_assert_uint_eq(stats.received, 2);
+    ck_assert_uint_eq(stats.dispatched + stats.coalesced, 2);
     ck_assert_ptr_ne(sets, NULL);
-    ck_assert_int_eq(arrlen(sets), 2);
-
-    ck_assert_ptr_ne(sets[0], NULL);
-    ck_assert_ptr_ne(sets[0]->bundles, NULL);
-    ck_assert_int_eq(jwtbundle_Set_Len(sets[0]), 2);
-    jwtbundle_Set_Free(sets[0]);
+    ck_assert_int_eq(arrlen(sets), stats.dispatched);
 
-    ck_assert_ptr_ne(sets[1], NULL);
-    ck_assert_ptr_ne(sets[1]->bundles, NULL);
-    ck_assert_int_eq(jwtbundle_Set_Len(sets[1]), 2);
-    jwtbundle_Set_Free(sets[1]);
-
-    arrpop(sets);
-    arrpop(sets);
+    for(int i = 0; i < arrlen(sets); ++i) {
+        ck_assert_ptr_ne(sets[i], NULL);
+        ck_assert_ptr_ne(sets[i]->bundles, NULL);
+        ck_assert_int_eq(jwtbundle_Set_Len(sets[i]), 2);
+        jwtbundle_Set_Free(sets[i]);
+    }
+    arrfree(sets);
+    workloadapi_JWTWatcher_Free(watcher);
 
     delete stub;
 
@@ -1061,12 +1451,48 @@ START_TEST(test_workloadapi_Client_FetchX509SVIDs)
 }
 END_TEST
 
+START_TEST(test_workloadapi_Client_FetchX509SVID_one_shot)
+{
+    err_t err = NO_ERROR;
+    workloadapi_Client *client = workloadapi_NewClient(&err);
+    MockSpiffeWorkloadAPIStub *stub = new MockSpiffeWorkloadAPIStub();
+    workloadapi_Client_SetStub(client, stub);
+    workloadapi_Client_setDefaultHeaderOption(client, NULL);
+    err = workloadapi_Client_Connect(client);
+
+    for(int i = 0; i < 3; ++i) {
+        auto cr = new grpc::testing::MockClientReader<X509SVIDResponse>();
+        EXPECT_CALL(*stub, FetchX509SVIDRaw(_, _)).WillOnce(Return(cr));
+        EXPECT_CALL(*cr, Read(_))
+            .WillOnce(
+                DoAll(WithArg<0>(set_single_SVID_response()), Return(true)));
+        // the stream is finished right after the first message
+        EXPECT_CALL(*cr, Finish()).WillOnce(Return(grpc::Status::CANCELLED));
+
+        x509svid_SVID *svid = workloadapi_Client_FetchX509SVID(client, &err);
+        ck_assert_int_eq(err, NO_ERROR);
+        ck_assert_ptr_ne(svid, NULL);
+        x509svid_SVID_Free(svid);
+
+        // the call is no longer registered, and its slot gets reused
+        ck_assert_int_eq(arrlen(client->calls), 1);
+        ck_assert_ptr_eq(client->calls[0], NULL);
+        ck_assert_int_eq(arrlen(client->free_calls), 1);
+    }
+
+    workloadapi_Client_Close(client);
+    workloadapi_Client_Free(client);
+    delete stub;
+}
+END_TEST
+
 Suite *client_suite(void)
 {
     Suite *s = suite_create("client");
     TCase *tc_core = tcase_create("core");
 
     tcase_add_test(tc_core, test_workloadapi_parseX509Bundles);
+    tcase_add_test(tc_core, test_workloadapi_parseX509Bundles_shared);
     tcase_add_test(tc_core, test_workloadapi_parseX509Context);
     tcase_add_test(tc_core, test_workloadapi_NewClient);
     tcase_add_test(tc_core, test_workloadapi_Client_Connect_uses_stub);
@@ -1077,8 +1503,15 @@ Suite *client_suite(void)
     tcase_add_test(tc_core, test_workloadapi_Client_WatchX509Context);
     tcase_add_test(tc_core, test_workloadapi_Client_WatchJWTBundles);
     tcase_add_test(tc_core, test_workloadapi_Client_FetchX509SVIDs);
+    tcase_add_test(tc_core, test_workloadapi_Client_FetchX509SVID_one_shot);
     tcase_add_test(tc_core, test_workloadapi_Client_FetchJWTSVID);
+    tcase_add_test(tc_core, test_workloadapi_Client_FetchJWTSVID_single_flight);
+    tcase_add_test(tc_core, test_workloadapi_parseJWTSVIDs);
+    tcase_add_test(tc_core, test_workloadapi_Client_FetchJWTSVIDs);
     tcase_add_test(tc_core, test_workloadapi_Client_ValidateJWTSVID);
+    tcase_add_test(tc_core,
+                   test_workloadapi_Client_ValidateJWTSVIDWithBundles);
+    tcase_add_test(tc_core, test_workloadapi_Client_ValidateJWTSVID_claims);
     tcase_add_test(tc_core, test_workloadapi_parseJWTSVID_null_or_empty);
     tcase_add_test(tc_core, test_workloadapi_parseJWTBundles_null_or_empty);
 
@@ -0,0 +1,189 @@
+/**
+ *
+ * (C) Copyright 2020-2021 Hewlett Packard Enterprise Development LP
+ *
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include "c-spiffe/workload/expirymonitor.h"
+#include <check.h>
+
+typedef struct {
+    string_arr_t keys;
+    time_t *expiries;
+} alerts_t;
+
+static void record_alert(const char *key, time_t expiry, void *args)
+{
+    alerts_t *alerts = (alerts_t *) args;
+    arrput(alerts->keys, string_new(key));
+    arrput(alerts->expiries, expiry);
+}
+
+static void alerts_free(alerts_t *alerts)
+{
+    util_string_arr_t_Free(alerts->keys);
+    arrfree(alerts->expiries);
+}
+
+START_TEST(test_workloadapi_NewExpiryMonitor)
+{
+    err_t err = NO_ERROR;
+    workloadapi_ExpiryCallback no_func = { NULL, NULL };
+    ck_assert_ptr_eq(workloadapi_NewExpiryMonitor(0, 0, no_func, &err),
+                     NULL);
+    ck_assert_int_eq(err, ERR_NULL);
+
+    alerts_t alerts = { NULL, NULL };
+    workloadapi_ExpiryCallback callback = { &alerts, record_alert };
+    ck_assert_ptr_eq(workloadapi_NewExpiryMonitor(1.5, 0, callback, &err),
+                     NULL);
+    ck_assert_int_eq(err, ERR_BAD_ARGUMENT);
+
+    workloadapi_ExpiryMonitor *monitor
+        = workloadapi_NewExpiryMonitor(0, 0, callback, &err);
+    ck_assert_int_eq(err, NO_ERROR);
+    ck_assert_ptr_ne(monitor, NULL);
+    ck_assert(monitor->fraction == WORKLOADAPI_EXPIRY_ALERT_FRACTION);
+    ck_assert_int_eq(monitor->tick, 1);
+
+    ck_assert_int_eq(workloadapi_ExpiryMonitor_Start(monitor), NO_ERROR);
+    ck_assert_int_eq(workloadapi_ExpiryMonitor_Start(monitor), ERR_EXISTS);
+    ck_assert_int_eq(workloadapi_ExpiryMonitor_Stop(monitor), NO_ERROR);
+    workloadapi_ExpiryMonitor_Free(monitor);
+}
+END_TEST
+
+START_TEST(test_workloadapi_ExpiryMonitor_Advance)
+{
+    err_t err = NO_ERROR;
+    alerts_t alerts = { NULL, NULL };
+    workloadapi_ExpiryCallback callback = { &alerts, record_alert };
+    workloadapi_ExpiryMonitor *monitor
+        = workloadapi_NewExpiryMonitor(0.5, 1, callback, &err);
+    ck_assert_int_eq(err, NO_ERROR);
+    const time_t now = monitor->current_time;
+
+    // alerts at now + 10 and, past a turn of the wheel, now + 1000
+    workloadapi_ExpiryMonitor_Track(monitor, "spiffe://example.org/a", now,
+                                    now + 20);
+    workloadapi_ExpiryMonitor_Track(monitor, "spiffe://example.org/b", now,
+                                    now + 2000);
+    // already past its alert, reported on the next tick
+    workloadapi_ExpiryMonitor_Track(monitor, "spiffe://example.org/c",
+                                    now - 100, now + 10);
+    ck_assert_uint_eq(workloadapi_ExpiryMonitor_GetStats(monitor).tracked,
+                      3);
+
+    workloadapi_ExpiryMonitor_Advance(monitor, now + 1);
+    ck_assert_uint_eq(arrlenu(alerts.keys), 1);
+    ck_assert_str_eq(alerts.keys[0], "spiffe://example.org/c");
+    ck_assert_int_eq(alerts.expiries[0], now + 10);
+
+    workloadapi_ExpiryMonitor_Advance(monitor, now + 9);
+    ck_assert_uint_eq(arrlenu(alerts.keys), 1);
+    workloadapi_ExpiryMonitor_Advance(monitor, now + 10);
+    ck_assert_uint_eq(arrlenu(alerts.keys), 2);
+    ck_assert_str_eq(alerts.keys[1], "spiffe://example.org/a");
+
+    // resent unchanged, not reported again
+    workloadapi_ExpiryMonitor_Track(monitor, "spiffe://example.org/a", now,
+                                    now + 20);
+    workloadapi_ExpiryMonitor_Advance(monitor, now + 999);
+    ck_assert_uint_eq(arrlenu(alerts.keys), 2);
+    workloadapi_ExpiryMonitor_Advance(monitor, now + 1000);
+    ck_assert_uint_eq(arrlenu(alerts.keys), 3);
+    ck_assert_str_eq(alerts.keys[2], "spiffe://example.org/b");
+
+    workloadapi_ExpiryMonitorStats stats
+        = workloadapi_ExpiryMonitor_GetStats(monitor);
+    ck_assert_uint_eq(stats.tracked, 3);
+    ck_assert_uint_eq(stats.alerts, 3);
+
+    workloadapi_ExpiryMonitor_Free(monitor);
+    alerts_free(&alerts);
+}
+END_TEST
+
+START_TEST(test_workloadapi_ExpiryMonitor_rotation)
+{
+    err_t err = NO_ERROR;
+    alerts_t alerts = { NULL, NULL };
+    workloadapi_ExpiryCallback callback = { &alerts, record_alert };
+    workloadapi_ExpiryMonitor *monitor
+        = workloadapi_NewExpiryMonitor(0.5, 1, callback, &err);
+    const time_t now = monitor->current_time;
+
+    workloadapi_ExpiryMonitor_Track(monitor, "spiffe://example.org/a", now,
+                                    now + 20);
+    workloadapi_ExpiryMonitor_Track(monitor, "spiffe://example.org/b", now,
+                                    now + 20);
+    // rotated before its alert, rescheduled for the new SVID
+    workloadapi_ExpiryMonitor_Track(monitor, "spiffe://example.org/a",
+                                    now + 5, now + 25);
+    // gone, never reported
+    workloadapi_ExpiryMonitor_Untrack(monitor, "spiffe://example.org/b");
+    workloadapi_ExpiryMonitor_Untrack(monitor, "spiffe://example.org/x");
+    ck_assert_uint_eq(workloadapi_ExpiryMonitor_GetStats(monitor).tracked,
+                      1);
+
+    workloadapi_ExpiryMonitor_Advance(monitor, now + 14);
+    ck_assert_uint_eq(arrlenu(alerts.keys), 0);
+    workloadapi_ExpiryMonitor_Advance(monitor, now + 15);
+    ck_assert_uint_eq(arrlenu(alerts.keys), 1);
+    ck_assert_str_eq(alerts.keys[0], "spiffe://example.org/a");
+    ck_assert_int_eq(alerts.expiries[0], now + 25);
+
+    // rotated after its alert, reported again for the new SVID
+    workloadapi_ExpiryMonitor_Track(monitor, "spiffe://example.org/a",
+                                    now + 15, now + 35);
+    workloadapi_ExpiryMonitor_Advance(monitor, now + 25);
+    ck_assert_uint_eq(arrlenu(alerts.keys), 2);
+    ck_assert_int_eq(alerts.expiries[1], now + 35);
+
+    workloadapi_ExpiryMonitor_Free(monitor);
+    alerts_free(&alerts);
+}
+END_TEST
+
+Suite *expirymonitor_suite(void)
+{
+    Suite *s = suite_create("expirymonitor");
+    TCase *tc_core = tcase_create("core");
+    tcase_add_test(tc_core, test_workloadapi_NewExpiryMonitor);
+    tcase_add_test(tc_core, test_workloadapi_ExpiryMonitor_Advance);
+    tcase_add_test(tc_core, test_workloadapi_ExpiryMonitor_rotation);
+
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(int argc, char **argv)
+{
+    Suite *s = expirymonitor_suite();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    const int number_failed = srunner_ntests_failed(sr);
+
+    srunner_free(sr);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -22,6 +22,8 @@
  *
  */
 
+#include "c-spiffe/bundle/jwtbundle/source.h"
+#include "c-spiffe/svid/jwtsvid/parse.h"
 #include "c-spiffe/svid/jwtsvid/svid.h"
 #include "c-spiffe/workload/jwtsource.h"
 #include "c-spiffe/workload/jwtwatcher.h"
@@ -42,7 +44,7 @@ START_TEST(test_workloadapi_NewJWTSource_creates_default_config);
     ck_assert_ptr_eq(tested->config->watcher_config.client_options[0],
                      workloadapi_Client_defaultOptions);
 
-    ck_assert_ptr_eq(tested->bundles, NULL);
+    ck_assert_ptr_eq(atomic_load(&(tested->snapshot)), NULL);
 
     ck_assert_ptr_eq(tested->watcher->jwt_callback.args, tested);
 
@@ -75,7 +77,7 @@ START_TEST(test_workloadapi_NewJWTSource_uses_config);
                      "unix:///var/example_agent");
     ck_assert(tested->closed);
 
-    ck_assert_ptr_eq(tested->bundles, NULL);
+    ck_assert_ptr_eq(atomic_load(&(tested->snapshot)), NULL);
     workloadapi_JWTSource_Free(tested);
 }
 END_TEST
@@ -92,11 +94,82 @@ START_TEST(test_workloadapi_JWTSource_applyJWTBundle_Set);
     jwtbundle_Set_Add(set, bundle);
     workloadapi_JWTSource_applyJWTBundle_Set(tested, set);
 
-    ck_assert_ptr_ne(tested->bundles, set);
-    ck_assert_str_eq(tested->bundles->bundles[0].value->td.name,
-                     set->bundles[0].value->td.name);
+    // the bundles were moved, not copied
+    workloadapi_JWTSnapshot *first = atomic_load(&(tested->snapshot));
+    ck_assert_ptr_ne(first->bundles, set);
+    ck_assert_uint_eq(shlenu(set->bundles), 0);
+    ck_assert_uint_eq(shlenu(first->bundles->bundles), 1);
+    ck_assert_ptr_eq(first->bundles->bundles[0].value, bundle);
+    ck_assert_uint_eq(first->generation, 1);
 
-    tested->bundles = NULL;
+    // a reader holds on to the first snapshot across two updates
+    tested->closed = false;
+    workloadapi_JWTSnapshot *held
+        = workloadapi_JWTSource_AcquireSnapshot(tested, &err);
+    ck_assert_int_eq(err, NO_ERROR);
+    ck_assert_ptr_eq(held, first);
+    ck_assert_int_eq(atomic_load(&(held->refs)), 2);
+
+    workloadapi_JWTSource_applyJWTBundle_Set(tested, set);
+    ck_assert_ptr_ne(atomic_load(&(tested->snapshot)), first);
+    ck_assert_ptr_eq(tested->retired, first);
+    ck_assert_uint_eq(atomic_load(&(tested->snapshot))->generation, 2);
+
+    workloadapi_JWTSource_applyJWTBundle_Set(tested, set);
+    ck_assert_ptr_ne(tested->retired, first);
+
+    // the source let go of it, the reader did not yet
+    ck_assert_int_eq(atomic_load(&(held->refs)), 1);
+    ck_assert_ptr_eq(held->bundles->bundles[0].value, bundle);
+    workloadapi_JWTSnapshot_Release(held);
+
+    tested->closed = true;
+    jwtbundle_Set_Free(set);
+    workloadapi_JWTSource_Free(tested);
+    spiffeid_TrustDomain_Free(&td);
+}
+END_TEST
+
+// a jwtbundle_Source of the source, pinned across two updates, still
+// lends the bundles of the update it was pinned at
+START_TEST(test_jwtbundle_Source_Pin);
+{
+    err_t err;
+    workloadapi_JWTSource *tested = workloadapi_NewJWTSource(NULL, &err);
+    tested->closed = false;
+    jwtbundle_Source source = { .type = JWTBUNDLE_WORKLOADAPI_JWTSOURCE };
+    source.source.source = tested;
+    jwtbundle_Source pinned;
+    workloadapi_JWTSnapshot *snapshot;
+
+    // nothing to pin before the first update
+    ck_assert_ptr_eq(jwtbundle_Source_Pin(&source, &pinned, &snapshot),
+                     &source);
+    ck_assert_ptr_eq(snapshot, NULL);
+
+    jwtbundle_Set *set = jwtbundle_NewSet(0);
+    spiffeid_TrustDomain td
+        = spiffeid_TrustDomainFromString("spiffe://example.com", &err);
+    jwtbundle_Bundle *bundle = jwtbundle_New(td);
+    jwtbundle_Set_Add(set, bundle);
+    workloadapi_JWTSource_applyJWTBundle_Set(tested, set);
+
+    jwtbundle_Source *bundles
+        = jwtbundle_Source_Pin(&source, &pinned, &snapshot);
+    ck_assert_ptr_eq(bundles, &pinned);
+    ck_assert_ptr_eq(snapshot, atomic_load(&(tested->snapshot)));
+    ck_assert_int_eq(pinned.type, JWTBUNDLE_FROZEN_SET);
+
+    workloadapi_JWTSource_applyJWTBundle_Set(tested, set);
+    workloadapi_JWTSource_applyJWTBundle_Set(tested, set);
+    ck_assert_ptr_eq(
+        jwtbundle_Source_GetJWTBundleForTrustDomain(bundles, td, &err),
+        bundle);
+    ck_assert_int_eq(err, NO_ERROR);
+    workloadapi_JWTSnapshot_Release(snapshot);
+
+    tested->closed = true;
+    jwtbundle_Set_Free(set);
     workloadapi_JWTSource_Free(tested);
     spiffeid_TrustDomain_Free(&td);
 }
@@ -133,7 +206,6 @@ START_TEST(test_workloadapi_JWTSource_Start_waits_and_sets_closed_false);
 
     workloadapi_JWTSource_Close(tested);
 
-    tested->bundles = NULL;
     workloadapi_JWTSource_Free(tested);
 }
 END_TEST
@@ -163,7 +235,6 @@ START_TEST(test_workloadapi_JWTSource_Closes_watcher);
     ck_assert_int_eq(workloadapi_JWTSource_checkClosed(tested), ERR_CLOSED);
     ck_assert(tested->watcher->closed);
 
-    tested->bundles = NULL;
     workloadapi_JWTSource_Free(tested);
 }
 END_TEST
@@ -181,6 +252,155 @@ START_TEST(test_workloadapi_JWTSource_GetJWTSVID_fails_if_closed);
 }
 END_TEST
 
+START_TEST(test_workloadapi_JWTSource_GetJWTSVID_uses_cache);
+{
+    err_t err;
+    workloadapi_JWTSource *tested = workloadapi_NewJWTSource(NULL, &err);
+    workloadapi_JWTSVIDCacheStats stats
+        = workloadapi_JWTSource_GetJWTSVIDCacheStats(tested);
+    ck_assert_uint_eq(stats.hits, 0);
+    ck_assert_uint_eq(stats.misses, 0);
+
+    char token[]
+        = "eyJhbGciOiJSUzI1NiIsInR5cCI6IkpXVCIsImtpZCI6ImZmM2M1Yzk2LTM5MmUtND"
+          "ZlZi1hODM5LTZmZjE2MDI3YWY3OCJ9."
+          "eyJzdWIiOiJzcGlmZmU6Ly9leGFtcGxlLmNvbS93b3JrbG9hZDEiLCJuYW1lIjoiSm"
+          "9obiBEb2UiLCJpYXQiOjE1MTYyMzkwMjIsImV4cCI6OTk5MDAwMDAwMH0."
+          "GaVfjoPAKmc991DEl-Su5uYNvzYMBn2mzTxbWsQjVowNBVa4M6m91no7zX0l0pGBN3"
+          "1kP1xT3MwUae5JZGajx_J05HzvkHJrF9VoFj7iJncHYQjz_"
+          "IlEXDL8smNRzazIES9PD3Zq39D0pt9PdCLDDZRoKRPyTC9LzpUoa0nVvXWGIECwH0D"
+          "RnKks_HFVIlrIkV8PVIE-A8wl3QiC9TRdvnav4DGlYlO3y3Bz3oGN2y-iBD8yBNhdw"
+          "9Dkmw0T-lQq01wUJRR84GXblBoB9TL3aIxVpJnfDADoDy4iD0kZ-"
+          "ne0v5W62tSEx8mT0dvBEwE8PWm0xCKR2uxM2jlICKADIw";
+    jwtsvid_SVID *svid = jwtsvid_ParseInsecure(token, NULL, &err);
+    ck_assert_int_eq(err, NO_ERROR);
+
+    jwtsvid_Params params
+        = { .audience = string_new("spiffe://example.org/audience1"),
+            .extra_audiences = NULL,
+            .subject
+            = spiffeid_FromString("spiffe://example.com/workload1", &err) };
+    arrput(params.extra_audiences,
+           string_new("spiffe://example.org/audience2"));
+    workloadapi_JWTSource_cacheJWTSVID(tested, &params, svid);
+    ck_assert_uint_eq(shlenu(tested->svid_cache), 1);
+    // its expiry is watched
+    ck_assert_uint_eq(workloadapi_JWTSource_GetExpiryStats(tested).tracked,
+                      1);
+
+    // same audience set, in a different order and with duplicates
+    jwtsvid_Params params2 = { .audience = params.extra_audiences[0],
+                               .extra_audiences = NULL,
+                               .subject = params.subject };
+    arrput(params2.extra_audiences, params.audience);
+    arrput(params2.extra_audiences, params.audience);
+
+    tested->closed = false;
+    jwtsvid_SVID *cached
+        = workloadapi_JWTSource_GetJWTSVID(tested, &params2, &err);
+
+    ck_assert_int_eq(err, NO_ERROR);
+    ck_assert_ptr_ne(cached, NULL);
+    ck_assert_ptr_ne(cached, svid);
+    ck_assert_str_eq(cached->token, svid->token);
+    ck_assert_str_eq(cached->id.path, "/workload1");
+    ck_assert_int_eq(cached->expiry, 9990000000);
+    ck_assert_uint_eq(shlenu(jwtsvid_SVID_GetClaims(cached)),
+                      shlenu(jwtsvid_SVID_GetClaims(svid)));
+    // params are left untouched
+    ck_assert_ptr_eq(params2.audience, params.extra_audiences[0]);
+    ck_assert_uint_eq(arrlenu(params2.extra_audiences), 2);
+
+    stats = workloadapi_JWTSource_GetJWTSVIDCacheStats(tested);
+    ck_assert_uint_eq(stats.hits, 1);
+    ck_assert_uint_eq(stats.misses, 0);
+    ck_assert_uint_eq(stats.evictions, 0);
+
+    jwtsvid_SVID_Free(cached);
+    arrfree(params2.extra_audiences);
+    tested->closed = true;
+    workloadapi_JWTSource_Free(tested);
+    util_string_t_Free(params.audience);
+    util_string_arr_t_Free(params.extra_audiences);
+    spiffeid_ID_Free(&(params.subject));
+}
+END_TEST
+
+START_TEST(test_workloadapi_JWTSource_refreshes_used_JWTSVIDs_only);
+{
+    err_t err;
+    workloadapi_JWTSourceConfig *config = calloc(1, sizeof(*config));
+    config->svid_cache_entries = 1;
+    workloadapi_JWTSource *tested = workloadapi_NewJWTSource(config, &err);
+    ck_assert_int_eq(err, NO_ERROR);
+
+    char token[]
+        = "eyJhbGciOiJSUzI1NiIsInR5cCI6IkpXVCIsImtpZCI6ImZmM2M1Yzk2LTM5MmUtND"
+          "ZlZi1hODM5LTZmZjE2MDI3YWY3OCJ9."
+          "eyJzdWIiOiJzcGlmZmU6Ly9leGFtcGxlLmNvbS93b3JrbG9hZDEiLCJuYW1lIjoiSm"
+          "9obiBEb2UiLCJpYXQiOjE1MTYyMzkwMjIsImV4cCI6OTk5MDAwMDAwMH0."
+          "GaVfjoPAKmc991DEl-Su5uYNvzYMBn2mzTxbWsQjVowNBVa4M6m91no7zX0l0pGBN3"
+          "1kP1xT3MwUae5JZGajx_J05HzvkHJrF9VoFj7iJncHYQjz_"
+          "IlEXDL8smNRzazIES9PD3Zq39D0pt9PdCLDDZRoKRPyTC9LzpUoa0nVvXWGIECwH0D"
+          "RnKks_HFVIlrIkV8PVIE-A8wl3QiC9TRdvnav4DGlYlO3y3Bz3oGN2y-iBD8yBNhdw"
+          "9Dkmw0T-lQq01wUJRR84GXblBoB9TL3aIxVpJnfDADoDy4iD0kZ-"
+          "ne0v5W62tSEx8mT0dvBEwE8PWm0xCKR2uxM2jlICKADIw";
+    jwtsvid_SVID *svid = jwtsvid_ParseInsecure(token, NULL, &err);
+    ck_assert_int_eq(err, NO_ERROR);
+
+    jwtsvid_Params params
+        = { .audience = string_new("spiffe://example.org/audience1"),
+            .extra_audiences = NULL,
+            .subject
+            = spiffeid_FromString("spiffe://example.com/workload1", &err) };
+    workloadapi_JWTSource_cacheJWTSVID(tested, &params, svid);
+    ck_assert_uint_eq(shlenu(tested->svid_cache), 1);
+    const time_t now = time(NULL);
+    tested->svid_cache[0].value->refresh_at = now;
+
+    // due, but nobody asked for it since it was fetched
+    time_t next;
+    jwtsvid_Params *due = workloadapi_JWTSource_dueJWTSVIDs(tested, now, &next);
+    ck_assert_uint_eq(arrlenu(due), 0);
+    // it waits for the expiry instead of spinning on the past deadline
+    ck_assert_int_gt(next, now);
+    ck_assert_uint_eq(shlenu(tested->svid_cache), 1);
+
+    tested->closed = false;
+    jwtsvid_SVID *cached
+        = workloadapi_JWTSource_GetJWTSVID(tested, &params, &err);
+    ck_assert_int_eq(err, NO_ERROR);
+    jwtsvid_SVID_Free(cached);
+
+    due = workloadapi_JWTSource_dueJWTSVIDs(tested, now, &next);
+    ck_assert_uint_eq(arrlenu(due), 1);
+    ck_assert_str_eq(due[0].audience, params.audience);
+    for(size_t i = 0, size = arrlenu(due); i < size; ++i) {
+        util_string_t_Free(due[i].audience);
+        util_string_arr_t_Free(due[i].extra_audiences);
+        spiffeid_ID_Free(&(due[i].subject));
+    }
+    arrfree(due);
+
+    // a second key makes room by dropping the first one
+    jwtsvid_Params params2 = params;
+    params2.audience = "spiffe://example.org/audience2";
+    svid = jwtsvid_ParseInsecure(token, NULL, &err);
+    workloadapi_JWTSource_cacheJWTSVID(tested, &params2, svid);
+    ck_assert_uint_eq(shlenu(tested->svid_cache), 1);
+    ck_assert_str_eq(tested->svid_cache[0].value->params.audience,
+                     params2.audience);
+    workloadapi_JWTSVIDCacheStats stats
+        = workloadapi_JWTSource_GetJWTSVIDCacheStats(tested);
+    ck_assert_uint_eq(stats.evictions, 1);
+
+    tested->closed = true;
+    workloadapi_JWTSource_Free(tested);
+    util_string_t_Free(params.audience);
+    spiffeid_ID_Free(&(params.subject));
+}
+END_TEST
+
 START_TEST(test_workloadapi_JWTSource_GetJWTBundleForTrustDomain);
 {
     err_t err;
@@ -195,20 +415,79 @@ START_TEST(test_workloadapi_JWTSource_GetJWTBundleForTrustDomain);
     ck_assert_int_eq(err, ERR_CLOSED); // source closed
 
     tested->closed = false;
-    tested->bundles = jwtbundle_NewSet(0);
+    bundle
+        = workloadapi_JWTSource_GetJWTBundleForTrustDomain(tested, td, &err);
+
+    ck_assert_ptr_eq(bundle, NULL);
+    ck_assert_int_eq(err, ERR_INVALID_TRUSTDOMAIN); // no update yet
+
+    jwtbundle_Set *set = jwtbundle_NewSet(0);
+    workloadapi_JWTSource_applyJWTBundle_Set(tested, set);
     bundle
         = workloadapi_JWTSource_GetJWTBundleForTrustDomain(tested, td, &err);
 
     ck_assert_ptr_eq(bundle, NULL);
     ck_assert_int_eq(err, ERR_INVALID_TRUSTDOMAIN); // trust domain not available
 
-    jwtbundle_Set_Free(tested->bundles);
-    tested->bundles = NULL;
+    jwtbundle_Set_Free(set);
     tested->closed = true;
     workloadapi_JWTSource_Free(tested);
 }
 END_TEST
 
+// records the generation of the snapshot it is called with
+void record_jwt_generation(workloadapi_JWTSnapshot *snapshot, void *args)
+{
+    uint64_t **generations = (uint64_t **) args;
+    arrput(*generations, snapshot->generation);
+}
+
+START_TEST(test_workloadapi_JWTSource_Subscribe);
+{
+    err_t err;
+    workloadapi_JWTSource *tested = workloadapi_NewJWTSource(NULL, &err);
+    jwtbundle_Set *set = jwtbundle_NewSet(0);
+    uint64_t *first = NULL, *second = NULL;
+
+    workloadapi_JWTSnapshotCallback callback
+        = { .args = &first, .func = record_jwt_generation };
+    const int first_id
+        = workloadapi_JWTSource_Subscribe(tested, callback, &err);
+    ck_assert_int_eq(err, NO_ERROR);
+    callback.args = &second;
+    const int second_id
+        = workloadapi_JWTSource_Subscribe(tested, callback, &err);
+    ck_assert_int_eq(err, NO_ERROR);
+    ck_assert_int_ne(first_id, second_id);
+
+    // both are called with the published snapshot
+    workloadapi_JWTSource_applyJWTBundle_Set(tested, set);
+    ck_assert_uint_eq(arrlenu(first), 1);
+    ck_assert_uint_eq(first[0], 1);
+    ck_assert_uint_eq(arrlenu(second), 1);
+    ck_assert_uint_eq(second[0], 1);
+
+    ck_assert_int_eq(workloadapi_JWTSource_Unsubscribe(tested, first_id),
+                     NO_ERROR);
+    ck_assert_int_eq(workloadapi_JWTSource_Unsubscribe(tested, first_id),
+                     ERR_NOT_FOUND);
+
+    workloadapi_JWTSource_applyJWTBundle_Set(tested, set);
+    ck_assert_uint_eq(arrlenu(first), 1);
+    ck_assert_uint_eq(arrlenu(second), 2);
+    ck_assert_uint_eq(second[1], 2);
+
+    callback.func = NULL;
+    workloadapi_JWTSource_Subscribe(tested, callback, &err);
+    ck_assert_int_eq(err, ERR_NULL);
+
+    arrfree(first);
+    arrfree(second);
+    jwtbundle_Set_Free(set);
+    workloadapi_JWTSource_Free(tested);
+}
+END_TEST
+
 Suite *watcher_suite(void)
 {
     Suite *s = suite_create("jwtsource");
@@ -218,11 +497,17 @@ Suite *watcher_suite(void)
                    test_workloadapi_NewJWTSource_creates_default_config);
     tcase_add_test(tc_core, test_workloadapi_NewJWTSource_uses_config);
     tcase_add_test(tc_core, test_workloadapi_JWTSource_applyJWTBundle_Set);
+    tcase_add_test(tc_core, test_jwtbundle_Source_Pin);
+    tcase_add_test(tc_core, test_workloadapi_JWTSource_Subscribe);
     tcase_add_test(
         tc_core, test_workloadapi_JWTSource_Start_waits_and_sets_closed_false);
     tcase_add_test(tc_core, test_workloadapi_JWTSource_Closes_watcher);
     tcase_add_test(tc_core,
                    test_workloadapi_JWTSource_GetJWTSVID_fails_if_closed);
+    tcase_add_test(tc_core,
+                   test_workloadapi_JWTSource_GetJWTSVID_uses_cache);
+    tcase_add_test(tc_core,
+                   test_workloadapi_JWTSource_refreshes_used_JWTSVIDs_only);
     tcase_add_test(tc_core,
                    test_workloadapi_JWTSource_GetJWTBundleForTrustDomain);
 
@@ -25,6 +25,7 @@
 #include "c-spiffe/workload/jwtcallback.h"
 #include "c-spiffe/workload/jwtwatcher.h"
 #include <check.h>
+#include <poll.h>
 
 // callback that sets an int to a value, and ignores the context.
 void set_int_callback(jwtbundle_Set *bundle_set, void *_args)
@@ -62,6 +63,8 @@ START_TEST(test_workloadapi_JWTWatcher_callback_is_called_on_update_once)
     workloadapi_JWTWatcher *watcher
         = (workloadapi_JWTWatcher *) calloc(1, sizeof *watcher);
     watcher->jwt_callback = callback;
+    // no update descriptor, calloc leaves it at 0
+    watcher->update_fd = -1;
 
     // call update -> toModify = 10
     workloadapi_JWTWatcher_OnJWTBundlesUpdate(watcher, NULL);
@@ -403,6 +406,49 @@ START_TEST(test_workloadapi_JWTWatcher_Close);
 }
 END_TEST
 
+START_TEST(test_workloadapi_JWTWatcher_update_fd)
+{
+    // empty but valid callback object
+    workloadapi_JWTCallback callback;
+    callback.func = empty_callback;
+    callback.args = NULL;
+
+    // empty but valid watcher config
+    workloadapi_JWTWatcherConfig config;
+    config.client = NULL;
+    config.client_options = NULL;
+
+    err_t error = NO_ERROR;
+    workloadapi_JWTWatcher *watcher
+        = workloadapi_newJWTWatcher(config, callback, &error);
+    ck_assert_uint_eq(error, NO_ERROR);
+
+    struct pollfd pfd = { .fd = workloadapi_JWTWatcher_GetUpdateFd(watcher),
+                          .events = POLLIN };
+    ck_assert_int_ge(pfd.fd, 0);
+    ck_assert_uint_eq(workloadapi_JWTWatcher_GetGeneration(watcher), 0);
+    // not readable before the first update
+    ck_assert_int_eq(poll(&pfd, 1, 0), 0);
+
+    // two updates before the poller gets to run
+    workloadapi_JWTWatcher_TriggerUpdated(watcher);
+    workloadapi_JWTWatcher_TriggerUpdated(watcher);
+    ck_assert_int_eq(poll(&pfd, 1, 0), 1);
+    ck_assert(pfd.revents & POLLIN);
+
+    ck_assert_uint_eq(workloadapi_JWTWatcher_ClearUpdateFd(watcher), 2);
+    ck_assert_int_eq(poll(&pfd, 1, 0), 0);
+    // clearing again is harmless
+    ck_assert_uint_eq(workloadapi_JWTWatcher_ClearUpdateFd(watcher), 2);
+
+    workloadapi_JWTWatcher_TriggerUpdated(watcher);
+    ck_assert_int_eq(poll(&pfd, 1, 0), 1);
+    ck_assert_uint_eq(workloadapi_JWTWatcher_ClearUpdateFd(watcher), 3);
+
+    workloadapi_JWTWatcher_Free(watcher);
+}
+END_TEST
+
 Suite *watcher_suite(void)
 {
     Suite *s = suite_create("jwt_watcher");
@@ -421,6 +467,7 @@ Suite *watcher_suite(void)
                    test_workloadapi_JWTWatcher_WaitUntilUpdated_blocks);
     tcase_add_test(tc_core, test_workloadapi_JWTWatcher_Start_blocks);
     tcase_add_test(tc_core, test_workloadapi_JWTWatcher_Close);
+    tcase_add_test(tc_core, test_workloadapi_JWTWatcher_update_fd);
 
     suite_add_tcase(s, tc_core);
 
@@ -25,6 +25,7 @@
 #include <check.h>
 #include <openssl/pem.h>
 #include <stdlib.h>
+#include <threads.h>
 
 #include "c-spiffe/svid/jwtsvid/parse.h"
 #include "c-spiffe/svid/jwtsvid/svid.h"
@@ -34,7 +35,9 @@ void test_fields_verify(jwtsvid_SVID *svid, err_t err, char *token)
 {
     ck_assert_uint_eq(err, NO_ERROR);
     ck_assert_ptr_eq(svid->audience, NULL);
-    ck_assert_ptr_ne(svid->claims, NULL);
+    // built on demand
+    ck_assert_ptr_eq(svid->claims, NULL);
+    ck_assert_ptr_ne(jwtsvid_SVID_GetClaims(svid), NULL);
     ck_assert_uint_eq(shlenu(svid->claims), 4);
     ck_assert_int_ge(shgeti(svid->claims, "sub"), 0);
     ck_assert_int_ge(shgeti(svid->claims, "name"), 0);
@@ -75,7 +78,7 @@ START_TEST(test_jwtsvid_parse)
 
     ck_assert_uint_eq(err, NO_ERROR);
     ck_assert_ptr_eq(svid->audience, NULL);
-    ck_assert_ptr_ne(svid->claims, NULL);
+    ck_assert_ptr_eq(svid->claims, NULL);
     ck_assert_int_eq(svid->expiry, 9990000000);
     ck_assert_ptr_ne(svid->id.path, NULL);
     ck_assert_str_eq(svid->id.path, "/workload1");
@@ -225,6 +228,47 @@ START_TEST(test_jwtsvid_error_invalid_signature)
 }
 END_TEST
 
+// precondition: valid jwt token, signed by a key the bundles do not have
+// postcondition: ERR_NOAUTHORITY for an unknown key id and ERR_NOT_FOUND
+// for an unknown trust domain, so callers can look for the key elsewhere
+START_TEST(test_jwtsvid_error_unknown_key)
+{
+    FILE *f = fopen("./resources/ec-secp256k1-priv-key.pem", "r");
+    ck_assert_ptr_ne(f, NULL);
+    EVP_PKEY *pkey = PEM_read_PrivateKey(f, NULL, NULL, NULL);
+    fclose(f);
+
+    char token[] = "eyJhbGciOiJFUzI1NiIsInR5cCI6IkpXVCIsImtpZCI6ImZmM2M1Yzk2LT"
+                   "M5MmUtNDZlZi1hODM5LTZmZjE2MDI3YWY3OCJ9."
+                   "eyJzdWIiOiJzcGlmZmU6Ly9leGFtcGxlLmNvbS93b3JrbG9hZDEiLCJuYW"
+                   "1lIjoiSm9obiBEb2UiLCJpYXQiOjE1MTYyMzkwMjIsImV4cCI6OTk5MDAw"
+                   "MDAwMH0.z-azwJt3UzuaL1x0g-"
+                   "pGbQOnXXYphAUeBMV3FlVtS53gBBsWLaWWGaJPcLTRdZ50TPTTxh3xlPyv"
+                   "P5H-YTP_kQ";
+
+    spiffeid_TrustDomain td = { "example.com" };
+    jwtbundle_Bundle *bundle = jwtbundle_New(td);
+    err_t err = jwtbundle_Bundle_AddJWTAuthority(bundle, "rotated-key", pkey);
+    ck_assert_uint_eq(err, NO_ERROR);
+
+    jwtbundle_Source *source = jwtbundle_SourceFromBundle(bundle);
+    jwtsvid_SVID *svid = jwtsvid_ParseAndValidate(token, source, NULL, &err);
+    ck_assert_uint_eq(err, ERR_NOAUTHORITY);
+    ck_assert_ptr_eq(svid, NULL);
+    jwtbundle_Source_Free(source);
+
+    spiffeid_TrustDomain td2 = { "example.org" };
+    bundle = jwtbundle_New(td2);
+    source = jwtbundle_SourceFromBundle(bundle);
+    svid = jwtsvid_ParseAndValidate(token, source, NULL, &err);
+    ck_assert_uint_eq(err, ERR_NOT_FOUND);
+    ck_assert_ptr_eq(svid, NULL);
+    jwtbundle_Source_Free(source);
+
+    EVP_PKEY_free(pkey);
+}
+END_TEST
+
 // precondition: invalid jwt token with subject not spifeeid
 // postcondition: invalid jwt svid corresponding to the
 // token with subject not spiffeeid
@@ -288,6 +332,152 @@ START_TEST(test_jwtsvid_error_issuer_jti_aud)
 }
 END_TEST
 
+// precondition: valid jwt token followed by other bytes, read only
+// postcondition: valid jwt svid for the token bytes only
+START_TEST(test_jwtsvid_parseView)
+{
+    const char buffer[]
+        = "eyJhbGciOiJSUzI1NiIsInR5cCI6IkpXVCIsImtpZCI6ImZmM2M1Yzk2LT"
+          "M5MmUtNDZlZi1hODM5LTZmZjE2MDI3YWY3OCJ9."
+          "eyJzdWIiOiJzcGlmZmU6Ly9leGFtcGxlLmNvbS93b3JrbG9hZDEiLCJuYW"
+          "1lIjoiSm9obiBEb2UiLCJpYXQiOjE1MTYyMzkwMjIsImV4cCI6OTk5MDAw"
+          "MDAwMH0.dkXaAoLz9E54JGwgW5stxOF9oi79ineUVrsjllNjfKtOV_GN-"
+          "S6V9VutS6uQuC5ncqyeUOh8TczPoJpJbVRcGatGuapVdGVTlYWd0_"
+          "dWyhE3nre2D5YqJYI4HaSy6-fz-"
+          "5q5b7eo4e5UvdIwqoXv8yAViddD3x9nafx3oifDTeEJ2k0xQPuHIf60rnW"
+          "1sQuIP8210GNKlmQT5H07dT7yOXm8RabmQ5arO6LY0bsy0gRQzimF6J3Sy"
+          "rOB7qrf4tVj4_1G-d-_vYe8dHmQsYOe3-AwZfTAfCKZYARiUm4tO8-"
+          "t1ur7Oy14SlM79FQExohAPzbAPJ02_Zg-9s6DknmNDg, Bearer next";
+    const size_t len = strchr(buffer, ',') - buffer;
+
+    err_t err;
+    jwtsvid_SVID *svid
+        = jwtsvid_parseView(buffer, len, NULL, NULL, NULL, &err);
+
+    ck_assert_uint_eq(err, NO_ERROR);
+    ck_assert_str_eq(svid->id.path, "/workload1");
+    ck_assert_uint_eq(strlen(svid->token), len);
+    ck_assert(!strncmp(svid->token, buffer, len));
+
+    jwtsvid_SVID_Free(svid);
+}
+END_TEST
+
+// precondition: tokens missing parts
+// postcondition: parsing error
+START_TEST(test_jwtsvid_error_missing_parts)
+{
+    const char *tokens[] = { "", "header", ".payload", "header.",
+                             "eyJhIjoxfQ.eyJhIjoxfQ",
+                             "eyJhIjoxfQ.eyJhIjoxfQ." };
+    for(size_t i = 0; i < sizeof tokens / sizeof *tokens; ++i) {
+        err_t err;
+        jwtsvid_SVID *svid = jwtsvid_ParseInsecure(tokens[i], NULL, &err);
+        ck_assert_uint_eq(err, ERR_PARSING);
+        ck_assert_ptr_eq(svid, NULL);
+    }
+}
+END_TEST
+
+// precondition: valid jwt token with escaped strings and private claims
+// postcondition: registered claims unescaped, private claims parsed when
+// requested
+START_TEST(test_jwtsvid_SVID_GetClaims)
+{
+    const char token[]
+        = "eyJhbGciOiJFUzI1NiIsInR5cCI6IkpXVCJ9."
+          "eyJzdWIiOiJzcGlmZmU6XC9cL2V4YW1wbGUuY29tXC93XHUwMDZmcmtsb2FkMSIsIm"
+          "F1ZCI6WyJhdWQxIiw3LCJhdWQyIl0sImV4cCI6OTk5MDAwMDAwMCwiZXh0Ijp7Im4i"
+          "OlsxLjUsLTJlMyx7IngiOm51bGx9XSwidCI6dHJ1ZX19.c2ln";
+    string_arr_t audience = NULL;
+    arrput(audience, "aud2");
+
+    err_t err;
+    jwtsvid_SVID *svid = jwtsvid_ParseInsecure(token, audience, &err);
+
+    ck_assert_uint_eq(err, NO_ERROR);
+    ck_assert_str_eq(svid->id.td.name, "example.com");
+    ck_assert_str_eq(svid->id.path, "/workload1");
+    ck_assert_uint_eq(arrlenu(svid->audience), 2);
+    ck_assert_str_eq(svid->audience[0], "aud1");
+    ck_assert_str_eq(svid->audience[1], "aud2");
+    ck_assert_ptr_eq(svid->claims, NULL);
+
+    // a clone builds its own
+    jwtsvid_SVID *clone = jwtsvid_SVID_Clone(svid);
+    ck_assert_ptr_eq(clone->claims, NULL);
+
+    map_string_claim *claims = jwtsvid_SVID_GetClaims(svid);
+    ck_assert_ptr_ne(claims, NULL);
+    ck_assert_ptr_eq(jwtsvid_SVID_GetClaims(svid), claims);
+    ck_assert_uint_eq(shlenu(claims), 4);
+    json_t *ext = shget(claims, "ext");
+    ck_assert(json_is_object(ext));
+    ck_assert(json_is_true(json_object_get(ext, "t")));
+
+    ck_assert_uint_eq(shlenu(jwtsvid_SVID_GetClaims(clone)), 4);
+    ck_assert_str_eq(json_string_value(shget(clone->claims, "sub")),
+                     "spiffe://example.com/workload1");
+
+    jwtsvid_SVID_Free(clone);
+    jwtsvid_SVID_Free(svid);
+    arrfree(audience);
+}
+END_TEST
+
+static int get_claims(void *arg)
+{
+    return jwtsvid_SVID_GetClaims((jwtsvid_SVID *) arg) != NULL;
+}
+
+// precondition: JWT-SVID whose claims were not built
+// postcondition: concurrent callers all get the single map built, and an
+// empty one is not built again
+START_TEST(test_jwtsvid_SVID_GetClaims_once)
+{
+    const char token[]
+        = "eyJhbGciOiJFUzI1NiIsInR5cCI6IkpXVCJ9."
+          "eyJzdWIiOiJzcGlmZmU6XC9cL2V4YW1wbGUuY29tXC93XHUwMDZmcmtsb2FkMSIsIm"
+          "F1ZCI6WyJhdWQxIiw3LCJhdWQyIl0sImV4cCI6OTk5MDAwMDAwMCwiZXh0Ijp7Im4i"
+          "OlsxLjUsLTJlMyx7IngiOm51bGx9XSwidCI6dHJ1ZX19.c2ln";
+    err_t err;
+    jwtsvid_SVID *svid = jwtsvid_ParseInsecure(token, NULL, &err);
+    ck_assert_uint_eq(err, NO_ERROR);
+
+    thrd_t threads[8];
+    for(int i = 0; i < 8; ++i) {
+        ck_assert_int_eq(thrd_create(&threads[i], get_claims, svid),
+                         thrd_success);
+    }
+    for(int i = 0; i < 8; ++i) {
+        int res = 0;
+        thrd_join(threads[i], &res);
+        ck_assert_int_eq(res, 1);
+    }
+    ck_assert_int_eq(atomic_load(&(svid->claims_state)),
+                     JWTSVID_CLAIMS_BUILT);
+    ck_assert_uint_eq(shlenu(svid->claims), 4);
+
+    // payload "{}": built once, into an empty map
+    jwtsvid_SVID *empty = jwtsvid_SVID_Clone(svid);
+    arrfree(empty->token);
+    empty->token = string_new("e30.e30.c2ln");
+    for(size_t i = 0, size = shlenu(empty->claims); i < size; ++i) {
+        json_decref(empty->claims[i].value);
+    }
+    shfree(empty->claims);
+    atomic_store(&(empty->claims_state), JWTSVID_CLAIMS_PENDING);
+
+    map_string_claim *claims = jwtsvid_SVID_GetClaims(empty);
+    ck_assert_ptr_ne(claims, NULL);
+    ck_assert_uint_eq(shlenu(claims), 0);
+    ck_assert_ptr_eq(jwtsvid_SVID_GetClaims(empty), claims);
+
+    jwtsvid_SVID_Free(empty);
+    jwtsvid_SVID_Free(svid);
+}
+END_TEST
+
 Suite *svid_suite(void)
 {
     Suite *s = suite_create("svid");
@@ -298,9 +488,14 @@ Suite *svid_suite(void)
     tcase_add_test(tc_core, test_jwtsvid_ParseAndValidate);
     tcase_add_test(tc_core, test_jwtsvid_EC);
     tcase_add_test(tc_core, test_jwtsvid_error_invalid_signature);
+    tcase_add_test(tc_core, test_jwtsvid_error_unknown_key);
     tcase_add_test(tc_core, test_jwtsvid_error_subject_not_spiffeid);
     tcase_add_test(tc_core, test_jwtsvid_error_without_exp);
     tcase_add_test(tc_core, test_jwtsvid_error_issuer_jti_aud);
+    tcase_add_test(tc_core, test_jwtsvid_parseView);
+    tcase_add_test(tc_core, test_jwtsvid_error_missing_parts);
+    tcase_add_test(tc_core, test_jwtsvid_SVID_GetClaims);
+    tcase_add_test(tc_core, test_jwtsvid_SVID_GetClaims_once);
 
     suite_add_tcase(s, tc_core);
 
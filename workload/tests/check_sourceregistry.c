@@ -0,0 +1,156 @@
+/**
+ *
+ * (C) Copyright 2020-2021 Hewlett Packard Enterprise Development LP
+ *
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include "c-spiffe/workload/sourceregistry.h"
+#include <check.h>
+
+START_TEST(test_workloadapi_AcquireX509Source_shares_by_address)
+{
+    err_t err = NO_ERROR;
+    workloadapi_X509Source *source1
+        = workloadapi_AcquireX509Source(NULL, &err);
+    ck_assert_int_eq(err, NO_ERROR);
+    ck_assert_ptr_ne(source1, NULL);
+    ck_assert_str_eq(source1->watcher->client->address,
+                     WORKLOADAPI_DEFAULT_ADDRESS);
+
+    // same address, same source
+    workloadapi_X509Source *source2
+        = workloadapi_AcquireX509Source(WORKLOADAPI_DEFAULT_ADDRESS, &err);
+    ck_assert_int_eq(err, NO_ERROR);
+    ck_assert_ptr_eq(source2, source1);
+
+    // other address, other source
+    workloadapi_X509Source *source3
+        = workloadapi_AcquireX509Source("unix:///var/example_agent", &err);
+    ck_assert_int_eq(err, NO_ERROR);
+    ck_assert_ptr_ne(source3, source1);
+    ck_assert_str_eq(source3->watcher->client->address,
+                     "unix:///var/example_agent");
+
+    workloadapi_ReleaseX509Source(source1);
+    // still referenced by the second caller
+    workloadapi_X509Source *source4
+        = workloadapi_AcquireX509Source(NULL, &err);
+    ck_assert_ptr_eq(source4, source1);
+
+    workloadapi_ReleaseX509Source(source2);
+    workloadapi_ReleaseX509Source(source4);
+    workloadapi_ReleaseX509Source(source3);
+    workloadapi_ReleaseX509Source(NULL);
+}
+END_TEST
+
+START_TEST(test_workloadapi_AcquireJWTSource_shares_by_address)
+{
+    err_t err = NO_ERROR;
+    workloadapi_JWTSource *source1 = workloadapi_AcquireJWTSource(NULL, &err);
+    ck_assert_int_eq(err, NO_ERROR);
+    ck_assert_ptr_ne(source1, NULL);
+    ck_assert_str_eq(source1->watcher->client->address,
+                     WORKLOADAPI_DEFAULT_ADDRESS);
+
+    workloadapi_JWTSource *source2
+        = workloadapi_AcquireJWTSource(WORKLOADAPI_DEFAULT_ADDRESS, &err);
+    ck_assert_int_eq(err, NO_ERROR);
+    ck_assert_ptr_eq(source2, source1);
+
+    workloadapi_JWTSource *source3
+        = workloadapi_AcquireJWTSource("unix:///var/example_agent", &err);
+    ck_assert_int_eq(err, NO_ERROR);
+    ck_assert_ptr_ne(source3, source1);
+
+    workloadapi_ReleaseJWTSource(source1);
+    workloadapi_ReleaseJWTSource(source2);
+    workloadapi_ReleaseJWTSource(source3);
+    workloadapi_ReleaseJWTSource(NULL);
+}
+END_TEST
+
+START_TEST(test_workloadapi_WaitUntilReady)
+{
+    err_t err = NO_ERROR;
+    workloadapi_X509Source *x509source = workloadapi_NewX509Source(NULL, &err);
+    workloadapi_JWTSource *jwtsource = workloadapi_NewJWTSource(NULL, &err);
+    workloadapi_X509Source **x509sources = NULL;
+    workloadapi_JWTSource **jwtsources = NULL;
+    arrput(x509sources, x509source);
+    arrput(jwtsources, jwtsource);
+
+    // nothing to wait for
+    ck_assert_int_eq(workloadapi_WaitUntilReady(NULL, NULL, NULL), NO_ERROR);
+    // not started, never ready
+    ck_assert_int_eq(workloadapi_WaitUntilReady(x509sources, jwtsources, NULL),
+                     ERR_CLOSED);
+
+    x509source->closed = false;
+    jwtsource->closed = false;
+    workloadapi_Watcher_TriggerUpdated(x509source->watcher);
+    struct timespec deadline;
+    timespec_get(&deadline, TIME_UTC);
+    deadline.tv_sec += 1;
+    ck_assert_int_eq(
+        workloadapi_WaitUntilReady(x509sources, jwtsources, &deadline),
+        ERR_TIMEOUT);
+
+    workloadapi_JWTWatcher_TriggerUpdated(jwtsource->watcher);
+    ck_assert_int_eq(
+        workloadapi_WaitUntilReady(x509sources, jwtsources, &deadline),
+        NO_ERROR);
+
+    x509source->closed = true;
+    jwtsource->closed = true;
+    arrfree(x509sources);
+    arrfree(jwtsources);
+    workloadapi_X509Source_Free(x509source);
+    workloadapi_JWTSource_Free(jwtsource);
+}
+END_TEST
+
+Suite *sourceregistry_suite(void)
+{
+    Suite *s = suite_create("sourceregistry");
+    TCase *tc_core = tcase_create("core");
+    tcase_add_test(tc_core,
+                   test_workloadapi_AcquireX509Source_shares_by_address);
+    tcase_add_test(tc_core,
+                   test_workloadapi_AcquireJWTSource_shares_by_address);
+    tcase_add_test(tc_core, test_workloadapi_WaitUntilReady);
+
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(int argc, char **argv)
+{
+    Suite *s = sourceregistry_suite();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    const int number_failed = srunner_ntests_failed(sr);
+
+    srunner_free(sr);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
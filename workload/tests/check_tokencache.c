@@ -0,0 +1,234 @@
+/**
+ *
+ * (C) Copyright 2020-2021 Hewlett Packard Enterprise Development LP
+ *
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <check.h>
+#include <openssl/pem.h>
+#include <stdlib.h>
+
+#include "c-spiffe/svid/jwtsvid/parse.h"
+#include "c-spiffe/svid/jwtsvid/tokencache.h"
+
+static const char kid[] = "ff3c5c96-392e-46ef-a839-6ff16027af78";
+
+// RS256 token for spiffe://example.com/workload1, without audience
+static const char rsa_token[]
+    = "eyJhbGciOiJSUzI1NiIsInR5cCI6IkpXVCIsImtpZCI6ImZmM2M1Yzk2LT"
+      "M5MmUtNDZlZi1hODM5LTZmZjE2MDI3YWY3OCJ9."
+      "eyJzdWIiOiJzcGlmZmU6Ly9leGFtcGxlLmNvbS93b3JrbG9hZDEiLCJuYW"
+      "1lIjoiSm9obiBEb2UiLCJpYXQiOjE1MTYyMzkwMjIsImV4cCI6OTk5MDAw"
+      "MDAwMH0.dkXaAoLz9E54JGwgW5stxOF9oi79ineUVrsjllNjfKtOV_GN-"
+      "S6V9VutS6uQuC5ncqyeUOh8TczPoJpJbVRcGatGuapVdGVTlYWd0_"
+      "dWyhE3nre2D5YqJYI4HaSy6-fz-"
+      "5q5b7eo4e5UvdIwqoXv8yAViddD3x9nafx3oifDTeEJ2k0xQPuHIf60rnW"
+      "1sQuIP8210GNKlmQT5H07dT7yOXm8RabmQ5arO6LY0bsy0gRQzimF6J3Sy"
+      "rOB7qrf4tVj4_1G-d-_vYe8dHmQsYOe3-AwZfTAfCKZYARiUm4tO8-"
+      "t1ur7Oy14SlM79FQExohAPzbAPJ02_Zg-9s6DknmNDg";
+
+static EVP_PKEY *read_key(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    ck_assert_ptr_ne(f, NULL);
+    EVP_PKEY *pkey = PEM_read_PrivateKey(f, NULL, NULL, NULL);
+    fclose(f);
+
+    return pkey;
+}
+
+/*
+Each test named 'test_jwtsvid_<function name>' tests
+jwtsvid_<function name> function.
+*/
+
+// precondition: same audiences in different order and repeated
+// postcondition: same digest, different from another audience set
+START_TEST(test_jwtsvid_TokenCache_Digest)
+{
+    string_arr_t aud1 = NULL, aud2 = NULL, aud3 = NULL;
+    arrput(aud1, "a");
+    arrput(aud1, "b");
+    arrput(aud2, "b");
+    arrput(aud2, "a");
+    arrput(aud2, "b");
+    arrput(aud3, "ab");
+
+    jwtsvid_TokenDigest d1 = jwtsvid_TokenCache_Digest("token", aud1);
+    jwtsvid_TokenDigest d2 = jwtsvid_TokenCache_Digest("token", aud2);
+    jwtsvid_TokenDigest d3 = jwtsvid_TokenCache_Digest("token", aud3);
+    jwtsvid_TokenDigest d4 = jwtsvid_TokenCache_Digest("token2", aud1);
+
+    ck_assert(!memcmp(&d1, &d2, sizeof d1));
+    ck_assert(memcmp(&d1, &d3, sizeof d1));
+    ck_assert(memcmp(&d1, &d4, sizeof d1));
+
+    arrfree(aud1);
+    arrfree(aud2);
+    arrfree(aud3);
+}
+END_TEST
+
+// precondition: shards holding one entry each
+// postcondition: the least recently used entry is evicted
+START_TEST(test_jwtsvid_TokenCacheShard_Put)
+{
+    jwtsvid_TokenCache *cache = jwtsvid_NewTokenCache(1);
+    jwtsvid_TokenCacheEntry *entries[2];
+    jwtsvid_TokenDigest digests[2];
+    for(int i = 0; i < 2; ++i) {
+        memset(&digests[i], i, sizeof digests[i]);
+        // both in the same shard
+        digests[i].bytes[0] = 0;
+        entries[i] = calloc(1, sizeof *entries[i]);
+        entries[i]->digest = digests[i];
+    }
+    jwtsvid_TokenCacheShard *shard
+        = jwtsvid_TokenCache_GetShard(cache, &digests[0]);
+    ck_assert_ptr_eq(shard, jwtsvid_TokenCache_GetShard(cache, &digests[1]));
+
+    jwtsvid_TokenCacheShard_Put(shard, entries[0]);
+    ck_assert_ptr_eq(jwtsvid_TokenCacheShard_Get(shard, &digests[0]),
+                     entries[0]);
+    jwtsvid_TokenCacheShard_Put(shard, entries[1]);
+    ck_assert_ptr_eq(jwtsvid_TokenCacheShard_Get(shard, &digests[0]), NULL);
+    ck_assert_ptr_eq(jwtsvid_TokenCacheShard_Get(shard, &digests[1]),
+                     entries[1]);
+    ck_assert_ptr_eq(shard->head, entries[1]);
+    ck_assert_ptr_eq(shard->tail, entries[1]);
+    ck_assert_uint_eq(jwtsvid_TokenCache_GetStats(cache).evictions, 1);
+
+    jwtsvid_TokenCache_Free(cache);
+}
+END_TEST
+
+// precondition: valid token validated twice for the same audience
+// postcondition: the second validation is served from the cache
+START_TEST(test_jwtsvid_ParseAndValidateCached)
+{
+    spiffeid_TrustDomain td = { "example.com" };
+    jwtbundle_Bundle *bundle = jwtbundle_New(td);
+    EVP_PKEY *pkey = read_key("./resources/privkey.pem");
+    err_t err = jwtbundle_Bundle_AddJWTAuthority(bundle, kid, pkey);
+    ck_assert_uint_eq(err, NO_ERROR);
+    jwtbundle_Source *source = jwtbundle_SourceFromBundle(bundle);
+    jwtsvid_TokenCache *cache = jwtsvid_NewTokenCache(0);
+
+    char token[sizeof rsa_token];
+    for(int i = 0; i < 2; ++i) {
+        strcpy(token, rsa_token);
+        jwtsvid_SVID *svid = jwtsvid_ParseAndValidateCached(
+            cache, token, source, NULL, &err);
+        ck_assert_uint_eq(err, NO_ERROR);
+        ck_assert_ptr_ne(svid, NULL);
+        ck_assert_str_eq(svid->id.td.name, "example.com");
+        ck_assert_str_eq(svid->id.path, "/workload1");
+        ck_assert_str_eq(svid->token, rsa_token);
+        jwtsvid_SVID_Free(svid);
+    }
+    jwtsvid_TokenCacheStats stats = jwtsvid_TokenCache_GetStats(cache);
+    ck_assert_uint_eq(stats.misses, 1);
+    ck_assert_uint_eq(stats.hits, 1);
+
+    // the token has no audience, an audience set is validated apart
+    string_arr_t audience = NULL;
+    arrput(audience, "spiffe://example.com/server");
+    jwtsvid_SVID *svid = jwtsvid_ParseAndValidateCached(cache, token, source,
+                                                        audience, &err);
+    ck_assert_uint_eq(err, ERR_INVALID_CLAIM);
+    ck_assert_ptr_eq(svid, NULL);
+    stats = jwtsvid_TokenCache_GetStats(cache);
+    ck_assert_uint_eq(stats.misses, 2);
+    ck_assert_uint_eq(stats.hits, 1);
+
+    arrfree(audience);
+    jwtsvid_TokenCache_Free(cache);
+    jwtbundle_Source_Free(source);
+    EVP_PKEY_free(pkey);
+}
+END_TEST
+
+// precondition: cached token whose key is replaced in the bundle
+// postcondition: the entry is invalidated and the token rejected
+START_TEST(test_jwtsvid_ParseAndValidateCached_key_rotated)
+{
+    spiffeid_TrustDomain td = { "example.com" };
+    jwtbundle_Bundle *bundle = jwtbundle_New(td);
+    EVP_PKEY *pkey = read_key("./resources/privkey.pem");
+    EVP_PKEY *other = read_key("./resources/ec-secp256k1-priv-key.pem");
+    err_t err = jwtbundle_Bundle_AddJWTAuthority(bundle, kid, pkey);
+    ck_assert_uint_eq(err, NO_ERROR);
+    jwtbundle_Source *source = jwtbundle_SourceFromBundle(bundle);
+    jwtsvid_TokenCache *cache = jwtsvid_NewTokenCache(0);
+
+    char token[sizeof rsa_token];
+    strcpy(token, rsa_token);
+    jwtsvid_SVID *svid
+        = jwtsvid_ParseAndValidateCached(cache, token, source, NULL, &err);
+    ck_assert_uint_eq(err, NO_ERROR);
+    jwtsvid_SVID_Free(svid);
+
+    jwtbundle_Bundle_RemoveJWTAuthority(bundle, kid);
+    err = jwtbundle_Bundle_AddJWTAuthority(bundle, kid, other);
+    ck_assert_uint_eq(err, NO_ERROR);
+
+    svid = jwtsvid_ParseAndValidateCached(cache, token, source, NULL, &err);
+    ck_assert_uint_eq(err, ERR_INVALID_JWT);
+    ck_assert_ptr_eq(svid, NULL);
+    jwtsvid_TokenCacheStats stats = jwtsvid_TokenCache_GetStats(cache);
+    ck_assert_uint_eq(stats.invalidations, 1);
+    ck_assert_uint_eq(stats.hits, 0);
+    ck_assert_uint_eq(stats.misses, 2);
+
+    jwtsvid_TokenCache_Free(cache);
+    jwtbundle_Source_Free(source);
+    EVP_PKEY_free(pkey);
+    EVP_PKEY_free(other);
+}
+END_TEST
+
+Suite *tokencache_suite(void)
+{
+    Suite *s = suite_create("tokencache");
+    TCase *tc_core = tcase_create("core");
+
+    tcase_add_test(tc_core, test_jwtsvid_TokenCache_Digest);
+    tcase_add_test(tc_core, test_jwtsvid_TokenCacheShard_Put);
+    tcase_add_test(tc_core, test_jwtsvid_ParseAndValidateCached);
+    tcase_add_test(tc_core, test_jwtsvid_ParseAndValidateCached_key_rotated);
+
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void)
+{
+    Suite *s = tokencache_suite();
+    SRunner *sr = srunner_create(s);
+
+    srunner_run_all(sr, CK_NORMAL);
+    const int number_failed = srunner_ntests_failed(sr);
+
+    srunner_free(sr);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
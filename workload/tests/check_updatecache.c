@@ -0,0 +1,308 @@
+/**
+ *
+ * (C) Copyright 2020-2021 Hewlett Packard Enterprise Development LP
+ *
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include "c-spiffe/workload/updatecache.h"
+#include <check.h>
+#include <openssl/pem.h>
+
+// reads every certificate in a PEM file as concatenated DER
+static size_t read_der_certs(const char *path, byte *der_bytes)
+{
+    FILE *f = fopen(path, "r");
+    ck_assert_ptr_ne(f, NULL);
+    byte *pout = der_bytes;
+    X509 *cert = NULL;
+    while((cert = PEM_read_X509(f, NULL, NULL, NULL))) {
+        i2d_X509(cert, &pout);
+        X509_free(cert);
+    }
+    fclose(f);
+    return pout - der_bytes;
+}
+
+static size_t read_der_key(const char *path, byte *der_bytes)
+{
+    FILE *f = fopen(path, "r");
+    ck_assert_ptr_ne(f, NULL);
+    EVP_PKEY *pkey = PEM_read_PrivateKey(f, NULL, NULL, NULL);
+    ck_assert_ptr_ne(pkey, NULL);
+    fclose(f);
+    byte *pout = der_bytes;
+    i2d_PrivateKey(pkey, &pout);
+    EVP_PKEY_free(pkey);
+    return pout - der_bytes;
+}
+
+START_TEST(test_workloadapi_UpdateCache_ParseX509SVID)
+{
+    const char id[] = "spiffe://example.org/workload-1";
+    byte cert_bytes[10000], key_bytes[10000];
+    size_t cert_len = read_der_certs(
+        "./resources/good-leaf-and-intermediate.pem", cert_bytes);
+    size_t key_len
+        = read_der_key("./resources/key-pkcs8-ecdsa.pem", key_bytes);
+
+    workloadapi_UpdateCache *cache = workloadapi_NewUpdateCache();
+    err_t err;
+
+    // first update parses the SVID
+    workloadapi_UpdateCache_Begin(cache);
+    x509svid_SVID *svid1 = workloadapi_UpdateCache_ParseX509SVID(
+        cache, id, cert_bytes, cert_len, key_bytes, key_len, &err);
+    workloadapi_UpdateCache_End(cache);
+    ck_assert_uint_eq(err, NO_ERROR);
+    ck_assert_ptr_ne(svid1, NULL);
+    ck_assert(workloadapi_UpdateCache_Changed(cache));
+    ck_assert_uint_eq(arrlenu(cache->delta.changed_svids), 1);
+    ck_assert_str_eq(cache->delta.changed_svids[0], id);
+
+    // same bytes: the parsed objects are reused
+    workloadapi_UpdateCache_Begin(cache);
+    x509svid_SVID *svid2 = workloadapi_UpdateCache_ParseX509SVID(
+        cache, id, cert_bytes, cert_len, key_bytes, key_len, &err);
+    workloadapi_UpdateCache_End(cache);
+    ck_assert_uint_eq(err, NO_ERROR);
+    ck_assert_ptr_ne(svid2, svid1);
+    ck_assert_ptr_eq(svid2->certs[0], svid1->certs[0]);
+    ck_assert_ptr_eq(svid2->private_key, svid1->private_key);
+    ck_assert_str_eq(svid2->id.path, svid1->id.path);
+    ck_assert(!workloadapi_UpdateCache_Changed(cache));
+
+    // different bytes: decoded again
+    workloadapi_UpdateCache_Begin(cache);
+    x509svid_SVID *svid3 = workloadapi_UpdateCache_ParseX509SVID(
+        cache, id, cert_bytes, cert_len, key_bytes, key_len - 1, &err);
+    ck_assert_uint_ne(err, NO_ERROR);
+    ck_assert_ptr_eq(svid3, NULL);
+    svid3 = workloadapi_UpdateCache_ParseX509SVID(
+        cache, "spiffe://example.org/workload-2", cert_bytes, cert_len,
+        key_bytes, key_len, &err);
+    workloadapi_UpdateCache_End(cache);
+    ck_assert_uint_eq(err, NO_ERROR);
+    ck_assert_ptr_ne(svid3->certs[0], svid1->certs[0]);
+    // the first one was not in the update
+    ck_assert_uint_eq(arrlenu(cache->delta.changed_svids), 1);
+    ck_assert_str_eq(cache->delta.changed_svids[0],
+                     "spiffe://example.org/workload-2");
+    ck_assert_uint_eq(arrlenu(cache->delta.removed_svids), 1);
+    ck_assert_str_eq(cache->delta.removed_svids[0], id);
+
+    // objects handed out outlive their cache entries
+    workloadapi_UpdateCache_Free(cache);
+    ck_assert_ptr_ne(X509_get_subject_name(svid1->certs[0]), NULL);
+
+    x509svid_SVID_Free(svid1);
+    x509svid_SVID_Free(svid2);
+    x509svid_SVID_Free(svid3);
+}
+END_TEST
+
+START_TEST(test_workloadapi_UpdateCache_Abort)
+{
+    const char id1[] = "spiffe://example.org/workload-1";
+    const char id2[] = "spiffe://example.org/workload-2";
+    byte cert_bytes[10000], leaf_bytes[10000], key_bytes[10000];
+    size_t cert_len = read_der_certs(
+        "./resources/good-leaf-and-intermediate.pem", cert_bytes);
+    size_t leaf_len
+        = read_der_certs("./resources/good-leaf-only.pem", leaf_bytes);
+    size_t key_len
+        = read_der_key("./resources/key-pkcs8-ecdsa.pem", key_bytes);
+
+    workloadapi_UpdateCache *cache = workloadapi_NewUpdateCache();
+    err_t err;
+
+    workloadapi_UpdateCache_Begin(cache);
+    x509svid_SVID *svid1 = workloadapi_UpdateCache_ParseX509SVID(
+        cache, id1, cert_bytes, cert_len, key_bytes, key_len, &err);
+    ck_assert_uint_eq(err, NO_ERROR);
+    workloadapi_UpdateCache_End(cache);
+
+    // the first SVID changes, then the second one fails to parse
+    workloadapi_UpdateCache_Begin(cache);
+    x509svid_SVID *svid2 = workloadapi_UpdateCache_ParseX509SVID(
+        cache, id1, leaf_bytes, leaf_len, key_bytes, key_len, &err);
+    ck_assert_uint_eq(err, NO_ERROR);
+    x509svid_SVID *svid3 = workloadapi_UpdateCache_ParseX509SVID(
+        cache, id2, cert_bytes, cert_len, key_bytes, key_len - 1, &err);
+    ck_assert_uint_ne(err, NO_ERROR);
+    ck_assert_ptr_eq(svid3, NULL);
+    workloadapi_UpdateCache_Abort(cache);
+    ck_assert(!workloadapi_UpdateCache_Changed(cache));
+    ck_assert_uint_eq(shlenu(cache->x509svids), 1);
+
+    // the failed update was never reported, so the next one reports both
+    workloadapi_UpdateCache_Begin(cache);
+    x509svid_SVID *svid4 = workloadapi_UpdateCache_ParseX509SVID(
+        cache, id1, leaf_bytes, leaf_len, key_bytes, key_len, &err);
+    ck_assert_uint_eq(err, NO_ERROR);
+    svid3 = workloadapi_UpdateCache_ParseX509SVID(
+        cache, id2, cert_bytes, cert_len, key_bytes, key_len, &err);
+    ck_assert_uint_eq(err, NO_ERROR);
+    workloadapi_UpdateCache_End(cache);
+    ck_assert_uint_eq(arrlenu(cache->delta.changed_svids), 2);
+    ck_assert_str_eq(cache->delta.changed_svids[0], id1);
+    ck_assert_str_eq(cache->delta.changed_svids[1], id2);
+    ck_assert_uint_eq(arrlenu(cache->delta.removed_svids), 0);
+
+    // and the one after that nothing
+    workloadapi_UpdateCache_Begin(cache);
+    x509svid_SVID *svid5 = workloadapi_UpdateCache_ParseX509SVID(
+        cache, id1, leaf_bytes, leaf_len, key_bytes, key_len, &err);
+    ck_assert_uint_eq(err, NO_ERROR);
+    workloadapi_UpdateCache_End(cache);
+    ck_assert_uint_eq(arrlenu(cache->delta.changed_svids), 0);
+    ck_assert_uint_eq(arrlenu(cache->delta.removed_svids), 1);
+    ck_assert_str_eq(cache->delta.removed_svids[0], id2);
+
+    x509svid_SVID_Free(svid1);
+    x509svid_SVID_Free(svid2);
+    x509svid_SVID_Free(svid3);
+    x509svid_SVID_Free(svid4);
+    x509svid_SVID_Free(svid5);
+    workloadapi_UpdateCache_Free(cache);
+}
+END_TEST
+
+START_TEST(test_workloadapi_UpdateCache_ParseX509Bundle)
+{
+    byte bundle_bytes[10000], other_bytes[10000];
+    size_t bundle_len = read_der_certs("./resources/certs.pem", bundle_bytes);
+    size_t other_len
+        = read_der_certs("./resources/good-leaf-only.pem", other_bytes);
+    spiffeid_TrustDomain td1 = { string_new("example1.com") };
+    spiffeid_TrustDomain td2 = { string_new("example2.com") };
+
+    workloadapi_UpdateCache *cache = workloadapi_NewUpdateCache();
+    err_t err;
+
+    workloadapi_UpdateCache_Begin(cache);
+    x509bundle_Bundle *b1 = workloadapi_UpdateCache_ParseX509Bundle(
+        cache, td1, bundle_bytes, bundle_len, &err);
+    ck_assert_uint_eq(err, NO_ERROR);
+    x509bundle_Bundle *b2 = workloadapi_UpdateCache_ParseX509Bundle(
+        cache, td2, bundle_bytes, bundle_len, &err);
+    ck_assert_uint_eq(err, NO_ERROR);
+    workloadapi_UpdateCache_End(cache);
+    ck_assert_uint_eq(arrlenu(cache->delta.changed_bundles), 2);
+    ck_assert_uint_eq(arrlenu(cache->delta.removed_bundles), 0);
+    // same bytes, decoded once for both trust domains
+    ck_assert_ptr_eq(b1->auths[0], b2->auths[0]);
+    ck_assert_uint_eq(hmlenu(cache->x509authorities), 1);
+
+    // only the second trust domain changed
+    workloadapi_UpdateCache_Begin(cache);
+    x509bundle_Bundle *b3 = workloadapi_UpdateCache_ParseX509Bundle(
+        cache, td1, bundle_bytes, bundle_len, &err);
+    ck_assert_uint_eq(err, NO_ERROR);
+    ck_assert_ptr_eq(b3->auths[0], b1->auths[0]);
+    x509bundle_Bundle *b4 = workloadapi_UpdateCache_ParseX509Bundle(
+        cache, td2, other_bytes, other_len, &err);
+    workloadapi_UpdateCache_End(cache);
+    ck_assert_ptr_ne(b4, NULL);
+    ck_assert_ptr_ne(b4->auths[0], b2->auths[0]);
+    ck_assert_uint_eq(arrlenu(cache->delta.changed_bundles), 1);
+    ck_assert_str_eq(cache->delta.changed_bundles[0], td2.name);
+    ck_assert_uint_eq(hmlenu(cache->x509authorities), 2);
+
+    // nothing at all: both removed
+    workloadapi_UpdateCache_Begin(cache);
+    workloadapi_UpdateCache_End(cache);
+    ck_assert_uint_eq(arrlenu(cache->delta.changed_bundles), 0);
+    ck_assert_uint_eq(arrlenu(cache->delta.removed_bundles), 2);
+    ck_assert_uint_eq(shlenu(cache->x509bundles), 0);
+    ck_assert_uint_eq(hmlenu(cache->x509authorities), 0);
+
+    x509bundle_Bundle_Free(b1);
+    x509bundle_Bundle_Free(b2);
+    x509bundle_Bundle_Free(b3);
+    x509bundle_Bundle_Free(b4);
+    spiffeid_TrustDomain_Free(&td1);
+    spiffeid_TrustDomain_Free(&td2);
+    workloadapi_UpdateCache_Free(cache);
+}
+END_TEST
+
+START_TEST(test_workloadapi_UpdateCache_ParseJWTBundle)
+{
+    FILE *f = fopen("./resources/jwk_keys.json", "r");
+    ck_assert_ptr_ne(f, NULL);
+    string_t jwks = FILE_to_string(f);
+    fclose(f);
+    spiffeid_TrustDomain td = { string_new("example.com") };
+
+    workloadapi_UpdateCache *cache = workloadapi_NewUpdateCache();
+    err_t err;
+
+    workloadapi_UpdateCache_Begin(cache);
+    jwtbundle_Bundle *b1 = workloadapi_UpdateCache_ParseJWTBundle(
+        cache, td, jwks, strlen(jwks), &err);
+    workloadapi_UpdateCache_End(cache);
+    ck_assert_uint_eq(err, NO_ERROR);
+    ck_assert_ptr_ne(b1, NULL);
+    ck_assert_uint_eq(arrlenu(cache->delta.changed_bundles), 1);
+
+    workloadapi_UpdateCache_Begin(cache);
+    jwtbundle_Bundle *b2 = workloadapi_UpdateCache_ParseJWTBundle(
+        cache, td, jwks, strlen(jwks), &err);
+    workloadapi_UpdateCache_End(cache);
+    ck_assert_uint_eq(err, NO_ERROR);
+    ck_assert(jwtbundle_Bundle_Equal(b1, b2));
+    ck_assert_ptr_eq(b2->auths[0].value, b1->auths[0].value);
+    ck_assert(!workloadapi_UpdateCache_Changed(cache));
+
+    jwtbundle_Bundle_Free(b1);
+    jwtbundle_Bundle_Free(b2);
+    spiffeid_TrustDomain_Free(&td);
+    arrfree(jwks);
+    workloadapi_UpdateCache_Free(cache);
+}
+END_TEST
+
+Suite *updatecache_suite(void)
+{
+    Suite *s = suite_create("updatecache");
+    TCase *tc_core = tcase_create("core");
+    tcase_add_test(tc_core, test_workloadapi_UpdateCache_ParseX509SVID);
+    tcase_add_test(tc_core, test_workloadapi_UpdateCache_Abort);
+    tcase_add_test(tc_core, test_workloadapi_UpdateCache_ParseX509Bundle);
+    tcase_add_test(tc_core, test_workloadapi_UpdateCache_ParseJWTBundle);
+
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(int argc, char **argv)
+{
+    Suite *s = updatecache_suite();
+    SRunner *sr = srunner_create(s);
+
+    srunner_run_all(sr, CK_NORMAL);
+    const int number_failed = srunner_ntests_failed(sr);
+
+    srunner_free(sr);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,348 @@
+/**
+ *
+ * (C) Copyright 2020-2021 Hewlett Packard Enterprise Development LP
+ *
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <check.h>
+#include <openssl/pem.h>
+#include <stdlib.h>
+
+#include "c-spiffe/svid/jwtsvid/verifier.h"
+
+static const char kid[] = "ff3c5c96-392e-46ef-a839-6ff16027af78";
+
+// RS256 token for spiffe://example.com/workload1, without audience
+static const char rsa_token[]
+    = "eyJhbGciOiJSUzI1NiIsInR5cCI6IkpXVCIsImtpZCI6ImZmM2M1Yzk2LT"
+      "M5MmUtNDZlZi1hODM5LTZmZjE2MDI3YWY3OCJ9."
+      "eyJzdWIiOiJzcGlmZmU6Ly9leGFtcGxlLmNvbS93b3JrbG9hZDEiLCJuYW"
+      "1lIjoiSm9obiBEb2UiLCJpYXQiOjE1MTYyMzkwMjIsImV4cCI6OTk5MDAw"
+      "MDAwMH0.dkXaAoLz9E54JGwgW5stxOF9oi79ineUVrsjllNjfKtOV_GN-"
+      "S6V9VutS6uQuC5ncqyeUOh8TczPoJpJbVRcGatGuapVdGVTlYWd0_"
+      "dWyhE3nre2D5YqJYI4HaSy6-fz-"
+      "5q5b7eo4e5UvdIwqoXv8yAViddD3x9nafx3oifDTeEJ2k0xQPuHIf60rnW"
+      "1sQuIP8210GNKlmQT5H07dT7yOXm8RabmQ5arO6LY0bsy0gRQzimF6J3Sy"
+      "rOB7qrf4tVj4_1G-d-_vYe8dHmQsYOe3-AwZfTAfCKZYARiUm4tO8-"
+      "t1ur7Oy14SlM79FQExohAPzbAPJ02_Zg-9s6DknmNDg";
+
+// ES256 token with the same claims
+static const char ec_token[]
+    = "eyJhbGciOiJFUzI1NiIsInR5cCI6IkpXVCIsImtpZCI6ImZmM2M1Yzk2LT"
+      "M5MmUtNDZlZi1hODM5LTZmZjE2MDI3YWY3OCJ9."
+      "eyJzdWIiOiJzcGlmZmU6Ly9leGFtcGxlLmNvbS93b3JrbG9hZDEiLCJuYW"
+      "1lIjoiSm9obiBEb2UiLCJpYXQiOjE1MTYyMzkwMjIsImV4cCI6OTk5MDAw"
+      "MDAwMH0.z-azwJt3UzuaL1x0g-"
+      "pGbQOnXXYphAUeBMV3FlVtS53gBBsWLaWWGaJPcLTRdZ50TPTTxh3xlPyv"
+      "P5H-YTP_kQ";
+
+// PS256 token with the same claims, signed by the RSA key
+static const char pss_token[]
+    = "eyJhbGciOiJQUzI1NiIsInR5cCI6IkpXVCIsImtpZCI6ImZmM2M1Yzk2LTM"
+      "5MmUtNDZlZi1hODM5LTZmZjE2MDI3YWY3OCJ9."
+      "eyJzdWIiOiJzcGlmZmU6Ly9leGFtcGxlLmNvbS93b3JrbG9hZDEiLCJuYW1"
+      "lIjoiSm9obiBEb2UiLCJpYXQiOjE1MTYyMzkwMjIsImV4cCI6OTk5MDAwMD"
+      "AwMH0."
+      "gJ-TOnChXqPXUwdzKeMytOvhGP5d5TH4Qs2vN0nhTP9CiyzcUXFiIRNHHYK"
+      "wu_G8xntfTdoW8DGTjKUWts6UJ4_KEBY_SnKtUOh64YHinpX4l1diMNrNqS"
+      "kIpryssr50bav_NcMn2nIeEtJQCFyOMRCaQuwdC7I3Wpsv3HFmsIxA3jhKk"
+      "E8WbDJpBGfpSFMPbid7otS6aYNkQXZ9oeRDZ1AQSKcSiPwOs-rB27WEbZaw"
+      "LBOUabxDbsV5Cevm3B7MX_b0wpgPYx307g_zZ4hEQt72SyIT0sncENLrE2L"
+      "8KcnGgfYuVUsltwYLFVTRGGpzqb0NwOUO1WWYQqrusdcJ2Q";
+
+// token claiming ES256, with an RS256 signature by the RSA key
+static const char forged_token[]
+    = "eyJhbGciOiJFUzI1NiIsInR5cCI6IkpXVCIsImtpZCI6ImZmM2M1Yzk2LTM"
+      "5MmUtNDZlZi1hODM5LTZmZjE2MDI3YWY3OCJ9."
+      "eyJzdWIiOiJzcGlmZmU6Ly9leGFtcGxlLmNvbS93b3JrbG9hZDEiLCJuYW1"
+      "lIjoiSm9obiBEb2UiLCJpYXQiOjE1MTYyMzkwMjIsImV4cCI6OTk5MDAwMD"
+      "AwMH0."
+      "LfW2w11-UTtQui388h-hYZTluy787wjzIOd8dfKYYRqiQg-piWlMfnY-2sR"
+      "OlHv2yB9yG0ZJ_3DZnJa24tGLtjsu4saorH5bqbmOznQwCHURi-KtANRJuK"
+      "exVOCWtXa6qts3L2N-9Txat4r1daoYCukvI3cXhYqKJY2AQxKjqUlqNQ0wC"
+      "Xf3DSiKdVSwDxcDirxaKUwUZDjdiCtCHkfj90QK-T-dwikdTKazwKvoLOYX"
+      "06wS1-rj_E8Dk3n5X-MKRI4J2GF_UO6hXriu5pOXo-mghXwCnFBGKTseEK4"
+      "6CqlSlgBrwi4-NGTR1O5uw9sWtvfDCQHPv5m9ZRw1UoB16w";
+
+static EVP_PKEY *read_key(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    ck_assert_ptr_ne(f, NULL);
+    EVP_PKEY *pkey = PEM_read_PrivateKey(f, NULL, NULL, NULL);
+    fclose(f);
+
+    return pkey;
+}
+
+static void validate(jwtsvid_Verifier *verifier, const char *token,
+                     err_t expected)
+{
+    char *copy = string_new(token);
+    err_t err;
+    jwtsvid_SVID *svid = jwtsvid_Verifier_Validate(verifier, copy, &err);
+    ck_assert_uint_eq(err, expected);
+    if(expected == NO_ERROR) {
+        ck_assert_ptr_ne(svid, NULL);
+        ck_assert_str_eq(svid->id.td.name, "example.com");
+        ck_assert_str_eq(svid->id.path, "/workload1");
+        ck_assert_int_eq(svid->expiry, 9990000000);
+        ck_assert_str_eq(svid->token, token);
+    } else {
+        ck_assert_ptr_eq(svid, NULL);
+    }
+    jwtsvid_SVID_Free(svid);
+    arrfree(copy);
+}
+
+/*
+Each test named 'test_jwtsvid_<function name>' tests
+jwtsvid_<function name> function.
+*/
+
+// precondition: RSA key in the bundle, token validated twice
+// postcondition: both validate, with one key prepared once
+START_TEST(test_jwtsvid_Verifier_Validate)
+{
+    spiffeid_TrustDomain td = { "example.com" };
+    jwtbundle_Bundle *bundle = jwtbundle_New(td);
+    EVP_PKEY *pkey = read_key("./resources/privkey.pem");
+    err_t err = jwtbundle_Bundle_AddJWTAuthority(bundle, kid, pkey);
+    ck_assert_uint_eq(err, NO_ERROR);
+    jwtbundle_Source *source = jwtbundle_SourceFromBundle(bundle);
+
+    jwtsvid_Verifier *verifier = jwtsvid_NewVerifier(source, NULL, &err);
+    ck_assert_uint_eq(err, NO_ERROR);
+
+    validate(verifier, rsa_token, NO_ERROR);
+    ck_assert_uint_eq(shlenu(verifier->keys), 1);
+    jwtsvid_VerifierKey *key = shget(verifier->keys, kid);
+    // every RS and PS algorithm is prepared up front, readers never modify
+    // a key. ES ones are not for an RSA key
+    for(int i = 0; i < 6; ++i) {
+        ck_assert_ptr_ne(key->templates[i], NULL);
+    }
+    for(int i = 6; i < JWTSVID_VERIFIER_ALGORITHMS; ++i) {
+        ck_assert_ptr_eq(key->templates[i], NULL);
+    }
+    ck_assert_str_eq(key->td, "example.com");
+
+    validate(verifier, rsa_token, NO_ERROR);
+    ck_assert_ptr_eq(shget(verifier->keys, kid), key);
+
+    jwtsvid_Verifier_Free(verifier);
+    jwtbundle_Source_Free(source);
+    EVP_PKEY_free(pkey);
+}
+END_TEST
+
+// precondition: EC key in the bundle
+// postcondition: the token validates, a truncated signature does not
+START_TEST(test_jwtsvid_Verifier_Validate_EC)
+{
+    spiffeid_TrustDomain td = { "example.com" };
+    jwtbundle_Bundle *bundle = jwtbundle_New(td);
+    EVP_PKEY *pkey = read_key("./resources/ec-secp256k1-priv-key.pem");
+    err_t err = jwtbundle_Bundle_AddJWTAuthority(bundle, kid, pkey);
+    ck_assert_uint_eq(err, NO_ERROR);
+    jwtbundle_Source *source = jwtbundle_SourceFromBundle(bundle);
+
+    jwtsvid_Verifier *verifier = jwtsvid_NewVerifier(source, NULL, &err);
+    ck_assert_uint_eq(err, NO_ERROR);
+
+    validate(verifier, ec_token, NO_ERROR);
+    ck_assert_uint_eq(shget(verifier->keys, kid)->ec_len, 32);
+
+    char truncated[sizeof ec_token];
+    strcpy(truncated, ec_token);
+    truncated[strlen(truncated) - 4] = '\0';
+    validate(verifier, truncated, ERR_INVALID_JWT);
+
+    jwtsvid_Verifier_Free(verifier);
+    jwtbundle_Source_Free(source);
+    EVP_PKEY_free(pkey);
+}
+END_TEST
+
+// precondition: RSA key in the bundle, PS256 token
+// postcondition: validates with PSS padding
+START_TEST(test_jwtsvid_Verifier_Validate_PS256)
+{
+    spiffeid_TrustDomain td = { "example.com" };
+    jwtbundle_Bundle *bundle = jwtbundle_New(td);
+    EVP_PKEY *pkey = read_key("./resources/privkey.pem");
+    err_t err = jwtbundle_Bundle_AddJWTAuthority(bundle, kid, pkey);
+    ck_assert_uint_eq(err, NO_ERROR);
+    jwtbundle_Source *source = jwtbundle_SourceFromBundle(bundle);
+
+    jwtsvid_Verifier *verifier = jwtsvid_NewVerifier(source, NULL, &err);
+    ck_assert_uint_eq(err, NO_ERROR);
+
+    validate(verifier, pss_token, NO_ERROR);
+    // same key, other padding
+    validate(verifier, rsa_token, NO_ERROR);
+    ck_assert_uint_eq(shlenu(verifier->keys), 1);
+
+    jwtsvid_Verifier_Free(verifier);
+    jwtbundle_Source_Free(source);
+    EVP_PKEY_free(pkey);
+}
+END_TEST
+
+// precondition: tokens whose algorithm is not of the key type
+// postcondition: none validates
+START_TEST(test_jwtsvid_Verifier_Validate_alg_mismatch)
+{
+    spiffeid_TrustDomain td = { "example.com" };
+    jwtbundle_Bundle *bundle = jwtbundle_New(td);
+    EVP_PKEY *pkey = read_key("./resources/privkey.pem");
+    err_t err = jwtbundle_Bundle_AddJWTAuthority(bundle, kid, pkey);
+    ck_assert_uint_eq(err, NO_ERROR);
+    jwtbundle_Source *source = jwtbundle_SourceFromBundle(bundle);
+
+    jwtsvid_Verifier *verifier = jwtsvid_NewVerifier(source, NULL, &err);
+    ck_assert_uint_eq(err, NO_ERROR);
+
+    // a valid RSA signature, under an EC algorithm
+    validate(verifier, forged_token, ERR_INVALID_JWT);
+    validate(verifier, ec_token, ERR_INVALID_JWT);
+
+    jwtsvid_JWT jwt = { .header = { .alg = "ES256" } };
+    ck_assert_uint_eq(jwtsvid_VerifyJWT(&jwt, pkey), ERR_INVALID_ALGORITHM);
+
+    jwtsvid_Verifier_Free(verifier);
+    jwtbundle_Source_Free(source);
+    EVP_PKEY_free(pkey);
+}
+END_TEST
+
+// precondition: key replaced under the same key ID
+// postcondition: the state is prepared again for the new key
+START_TEST(test_jwtsvid_Verifier_Validate_key_rotated)
+{
+    spiffeid_TrustDomain td = { "example.com" };
+    jwtbundle_Bundle *bundle = jwtbundle_New(td);
+    EVP_PKEY *pkey = read_key("./resources/privkey.pem");
+    EVP_PKEY *other = read_key("./resources/ec-secp256k1-priv-key.pem");
+    err_t err = jwtbundle_Bundle_AddJWTAuthority(bundle, kid, pkey);
+    ck_assert_uint_eq(err, NO_ERROR);
+    jwtbundle_Source *source = jwtbundle_SourceFromBundle(bundle);
+
+    jwtsvid_Verifier *verifier = jwtsvid_NewVerifier(source, NULL, &err);
+    ck_assert_uint_eq(err, NO_ERROR);
+    validate(verifier, rsa_token, NO_ERROR);
+
+    jwtbundle_Bundle_RemoveJWTAuthority(bundle, kid);
+    err = jwtbundle_Bundle_AddJWTAuthority(bundle, kid, other);
+    ck_assert_uint_eq(err, NO_ERROR);
+
+    validate(verifier, rsa_token, ERR_INVALID_JWT);
+    validate(verifier, ec_token, NO_ERROR);
+    ck_assert_uint_eq(shlenu(verifier->keys), 1);
+    ck_assert_ptr_eq(shget(verifier->keys, kid)->pkey, other);
+
+    jwtsvid_Verifier_Free(verifier);
+    jwtbundle_Source_Free(source);
+    EVP_PKEY_free(pkey);
+    EVP_PKEY_free(other);
+}
+END_TEST
+
+// precondition: key removed from the bundle
+// postcondition: its prepared state is dropped
+START_TEST(test_jwtsvid_Verifier_Validate_key_removed)
+{
+    spiffeid_TrustDomain td = { "example.com" };
+    jwtbundle_Bundle *bundle = jwtbundle_New(td);
+    EVP_PKEY *pkey = read_key("./resources/privkey.pem");
+    err_t err = jwtbundle_Bundle_AddJWTAuthority(bundle, kid, pkey);
+    ck_assert_uint_eq(err, NO_ERROR);
+    jwtbundle_Source *source = jwtbundle_SourceFromBundle(bundle);
+
+    jwtsvid_Verifier *verifier = jwtsvid_NewVerifier(source, NULL, &err);
+    ck_assert_uint_eq(err, NO_ERROR);
+    validate(verifier, rsa_token, NO_ERROR);
+    ck_assert_uint_eq(shlenu(verifier->keys), 1);
+
+    jwtbundle_Bundle_RemoveJWTAuthority(bundle, kid);
+    validate(verifier, rsa_token, ERR_NOAUTHORITY);
+    ck_assert_uint_eq(shlenu(verifier->keys), 0);
+
+    jwtsvid_Verifier_Free(verifier);
+    jwtbundle_Source_Free(source);
+    EVP_PKEY_free(pkey);
+}
+END_TEST
+
+// precondition: verifier for an audience the token lacks
+// postcondition: invalid claim
+START_TEST(test_jwtsvid_Verifier_Validate_audience)
+{
+    spiffeid_TrustDomain td = { "example.com" };
+    jwtbundle_Bundle *bundle = jwtbundle_New(td);
+    EVP_PKEY *pkey = read_key("./resources/privkey.pem");
+    err_t err = jwtbundle_Bundle_AddJWTAuthority(bundle, kid, pkey);
+    ck_assert_uint_eq(err, NO_ERROR);
+    jwtbundle_Source *source = jwtbundle_SourceFromBundle(bundle);
+
+    string_arr_t audience = NULL;
+    arrput(audience, "spiffe://example.com/server");
+    jwtsvid_Verifier *verifier = jwtsvid_NewVerifier(source, audience, &err);
+    ck_assert_uint_eq(err, NO_ERROR);
+    arrfree(audience);
+
+    validate(verifier, rsa_token, ERR_INVALID_CLAIM);
+
+    jwtsvid_Verifier_Free(verifier);
+    jwtbundle_Source_Free(source);
+    EVP_PKEY_free(pkey);
+}
+END_TEST
+
+Suite *verifier_suite(void)
+{
+    Suite *s = suite_create("verifier");
+    TCase *tc_core = tcase_create("core");
+
+    tcase_add_test(tc_core, test_jwtsvid_Verifier_Validate);
+    tcase_add_test(tc_core, test_jwtsvid_Verifier_Validate_EC);
+    tcase_add_test(tc_core, test_jwtsvid_Verifier_Validate_PS256);
+    tcase_add_test(tc_core, test_jwtsvid_Verifier_Validate_alg_mismatch);
+    tcase_add_test(tc_core, test_jwtsvid_Verifier_Validate_key_rotated);
+    tcase_add_test(tc_core, test_jwtsvid_Verifier_Validate_key_removed);
+    tcase_add_test(tc_core, test_jwtsvid_Verifier_Validate_audience);
+
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void)
+{
+    Suite *s = verifier_suite();
+    SRunner *sr = srunner_create(s);
+
+    srunner_run_all(sr, CK_NORMAL);
+    const int number_failed = srunner_ntests_failed(sr);
+
+    srunner_free(sr);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
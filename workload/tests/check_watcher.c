@@ -24,6 +24,7 @@
 
 #include "c-spiffe/workload/watcher.h"
 #include <check.h>
+#include <poll.h>
 
 // callback that sets an int to a value, and ignores the context.
 void set_int_callback(workloadapi_X509Context *context, void *_args)
@@ -61,6 +62,8 @@ START_TEST(test_workloadapi_Watcher_callback_is_called_on_update_once)
     workloadapi_Watcher *watcher
         = (workloadapi_Watcher *) calloc(1, sizeof *watcher);
     watcher->x509callback = callback;
+    // no update descriptor, calloc leaves it at 0
+    watcher->update_fd = -1;
 
     // call update -> toModify = 10
     workloadapi_Watcher_OnX509ContextUpdate(watcher, NULL);
@@ -402,6 +405,80 @@ START_TEST(test_workloadapi_Watcher_Close);
 }
 END_TEST
 
+START_TEST(test_workloadapi_Watcher_update_fd)
+{
+    // empty but valid callback object
+    workloadapi_X509Callback callback;
+    callback.func = empty_callback;
+    callback.args = NULL;
+
+    // empty but valid watcher config
+    workloadapi_WatcherConfig config;
+    config.client = NULL;
+    config.client_options = NULL;
+
+    err_t error = NO_ERROR;
+    workloadapi_Watcher *watcher
+        = workloadapi_newWatcher(config, callback, &error);
+    ck_assert_uint_eq(error, NO_ERROR);
+
+    struct pollfd pfd = { .fd = workloadapi_Watcher_GetUpdateFd(watcher),
+                          .events = POLLIN };
+    ck_assert_int_ge(pfd.fd, 0);
+    ck_assert_uint_eq(workloadapi_Watcher_GetGeneration(watcher), 0);
+    // not readable before the first update
+    ck_assert_int_eq(poll(&pfd, 1, 0), 0);
+
+    // two updates before the poller gets to run
+    workloadapi_Watcher_TriggerUpdated(watcher);
+    workloadapi_Watcher_TriggerUpdated(watcher);
+    ck_assert_int_eq(poll(&pfd, 1, 0), 1);
+    ck_assert(pfd.revents & POLLIN);
+
+    ck_assert_uint_eq(workloadapi_Watcher_ClearUpdateFd(watcher), 2);
+    ck_assert_int_eq(poll(&pfd, 1, 0), 0);
+    // clearing again is harmless
+    ck_assert_uint_eq(workloadapi_Watcher_ClearUpdateFd(watcher), 2);
+
+    workloadapi_Watcher_TriggerUpdated(watcher);
+    ck_assert_int_eq(poll(&pfd, 1, 0), 1);
+    ck_assert_uint_eq(workloadapi_Watcher_ClearUpdateFd(watcher), 3);
+
+    workloadapi_Watcher_Free(watcher);
+}
+END_TEST
+
+START_TEST(test_workloadapi_Watcher_Restart)
+{
+    workloadapi_X509Callback callback;
+    callback.func = empty_callback;
+    callback.args = NULL;
+
+    workloadapi_WatcherConfig config;
+    config.client = NULL;
+    config.client_options = NULL;
+
+    err_t error = NO_ERROR;
+    workloadapi_Watcher *watcher
+        = workloadapi_newWatcher(config, callback, &error);
+    ck_assert_uint_eq(error, NO_ERROR);
+
+    ck_assert_uint_eq(workloadapi_Watcher_Restart(NULL), ERR_NULL);
+    // no stream open, nothing to cancel
+    ck_assert_ptr_eq(watcher->stream, NULL);
+    ck_assert_uint_eq(workloadapi_Watcher_Restart(watcher), NO_ERROR);
+    ck_assert(!watcher->restart);
+
+    // async client streams are not restarted
+    watcher->async_client = (workloadapi_AsyncClient *) watcher;
+    ck_assert_uint_eq(workloadapi_Watcher_Restart(watcher),
+                      ERR_UNSUPPORTED_TYPE);
+    watcher->async_client = NULL;
+
+    workloadapi_Watcher_Free(watcher);
+}
+END_TEST
+
 Suite *watcher_suite(void)
 {
     Suite *s = suite_create("watcher");
@@ -417,6 +494,8 @@ Suite *watcher_suite(void)
     tcase_add_test(tc_core, test_workloadapi_Watcher_WaitUntilUpdated_blocks);
     tcase_add_test(tc_core, test_workloadapi_Watcher_Start_blocks);
     tcase_add_test(tc_core, test_workloadapi_Watcher_Close);
+    tcase_add_test(tc_core, test_workloadapi_Watcher_update_fd);
+    tcase_add_test(tc_core, test_workloadapi_Watcher_Restart);
 
     suite_add_tcase(s, tc_core);
 
@@ -43,8 +43,7 @@ START_TEST(test_workloadapi_NewX509Source_creates_default_config);
                      workloadapi_Client_defaultOptions);
     ck_assert_ptr_eq(tested->config->picker, x509svid_SVID_GetDefaultX509SVID);
 
-    ck_assert_ptr_eq(tested->svids, NULL);
-    ck_assert_ptr_eq(tested->bundles, NULL);
+    ck_assert_ptr_eq(atomic_load(&(tested->snapshot)), NULL);
 
     ck_assert_ptr_eq(tested->watcher->x509callback.args, tested);
 
@@ -79,8 +78,7 @@ START_TEST(test_workloadapi_NewX509Source_uses_config);
                      "unix:///var/example_agent");
     ck_assert(tested->closed);
 
-    ck_assert_ptr_eq(tested->svids, NULL);
-    ck_assert_ptr_eq(tested->bundles, NULL);
+    ck_assert_ptr_eq(atomic_load(&(tested->snapshot)), NULL);
     workloadapi_X509Source_Free(tested);
 }
 END_TEST
@@ -110,16 +108,18 @@ START_TEST(test_workloadapi_X509Source_GetX509SVID_default_picker);
     _svid1.private_key = NULL;
     _svid2.private_key = NULL;
 
-    tested->svids = NULL;
-
-    arrpush(tested->svids, svid1);
-    arrpush(tested->svids, svid2);
+    workloadapi_X509Context ctx = { NULL, NULL };
+    arrpush(ctx.svids, svid1);
+    arrpush(ctx.svids, svid2);
+    workloadapi_X509Source_applyX509Context(tested, &ctx);
     tested->closed = false;
     x509svid_SVID *svid3 = workloadapi_X509Source_GetX509SVID(tested, &err);
 
     ck_assert_ptr_eq(svid3, svid1);
-    arrpop(tested->svids);
-    arrpop(tested->svids);
+    // the SVIDs live on the stack
+    workloadapi_X509Snapshot *snapshot = atomic_load(&(tested->snapshot));
+    arrpop(snapshot->svids);
+    arrpop(snapshot->svids);
     workloadapi_X509Source_Free(tested);
 }
 END_TEST
@@ -149,18 +149,80 @@ START_TEST(test_workloadapi_X509Source_GetX509SVID_custom_picker);
     _svid1.private_key = NULL;
     _svid2.private_key = NULL;
 
-    tested->svids = NULL;
-
-    arrpush(tested->svids, svid1);
-    arrpush(tested->svids, svid2);
+    workloadapi_X509Context ctx = { NULL, NULL };
+    arrpush(ctx.svids, svid1);
+    arrpush(ctx.svids, svid2);
+    workloadapi_X509Source_applyX509Context(tested, &ctx);
     tested->closed = false;
 
     x509svid_SVID *svid3 = workloadapi_X509Source_GetX509SVID(tested, &err);
 
     ck_assert_ptr_eq(svid3, svid2);
-    arrpop(tested->svids);
-    arrpop(tested->svids);
+    // the SVIDs live on the stack
+    workloadapi_X509Snapshot *snapshot = atomic_load(&(tested->snapshot));
+    arrpop(snapshot->svids);
+    arrpop(snapshot->svids);
+    workloadapi_X509Source_Free(tested);
+}
+END_TEST
+
+START_TEST(test_workloadapi_X509Source_GetX509SVIDForID);
+{
+    err_t err;
+    workloadapi_X509Source *tested = workloadapi_NewX509Source(NULL, &err);
+
+    x509svid_SVID _svid1, _svid2, _svid3;
+    x509svid_SVID *svid1 = &_svid1, *svid2 = &_svid2, *svid3 = &_svid3;
+    spiffeid_ID id1
+        = spiffeid_FromString("spiffe://example.org/workload1", &err);
+    spiffeid_ID id2
+        = spiffeid_FromString("spiffe://example.org/workload2", &err);
+    spiffeid_ID id3
+        = spiffeid_FromString("spiffe://example.org/workload3", &err);
+    _svid1.id = id1;
+    _svid2.id = id2;
+    // same ID as the first one
+    _svid3.id = id1;
+
+    x509svid_SVID *svid
+        = workloadapi_X509Source_GetX509SVIDForID(tested, id1, &err);
+    ck_assert_ptr_eq(svid, NULL);
+    ck_assert_int_eq(err, ERR_CLOSED);
+
+    workloadapi_X509Context ctx = { NULL, NULL };
+    arrpush(ctx.svids, svid1);
+    arrpush(ctx.svids, svid2);
+    arrpush(ctx.svids, svid3);
+    workloadapi_X509Source_applyX509Context(tested, &ctx);
+    tested->closed = false;
+
+    ck_assert_ptr_eq(
+        workloadapi_X509Source_GetX509SVIDForID(tested, id1, &err), svid1);
+    ck_assert_int_eq(err, NO_ERROR);
+    ck_assert_ptr_eq(
+        workloadapi_X509Source_GetX509SVIDForID(tested, id2, &err), svid2);
+    ck_assert_int_eq(err, NO_ERROR);
+    ck_assert_ptr_eq(
+        workloadapi_X509Source_GetX509SVIDForID(tested, id3, &err), NULL);
+    ck_assert_int_eq(err, ERR_NOT_FOUND);
+
+    // the index follows a rotation
+    workloadapi_X509Context rotated = { NULL, NULL };
+    arrpush(rotated.svids, svid3);
+    arrpush(rotated.svids, svid2);
+    workloadapi_X509Source_applyX509Context(tested, &rotated);
+    ck_assert_ptr_eq(
+        workloadapi_X509Source_GetX509SVIDForID(tested, id1, &err), svid3);
+    ck_assert_int_eq(err, NO_ERROR);
+
+    // the SVIDs live on the stack
+    arrsetlen(atomic_load(&(tested->snapshot))->svids, 0);
+    arrsetlen(tested->retired->svids, 0);
+    tested->closed = true;
     workloadapi_X509Source_Free(tested);
+    spiffeid_ID_Free(&id1);
+    spiffeid_ID_Free(&id2);
+    spiffeid_ID_Free(&id3);
 }
 END_TEST
 
@@ -170,17 +232,41 @@ START_TEST(test_workloadapi_X509Source_applyX509Context);
     workloadapi_X509Source *tested = workloadapi_NewX509Source(NULL, &err);
 
     workloadapi_X509Context ctx;
-    ctx.bundles = (x509bundle_Set *) 1;
-    ctx.svids = (x509svid_SVID **) 2;
+    ctx.bundles = x509bundle_NewSet(0);
+    ctx.svids = NULL;
 
     workloadapi_X509Source_applyX509Context(tested, &ctx);
 
-    ck_assert_ptr_eq(tested->bundles, (x509bundle_Set *) 1);
+    workloadapi_X509Snapshot *first = atomic_load(&(tested->snapshot));
+    ck_assert_ptr_eq(first->bundles, ctx.bundles);
+    ck_assert_ptr_eq(first->svids, NULL);
+    ck_assert_ptr_eq(first->svid, NULL);
+    ck_assert_uint_eq(first->generation, 1);
 
-    ck_assert_ptr_eq(tested->svids, (x509svid_SVID **) 2);
+    // a reader holds on to the first snapshot across two updates
+    tested->closed = false;
+    workloadapi_X509Snapshot *held
+        = workloadapi_X509Source_AcquireSnapshot(tested, &err);
+    ck_assert_int_eq(err, NO_ERROR);
+    ck_assert_ptr_eq(held, first);
+    ck_assert_int_eq(atomic_load(&(held->refs)), 2);
 
-    tested->bundles = NULL;
-    tested->svids = NULL;
+    ctx.bundles = x509bundle_NewSet(0);
+    workloadapi_X509Source_applyX509Context(tested, &ctx);
+    ck_assert_ptr_ne(atomic_load(&(tested->snapshot)), first);
+    ck_assert_ptr_eq(tested->retired, first);
+    ck_assert_uint_eq(atomic_load(&(tested->snapshot))->generation, 2);
+
+    ctx.bundles = x509bundle_NewSet(0);
+    workloadapi_X509Source_applyX509Context(tested, &ctx);
+    ck_assert_ptr_ne(tested->retired, first);
+
+    // the source let go of it, the reader did not yet
+    ck_assert_int_eq(atomic_load(&(held->refs)), 1);
+    ck_assert_ptr_ne(held->bundles, NULL);
+    workloadapi_X509Snapshot_Release(held);
+
+    tested->closed = true;
     workloadapi_X509Source_Free(tested);
 }
 END_TEST
@@ -216,8 +302,6 @@ START_TEST(test_workloadapi_X509Source_Start_waits_and_sets_closed_false);
 
     workloadapi_X509Source_Close(tested);
 
-    tested->bundles = NULL;
-    tested->svids = NULL;
     workloadapi_X509Source_Free(tested);
 }
 END_TEST
@@ -247,8 +331,6 @@ START_TEST(test_workloadapi_X509Source_Closes_watcher);
     ck_assert_int_eq(workloadapi_X509Source_checkClosed(tested), ERR_CLOSED);
     ck_assert(tested->watcher->closed);
 
-    tested->bundles = NULL;
-    tested->svids = NULL;
     workloadapi_X509Source_Free(tested);
 }
 END_TEST
@@ -267,20 +349,72 @@ START_TEST(test_workloadapi_X509Source_GetX509BundleForTrustDomain);
     ck_assert_int_eq(err, ERR_CLOSED); // source closed
 
     tested->closed = false;
-    tested->bundles = x509bundle_NewSet(0);
+    workloadapi_X509Context ctx = { NULL, x509bundle_NewSet(0) };
+    workloadapi_X509Source_applyX509Context(tested, &ctx);
     bundle
         = workloadapi_X509Source_GetX509BundleForTrustDomain(tested, td, &err);
 
     ck_assert_ptr_eq(bundle, NULL);
     ck_assert_int_eq(err, ERR_CLOSED); // trust domain not available
 
-    x509bundle_Set_Free(tested->bundles);
-    tested->bundles = NULL;
     tested->closed = true;
     workloadapi_X509Source_Free(tested);
 }
 END_TEST
 
+// records the generation of the snapshot it is called with
+void record_x509_generation(workloadapi_X509Snapshot *snapshot, void *args)
+{
+    uint64_t **generations = (uint64_t **) args;
+    arrput(*generations, snapshot->generation);
+}
+
+START_TEST(test_workloadapi_X509Source_Subscribe);
+{
+    err_t err;
+    workloadapi_X509Source *tested = workloadapi_NewX509Source(NULL, &err);
+    uint64_t *first = NULL, *second = NULL;
+
+    workloadapi_X509SnapshotCallback callback
+        = { .args = &first, .func = record_x509_generation };
+    const int first_id
+        = workloadapi_X509Source_Subscribe(tested, callback, &err);
+    ck_assert_int_eq(err, NO_ERROR);
+    callback.args = &second;
+    const int second_id
+        = workloadapi_X509Source_Subscribe(tested, callback, &err);
+    ck_assert_int_eq(err, NO_ERROR);
+    ck_assert_int_ne(first_id, second_id);
+
+    // both are called with the published snapshot
+    workloadapi_X509Context ctx = { NULL, x509bundle_NewSet(0) };
+    workloadapi_X509Source_applyX509Context(tested, &ctx);
+    ck_assert_uint_eq(arrlenu(first), 1);
+    ck_assert_uint_eq(first[0], 1);
+    ck_assert_uint_eq(arrlenu(second), 1);
+    ck_assert_uint_eq(second[0], 1);
+
+    ck_assert_int_eq(workloadapi_X509Source_Unsubscribe(tested, first_id),
+                     NO_ERROR);
+    ck_assert_int_eq(workloadapi_X509Source_Unsubscribe(tested, first_id),
+                     ERR_NOT_FOUND);
+
+    ctx.bundles = x509bundle_NewSet(0);
+    workloadapi_X509Source_applyX509Context(tested, &ctx);
+    ck_assert_uint_eq(arrlenu(first), 1);
+    ck_assert_uint_eq(arrlenu(second), 2);
+    ck_assert_uint_eq(second[1], 2);
+
+    callback.func = NULL;
+    workloadapi_X509Source_Subscribe(tested, callback, &err);
+    ck_assert_int_eq(err, ERR_NULL);
+
+    arrfree(first);
+    arrfree(second);
+    workloadapi_X509Source_Free(tested);
+}
+END_TEST
+
 Suite *watcher_suite(void)
 {
     Suite *s = suite_create("x509source");
@@ -293,7 +427,9 @@ Suite *watcher_suite(void)
                    test_workloadapi_X509Source_GetX509SVID_default_picker);
     tcase_add_test(tc_core,
                    test_workloadapi_X509Source_GetX509SVID_custom_picker);
+    tcase_add_test(tc_core, test_workloadapi_X509Source_GetX509SVIDForID);
     tcase_add_test(tc_core, test_workloadapi_X509Source_applyX509Context);
+    tcase_add_test(tc_core, test_workloadapi_X509Source_Subscribe);
     tcase_add_test(
         tc_core,
         test_workloadapi_X509Source_Start_waits_and_sets_closed_false);
@@ -0,0 +1,366 @@
+/**
+ *
+ * (C) Copyright 2020-2021 Hewlett Packard Enterprise Development LP
+ *
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include "c-spiffe/workload/updatecache.h"
+#include "c-spiffe/internal/x509util/util.h"
+#include <openssl/evp.h>
+#include <stdint.h>
+
+// SHA-256 of both buffers, each prefixed by its length so that moving
+// bytes from one to the other changes the digest.
+static void workloadapi_digest(unsigned char digest[SHA256_DIGEST_LENGTH],
+                               const byte *bytes1, size_t len1,
+                               const byte *bytes2, size_t len2)
+{
+    EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+    const uint64_t len1_u64 = len1, len2_u64 = len2;
+
+    EVP_DigestInit_ex(ctx, EVP_sha256(), NULL);
+    EVP_DigestUpdate(ctx, &len1_u64, sizeof len1_u64);
+    if(len1 > 0) {
+        EVP_DigestUpdate(ctx, bytes1, len1);
+    }
+    EVP_DigestUpdate(ctx, &len2_u64, sizeof len2_u64);
+    if(len2 > 0) {
+        EVP_DigestUpdate(ctx, bytes2, len2);
+    }
+    EVP_DigestFinal_ex(ctx, digest, NULL);
+    EVP_MD_CTX_free(ctx);
+}
+
+// adds str to arr, unless it is there already
+static void workloadapi_deltaAdd(string_arr_t *arr, const char *str)
+{
+    for(size_t i = 0, size = arrlenu(*arr); i < size; ++i) {
+        if(!strcmp((*arr)[i], str)) {
+            return;
+        }
+    }
+    arrput(*arr, string_new(str));
+}
+
+static void
+workloadapi_authoritiesFree(workloadapi_X509AuthoritiesCacheEntry *entry)
+{
+    for(size_t i = 0, size = arrlenu(entry->certs); i < size; ++i) {
+        X509_free(entry->certs[i]);
+    }
+    arrfree(entry->certs);
+    free(entry);
+}
+
+static void workloadapi_deltaClear(workloadapi_UpdateDelta *delta)
+{
+    util_string_arr_t_Free(delta->changed_svids);
+    util_string_arr_t_Free(delta->removed_svids);
+    util_string_arr_t_Free(delta->changed_bundles);
+    util_string_arr_t_Free(delta->removed_bundles);
+    memset(delta, 0, sizeof *delta);
+}
+
+workloadapi_UpdateCache *workloadapi_NewUpdateCache(void)
+{
+    workloadapi_UpdateCache *cache = calloc(1, sizeof *cache);
+    if(cache) {
+        sh_new_strdup(cache->x509svids);
+        shdefault(cache->x509svids, NULL);
+        sh_new_strdup(cache->x509bundles);
+        shdefault(cache->x509bundles, NULL);
+        sh_new_strdup(cache->jwtbundles);
+        shdefault(cache->jwtbundles, NULL);
+    }
+
+    return cache;
+}
+
+void workloadapi_UpdateCache_Free(workloadapi_UpdateCache *cache)
+{
+    if(cache) {
+        for(size_t i = 0, size = shlenu(cache->x509svids); i < size; ++i) {
+            x509svid_SVID_Free(cache->x509svids[i].value->svid);
+            free(cache->x509svids[i].value);
+        }
+        shfree(cache->x509svids);
+        for(size_t i = 0, size = shlenu(cache->x509bundles); i < size; ++i) {
+            x509bundle_Bundle_Free(cache->x509bundles[i].value->bundle);
+            free(cache->x509bundles[i].value);
+        }
+        shfree(cache->x509bundles);
+        for(size_t i = 0, size = hmlenu(cache->x509authorities); i < size;
+            ++i) {
+            workloadapi_authoritiesFree(cache->x509authorities[i].value);
+        }
+        hmfree(cache->x509authorities);
+        for(size_t i = 0, size = shlenu(cache->jwtbundles); i < size; ++i) {
+            jwtbundle_Bundle_Free(cache->jwtbundles[i].value->bundle);
+            free(cache->jwtbundles[i].value);
+        }
+        shfree(cache->jwtbundles);
+        workloadapi_deltaClear(&(cache->delta));
+        free(cache);
+    }
+}
+
+void workloadapi_UpdateCache_Begin(workloadapi_UpdateCache *cache)
+{
+    workloadapi_deltaClear(&(cache->delta));
+    for(size_t i = 0, size = shlenu(cache->x509svids); i < size; ++i) {
+        cache->x509svids[i].value->seen = false;
+    }
+    for(size_t i = 0, size = shlenu(cache->x509bundles); i < size; ++i) {
+        cache->x509bundles[i].value->seen = false;
+    }
+    for(size_t i = 0, size = hmlenu(cache->x509authorities); i < size; ++i) {
+        cache->x509authorities[i].value->seen = false;
+    }
+    for(size_t i = 0, size = shlenu(cache->jwtbundles); i < size; ++i) {
+        cache->jwtbundles[i].value->seen = false;
+    }
+}
+
+void workloadapi_UpdateCache_End(workloadapi_UpdateCache *cache)
+{
+    // backwards, as shdel moves the last entry into the deleted one
+    for(ptrdiff_t i = shlen(cache->x509svids) - 1; i >= 0; --i) {
+        workloadapi_X509SVIDCacheEntry *entry = cache->x509svids[i].value;
+        if(!entry->seen) {
+            workloadapi_deltaAdd(&(cache->delta.removed_svids),
+                                 cache->x509svids[i].key);
+            x509svid_SVID_Free(entry->svid);
+            free(entry);
+            shdel(cache->x509svids, cache->x509svids[i].key);
+        }
+    }
+    for(ptrdiff_t i = shlen(cache->x509bundles) - 1; i >= 0; --i) {
+        workloadapi_X509BundleCacheEntry *entry = cache->x509bundles[i].value;
+        if(!entry->seen) {
+            workloadapi_deltaAdd(&(cache->delta.removed_bundles),
+                                 cache->x509bundles[i].key);
+            x509bundle_Bundle_Free(entry->bundle);
+            free(entry);
+            shdel(cache->x509bundles, cache->x509bundles[i].key);
+        }
+    }
+    for(ptrdiff_t i = hmlen(cache->x509authorities) - 1; i >= 0; --i) {
+        workloadapi_X509AuthoritiesCacheEntry *entry
+            = cache->x509authorities[i].value;
+        if(!entry->seen) {
+            workloadapi_authoritiesFree(entry);
+            hmdel(cache->x509authorities, cache->x509authorities[i].key);
+        }
+    }
+    for(ptrdiff_t i = shlen(cache->jwtbundles) - 1; i >= 0; --i) {
+        workloadapi_JWTBundleCacheEntry *entry = cache->jwtbundles[i].value;
+        if(!entry->seen) {
+            workloadapi_deltaAdd(&(cache->delta.removed_bundles),
+                                 cache->jwtbundles[i].key);
+            jwtbundle_Bundle_Free(entry->bundle);
+            free(entry);
+            shdel(cache->jwtbundles, cache->jwtbundles[i].key);
+        }
+    }
+}
+
+void workloadapi_UpdateCache_Abort(workloadapi_UpdateCache *cache)
+{
+    // the delta lists every entry replaced since Begin. a zeroed digest
+    // matches no bytes, so they are decoded again by the next update.
+    for(size_t i = 0, size = arrlenu(cache->delta.changed_svids); i < size;
+        ++i) {
+        workloadapi_X509SVIDCacheEntry *entry
+            = shget(cache->x509svids, cache->delta.changed_svids[i]);
+        if(entry) {
+            memset(entry->digest, 0, sizeof entry->digest);
+        }
+    }
+    for(size_t i = 0, size = arrlenu(cache->delta.changed_bundles); i < size;
+        ++i) {
+        const char *td = cache->delta.changed_bundles[i];
+        workloadapi_X509BundleCacheEntry *x509entry
+            = shget(cache->x509bundles, td);
+        if(x509entry) {
+            memset(x509entry->digest, 0, sizeof x509entry->digest);
+        }
+        workloadapi_JWTBundleCacheEntry *jwtentry
+            = shget(cache->jwtbundles, td);
+        if(jwtentry) {
+            memset(jwtentry->digest, 0, sizeof jwtentry->digest);
+        }
+    }
+    workloadapi_deltaClear(&(cache->delta));
+}
+
+bool workloadapi_UpdateCache_Changed(const workloadapi_UpdateCache *cache)
+{
+    return arrlenu(cache->delta.changed_svids) > 0
+           || arrlenu(cache->delta.removed_svids) > 0
+           || arrlenu(cache->delta.changed_bundles) > 0
+           || arrlenu(cache->delta.removed_bundles) > 0;
+}
+
+x509svid_SVID *workloadapi_UpdateCache_ParseX509SVID(
+    workloadapi_UpdateCache *cache, const char *id, const byte *certbytes,
+    size_t certlen, const byte *keybytes, size_t keylen, err_t *err)
+{
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+    workloadapi_digest(digest, certbytes, certlen, keybytes, keylen);
+
+    workloadapi_X509SVIDCacheEntry *entry = shget(cache->x509svids, id);
+    if(entry && !memcmp(entry->digest, digest, sizeof digest)) {
+        // unchanged, no need to decode it again
+        entry->seen = true;
+        *err = NO_ERROR;
+        return x509svid_SVID_Clone(entry->svid);
+    }
+
+    x509svid_SVID *svid
+        = x509svid_ParseRaw(certbytes, certlen, keybytes, keylen, err);
+    if(*err != NO_ERROR) {
+        return NULL;
+    }
+
+    if(entry) {
+        x509svid_SVID_Free(entry->svid);
+    } else {
+        entry = calloc(1, sizeof *entry);
+        shput(cache->x509svids, id, entry);
+    }
+    memcpy(entry->digest, digest, sizeof digest);
+    entry->svid = svid;
+    entry->seen = true;
+    workloadapi_deltaAdd(&(cache->delta.changed_svids), id);
+
+    return x509svid_SVID_Clone(svid);
+}
+
+// authorities decoded from bundle bytes with the given digest, decoding
+// them only if no trust domain had the same bytes
+static X509 **workloadapi_x509Authorities(workloadapi_UpdateCache *cache,
+                                          const unsigned char *digest,
+                                          const byte *bytes, size_t len,
+                                          err_t *err)
+{
+    workloadapi_Digest key;
+    memcpy(key.bytes, digest, sizeof key.bytes);
+    const ptrdiff_t idx = hmgeti(cache->x509authorities, key);
+    if(idx >= 0) {
+        cache->x509authorities[idx].value->seen = true;
+        *err = NO_ERROR;
+        return cache->x509authorities[idx].value->certs;
+    }
+
+    X509 **certs = x509util_ParseCertificates(bytes, len, err);
+    if(*err != NO_ERROR) {
+        for(size_t i = 0, size = arrlenu(certs); i < size; ++i) {
+            X509_free(certs[i]);
+        }
+        arrfree(certs);
+        return NULL;
+    }
+    workloadapi_X509AuthoritiesCacheEntry *entry = calloc(1, sizeof *entry);
+    entry->certs = certs;
+    entry->seen = true;
+    hmput(cache->x509authorities, key, entry);
+
+    return certs;
+}
+
+x509bundle_Bundle *workloadapi_UpdateCache_ParseX509Bundle(
+    workloadapi_UpdateCache *cache, const spiffeid_TrustDomain td,
+    const byte *bytes, size_t len, err_t *err)
+{
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+    workloadapi_digest(digest, bytes, len, NULL, 0);
+
+    workloadapi_X509BundleCacheEntry *entry
+        = shget(cache->x509bundles, td.name);
+    if(entry && !memcmp(entry->digest, digest, sizeof digest)) {
+        // unchanged, no need to decode it again. Its authorities are kept
+        // for other trust domains with the same bytes
+        workloadapi_Digest key;
+        memcpy(key.bytes, digest, sizeof key.bytes);
+        const ptrdiff_t idx = hmgeti(cache->x509authorities, key);
+        if(idx >= 0) {
+            cache->x509authorities[idx].value->seen = true;
+        }
+        entry->seen = true;
+        *err = NO_ERROR;
+        return x509bundle_Bundle_Clone(entry->bundle);
+    }
+
+    X509 **certs = workloadapi_x509Authorities(cache, digest, bytes, len, err);
+    if(*err != NO_ERROR) {
+        return NULL;
+    }
+    x509bundle_Bundle *bundle = x509bundle_FromX509Authorities(td, certs);
+
+    if(entry) {
+        x509bundle_Bundle_Free(entry->bundle);
+    } else {
+        entry = calloc(1, sizeof *entry);
+        shput(cache->x509bundles, td.name, entry);
+    }
+    memcpy(entry->digest, digest, sizeof digest);
+    entry->bundle = bundle;
+    entry->seen = true;
+    workloadapi_deltaAdd(&(cache->delta.changed_bundles), td.name);
+
+    return x509bundle_Bundle_Clone(bundle);
+}
+
+jwtbundle_Bundle *workloadapi_UpdateCache_ParseJWTBundle(
+    workloadapi_UpdateCache *cache, const spiffeid_TrustDomain td,
+    const char *bytes, size_t len, err_t *err)
+{
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+    workloadapi_digest(digest, (const byte *) bytes, len, NULL, 0);
+
+    workloadapi_JWTBundleCacheEntry *entry
+        = shget(cache->jwtbundles, td.name);
+    if(entry && !memcmp(entry->digest, digest, sizeof digest)) {
+        // unchanged, no need to decode it again
+        entry->seen = true;
+        *err = NO_ERROR;
+        return jwtbundle_Bundle_Clone(entry->bundle);
+    }
+
+    jwtbundle_Bundle *bundle = jwtbundle_Parse(td, bytes, err);
+    if(*err != NO_ERROR || !bundle) {
+        jwtbundle_Bundle_Free(bundle);
+        return NULL;
+    }
+
+    if(entry) {
+        jwtbundle_Bundle_Free(entry->bundle);
+    } else {
+        entry = calloc(1, sizeof *entry);
+        shput(cache->jwtbundles, td.name, entry);
+    }
+    memcpy(entry->digest, digest, sizeof digest);
+    entry->bundle = bundle;
+    entry->seen = true;
+    workloadapi_deltaAdd(&(cache->delta.changed_bundles), td.name);
+
+    return jwtbundle_Bundle_Clone(bundle);
+}
@@ -23,9 +23,12 @@
  */
 
 #include "c-spiffe/workload/watcher.h"
+#include "c-spiffe/workload/asyncclient.h"
 #include "c-spiffe/workload/client.h"
 #include "c-spiffe/workload/x509context.h"
 #include "c-spiffe/workload/x509source.h"
+#include <sys/eventfd.h>
+#include <unistd.h>
 
 // Function that will run on thread spun for watcher
 int workloadapi_Watcher_X509backgroundFunc(void *_watcher)
@@ -101,35 +104,59 @@ workloadapi_newWatcher(workloadapi_WatcherConfig config,
         *error = ERR_NULL;
         return NULL;
     }
+    newW->update_cache = workloadapi_NewUpdateCache();
+    // not fatal, only pollers need it
+    newW->update_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
 
     return newW;
 }
 
-// starts watcher and blocks waiting on an update.
-err_t workloadapi_Watcher_Start(workloadapi_Watcher *watcher)
+// starts watcher without waiting for an update.
+err_t workloadapi_Watcher_StartAsync(workloadapi_Watcher *watcher)
 {
     err_t error = NO_ERROR;
     if(!watcher) {
         return ERR_NULL; /// NULL WATCHER;
     }
-    error = workloadapi_Client_Connect(watcher->client);
-    if(error != NO_ERROR) {
-        return error;
-    }
-    /// spin watcher thread out.
-    int thread_error
-        = thrd_create(&(watcher->watcher_thread),
-                      workloadapi_Watcher_X509backgroundFunc, watcher);
+    if(watcher->async_client) {
+        /// register stream on the async client event thread.
+        error = workloadapi_AsyncClient_WatchX509Context(watcher->async_client,
+                                                         watcher);
+        if(error != NO_ERROR) {
+            return error;
+        }
+    } else {
+        error = workloadapi_Client_Connect(watcher->client);
+        if(error != NO_ERROR) {
+            return error;
+        }
+        /// spin watcher thread out.
+        int thread_error
+            = thrd_create(&(watcher->watcher_thread),
+                          workloadapi_Watcher_X509backgroundFunc, watcher);
 
-    if(thread_error != thrd_success) {
-        watcher->thread_error = thread_error;
-        return ERR_THREAD; // THREAD ERROR, see watcher->threadERROR for error
+        if(thread_error != thrd_success) {
+            watcher->thread_error = thread_error;
+            // THREAD ERROR, see watcher->threadERROR for error
+            return ERR_THREAD;
+        }
     }
 
     mtx_lock(&(watcher->close_mutex));
     watcher->closed = false;
     mtx_unlock(&(watcher->close_mutex));
 
+    return NO_ERROR;
+}
+
+// starts watcher and blocks waiting on an update.
+err_t workloadapi_Watcher_Start(workloadapi_Watcher *watcher)
+{
+    err_t error = workloadapi_Watcher_StartAsync(watcher);
+    if(error != NO_ERROR) {
+        return error;
+    }
+
     /// wait for update and check for errors.
     error = workloadapi_Watcher_WaitUntilUpdated(watcher);
     if(error != NO_ERROR) {
@@ -145,6 +172,14 @@ err_t workloadapi_Watcher_Start(workloadapi_Watcher *watcher)
 // drops connection to WorkloadAPI (if owns client)
 err_t workloadapi_Watcher_Close(workloadapi_Watcher *watcher)
 {
+    if(watcher->async_client) {
+        mtx_lock(&(watcher->close_mutex));
+        watcher->closed = true;
+        mtx_unlock(&(watcher->close_mutex));
+        // no callback runs for this watcher once the call returns.
+        return workloadapi_AsyncClient_CancelWatch(watcher->async_client,
+                                                   watcher);
+    }
     mtx_lock(&(watcher->close_mutex));
     watcher->closed = true;
     err_t error = NO_ERROR;
@@ -167,6 +202,43 @@ err_t workloadapi_Watcher_Close(workloadapi_Watcher *watcher)
     return ERR_CLOSING;
 }
 
+err_t workloadapi_Watcher_SetAsyncClient(
+    workloadapi_Watcher *watcher, workloadapi_AsyncClient *async_client)
+{
+    if(!watcher || !async_client) {
+        return ERR_NULL;
+    }
+    mtx_lock(&(watcher->close_mutex));
+    if(!watcher->closed) {
+        mtx_unlock(&(watcher->close_mutex));
+        return ERR_EXISTS; // already started
+    }
+    if(watcher->owns_client) {
+        workloadapi_Client_Free(watcher->client);
+        watcher->owns_client = false;
+    }
+    watcher->client = async_client->client;
+    watcher->async_client = async_client;
+    mtx_unlock(&(watcher->close_mutex));
+    return NO_ERROR;
+}
+
+err_t workloadapi_Watcher_SetDeltaCallback(workloadapi_Watcher *watcher,
+                                           workloadapi_DeltaCallback callback)
+{
+    if(!watcher) {
+        return ERR_NULL;
+    }
+    mtx_lock(&(watcher->close_mutex));
+    if(!watcher->closed) {
+        mtx_unlock(&(watcher->close_mutex));
+        return ERR_EXISTS; // already started
+    }
+    watcher->delta_callback = callback;
+    mtx_unlock(&(watcher->close_mutex));
+    return NO_ERROR;
+}
+
 // Free's Watcher (if owns client) MUST ALREADY BE CLOSED.
 err_t workloadapi_Watcher_Free(/*context,*/ workloadapi_Watcher *watcher)
 {
@@ -176,6 +248,10 @@ err_t workloadapi_Watcher_Free(/*context,*/ workloadapi_Watcher *watcher)
     if(watcher->owns_client) {
         workloadapi_Client_Free(watcher->client);
     }
+    workloadapi_UpdateCache_Free(watcher->update_cache);
+    if(watcher->update_fd >= 0) {
+        close(watcher->update_fd);
+    }
     free(watcher);
     return NO_ERROR;
 }
@@ -186,6 +262,11 @@ void workloadapi_Watcher_OnX509ContextUpdate(workloadapi_Watcher *watcher,
 {
     void *args = watcher->x509callback.args;
     watcher->x509callback.func(context, args);
+    if(watcher->delta_callback.func
+       && workloadapi_UpdateCache_Changed(watcher->update_cache)) {
+        watcher->delta_callback.func(&(watcher->update_cache->delta),
+                                     watcher->delta_callback.args);
+    }
     workloadapi_Watcher_TriggerUpdated(watcher);
 }
 
@@ -206,10 +287,8 @@ err_t workloadapi_Watcher_TimedWaitUntilUpdated(workloadapi_Watcher *watcher,
                                                 const struct timespec *timer)
 {
     mtx_lock(&watcher->update_mutex);
-    if(watcher->updated) {
-        mtx_unlock(&watcher->update_mutex);
-        return NO_ERROR;
-    } else {
+    // loops on spurious wakeups, only an update sets updated
+    while(!watcher->updated) {
         int thread_error = thrd_success;
         if(timer != NULL) {
             thread_error = cnd_timedwait(&(watcher->update_cond),
@@ -222,13 +301,13 @@ err_t workloadapi_Watcher_TimedWaitUntilUpdated(workloadapi_Watcher *watcher,
             thread_error
                 = cnd_wait(&(watcher->update_cond), &(watcher->update_mutex));
         }
-        mtx_unlock(&watcher->update_mutex);
         if(thread_error != thrd_success) {
+            mtx_unlock(&watcher->update_mutex);
             return ERR_WAITING;
-        } else {
-            return NO_ERROR;
         }
     }
+    mtx_unlock(&watcher->update_mutex);
+    return NO_ERROR;
 }
 
 err_t workloadapi_Watcher_TriggerUpdated(workloadapi_Watcher *watcher)
@@ -238,6 +317,7 @@ err_t workloadapi_Watcher_TriggerUpdated(workloadapi_Watcher *watcher)
         return error; // lock error
     }
     watcher->updated = true;
+    ++(watcher->generation);
     if(error = (err_t) cnd_broadcast(&(watcher->update_cond))) {
         // save broadcast error, so if we also error on unlock
         // we have a way to check it
@@ -247,8 +327,69 @@ err_t workloadapi_Watcher_TriggerUpdated(workloadapi_Watcher *watcher)
         // if unlock
         return error;
     }
+    if(watcher->update_fd >= 0) {
+        // written after the generation is bumped, so a woken poller sees it.
+        // only fails once the counter saturates, it is readable then anyway
+        const uint64_t one = 1;
+        const ssize_t written = write(watcher->update_fd, &one, sizeof one);
+        (void) written;
+    }
     if(!error) {
         return (err_t) watcher->thread_error;
     }
     return error;
 }
+
+uint64_t workloadapi_Watcher_GetGeneration(workloadapi_Watcher *watcher)
+{
+    mtx_lock(&(watcher->update_mutex));
+    const uint64_t generation = watcher->generation;
+    mtx_unlock(&(watcher->update_mutex));
+    return generation;
+}
+
+workloadapi_PipelineStats
+workloadapi_Watcher_GetPipelineStats(workloadapi_Watcher *watcher)
+{
+    mtx_lock(&(watcher->update_mutex));
+    workloadapi_PipelineStats stats = watcher->pipeline_stats;
+    mtx_unlock(&(watcher->update_mutex));
+    return stats;
+}
+
+int workloadapi_Watcher_GetUpdateFd(workloadapi_Watcher *watcher)
+{
+    return watcher->update_fd;
+}
+
+uint64_t workloadapi_Watcher_ClearUpdateFd(workloadapi_Watcher *watcher)
+{
+    if(watcher->update_fd >= 0) {
+        // non blocking, fails with EAGAIN if already cleared
+        uint64_t count;
+        const ssize_t nread = read(watcher->update_fd, &count, sizeof count);
+        (void) nread;
+    }
+    // read after clearing, an update landing in between is reported here
+    // and makes the descriptor readable again
+    return workloadapi_Watcher_GetGeneration(watcher);
+}
+
+err_t workloadapi_Watcher_Restart(workloadapi_Watcher *watcher)
+{
+    if(!watcher) {
+        return ERR_NULL;
+    }
+    if(watcher->async_client) {
+        return ERR_UNSUPPORTED_TYPE;
+    }
+    mtx_lock(&(watcher->update_mutex));
+    if(watcher->stream) {
+        // the stream unpublishes its context under the lock before it ends
+        watcher->restart = true;
+        workloadapi_Client_CancelContext(watcher->stream);
+    }
+    mtx_unlock(&(watcher->update_mutex));
+
+    return NO_ERROR;
+}
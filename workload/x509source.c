@@ -24,6 +24,81 @@
 
 #include "c-spiffe/workload/x509source.h"
 #include "c-spiffe/workload/watcher.h"
+#include <openssl/asn1.h>
+#include <time.h>
+
+// writes the index key of id into buf if it fits, else into a new buffer
+// the caller frees.
+static char *workloadapi_svidKey(char *buf, size_t size, const spiffeid_ID id)
+{
+    const size_t td_len = id.td.name ? strlen(id.td.name) : 0;
+    const size_t path_len = id.path ? strlen(id.path) : 0;
+    char *key = td_len + path_len < size ? buf : malloc(td_len + path_len + 1);
+    if(td_len > 0) {
+        memcpy(key, id.td.name, td_len);
+    }
+    if(path_len > 0) {
+        memcpy(key + td_len, id.path, path_len);
+    }
+    key[td_len + path_len] = '\0';
+    return key;
+}
+
+// reads the validity period of the leaf certificate of svid
+static bool workloadapi_svidLifetime(const x509svid_SVID *svid,
+                                     time_t *issued, time_t *expiry)
+{
+    if(arrlenu(svid->certs) == 0) {
+        return false;
+    }
+    struct tm tm;
+    if(!ASN1_TIME_to_tm(X509_get0_notBefore(svid->certs[0]), &tm)) {
+        return false;
+    }
+    *issued = timegm(&tm);
+    if(!ASN1_TIME_to_tm(X509_get0_notAfter(svid->certs[0]), &tm)) {
+        return false;
+    }
+    *expiry = timegm(&tm);
+    return true;
+}
+
+// tracks the SVIDs of snapshot and stops tracking those only in old.
+// Called before publishing snapshot, as lookups write to its index.
+static void workloadapi_trackExpiry(workloadapi_ExpiryMonitor *monitor,
+                                    workloadapi_X509Snapshot *snapshot,
+                                    workloadapi_X509Snapshot *old)
+{
+    if(old) {
+        for(size_t i = 0, size = shlenu(old->svids_by_id); i < size; ++i) {
+            if(shgeti(snapshot->svids_by_id, old->svids_by_id[i].key) < 0) {
+                workloadapi_ExpiryMonitor_Untrack(monitor,
+                                                  old->svids_by_id[i].key);
+            }
+        }
+    }
+    for(size_t i = 0, size = shlenu(snapshot->svids_by_id); i < size; ++i) {
+        time_t issued, expiry;
+        if(workloadapi_svidLifetime(snapshot->svids_by_id[i].value, &issued,
+                                    &expiry)) {
+            workloadapi_ExpiryMonitor_Track(
+                monitor, snapshot->svids_by_id[i].key, issued, expiry);
+        }
+    }
+}
+
+// an SVID was not rotated in time, the stream may be stuck
+static void workloadapi_x509Source_onExpiry(const char *key, time_t expiry,
+                                            void *args)
+{
+    workloadapi_X509Source *source = (workloadapi_X509Source *) args;
+    workloadapi_ExpiryCallback *callback
+        = &(source->config->expiry_callback);
+    if(callback->func) {
+        callback->func(key, expiry, callback->args);
+    }
+    workloadapi_Watcher_Restart(source->watcher);
+}
 
 void workloadapi_x509Source_onX509ContextCallback(
     workloadapi_X509Context *x509cntx, void *args)
@@ -42,11 +117,18 @@ workloadapi_NewX509Source(workloadapi_X509SourceConfig *config, err_t *err)
 
     workloadapi_X509Source *source
         = (workloadapi_X509Source *) malloc(sizeof *source);
-    source->closed = true;
+    atomic_init(&(source->closed), true);
     mtx_init(&(source->mtx), mtx_plain);
     mtx_init(&(source->closed_mutex), mtx_plain);
-    source->svids = NULL;
-    source->bundles = NULL;
+    atomic_init(&(source->snapshot), NULL);
+    source->retired = NULL;
+    atomic_init(&(source->epoch), 0);
+    atomic_init(&(source->readers[0]), 0);
+    atomic_init(&(source->readers[1]), 0);
+    source->subscribers = NULL;
+    source->last_subscriber_id = 0;
+    mtx_init(&(source->subscribers_mutex), mtx_plain);
+    source->expiry_monitor = NULL;
     source->config = config;
     if(!source->config->picker) {
         source->config->picker = x509svid_SVID_GetDefaultX509SVID;
@@ -70,15 +152,60 @@ workloadapi_NewX509Source(workloadapi_X509SourceConfig *config, err_t *err)
 
 // blocks until first SVID update is received
 err_t workloadapi_X509Source_Start(workloadapi_X509Source *source)
+{
+    err_t err = workloadapi_X509Source_StartAsync(source);
+    if(err != NO_ERROR) {
+        return err;
+    }
+    return workloadapi_Watcher_WaitUntilUpdated(source->watcher);
+}
+
+// undoes a start that failed half-way, so a later one can try again
+static void workloadapi_X509Source_failStart(workloadapi_X509Source *source)
+{
+    workloadapi_ExpiryMonitor_Stop(source->expiry_monitor);
+    mtx_lock(&(source->closed_mutex));
+    source->closed = true;
+    mtx_unlock(&(source->closed_mutex));
+}
+
+err_t workloadapi_X509Source_StartAsync(workloadapi_X509Source *source)
 {
     if(!source) {
         return ERR_NULL;
     }
     mtx_lock(&(source->closed_mutex));
+    if(!source->closed) {
+        // already started by another user of the source
+        mtx_unlock(&(source->closed_mutex));
+        return NO_ERROR;
+    }
     source->closed = false;
     mtx_unlock(&(source->closed_mutex));
-    err_t err = workloadapi_Watcher_Start(
-        source->watcher); // blocks until first update
+
+    const double fraction = source->config->expiry_alert_fraction;
+    if(fraction >= 0) {
+        err_t err = NO_ERROR;
+        if(!source->expiry_monitor) {
+            workloadapi_ExpiryCallback callback
+                = { .args = source, .func = workloadapi_x509Source_onExpiry };
+            // set before the watcher thread applies updates
+            source->expiry_monitor = workloadapi_NewExpiryMonitor(
+                fraction > 1 ? 1 : fraction, 0, callback, &err);
+        }
+        if(err == NO_ERROR) {
+            err = workloadapi_ExpiryMonitor_Start(source->expiry_monitor);
+        }
+        if(err != NO_ERROR) {
+            workloadapi_X509Source_failStart(source);
+            return err;
+        }
+    }
+
+    err_t err = workloadapi_Watcher_StartAsync(source->watcher);
+    if(err != NO_ERROR) {
+        workloadapi_X509Source_failStart(source);
+    }
     return err;
 }
 
@@ -88,44 +215,138 @@ err_t workloadapi_X509Source_Close(workloadapi_X509Source *source)
     source->closed = true;
     mtx_unlock(&(source->closed_mutex));
 
+    // no restart of the watcher from here on
+    workloadapi_ExpiryMonitor_Stop(source->expiry_monitor);
+
     return workloadapi_Watcher_Close(source->watcher);
 }
 
-x509svid_SVID *
-workloadapi_X509Source_GetX509SVID(workloadapi_X509Source *source, err_t *err)
+workloadapi_X509Snapshot *
+workloadapi_X509Source_AcquireSnapshot(workloadapi_X509Source *source,
+                                       err_t *err)
 {
     *err = workloadapi_X509Source_checkClosed(source);
-    if(!(*err)) {
-        mtx_lock(&(source->mtx));
-        x509svid_SVID *svid = source->config->picker
-                                  ? source->config->picker(source->svids)
-                                  : source->svids[0];
-        mtx_unlock(&(source->mtx));
+    if(*err) {
+        return NULL;
+    }
+
+    // announce this reader in the current epoch, so an update moving past
+    // it waits before dropping the snapshot read below
+    unsigned int epoch;
+    while(true) {
+        epoch = atomic_load(&(source->epoch));
+        atomic_fetch_add(&(source->readers[epoch & 1]), 1);
+        if(atomic_load(&(source->epoch)) == epoch) {
+            break;
+        }
+        atomic_fetch_sub(&(source->readers[epoch & 1]), 1);
+    }
+    workloadapi_X509Snapshot *snapshot = atomic_load(&(source->snapshot));
+    if(snapshot) {
+        atomic_fetch_add(&(snapshot->refs), 1);
+    }
+    atomic_fetch_sub(&(source->readers[epoch & 1]), 1);
+
+    if(!snapshot) {
+        // no update received yet
+        *err = ERR_NULL_DATA;
+    }
+    return snapshot;
+}
 
-        if(svid) {
-            return svid;
+void workloadapi_X509Snapshot_Release(workloadapi_X509Snapshot *snapshot)
+{
+    if(snapshot && atomic_fetch_sub(&(snapshot->refs), 1) == 1) {
+        x509bundle_Set_Free(snapshot->bundles);
+        for(size_t i = 0, size = arrlenu(snapshot->svids); i < size; ++i) {
+            x509svid_SVID_Free(snapshot->svids[i]);
         }
-        // missing SVID
-        *err = ERR_NULL_SVID;
+        arrfree(snapshot->svids);
+        shfree(snapshot->svids_by_id);
+        free(snapshot);
+    }
+}
+
+x509svid_SVID *
+workloadapi_X509Source_GetX509SVID(workloadapi_X509Source *source, err_t *err)
+{
+    workloadapi_X509Snapshot *snapshot
+        = workloadapi_X509Source_AcquireSnapshot(source, err);
+    if(*err == ERR_CLOSED) {
         return NULL;
     }
 
+    // borrowed past this release: the source retires a replaced snapshot
+    // and frees it only on the update after, so the SVID lasts until the
+    // second update from now
+    x509svid_SVID *svid = snapshot ? snapshot->svid : NULL;
+    workloadapi_X509Snapshot_Release(snapshot);
+    if(svid) {
+        *err = NO_ERROR;
+        return svid;
+    }
+    // missing SVID
+    *err = ERR_NULL_SVID;
     return NULL;
 }
 
+x509svid_SVID *
+workloadapi_X509Snapshot_GetX509SVIDForID(workloadapi_X509Snapshot *snapshot,
+                                          const spiffeid_ID id, err_t *err)
+{
+    char buf[256];
+    char *key = workloadapi_svidKey(buf, sizeof buf, id);
+    const ptrdiff_t index = util_shgeti_ts(snapshot->svids_by_id, key);
+    if(key != buf) {
+        free(key);
+    }
+
+    if(index < 0) {
+        *err = ERR_NOT_FOUND;
+        return NULL;
+    }
+    *err = NO_ERROR;
+    return snapshot->svids_by_id[index].value;
+}
+
+x509svid_SVID *
+workloadapi_X509Source_GetX509SVIDForID(workloadapi_X509Source *source,
+                                        const spiffeid_ID id, err_t *err)
+{
+    workloadapi_X509Snapshot *snapshot
+        = workloadapi_X509Source_AcquireSnapshot(source, err);
+    if(!snapshot) {
+        return NULL;
+    }
+
+    // borrowed past this release, until the second update from now as in
+    // workloadapi_X509Source_GetX509SVID
+    x509svid_SVID *svid
+        = workloadapi_X509Snapshot_GetX509SVIDForID(snapshot, id, err);
+    workloadapi_X509Snapshot_Release(snapshot);
+    return svid;
+}
+
 x509bundle_Bundle *workloadapi_X509Source_GetX509BundleForTrustDomain(
     workloadapi_X509Source *source, const spiffeid_TrustDomain td, err_t *err)
 {
-    *err = workloadapi_X509Source_checkClosed(source);
-    if(!(*err)) {
-        x509bundle_Bundle *bundle = x509bundle_Set_GetX509BundleForTrustDomain(
-            source->bundles, td, err);
-        if(*err == ERR_TRUSTDOMAIN_NOTAVAILABLE) {
-            *err = ERR_CLOSED;
-        }
-        return bundle;
+    workloadapi_X509Snapshot *snapshot
+        = workloadapi_X509Source_AcquireSnapshot(source, err);
+    if(*err == ERR_CLOSED) {
+        return NULL;
     }
-    return NULL;
+
+    x509bundle_Bundle *bundle = NULL;
+    *err = ERR_TRUSTDOMAIN_NOTAVAILABLE;
+    if(snapshot) {
+        bundle = x509bundle_Set_GetX509BundleForTrustDomain(snapshot->bundles,
+                                                            td, err);
+    }
+    workloadapi_X509Snapshot_Release(snapshot);
+    if(*err == ERR_TRUSTDOMAIN_NOTAVAILABLE) {
+        *err = ERR_CLOSED;
+    }
+    return bundle;
 }
 
 err_t workloadapi_X509Source_WaitUntilUpdated(workloadapi_X509Source *source)
@@ -133,42 +354,150 @@ err_t workloadapi_X509Source_WaitUntilUpdated(workloadapi_X509Source *source)
     return workloadapi_Watcher_WaitUntilUpdated(source->watcher);
 }
 
+err_t workloadapi_X509Source_TimedWaitUntilUpdated(
+    workloadapi_X509Source *source, const struct timespec *deadline)
+{
+    err_t err = workloadapi_X509Source_checkClosed(source);
+    if(err != NO_ERROR) {
+        // not started, would never be updated
+        return err;
+    }
+    return workloadapi_Watcher_TimedWaitUntilUpdated(source->watcher,
+                                                     deadline);
+}
+
+int workloadapi_X509Source_Subscribe(
+    workloadapi_X509Source *source,
+    workloadapi_X509SnapshotCallback callback, err_t *err)
+{
+    if(!source || !callback.func) {
+        *err = ERR_NULL;
+        return 0;
+    }
+    mtx_lock(&(source->subscribers_mutex));
+    workloadapi_X509Subscriber subscriber
+        = { .id = ++(source->last_subscriber_id), .callback = callback };
+    arrput(source->subscribers, subscriber);
+    mtx_unlock(&(source->subscribers_mutex));
+
+    *err = NO_ERROR;
+    return subscriber.id;
+}
+
+err_t workloadapi_X509Source_Unsubscribe(workloadapi_X509Source *source,
+                                         int id)
+{
+    if(!source) {
+        return ERR_NULL;
+    }
+    err_t err = ERR_NOT_FOUND;
+    // waits for a running update to finish calling the listeners
+    mtx_lock(&(source->subscribers_mutex));
+    for(size_t i = 0, size = arrlenu(source->subscribers); i < size; ++i) {
+        if(source->subscribers[i].id == id) {
+            // keeps the order of the others
+            arrdel(source->subscribers, i);
+            err = NO_ERROR;
+            break;
+        }
+    }
+    mtx_unlock(&(source->subscribers_mutex));
+    return err;
+}
+
+workloadapi_ExpiryMonitorStats
+workloadapi_X509Source_GetExpiryStats(workloadapi_X509Source *source)
+{
+    if(!source->expiry_monitor) {
+        workloadapi_ExpiryMonitorStats stats = { 0, 0 };
+        return stats;
+    }
+    return workloadapi_ExpiryMonitor_GetStats(source->expiry_monitor);
+}
+
+int workloadapi_X509Source_GetUpdateFd(workloadapi_X509Source *source)
+{
+    return workloadapi_Watcher_GetUpdateFd(source->watcher);
+}
+
+uint64_t workloadapi_X509Source_ClearUpdateFd(workloadapi_X509Source *source)
+{
+    return workloadapi_Watcher_ClearUpdateFd(source->watcher);
+}
+
 void workloadapi_X509Source_applyX509Context(workloadapi_X509Source *source,
                                              workloadapi_X509Context *ctx)
 {
+    workloadapi_X509Snapshot *snapshot = malloc(sizeof *snapshot);
+    snapshot->svids = ctx->svids;
+    snapshot->bundles = ctx->bundles;
+    snapshot->svid = source->config->picker
+                         ? source->config->picker(ctx->svids)
+                         : x509svid_SVID_GetDefaultX509SVID(ctx->svids);
+    snapshot->svids_by_id = NULL;
+    sh_new_strdup(snapshot->svids_by_id);
+    for(size_t i = 0, size = arrlenu(ctx->svids); i < size; ++i) {
+        char buf[256];
+        char *key = workloadapi_svidKey(buf, sizeof buf, ctx->svids[i]->id);
+        if(shgeti(snapshot->svids_by_id, key) < 0) {
+            shput(snapshot->svids_by_id, key, ctx->svids[i]);
+        }
+        if(key != buf) {
+            free(key);
+        }
+    }
+    // the reference held by the source
+    atomic_init(&(snapshot->refs), 1);
+
     mtx_lock(&(source->mtx));
-    x509bundle_Set_Free(source->bundles);
-    for(size_t i = 0, size = arrlenu(source->svids); i < size; ++i) {
-        x509svid_SVID_Free(source->svids[i]);
+    workloadapi_X509Snapshot *old = atomic_load(&(source->snapshot));
+    snapshot->generation = old ? old->generation + 1 : 1;
+    if(source->expiry_monitor) {
+        workloadapi_trackExpiry(source->expiry_monitor, snapshot, old);
+    }
+    atomic_store(&(source->snapshot), snapshot);
+    // readers still in the previous epoch may be taking a reference to old
+    const unsigned int epoch = atomic_fetch_add(&(source->epoch), 1);
+    while(atomic_load(&(source->readers[epoch & 1])) > 0) {
+        thrd_yield();
     }
-    arrfree(source->svids);
-    source->svids = ctx->svids;
-    source->bundles = ctx->bundles;
+    workloadapi_X509Snapshot *retired = source->retired;
+    source->retired = old;
+    // for the listeners, as the source may replace it meanwhile
+    atomic_fetch_add(&(snapshot->refs), 1);
     mtx_unlock(&(source->mtx));
+
+    workloadapi_X509Snapshot_Release(retired);
+
+    mtx_lock(&(source->subscribers_mutex));
+    for(size_t i = 0, size = arrlenu(source->subscribers); i < size; ++i) {
+        workloadapi_X509SnapshotCallback *callback
+            = &(source->subscribers[i].callback);
+        callback->func(snapshot, callback->args);
+    }
+    mtx_unlock(&(source->subscribers_mutex));
+    workloadapi_X509Snapshot_Release(snapshot);
 }
 
 err_t workloadapi_X509Source_checkClosed(workloadapi_X509Source *source)
 {
-    err_t err = NO_ERROR;
-    mtx_lock(&(source->closed_mutex));
-    if(source->closed) {
+    // read on every handshake, so no lock
+    if(atomic_load(&(source->closed))) {
         // source is closed
-        err = ERR_CLOSED;
+        return ERR_CLOSED;
     }
-    mtx_unlock(&(source->closed_mutex));
-    return err;
+    return NO_ERROR;
 }
 
 void workloadapi_X509Source_Free(workloadapi_X509Source *source)
 {
     if(source) {
         mtx_lock(&(source->mtx));
-        x509bundle_Set_Free(source->bundles);
-
-        for(size_t i = 0, size = arrlenu(source->svids); i < size; ++i) {
-            x509svid_SVID_Free(source->svids[i]);
-        }
-        arrfree(source->svids);
+        workloadapi_X509Snapshot_Release(atomic_load(&(source->snapshot)));
+        workloadapi_X509Snapshot_Release(source->retired);
+        arrfree(source->subscribers);
+        mtx_destroy(&(source->subscribers_mutex));
+        workloadapi_ExpiryMonitor_Free(source->expiry_monitor);
         if(source->watcher)
             workloadapi_Watcher_Free(source->watcher);
 